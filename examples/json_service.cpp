@@ -0,0 +1,70 @@
+//
+// Created on 10/18/26.
+//
+
+//a service embedding cheehttpd: its endpoints are plain functions answering on the
+//server's own loops, nothing sits between the socket and the handler
+//  ./json_service [host:port] [threads]
+
+#include "server/server.hpp"
+#include "logging/logging.hpp"
+
+#include <csignal>
+#include <iostream>
+
+int main(int argc, char** argv) {
+    std::string listen = argc > 1 ? argv[1] : "127.0.0.1:8080";
+    std::string threads = argc > 2 ? argv[2] : "2";
+
+    //block the signals before any thread starts so only sigwait sees them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    try {
+        server::http_server service(server::server_config_t{{"server_listen", listen}, {"server_threads", threads}});
+        std::atomic<uint64_t> next_id{1};
+        //the fixed headers of the json answers are serialized once, handlers only fill bodies
+        auto json = std::make_shared<const server::header_template>(200, http::headers_t{
+            {"Server", "json_service"}, {"Content-Type", "application/json"}, {"Cache-Control", "no-store"},
+            {"X-Content-Type-Options", "nosniff"}});
+
+        service.routes().get("/health", [](const http::request&, http::response& response) {
+            response.body = "{\"status\":\"ok\"}";
+        }, json);
+        service.routes().add("GET", "/users/*", [](const http::request& request, http::response& response) {
+            //the route guarantees the '/users/' prefix
+            std::string name = request.target.substr(7, std::min(request.target.find('?'), request.target.size()) - 7);
+            if(name.empty() || !std::all_of(name.begin(), name.end(), [](char c) { return isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_'; })) {
+                response.status = 404;
+                return;
+            }
+            response.body = "{\"user\":\"" + name + "\"}";
+        }, json);
+        service.routes().post("/users", [&next_id](const http::request& request, http::response& response) {
+            if(request.body.empty()) {
+                response.status = 400;
+                return;
+            }
+            response.status = 201;
+            response.headers.emplace_back("Content-Type", "application/json");
+            response.body = "{\"id\":" + std::to_string(next_id++) + ",\"bytes\":" + std::to_string(request.body.size()) + "}";
+        });
+
+        service.start();
+        logging::INFO("json_service listening on port " + std::to_string(service.port()));
+        int received = 0;
+        sigwait(&signals, &received);
+        service.stop();
+        const auto& stats = service.statistics();
+        logging::INFO("served " + std::to_string(stats.requests) + " requests on " + std::to_string(stats.accepted) + " connections");
+    }
+    catch(const std::exception& e) {
+        logging::ERROR(e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,624 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __ACL_HPP__
+#define __ACL_HPP__
+
+#include <map>
+#include <array>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include <cstring>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+namespace acl {
+    using acl_config_t = std::unordered_map<std::string, std::string>;
+
+    enum class verdict : uint8_t {NONE = 0, ALLOW = 1, DENY = 2};
+
+    //one cidr rule, the address in network byte order
+    struct prefix {
+        uint8_t bytes[16];
+        uint8_t length;
+        bool v6;
+        verdict action;
+    };
+
+    //parses '10.0.0.0/8', '2001:db8::/32' or a bare address. bits past the length are
+    //ignored, ipv4 mapped ipv6 rules become ipv4 ones
+    inline bool parse_prefix(const std::string& text, verdict action, prefix& out) {
+        memset(&out, 0, sizeof(out));
+        out.action = action;
+        auto slash = text.find('/');
+        std::string address = text.substr(0, slash);
+        int limit;
+        if(inet_pton(AF_INET, address.c_str(), out.bytes) == 1) {
+            limit = 32;
+        }
+        else if(inet_pton(AF_INET6, address.c_str(), out.bytes) == 1) {
+            out.v6 = true;
+            limit = 128;
+        }
+        else {
+            return false;
+        }
+        int length = limit;
+        if(slash != std::string::npos) {
+            std::string bits = text.substr(slash + 1);
+            if(bits.empty() || bits.size() > 3 || bits.find_first_not_of("0123456789") != std::string::npos)
+                return false;
+            length = std::stoi(bits);
+            if(length > limit)
+                return false;
+        }
+        static const uint8_t mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+        if(out.v6 && length >= 96 && !memcmp(out.bytes, mapped, sizeof(mapped))) {
+            memmove(out.bytes, out.bytes + 12, 4);
+            memset(out.bytes + 4, 0, 12);
+            out.v6 = false;
+            length -= 96;
+        }
+        out.length = static_cast<uint8_t>(length);
+        return true;
+    }
+
+    //ipv4 longest prefix match in dir-24-8 form: the top 24 bits index a table that holds
+    //either the verdict or a group of 256 entries for the last 8 bits, so every lookup is one
+    //or two memory reads. the 2^24 entry table is reserved but only the pages rules write to
+    //are ever backed by memory
+    class table4 {
+    public:
+        static constexpr uint32_t GROUP = 0x80000000u;
+
+        table4() : tbl24(nullptr) {}
+        ~table4() {
+            if(tbl24)
+                munmap(tbl24, SIZE);
+        }
+        table4(const table4&) = delete;
+        table4& operator=(const table4&) = delete;
+
+        //rules in ascending length order, so longer prefixes overwrite the shorter ones they nest in
+        void build(const std::vector<prefix>& rules) {
+            for(const auto& rule : rules) {
+                if(rule.length == 0)
+                    continue;
+                if(!tbl24) {
+                    void* memory = mmap(nullptr, SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+                    if(memory == MAP_FAILED)
+                        throw std::runtime_error(std::string("Couldn't reserve the ipv4 access table: ") + strerror(errno));
+                    tbl24 = static_cast<uint32_t*>(memory);
+                }
+                uint32_t address;
+                memcpy(&address, rule.bytes, 4);
+                address = ntohl(address) & (rule.length == 32 ? ~0u : ~(~0u >> rule.length));
+                auto value = static_cast<uint8_t>(rule.action);
+                if(rule.length <= 24) {
+                    uint32_t first = address >> 8;
+                    uint32_t count = 1u << (24 - rule.length);
+                    for(uint32_t i = first; i < first + count; ++i) {
+                        if(tbl24[i] & GROUP)
+                            memset(&tbl8[(tbl24[i] & ~GROUP) << 8], value, 256);
+                        else
+                            tbl24[i] = value;
+                    }
+                    continue;
+                }
+                uint32_t& entry = tbl24[address >> 8];
+                if(!(entry & GROUP)) {
+                    uint32_t group = static_cast<uint32_t>(tbl8.size() >> 8);
+                    tbl8.resize(tbl8.size() + 256, static_cast<uint8_t>(entry));
+                    entry = GROUP | group;
+                }
+                size_t first = ((entry & ~GROUP) << 8) | (address & 0xff);
+                memset(&tbl8[first], value, size_t(1) << (32 - rule.length));
+            }
+        }
+
+        //address in host byte order
+        verdict find(uint32_t address) const {
+            if(!tbl24)
+                return verdict::NONE;
+            uint32_t entry = tbl24[address >> 8];
+            if(entry & GROUP)
+                return static_cast<verdict>(tbl8[((entry & ~GROUP) << 8) | (address & 0xff)]);
+            return static_cast<verdict>(entry);
+        }
+
+        size_t groups() const {
+            return tbl8.size() >> 8;
+        }
+
+    protected:
+        static constexpr size_t SIZE = (size_t(1) << 24) * sizeof(uint32_t);
+
+        uint32_t* tbl24;
+        std::vector<uint8_t> tbl8;
+    };
+
+    //ipv6 longest prefix match in a 16 level trie of 256 way nodes with leaf pushing, so the
+    //first missing child ends the walk with the answer. nodes only store a bitmap of which
+    //slots have a child and the children sit next to each other, a popcount finds the one to
+    //follow. verdicts are packed four to a byte
+    class table6 {
+    public:
+        //rules in ascending length order
+        void build(const std::vector<prefix>& rules) {
+            std::vector<draft> drafts(1);
+            drafts[0].values.fill(0);
+            for(const auto& rule : rules) {
+                uint32_t at = 0;
+                size_t level = 0;
+                while(rule.length > (level + 1) * 8) {
+                    uint8_t slot = rule.bytes[level];
+                    auto child = drafts[at].children.find(slot);
+                    if(child == drafts[at].children.end()) {
+                        //the new node inherits what its slot said so far
+                        uint8_t inherited = drafts[at].values[slot];
+                        uint32_t created = static_cast<uint32_t>(drafts.size());
+                        drafts.emplace_back();
+                        drafts.back().values.fill(inherited);
+                        child = drafts[at].children.emplace(slot, created).first;
+                    }
+                    at = child->second;
+                    ++level;
+                }
+                size_t bits = rule.length - level * 8;
+                size_t span = size_t(1) << (8 - bits);
+                size_t first = rule.bytes[level] & ~(span - 1);
+                for(size_t s = first; s < first + span; ++s)
+                    drafts[at].values[s] = static_cast<uint8_t>(rule.action);
+            }
+
+            //breadth first, the children of a node are laid out together in slot order
+            nodes.clear();
+            nodes.reserve(drafts.size());
+            std::vector<uint32_t> order(1, 0);
+            for(size_t i = 0; i < order.size(); ++i) {
+                const draft& d = drafts[order[i]];
+                node n{};
+                n.base = static_cast<uint32_t>(order.size());
+                for(size_t s = 0; s < 256; ++s)
+                    n.values[s >> 2] |= static_cast<uint8_t>(d.values[s] << ((s & 3) * 2));
+                for(const auto& child : d.children) {
+                    n.children[child.first >> 6] |= uint64_t(1) << (child.first & 63);
+                    order.push_back(child.second);
+                }
+                for(size_t w = 1; w < 4; ++w)
+                    n.ranks[w] = static_cast<uint16_t>(n.ranks[w - 1] + __builtin_popcountll(n.children[w - 1]));
+                nodes.push_back(n);
+            }
+        }
+
+        verdict find(const uint8_t* address) const {
+            if(nodes.empty())
+                return verdict::NONE;
+            const node* n = &nodes[0];
+            for(size_t level = 0; level < 16; ++level) {
+                uint8_t slot = address[level];
+                uint64_t word = n->children[slot >> 6];
+                uint64_t bit = uint64_t(1) << (slot & 63);
+                if(!(word & bit))
+                    return static_cast<verdict>((n->values[slot >> 2] >> ((slot & 3) * 2)) & 3);
+                n = &nodes[n->base + n->ranks[slot >> 6] + __builtin_popcountll(word & (bit - 1))];
+            }
+            return verdict::NONE;
+        }
+
+        size_t size() const {
+            return nodes.size();
+        }
+
+    protected:
+        struct draft {
+            std::array<uint8_t, 256> values;
+            std::map<uint8_t, uint32_t> children;
+        };
+        struct node {
+            uint64_t children[4];
+            uint32_t base;
+            uint16_t ranks[4];
+            uint8_t values[64];
+        };
+
+        std::vector<node> nodes;
+    };
+
+    //allow and deny rules for client addresses, checked right after accept so a denied
+    //client costs nothing but the accept and the close. the longest matching prefix decides,
+    //deny wins between equal prefixes and access_default covers addresses nothing matches.
+    //rules come from access_allow and access_deny as comma lists and from the access_list
+    //file with one 'allow cidr' or 'deny cidr' per line. read only once built, any number of
+    //threads may check at the same time
+    class access_list {
+    public:
+        access_list() = delete;
+        explicit access_list(const acl_config_t& config) : fallback(verdict::ALLOW), default4(verdict::NONE), default6(verdict::NONE), count(0) {
+            std::vector<prefix> rules;
+            auto list = [&rules](const std::string& items, verdict action, const std::string& key) {
+                size_t start = 0;
+                while(start < items.size()) {
+                    size_t comma = items.find(',', start);
+                    std::string item = items.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+                    item.erase(0, item.find_first_not_of(' '));
+                    item.erase(item.find_last_not_of(' ') + 1);
+                    prefix p;
+                    if(!item.empty()) {
+                        if(!parse_prefix(item, action, p))
+                            throw std::runtime_error(item + " is not a valid " + key + " address");
+                        rules.push_back(p);
+                    }
+                    start = comma == std::string::npos ? items.size() : comma + 1;
+                }
+            };
+            auto allow = config.find("access_allow");
+            if(allow != config.end())
+                list(allow->second, verdict::ALLOW, "access_allow");
+            auto deny = config.find("access_deny");
+            if(deny != config.end())
+                list(deny->second, verdict::DENY, "access_deny");
+            auto file = config.find("access_list");
+            if(file != config.end())
+                load(file->second, rules);
+            auto fallback_name = config.find("access_default");
+            if(fallback_name != config.end()) {
+                if(fallback_name->second == "allow")
+                    fallback = verdict::ALLOW;
+                else if(fallback_name->second == "deny")
+                    fallback = verdict::DENY;
+                else
+                    throw std::runtime_error(fallback_name->second + " is not a valid access_default");
+            }
+            build(rules);
+        }
+        access_list(const access_list&) = delete;
+        access_list& operator=(const access_list&) = delete;
+
+        //true when the rules let this peer in, unix sockets always are
+        bool allowed(const sockaddr* address) const {
+            return check(address) != verdict::DENY;
+        }
+
+        verdict check(const sockaddr* address) const {
+            if(address->sa_family == AF_INET) {
+                auto* in = reinterpret_cast<const sockaddr_in*>(address);
+                return or_default(v4.find(ntohl(in->sin_addr.s_addr)), default4);
+            }
+            if(address->sa_family == AF_INET6) {
+                auto* in6 = reinterpret_cast<const sockaddr_in6*>(address);
+                //dual stack listeners see ipv4 clients as ::ffff:a.b.c.d
+                if(IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)) {
+                    uint32_t address4;
+                    memcpy(&address4, in6->sin6_addr.s6_addr + 12, 4);
+                    return or_default(v4.find(ntohl(address4)), default4);
+                }
+                return or_default(v6.find(in6->sin6_addr.s6_addr), default6);
+            }
+            return verdict::ALLOW;
+        }
+
+        //'1.2.3.4' or '2001:db8::1', for tools and tests
+        verdict check(const std::string& text) const {
+            sockaddr_storage address{};
+            auto* in = reinterpret_cast<sockaddr_in*>(&address);
+            auto* in6 = reinterpret_cast<sockaddr_in6*>(&address);
+            if(inet_pton(AF_INET, text.c_str(), &in->sin_addr) == 1)
+                address.ss_family = AF_INET;
+            else if(inet_pton(AF_INET6, text.c_str(), &in6->sin6_addr) == 1)
+                address.ss_family = AF_INET6;
+            else
+                throw std::runtime_error(text + " is not an ip address");
+            return check(reinterpret_cast<const sockaddr*>(&address));
+        }
+
+        size_t rules() const {
+            return count;
+        }
+
+    protected:
+        static void load(const std::string& path, std::vector<prefix>& rules) {
+            std::ifstream file(path);
+            if(!file)
+                throw std::runtime_error("Couldn't open access_list " + path);
+            std::string line;
+            size_t number = 0;
+            while(std::getline(file, line)) {
+                ++number;
+                line = line.substr(0, line.find('#'));
+                std::istringstream fields(line);
+                std::string keyword, cidr;
+                if(!(fields >> keyword))
+                    continue;
+                prefix p;
+                verdict action = keyword == "allow" ? verdict::ALLOW : keyword == "deny" ? verdict::DENY : verdict::NONE;
+                if(action == verdict::NONE || !(fields >> cidr) || !parse_prefix(cidr, action, p))
+                    throw std::runtime_error(path + ":" + std::to_string(number) + " is not 'allow cidr' or 'deny cidr'");
+                rules.push_back(p);
+            }
+        }
+
+        void build(std::vector<prefix>& rules) {
+            count = rules.size();
+            //shorter prefixes first so the longer ones overwrite them, deny after allow
+            std::stable_sort(rules.begin(), rules.end(), [](const prefix& a, const prefix& b) {
+                return a.length != b.length ? a.length < b.length : a.action < b.action;
+            });
+            std::vector<prefix> rules4, rules6;
+            for(const auto& rule : rules) {
+                if(rule.length == 0)
+                    (rule.v6 ? default6 : default4) = rule.action;
+                else
+                    (rule.v6 ? rules6 : rules4).push_back(rule);
+            }
+            v4.build(rules4);
+            if(!rules6.empty())
+                v6.build(rules6);
+        }
+
+        verdict or_default(verdict found, verdict family) const {
+            if(found != verdict::NONE)
+                return found;
+            return family != verdict::NONE ? family : fallback;
+        }
+
+        verdict fallback;
+        verdict default4;
+        verdict default6;
+        size_t count;
+        table4 v4;
+        table6 v6;
+    };
+}
+
+#endif //__ACL_HPP__
+
+#ifdef TEST_ACL
+
+#include <cassert>
+#include <chrono>
+#include <random>
+#include <iostream>
+
+//every rule looked at for every address, what the tables must agree with
+static acl::verdict naive(const std::vector<acl::prefix>& rules, const uint8_t* bytes, bool v6, acl::verdict fallback) {
+  int best = -1;
+  acl::verdict found = acl::verdict::NONE;
+  for(const auto& rule : rules) {
+    if(rule.v6 != v6)
+      continue;
+    size_t whole = rule.length / 8, rest = rule.length % 8;
+    if(memcmp(rule.bytes, bytes, whole) != 0)
+      continue;
+    if(rest && ((rule.bytes[whole] ^ bytes[whole]) & static_cast<uint8_t>(0xff << (8 - rest))))
+      continue;
+    if(static_cast<int>(rule.length) > best || (static_cast<int>(rule.length) == best && rule.action == acl::verdict::DENY)) {
+      best = rule.length;
+      found = rule.action;
+    }
+  }
+  return best < 0 ? fallback : found;
+}
+
+static std::string text4(const uint8_t* bytes) {
+  char text[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, bytes, text, sizeof(text));
+  return text;
+}
+
+static std::string text6(const uint8_t* bytes) {
+  char text[INET6_ADDRSTRLEN];
+  inet_ntop(AF_INET6, bytes, text, sizeof(text));
+  return text;
+}
+
+//rule sets nested around a few hubs so prefixes overlap at every length, checked against naive
+//for addresses near the rules and far from them, as ipv4, ipv4 mapped ipv6 and ipv6
+static void compare(std::mt19937_64& random, size_t round) {
+  uint8_t hubs4[4][4], hubs6[4][16];
+  for(auto& hub : hubs4)
+    for(auto& b : hub)
+      b = static_cast<uint8_t>(random());
+  for(auto& hub : hubs6)
+    for(auto& b : hub)
+      b = static_cast<uint8_t>(random());
+  //nudges the bits past a random position of a hub
+  auto near = [&random](const uint8_t* hub, size_t size, uint8_t* out) {
+    memcpy(out, hub, size);
+    size_t from = random() % (size * 8);
+    for(size_t bit = from; bit < size * 8; ++bit)
+      if(random() % 3 == 0)
+        out[bit / 8] ^= static_cast<uint8_t>(0x80 >> (bit % 8));
+  };
+  std::string path = "/tmp/acltest.list";
+  std::vector<acl::prefix> rules;
+  {
+    std::ofstream file(path);
+    for(size_t i = 0; i < 400; ++i) {
+      acl::verdict action = random() % 2 ? acl::verdict::ALLOW : acl::verdict::DENY;
+      uint8_t bytes[16];
+      std::string cidr;
+      switch(random() % 3) {
+        case 0:
+          near(hubs4[random() % 4], 4, bytes);
+          cidr = text4(bytes) + "/" + std::to_string(1 + random() % 32);
+          break;
+        case 1:
+          near(hubs6[random() % 4], 16, bytes);
+          cidr = text6(bytes) + "/" + std::to_string(1 + random() % 128);
+          break;
+        default:
+          //ipv4 mapped rules are ipv4 rules
+          near(hubs4[random() % 4], 4, bytes);
+          cidr = "::ffff:" + text4(bytes) + "/" + std::to_string(96 + random() % 33);
+          break;
+      }
+      acl::prefix p;
+      assert(acl::parse_prefix(cidr, action, p));
+      rules.push_back(p);
+      file << (action == acl::verdict::ALLOW ? "allow " : "deny ") << cidr << '\n';
+    }
+    //every other round has catch alls, for one family or both
+    if(round % 2) {
+      for(const char* all : {"0.0.0.0/0", "::/0"}) {
+        if(random() % 3 == 0)
+          continue;
+        acl::verdict action = random() % 2 ? acl::verdict::ALLOW : acl::verdict::DENY;
+        acl::prefix p;
+        assert(acl::parse_prefix(all, action, p));
+        rules.push_back(p);
+        file << (action == acl::verdict::ALLOW ? "allow " : "deny ") << all << '\n';
+      }
+    }
+  }
+  acl::verdict fallback = round % 4 < 2 ? acl::verdict::ALLOW : acl::verdict::DENY;
+  acl::access_list list(acl::acl_config_t{{"access_list", path}, {"access_default", fallback == acl::verdict::ALLOW ? "allow" : "deny"}});
+  assert(list.rules() == rules.size());
+  for(size_t i = 0; i < 4000; ++i) {
+    uint8_t bytes4[4], bytes6[16];
+    if(random() % 4)
+      near(hubs4[random() % 4], 4, bytes4);
+    else
+      for(auto& b : bytes4)
+        b = static_cast<uint8_t>(random());
+    if(random() % 4)
+      near(hubs6[random() % 4], 16, bytes6);
+    else
+      for(auto& b : bytes6)
+        b = static_cast<uint8_t>(random());
+    acl::verdict expected4 = naive(rules, bytes4, false, fallback), expected6 = naive(rules, bytes6, true, fallback);
+    sockaddr_in in{};
+    in.sin_family = AF_INET;
+    memcpy(&in.sin_addr, bytes4, 4);
+    sockaddr_in6 mapped{};
+    mapped.sin6_family = AF_INET6;
+    mapped.sin6_addr.s6_addr[10] = mapped.sin6_addr.s6_addr[11] = 0xff;
+    memcpy(mapped.sin6_addr.s6_addr + 12, bytes4, 4);
+    sockaddr_in6 in6{};
+    in6.sin6_family = AF_INET6;
+    memcpy(&in6.sin6_addr, bytes6, 16);
+    assert(list.check(reinterpret_cast<const sockaddr*>(&in)) == expected4);
+    assert(list.check(reinterpret_cast<const sockaddr*>(&mapped)) == expected4);
+    assert(list.check(reinterpret_cast<const sockaddr*>(&in6)) == expected6);
+    assert(list.allowed(reinterpret_cast<const sockaddr*>(&in6)) == (expected6 != acl::verdict::DENY));
+  }
+  remove(path.c_str());
+}
+
+//checks the tables against a linear scan of the rules, then lookups per second against a few
+//hundred thousand random prefixes:
+//  g++ -std=c++17 -O2 -DTEST_ACL -Iinclude -x c++ include/acl/acl.hpp -o aclbench
+//  ./aclbench [ipv4 rules] [ipv6 rules]
+int main(int argc, char** argv) {
+  size_t count4 = argc > 1 ? std::stoul(argv[1]) : 400000;
+  size_t count6 = argc > 2 ? std::stoul(argv[2]) : 100000;
+  std::mt19937_64 random(42);
+
+  //equal prefixes go to deny, the family catch all before access_default, unix sockets pass
+  acl::access_list fixed(acl::acl_config_t{{"access_allow", "10.0.0.0/8, 10.1.0.0/16,2001:db8::/32"},
+                                           {"access_deny", "10.1.0.0/16 ,10.1.2.3,::ffff:192.168.0.0/112,::/0"},
+                                           {"access_default", "deny"}});
+  assert(fixed.rules() == 7);
+  assert(fixed.check("10.9.9.9") == acl::verdict::ALLOW && fixed.check("10.1.9.9") == acl::verdict::DENY);
+  assert(fixed.check("10.1.2.3") == acl::verdict::DENY && fixed.check("11.0.0.1") == acl::verdict::DENY);
+  assert(fixed.check("192.168.7.7") == acl::verdict::DENY && fixed.check("::ffff:10.2.3.4") == acl::verdict::ALLOW);
+  assert(fixed.check("2001:db8::1") == acl::verdict::ALLOW && fixed.check("2001:db9::1") == acl::verdict::DENY);
+  sockaddr local{};
+  local.sa_family = AF_UNIX;
+  assert(fixed.allowed(&local));
+  acl::access_list empty(acl::acl_config_t{});
+  assert(empty.check("1.2.3.4") == acl::verdict::ALLOW && empty.check("::1") == acl::verdict::ALLOW);
+  for(const auto& bad : {acl::acl_config_t{{"access_allow", "10.0.0.0/33"}}, acl::acl_config_t{{"access_deny", "::/129"}},
+                         acl::acl_config_t{{"access_deny", "10.0.0.0/"}}, acl::acl_config_t{{"access_allow", "example.com"}},
+                         acl::acl_config_t{{"access_default", "maybe"}}, acl::acl_config_t{{"access_list", "/nonexistent"}}}) {
+    bool refused = false;
+    try {
+      acl::access_list broken(bad);
+    }
+    catch(const std::runtime_error&) {
+      refused = true;
+    }
+    assert(refused);
+  }
+  for(size_t round = 0; round < 16; ++round)
+    compare(random, round);
+  std::cout << "matches a linear scan" << std::endl;
+
+  std::string path = "/tmp/aclbench.list";
+  std::vector<acl::prefix> rules;
+  {
+    std::ofstream file(path);
+    //mostly single hosts and /24s like real block lists, some wide ranges
+    static const int lengths4[] = {32, 32, 32, 32, 24, 24, 28, 20, 16, 12};
+    static const int lengths6[] = {128, 64, 64, 56, 48, 48, 40, 32};
+    for(size_t i = 0; i < count4; ++i) {
+      uint32_t a = static_cast<uint32_t>(random());
+      std::string cidr = std::to_string(a >> 24) + '.' + std::to_string((a >> 16) & 255) + '.' + std::to_string((a >> 8) & 255) + '.' +
+                         std::to_string(a & 255) + '/' + std::to_string(lengths4[random() % 10]);
+      rules.emplace_back();
+      acl::parse_prefix(cidr, i % 7 ? acl::verdict::DENY : acl::verdict::ALLOW, rules.back());
+      file << (i % 7 ? "deny " : "allow ") << cidr << '\n';
+    }
+    for(size_t i = 0; i < count6; ++i) {
+      uint8_t bytes[16];
+      uint64_t high = random(), low = random();
+      memcpy(bytes, &high, 8);
+      memcpy(bytes + 8, &low, 8);
+      bytes[0] = 0x20;
+      bytes[1] = static_cast<uint8_t>(random() % 4);
+      std::string cidr = text6(bytes) + '/' + std::to_string(lengths6[random() % 8]);
+      rules.emplace_back();
+      acl::parse_prefix(cidr, i % 7 ? acl::verdict::DENY : acl::verdict::ALLOW, rules.back());
+      file << (i % 7 ? "deny " : "allow ") << cidr << '\n';
+    }
+  }
+  auto start = std::chrono::steady_clock::now();
+  acl::access_list list(acl::acl_config_t{{"access_list", path}});
+  std::cout << "built " << list.rules() << " rules in "
+            << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+  assert(list.rules() == count4 + count6);
+
+  const size_t lookups = 1 << 20;
+  std::vector<sockaddr_in> addresses4(lookups);
+  std::vector<sockaddr_in6> addresses6(lookups);
+  for(size_t i = 0; i < lookups; ++i) {
+    addresses4[i].sin_family = AF_INET;
+    addresses4[i].sin_addr.s_addr = static_cast<uint32_t>(random());
+    addresses6[i].sin6_family = AF_INET6;
+    uint64_t high = random(), low = random();
+    memcpy(addresses6[i].sin6_addr.s6_addr, &high, 8);
+    memcpy(addresses6[i].sin6_addr.s6_addr + 8, &low, 8);
+    addresses6[i].sin6_addr.s6_addr[0] = 0x20;
+    addresses6[i].sin6_addr.s6_addr[1] = static_cast<uint8_t>(random() % 4);
+  }
+  //a sample of the benchmark lookups against the linear scan as well
+  for(size_t i = 0; i < lookups; i += lookups / 64) {
+    const auto* bytes4 = reinterpret_cast<const uint8_t*>(&addresses4[i].sin_addr);
+    assert(list.check(reinterpret_cast<const sockaddr*>(&addresses4[i])) == naive(rules, bytes4, false, acl::verdict::ALLOW));
+    assert(list.check(reinterpret_cast<const sockaddr*>(&addresses6[i])) == naive(rules, addresses6[i].sin6_addr.s6_addr, true, acl::verdict::ALLOW));
+  }
+  auto measure = [&list, lookups](const char* name, const sockaddr* first, size_t stride) {
+    size_t denied = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for(int round = 0; round < 16; ++round)
+      for(size_t i = 0; i < lookups; ++i)
+        denied += !list.allowed(reinterpret_cast<const sockaddr*>(reinterpret_cast<const char*>(first) + i * stride));
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    std::cout << name << ": " << 16 * lookups / elapsed / 1e6 << " M lookups/s, " << denied * 100.0 / (16 * lookups) << "% denied" << std::endl;
+    //random addresses mostly miss the sparse rules, the wide ones deny some
+    assert(denied > 0 && denied < 16 * lookups);
+  };
+  measure("ipv4", reinterpret_cast<const sockaddr*>(addresses4.data()), sizeof(sockaddr_in));
+  measure("ipv6", reinterpret_cast<const sockaddr*>(addresses6.data()), sizeof(sockaddr_in6));
+  remove(path.c_str());
+  return 0;
+}
+
+#endif
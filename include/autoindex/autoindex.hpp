@@ -0,0 +1,419 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __AUTOINDEX_HPP__
+#define __AUTOINDEX_HPP__
+
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "compression/gzip.hpp"
+
+namespace autoindex {
+    //the two listing flavours we render
+    enum class format : uint8_t { HTML = 0, JSON = 1 };
+
+    //what we remember about a single directory entry
+    struct entry {
+        std::string name;
+        bool directory;
+        off_t size;
+        time_t mtime;
+    };
+
+    //the kernel's dirent64 layout, glibc does not export it
+    struct linux_dirent64 {
+        ino64_t d_ino;
+        off64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+    };
+
+    //reads a whole directory with as few getdents64 calls as possible, each call fills
+    //a large buffer with many records instead of one readdir round trip per entry
+    inline std::vector<entry> scan(int dir_fd, size_t buffer_size = 256 * 1024) {
+        std::vector<entry> entries;
+        std::unique_ptr<char[]> buffer(new char[buffer_size]);
+        for(;;) {
+            long read = syscall(SYS_getdents64, dir_fd, buffer.get(), buffer_size);
+            if(read < 0)
+                throw std::runtime_error(std::string("getdents64 failed: ") + strerror(errno));
+            if(read == 0)
+                break;
+            for(long offset = 0; offset < read;) {
+                auto* record = reinterpret_cast<linux_dirent64*>(buffer.get() + offset);
+                offset += record->d_reclen;
+                const char* name = record->d_name;
+                if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                    continue;
+                //hidden files are never listed
+                if(name[0] == '.')
+                    continue;
+                //follow symlinks like a client would, dangling ones are shown as the link itself
+                struct stat st{};
+                if(fstatat(dir_fd, name, &st, 0) != 0 && fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                    continue;
+                entries.push_back(entry{name, S_ISDIR(st.st_mode), st.st_size, st.st_mtim.tv_sec});
+            }
+        }
+        //directories first, then byte order which is stable across locales
+        std::sort(entries.begin(), entries.end(), [](const entry& a, const entry& b) {
+            if(a.directory != b.directory)
+                return a.directory;
+            return a.name < b.name;
+        });
+        return entries;
+    }
+
+    //escapes the handful of characters that matter inside html text and attributes
+    inline void append_html_escaped(std::string& out, const std::string& text) {
+        for(char c : text) {
+            switch(c) {
+                case '&': out.append("&amp;"); break;
+                case '<': out.append("&lt;"); break;
+                case '>': out.append("&gt;"); break;
+                case '"': out.append("&quot;"); break;
+                case '\'': out.append("&#39;"); break;
+                default: out.push_back(c);
+            }
+        }
+    }
+
+    //percent encodes a path segment so any file name survives as an href
+    inline void append_url_encoded(std::string& out, const std::string& text) {
+        static const char hex[] = "0123456789ABCDEF";
+        for(unsigned char c : text) {
+            if(isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+                out.push_back(static_cast<char>(c));
+            }
+            else {
+                out.push_back('%');
+                out.push_back(hex[c >> 4]);
+                out.push_back(hex[c & 0x0f]);
+            }
+        }
+    }
+
+    inline void append_json_escaped(std::string& out, const std::string& text) {
+        static const char hex[] = "0123456789abcdef";
+        for(unsigned char c : text) {
+            switch(c) {
+                case '"': out.append("\\\""); break;
+                case '\\': out.append("\\\\"); break;
+                case '\n': out.append("\\n"); break;
+                case '\r': out.append("\\r"); break;
+                case '\t': out.append("\\t"); break;
+                default:
+                    if(c < 0x20) {
+                        out.append("\\u00");
+                        out.push_back(hex[c >> 4]);
+                        out.push_back(hex[c & 0x0f]);
+                    }
+                    else {
+                        out.push_back(static_cast<char>(c));
+                    }
+            }
+        }
+    }
+
+    //formats to: 'year-mo-dy hr:mn' in utc
+    inline std::string format_time(time_t t) {
+        std::tm gmt{}; gmtime_r(&t, &gmt);
+        char buffer[32];
+        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M", &gmt);
+        return buffer;
+    }
+
+    inline std::string render_html(const std::string& uri, const std::vector<entry>& entries) {
+        std::string out;
+        out.reserve(256 + entries.size() * 160);
+        out.append("<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>Index of ");
+        append_html_escaped(out, uri);
+        out.append("</title></head>\n<body><h1>Index of ");
+        append_html_escaped(out, uri);
+        out.append("</h1><hr><pre>\n<a href=\"../\">../</a>\n");
+        for(const auto& e : entries) {
+            std::string href;
+            append_url_encoded(href, e.name);
+            if(e.directory)
+                href.push_back('/');
+            out.append("<a href=\"");
+            append_html_escaped(out, href);
+            out.append("\">");
+            append_html_escaped(out, e.directory ? e.name + "/" : e.name);
+            out.append("</a> ");
+            out.append(format_time(e.mtime));
+            out.push_back(' ');
+            out.append(e.directory ? "-" : std::to_string(e.size));
+            out.push_back('\n');
+        }
+        out.append("</pre><hr></body></html>\n");
+        return out;
+    }
+
+    inline std::string render_json(const std::vector<entry>& entries) {
+        std::string out;
+        out.reserve(16 + entries.size() * 96);
+        out.push_back('[');
+        for(size_t i = 0; i < entries.size(); ++i) {
+            const auto& e = entries[i];
+            if(i)
+                out.push_back(',');
+            out.append("{\"name\":\"");
+            append_json_escaped(out, e.name);
+            out.append("\",\"type\":\"");
+            out.append(e.directory ? "directory" : "file");
+            out.append("\",\"mtime\":");
+            out.append(std::to_string(e.mtime));
+            if(!e.directory) {
+                out.append(",\"size\":");
+                out.append(std::to_string(e.size));
+            }
+            out.push_back('}');
+        }
+        out.append("]\n");
+        return out;
+    }
+
+    //a rendered listing, immutable once published so readers need no lock
+    struct listing {
+        std::string body;
+        std::string gzipped;
+        const char* content_type;
+        struct timespec mtime;
+        ino_t inode;
+        //pick the representation for a request
+        const std::string& select(bool gzip_ok) const {
+            return gzip_ok && !gzipped.empty() ? gzipped : body;
+        }
+    };
+
+    //caches rendered listings keyed by directory path and format, an entry is valid as long
+    //as the directory's mtime and inode are unchanged, which is what adding, removing or
+    //renaming an entry updates. sizes of files modified in place are refreshed on the next
+    //change to the directory itself
+    using autoindex_config_t = std::unordered_map<std::string, std::string>;
+    class listing_cache {
+    public:
+        listing_cache() = delete;
+        explicit listing_cache(const autoindex_config_t& config) : max_entries(1024), gzip_level(Z_BEST_COMPRESSION), min_gzip_size(256) {
+            auto parse = [&config](const char* key, size_t& value) {
+                auto found = config.find(key);
+                if(found == config.end())
+                    return;
+                try {
+                    value = std::stoul(found->second);
+                }
+                catch(...) {
+                    throw std::runtime_error(found->second + " is not a valid " + key);
+                }
+            };
+            size_t level = gzip_level;
+            parse("max_entries", max_entries);
+            parse("gzip_level", level);
+            parse("min_gzip_size", min_gzip_size);
+            if(level > 9)
+                throw std::runtime_error(std::to_string(level) + " is not a valid gzip_level");
+            gzip_level = static_cast<int>(level);
+        }
+
+        //returns the listing for the directory at path, rendering it only when the directory changed
+        std::shared_ptr<const listing> get(const std::string& path, const std::string& uri, format type) {
+            int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if(fd < 0)
+                throw std::runtime_error("Couldn't open directory " + path + ": " + strerror(errno));
+            struct stat st{};
+            if(fstat(fd, &st) != 0) {
+                close(fd);
+                throw std::runtime_error("Couldn't stat directory " + path + ": " + strerror(errno));
+            }
+
+            //the uri is part of the html so it must be part of the key too
+            std::string key;
+            key.reserve(path.size() + uri.size() + 2);
+            key.push_back(type == format::HTML ? 'h' : 'j');
+            key.append(path);
+            key.push_back('\0');
+            key.append(uri);
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                auto found = index.find(key);
+                if(found != index.end()) {
+                    const auto& cached = found->second->second;
+                    if(cached->inode == st.st_ino && cached->mtime.tv_sec == st.st_mtim.tv_sec &&
+                       cached->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+                        lru.splice(lru.begin(), lru, found->second);
+                        close(fd);
+                        return cached;
+                    }
+                }
+            }
+
+            //render outside the lock, concurrent misses on the same directory simply race to publish
+            std::shared_ptr<listing> rendered;
+            try {
+                auto entries = scan(fd);
+                rendered = std::make_shared<listing>();
+                rendered->body = type == format::HTML ? render_html(uri, entries) : render_json(entries);
+                rendered->content_type = type == format::HTML ? "text/html; charset=utf-8" : "application/json";
+                rendered->mtime = st.st_mtim;
+                rendered->inode = st.st_ino;
+                if(rendered->body.size() >= min_gzip_size)
+                    rendered->gzipped = compression::gzip(rendered->body, gzip_level);
+            }
+            catch(...) {
+                close(fd);
+                throw;
+            }
+            close(fd);
+
+            //a directory changed within the current second may change again without a visible mtime
+            //bump on coarse timestamp filesystems, so we dont remember listings that young
+            auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+            if(st.st_mtim.tv_sec >= now - 1)
+                return rendered;
+
+            std::lock_guard<std::mutex> guard(lock);
+            auto found = index.find(key);
+            if(found != index.end()) {
+                found->second->second = rendered;
+                lru.splice(lru.begin(), lru, found->second);
+                return rendered;
+            }
+            lru.emplace_front(key, rendered);
+            index.emplace(std::move(key), lru.begin());
+            while(lru.size() > max_entries) {
+                index.erase(lru.back().first);
+                lru.pop_back();
+            }
+            return rendered;
+        }
+
+        //forget everything, for example after a config reload
+        void clear() {
+            std::lock_guard<std::mutex> guard(lock);
+            index.clear();
+            lru.clear();
+        }
+
+    protected:
+        using lru_t = std::list<std::pair<std::string, std::shared_ptr<const listing> > >;
+        std::mutex lock;
+        lru_t lru;
+        std::unordered_map<std::string, lru_t::iterator> index;
+        size_t max_entries;
+        int gzip_level;
+        size_t min_gzip_size;
+    };
+}
+
+#endif //__AUTOINDEX_HPP__
+
+#ifdef TEST_AUTOINDEX
+//g++ -std=c++17 -O2 -DTEST_AUTOINDEX -Iinclude -x c++ include/autoindex/autoindex.hpp -o autoindextest -lz
+#include <cassert>
+#include <iostream>
+#include <sys/time.h>
+
+int main() {
+  char dir[] = "/tmp/autoindexXXXXXX";
+  assert(mkdtemp(dir));
+  std::string root(dir);
+  auto touch = [](const std::string& path, const std::string& body) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assert(fd >= 0 && write(fd, body.data(), body.size()) == static_cast<ssize_t>(body.size()));
+    close(fd);
+  };
+  //listings younger than a second are not cached, so date the directory back
+  auto age = [&root](time_t seconds) {
+    timespec times[2] = {{time(nullptr) - seconds, 0}, {time(nullptr) - seconds, 0}};
+    assert(utimensat(AT_FDCWD, root.c_str(), times, 0) == 0);
+  };
+  touch(root + "/b.txt", "hello");
+  touch(root + "/a <&\"'>.txt", "");
+  touch(root + "/.hidden", "x");
+  assert(mkdir((root + "/z dir").c_str(), 0755) == 0);
+  assert(symlink((root + "/b.txt").c_str(), (root + "/link").c_str()) == 0);
+  assert(symlink("/nonexistent", (root + "/dangling").c_str()) == 0);
+
+  //directories first, then byte order, dot files left out, symlinks followed
+  int fd = open(root.c_str(), O_RDONLY | O_DIRECTORY);
+  auto entries = autoindex::scan(fd, 64);
+  close(fd);
+  assert(entries.size() == 5);
+  assert(entries[0].name == "z dir" && entries[0].directory);
+  assert(entries[1].name == "a <&\"'>.txt" && entries[1].size == 0);
+  assert(entries[2].name == "b.txt" && entries[2].size == 5);
+  assert(entries[3].name == "dangling" && !entries[3].directory);
+  assert(entries[4].name == "link" && entries[4].size == 5);
+
+  //names are escaped for text and percent encoded in hrefs
+  std::string html = autoindex::render_html("/files/<x>", entries);
+  assert(html.find("<title>Index of /files/&lt;x&gt;</title>") != std::string::npos);
+  assert(html.find("<a href=\"z%20dir/\">z dir/</a>") != std::string::npos);
+  assert(html.find("<a href=\"a%20%3C%26%22%27%3E.txt\">a &lt;&amp;&quot;&#39;&gt;.txt</a>") != std::string::npos);
+  assert(html.find(".hidden") == std::string::npos);
+  std::string json = autoindex::render_json({{"q\"\\\n\x01", false, 3, 7}, {"d", true, 0, 8}});
+  assert(json == "[{\"name\":\"q\\\"\\\\\\n\\u0001\",\"type\":\"file\",\"mtime\":7,\"size\":3},"
+                 "{\"name\":\"d\",\"type\":\"directory\",\"mtime\":8}]\n");
+
+  assert(compression::accepts_gzip("gzip"));
+  assert(compression::accepts_gzip("br, gzip;q=0.5"));
+  assert(!compression::accepts_gzip("gzip;q=0"));
+  assert(!compression::accepts_gzip("deflate, br"));
+
+  //a hit is the same rendered listing, a change to the directory renders it again
+  autoindex::listing_cache cache({{"min_gzip_size", "1"}, {"max_entries", "2"}});
+  age(60);
+  auto first = cache.get(root, "/", autoindex::format::HTML);
+  assert(first->content_type == std::string("text/html; charset=utf-8"));
+  assert(compression::gunzip(first->select(true)) == first->body);
+  assert(&first->select(false) == &first->body);
+  assert(cache.get(root, "/", autoindex::format::HTML) == first);
+  auto listed = cache.get(root, "/", autoindex::format::JSON);
+  assert(listed != first && listed->content_type == std::string("application/json"));
+  assert(cache.get(root, "/other/", autoindex::format::HTML) != first);
+  //the third key pushed the oldest one out
+  assert(cache.get(root, "/", autoindex::format::HTML) != first);
+  first = cache.get(root, "/", autoindex::format::HTML);
+  touch(root + "/c.txt", "c");
+  age(30);
+  auto changed = cache.get(root, "/", autoindex::format::HTML);
+  assert(changed != first && changed->body.find("c.txt") != std::string::npos);
+  //a directory changed this second is rendered but not remembered
+  touch(root + "/d.txt", "d");
+  auto young = cache.get(root, "/", autoindex::format::HTML);
+  assert(young->body.find("d.txt") != std::string::npos && cache.get(root, "/", autoindex::format::HTML) != young);
+
+  bool thrown = false;
+  try { autoindex::listing_cache(autoindex::autoindex_config_t{{"gzip_level", "10"}}); } catch(const std::runtime_error&) { thrown = true; }
+  assert(thrown);
+  thrown = false;
+  try { cache.get(root + "/missing", "/", autoindex::format::HTML); } catch(const std::runtime_error&) { thrown = true; }
+  assert(thrown);
+
+  for(const char* name : {"/b.txt", "/a <&\"'>.txt", "/.hidden", "/link", "/dangling", "/c.txt", "/d.txt"})
+    unlink((root + name).c_str());
+  rmdir((root + "/z dir").c_str());
+  rmdir(root.c_str());
+  std::cout << "autoindex ok" << std::endl;
+  return 0;
+}
+#endif
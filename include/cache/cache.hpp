@@ -0,0 +1,201 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __CACHE_HPP__
+#define __CACHE_HPP__
+
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace cache {
+    using clock = std::chrono::steady_clock;
+    using cache_config_t = std::unordered_map<std::string, std::string>;
+
+    //reads an unsigned setting, leaving value alone if the key is absent
+    inline void parse(const cache_config_t& config, const char* key, size_t& value) {
+        auto found = config.find(key);
+        if(found == config.end())
+            return;
+        try {
+            value = std::stoul(found->second);
+        }
+        catch(...) {
+            throw std::runtime_error(found->second + " is not a valid " + key);
+        }
+    }
+
+    //a cached response, immutable once inserted so readers hold it without a lock
+    struct object {
+        std::string key;
+        //the serialized response head, status line and headers
+        std::string head;
+        std::string body;
+        clock::time_point expires;
+        size_t footprint() const {
+            return key.size() + head.size() + body.size() + sizeof(object);
+        }
+        bool fresh(clock::time_point now = clock::now()) const {
+            return now < expires;
+        }
+    };
+
+    //a byte bounded lru split into shards so concurrent workers rarely share a lock
+    class object_cache {
+    public:
+        object_cache() = delete;
+        explicit object_cache(const cache_config_t& config) : max_bytes(256ul << 20) {
+            size_t shard_count = 16;
+            parse(config, "max_bytes", max_bytes);
+            parse(config, "shards", shard_count);
+            if(shard_count == 0)
+                throw std::runtime_error("Cache needs at least one shard");
+            shards = std::vector<shard>(shard_count);
+            for(auto& s : shards)
+                s.max_bytes = max_bytes / shard_count;
+        }
+
+        //the object under key, fresh or not, callers decide what staleness means to them
+        std::shared_ptr<const object> get(const std::string& key) {
+            auto& s = shard_for(key);
+            std::lock_guard<std::mutex> guard(s.lock);
+            auto found = s.index.find(key);
+            if(found == s.index.end())
+                return nullptr;
+            s.lru.splice(s.lru.begin(), s.lru, found->second);
+            return *found->second;
+        }
+
+        //inserts or replaces, evicting from the cold end until the shard fits again
+        void put(std::shared_ptr<const object> value) {
+            if(!value)
+                return;
+            auto& s = shard_for(value->key);
+            if(value->footprint() > s.max_bytes)
+                return;
+            std::vector<std::string> evicted;
+            {
+                std::lock_guard<std::mutex> guard(s.lock);
+                auto found = s.index.find(value->key);
+                if(found != s.index.end()) {
+                    s.bytes -= (*found->second)->footprint();
+                    s.lru.erase(found->second);
+                    s.index.erase(found);
+                }
+                s.bytes += value->footprint();
+                s.lru.push_front(std::move(value));
+                s.index.emplace(s.lru.front()->key, s.lru.begin());
+                while(s.bytes > s.max_bytes)
+                    evicted.push_back(evict(s));
+            }
+            //the listener runs outside the shard lock so it is free to take its own
+            if(!evicted.empty())
+                notify(evicted);
+        }
+
+        //called with the key of every object pushed out by the lru, not for erase or replace.
+        //returns once no call into the previous listener is running anymore, so whatever it
+        //points at may go away right after. never call it from inside a listener
+        void on_evict(std::function<void(const std::string&)> listener) {
+            std::shared_ptr<const evict_listener> next;
+            if(listener)
+                next = std::make_shared<const evict_listener>(std::move(listener));
+            std::unique_lock<std::mutex> guard(listener_lock);
+            std::shared_ptr<const evict_listener> previous = std::move(evicted_listener);
+            evicted_listener = std::move(next);
+            //every copy is taken and dropped under listener_lock, so the count is exact here
+            listener_done.wait(guard, [&previous]() { return !previous || previous.use_count() == 1; });
+        }
+
+        bool erase(const std::string& key) {
+            auto& s = shard_for(key);
+            std::lock_guard<std::mutex> guard(s.lock);
+            auto found = s.index.find(key);
+            if(found == s.index.end())
+                return false;
+            s.bytes -= (*found->second)->footprint();
+            s.lru.erase(found->second);
+            s.index.erase(found);
+            return true;
+        }
+
+        size_t bytes() {
+            size_t total = 0;
+            for(auto& s : shards) {
+                std::lock_guard<std::mutex> guard(s.lock);
+                total += s.bytes;
+            }
+            return total;
+        }
+
+        size_t size() {
+            size_t total = 0;
+            for(auto& s : shards) {
+                std::lock_guard<std::mutex> guard(s.lock);
+                total += s.lru.size();
+            }
+            return total;
+        }
+
+    protected:
+        using lru_t = std::list<std::shared_ptr<const object> >;
+        using evict_listener = std::function<void(const std::string&)>;
+        struct shard {
+            std::mutex lock;
+            lru_t lru;
+            std::unordered_map<std::string, lru_t::iterator> index;
+            size_t bytes = 0;
+            size_t max_bytes = 0;
+        };
+        shard& shard_for(const std::string& key) {
+            return shards[std::hash<std::string>{}(key) % shards.size()];
+        }
+        std::string evict(shard& s) {
+            std::string key = s.lru.back()->key;
+            s.bytes -= s.lru.back()->footprint();
+            s.index.erase(key);
+            s.lru.pop_back();
+            return key;
+        }
+        //holds on to the current listener for the duration of the calls, on_evict waits for it
+        void notify(const std::vector<std::string>& evicted) {
+            std::shared_ptr<const evict_listener> listener;
+            {
+                std::lock_guard<std::mutex> guard(listener_lock);
+                listener = evicted_listener;
+            }
+            if(!listener)
+                return;
+            auto release = [&]() {
+                std::lock_guard<std::mutex> guard(listener_lock);
+                listener.reset();
+                listener_done.notify_all();
+            };
+            try {
+                for(const auto& key : evicted)
+                    (*listener)(key);
+            }
+            catch(...) {
+                release();
+                throw;
+            }
+            release();
+        }
+
+        size_t max_bytes;
+        std::vector<shard> shards;
+        std::mutex listener_lock;
+        std::condition_variable listener_done;
+        std::shared_ptr<const evict_listener> evicted_listener;
+    };
+}
+
+#endif //__CACHE_HPP__
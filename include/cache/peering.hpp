@@ -0,0 +1,353 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __PEERING_HPP__
+#define __PEERING_HPP__
+
+#include "cache/cache.hpp"
+#include "hashing/hash_ring.hpp"
+#include "upstream/upstream.hpp"
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <cstdlib>
+
+namespace cache {
+    //the origin path of a node: produce the object from its own cache or the upstream
+    using origin_function = std::function<std::shared_ptr<const object>(const std::string& key)>;
+
+    //shares one cache across many nodes. every key has an owner picked by consistent hashing
+    //with bounded loads, only the owner fills from the origin and everybody else asks the owner
+    //over pooled keep-alive connections. objects fetched from a peer are kept briefly in a
+    //small local hot tier so popular keys do not pay the extra hop on every request
+    class peer_cluster {
+    public:
+        //marks peer to peer requests, an owner receiving one never forwards it again
+        static constexpr const char* PEER_HEADER = "X-Cheehttpd-Peer";
+
+        peer_cluster() = delete;
+        peer_cluster(object_cache& hot_tier, const cache_config_t& config) :
+            hot_tier(hot_tier), self(-1), load_factor(1.25), hot_ttl(std::chrono::seconds(5)) {
+            auto peers = config.find("peers");
+            auto me = config.find("self");
+            if(peers == config.end() || me == config.end())
+                throw std::runtime_error("Cache peering needs peers and self");
+            size_t vnodes = 160, ttl = 5;
+            parse(config, "vnodes", vnodes);
+            parse(config, "peer_hot_ttl", ttl);
+            hot_ttl = std::chrono::seconds(ttl);
+            auto factor = config.find("load_factor");
+            if(factor != config.end()) {
+                load_factor = std::strtod(factor->second.c_str(), nullptr);
+                if(load_factor < 1.0)
+                    throw std::runtime_error(factor->second + " is not a valid load_factor, use 1.0 or more");
+            }
+            std::vector<std::string> names;
+            for(size_t pos = 0; pos <= peers->second.size();) {
+                size_t end = peers->second.find(',', pos);
+                if(end == std::string::npos)
+                    end = peers->second.size();
+                std::string name = peers->second.substr(pos, end - pos);
+                if(!name.empty()) {
+                    auto target = upstream::parse_backend(name);
+                    if(name == me->second)
+                        self = static_cast<int>(names.size());
+                    names.push_back(target.name());
+                    pools.emplace_back(new upstream::pool(target, config));
+                }
+                pos = end + 1;
+            }
+            if(self < 0)
+                throw std::runtime_error("Cache peering self " + me->second + " is not among the peers");
+            loads = std::vector<std::atomic<uint32_t> >(names.size());
+            ring = hashing::hash_ring(names, vnodes);
+        }
+
+        //true if this node is where key lives
+        bool owns(const std::string& key) const {
+            return static_cast<int>(ring.owner(key)) == self;
+        }
+
+        //true if the request came from another node and must be answered locally
+        static bool from_peer(const http::headers_t& headers) {
+            return http::find_header(headers, PEER_HEADER) != nullptr;
+        }
+
+        //the object for key, from the local origin if we own it, else from the hot tier or the owner.
+        //if the owner is unreachable we fall back to our own origin rather than failing the request
+        std::shared_ptr<const object> fetch(const std::string& key, const std::string& host, const origin_function& origin) {
+            size_t owner = ring.owner(key, loads, load_factor);
+            if(static_cast<int>(owner) == self) {
+                //our own origin fetches count towards our load like requests to peers do theirs
+                load_guard busy(loads[owner]);
+                return origin(key);
+            }
+            auto hot = hot_tier.get(key);
+            if(hot && hot->fresh())
+                return hot;
+            load_guard busy(loads[owner]);
+            try {
+                http::request request;
+                request.method = "GET";
+                request.target = key;
+                request.headers = {{"Host", host}, {PEER_HEADER, "1"}};
+                auto response = pools[owner]->exchange(request);
+                if(response.status != 200)
+                    return origin(key);
+                auto fetched = std::make_shared<object>();
+                fetched->key = key;
+                fetched->expires = clock::now() + hot_ttl;
+                http::remove_header(response.headers, PEER_HEADER);
+                http::remove_header(response.headers, "Connection");
+                http::remove_header(response.headers, "Keep-Alive");
+                http::remove_header(response.headers, "Transfer-Encoding");
+                http::set_header(response.headers, "Content-Length", std::to_string(response.body.size()));
+                fetched->head = http::serialize_head(response);
+                fetched->body = std::move(response.body);
+                hot_tier.put(fetched);
+                return fetched;
+            }
+            catch(const upstream::upstream_error&) {
+                return origin(key);
+            }
+        }
+
+        size_t peer_count() const {
+            return pools.size();
+        }
+
+    protected:
+        //counts a request as in flight towards a node for the bounded load calculation
+        struct load_guard {
+            explicit load_guard(std::atomic<uint32_t>& load) : load(load) { ++load; }
+            ~load_guard() { --load; }
+            std::atomic<uint32_t>& load;
+        };
+
+        object_cache& hot_tier;
+        int self;
+        double load_factor;
+        std::chrono::seconds hot_ttl;
+        hashing::hash_ring ring;
+        std::vector<std::unique_ptr<upstream::pool> > pools;
+        std::vector<std::atomic<uint32_t> > loads;
+    };
+}
+
+#endif //__PEERING_HPP__
+
+#ifdef TEST_PEERING
+//g++ -std=c++17 -O2 -DTEST_PEERING -Iinclude -x c++ include/cache/peering.hpp -o peeringtest -pthread
+#include <arpa/inet.h>
+#include <cassert>
+#include <future>
+#include <iostream>
+#include <thread>
+
+namespace {
+  //a blocking keep-alive http server on a loopback port, a thread per connection, good enough
+  //to stand in for a cache node. answer gets the request and returns the raw response
+  struct mini_server {
+    using answer_t = std::function<std::string(const http::request&)>;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    uint16_t port = 0;
+    answer_t answer;
+    std::mutex lock;
+    std::vector<int> connections;
+    std::vector<std::thread> threads;
+    std::thread acceptor;
+    explicit mini_server(answer_t answer) : answer(std::move(answer)) {
+      sockaddr_in a{};
+      a.sin_family = AF_INET;
+      a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      socklen_t length = sizeof(a);
+      assert(bind(fd, reinterpret_cast<sockaddr*>(&a), sizeof(a)) == 0 && listen(fd, 64) == 0);
+      getsockname(fd, reinterpret_cast<sockaddr*>(&a), &length);
+      port = ntohs(a.sin_port);
+      acceptor = std::thread([this]() {
+        int c;
+        while((c = accept(fd, nullptr, nullptr)) >= 0) {
+          std::lock_guard<std::mutex> guard(lock);
+          connections.push_back(c);
+          threads.emplace_back([this, c]() { serve(c); });
+        }
+      });
+    }
+    void serve(int c) {
+      std::string in;
+      char buffer[4096];
+      ssize_t got;
+      while((got = read(c, buffer, sizeof(buffer))) > 0) {
+        in.append(buffer, static_cast<size_t>(got));
+        http::request request;
+        size_t head;
+        while((head = http::parse_request_head(in.data(), in.size(), request))) {
+          in.erase(0, head);
+          std::string out = this->answer(request);
+          if(write(c, out.data(), out.size()) != static_cast<ssize_t>(out.size()))
+            return;
+        }
+      }
+    }
+    void stop() {
+      if(fd < 0)
+        return;
+      shutdown(fd, SHUT_RDWR);
+      acceptor.join();
+      for(int c : connections)
+        shutdown(c, SHUT_RDWR);
+      for(auto& t : threads)
+        t.join();
+      for(int c : connections)
+        close(c);
+      close(fd);
+      fd = -1;
+    }
+    ~mini_server() {
+      stop();
+    }
+  };
+
+  std::string ok(const std::string& body) {
+    return "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+  }
+
+  //one cache node answering peers from its origin and clients from its cluster view
+  struct node {
+    size_t index = 0;
+    std::atomic<size_t> origin_calls{0};
+    std::function<void()> before_origin;
+    std::unique_ptr<cache::object_cache> hot;
+    std::unique_ptr<cache::peer_cluster> cluster;
+    std::unique_ptr<mini_server> http;
+    std::shared_ptr<const cache::object> origin(const std::string& key) {
+      if(before_origin)
+        before_origin();
+      ++origin_calls;
+      auto o = std::make_shared<cache::object>();
+      o->key = key;
+      o->body = "node" + std::to_string(index) + ":" + key;
+      o->expires = cache::clock::now() + std::chrono::hours(1);
+      return o;
+    }
+    cache::origin_function origin_function() {
+      return [this](const std::string& key) { return origin(key); };
+    }
+    void listen() {
+      http.reset(new mini_server([this](const http::request& request) {
+        auto o = cache::peer_cluster::from_peer(request.headers) ? origin(request.target)
+                                                                 : cluster->fetch(request.target, "localhost", origin_function());
+        return ok(o->body);
+      }));
+    }
+  };
+
+  std::string address(uint16_t port) {
+    return "127.0.0.1:" + std::to_string(port);
+  }
+}
+
+int main() {
+  //three nodes on localhost, each asking the owner of a key for it
+  std::vector<std::unique_ptr<node> > nodes;
+  for(size_t i = 0; i < 3; ++i) {
+    nodes.emplace_back(new node());
+    nodes.back()->index = i;
+    nodes.back()->listen();
+  }
+  std::string peers = address(nodes[0]->http->port) + "," + address(nodes[1]->http->port) + "," + address(nodes[2]->http->port);
+  for(auto& n : nodes) {
+    n->hot.reset(new cache::object_cache(cache::cache_config_t{{"max_bytes", "1048576"}}));
+    n->cluster.reset(new cache::peer_cluster(*n->hot, {{"peers", peers}, {"self", address(n->http->port)}, {"timeout_ms", "2000"}}));
+  }
+
+  //every node agrees on the owner and the object always comes from the owner's origin
+  std::vector<size_t> owned(3);
+  for(int k = 0; k < 60; ++k) {
+    std::string key = "/object/" + std::to_string(k);
+    size_t owner = 3;
+    for(size_t i = 0; i < 3; ++i)
+      if(nodes[i]->cluster->owns(key)) {
+        assert(owner == 3);
+        owner = i;
+      }
+    assert(owner < 3);
+    ++owned[owner];
+    for(auto& n : nodes)
+      assert(n->cluster->fetch(key, "localhost", n->origin_function())->body == "node" + std::to_string(owner) + ":" + key);
+  }
+  assert(owned[0] && owned[1] && owned[2]);
+  assert(nodes[0]->origin_calls + nodes[1]->origin_calls + nodes[2]->origin_calls == 60 * 3);
+
+  //the hot tier answers a second time without a hop
+  std::string remote;
+  for(int k = 0; remote.empty(); ++k)
+    if(!nodes[0]->cluster->owns("/hot/" + std::to_string(k)))
+      remote = "/hot/" + std::to_string(k);
+  nodes[0]->cluster->fetch(remote, "localhost", nodes[0]->origin_function());
+  size_t calls = nodes[0]->origin_calls + nodes[1]->origin_calls + nodes[2]->origin_calls;
+  nodes[0]->cluster->fetch(remote, "localhost", nodes[0]->origin_function());
+  assert(calls == nodes[0]->origin_calls + nodes[1]->origin_calls + nodes[2]->origin_calls);
+
+  //our own origin fetches count as load: with two of them in flight a third key we own goes
+  //to the other node instead of piling on
+  {
+    cache::object_cache hot(cache::cache_config_t{{"max_bytes", "1048576"}});
+    cache::peer_cluster pair(hot, {{"peers", address(nodes[0]->http->port) + "," + address(nodes[1]->http->port)},
+                                   {"self", address(nodes[0]->http->port)}});
+    std::vector<std::string> mine;
+    for(int k = 0; mine.size() < 3; ++k)
+      if(pair.owns("/busy/" + std::to_string(k)))
+        mine.push_back("/busy/" + std::to_string(k));
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    std::atomic<int> waiting{0};
+    node blocking;
+    blocking.before_origin = [&]() {
+      ++waiting;
+      released.wait();
+    };
+    std::vector<std::thread> busy;
+    for(int i = 0; i < 2; ++i)
+      busy.emplace_back([&, i]() { pair.fetch(mine[i], "localhost", blocking.origin_function()); });
+    while(waiting < 2)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    assert(pair.fetch(mine[2], "localhost", nodes[0]->origin_function())->body == "node1:" + mine[2]);
+    release.set_value();
+    for(auto& t : busy)
+      t.join();
+    //idle again the key is served here
+    assert(pair.fetch(mine[2], "localhost", nodes[0]->origin_function())->body == "node0:" + mine[2]);
+  }
+
+  //a peer sending garbage is treated like one that is down
+  {
+    mini_server broken([](const http::request&) { return std::string("HTTP/1.1 200 OK\r\nContent-Length: abc\r\n\r\n"); });
+    cache::object_cache hot(cache::cache_config_t{{"max_bytes", "1048576"}});
+    cache::peer_cluster pair(hot, {{"peers", address(nodes[0]->http->port) + "," + address(broken.port)},
+                                   {"self", address(nodes[0]->http->port)}});
+    std::string theirs;
+    for(int k = 0; theirs.empty(); ++k)
+      if(!pair.owns("/garbage/" + std::to_string(k)))
+        theirs = "/garbage/" + std::to_string(k);
+    assert(pair.fetch(theirs, "localhost", nodes[0]->origin_function())->body == "node0:" + theirs);
+  }
+
+  //and so is one that went away
+  nodes[2]->http->stop();
+  std::string orphan;
+  for(int k = 0; orphan.empty(); ++k)
+    if(nodes[2]->cluster->owns("/orphan/" + std::to_string(k)))
+      orphan = "/orphan/" + std::to_string(k);
+  assert(nodes[0]->cluster->fetch(orphan, "localhost", nodes[0]->origin_function())->body == "node0:" + orphan);
+
+  for(auto& n : nodes)
+    n->http->stop();
+  std::cout << "peering ok" << std::endl;
+  return 0;
+}
+#endif
@@ -0,0 +1,529 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __PURGE_HPP__
+#define __PURGE_HPP__
+
+#include "cache/cache.hpp"
+#include "acl/acl.hpp"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <unordered_set>
+#include <utility>
+#include <cstdint>
+
+namespace cache {
+    //what a lookup should do with the cached object it found
+    enum class freshness : uint8_t { MISS = 0, FRESH = 1, STALE = 2, REVALIDATE = 3 };
+
+    //hard purges drop objects, soft ones keep serving them stale while one request refreshes
+    enum class purge_mode : uint8_t { HARD = 0, SOFT = 1 };
+
+    //an inverted index from surrogate keys (tags) to cached objects for fast invalidation.
+    //every tracked object and every tag gets a compact 32 bit id, tag postings are plain
+    //vectors of (id, generation) pairs so purging a tag with many thousands of objects is a
+    //linear walk over packed integers. ids are recycled, the generation tells a posting left
+    //behind by an evicted object from the object that reuses its id, and dead postings are
+    //compacted away once they outnumber live ones. a tag goes with the last object carrying it.
+    //the purge endpoint takes requests from peers in the comma separated purge_allow prefixes
+    //or with a bearer token from the comma separated purge_tokens, with neither set nobody purges
+    class purge_index {
+    public:
+        purge_index() = delete;
+        purge_index(object_cache& store, const cache_config_t& config) :
+            store(store), revalidate_timeout(std::chrono::seconds(10)), max_stale(std::chrono::seconds(86400)) {
+            size_t timeout = 10, stale = 86400;
+            parse(config, "revalidate_timeout", timeout);
+            parse(config, "max_stale", stale);
+            revalidate_timeout = std::chrono::seconds(timeout);
+            max_stale = std::chrono::seconds(stale);
+            auto allow = config.find("purge_allow");
+            if(allow != config.end())
+                purgers.reset(new acl::access_list(acl::acl_config_t{{"access_allow", allow->second}, {"access_default", "deny"}}));
+            auto list = config.find("purge_tokens");
+            if(list != config.end()) {
+                size_t start = 0;
+                while(start <= list->second.size()) {
+                    size_t comma = list->second.find(',', start);
+                    if(comma == std::string::npos)
+                        comma = list->second.size();
+                    if(comma > start)
+                        tokens.emplace(list->second, start, comma - start);
+                    start = comma + 1;
+                }
+            }
+            store.on_evict([this](const std::string& key) { forget(key); });
+        }
+        ~purge_index() {
+            //waits out a forget() already running on a thread that is evicting
+            store.on_evict(nullptr);
+        }
+
+        //records the surrogate keys of a freshly stored object, a space separated list as it
+        //arrives in the surrogate-key response header. storing an object clears any stale mark
+        void track(const std::string& key, const std::string& surrogate_keys) {
+            std::lock_guard<std::mutex> guard(lock);
+            auto found = keys.find(key);
+            uint32_t id;
+            if(found != keys.end()) {
+                id = found->second;
+                unlink(id);
+            }
+            else {
+                id = allocate(key);
+            }
+            auto& e = entries[id];
+            e.stale = false;
+            e.revalidating = false;
+            size_t pos = 0;
+            while(pos < surrogate_keys.size()) {
+                while(pos < surrogate_keys.size() && surrogate_keys[pos] == ' ')
+                    ++pos;
+                size_t end = surrogate_keys.find(' ', pos);
+                if(end == std::string::npos)
+                    end = surrogate_keys.size();
+                if(end > pos) {
+                    uint32_t tag = intern(surrogate_keys.substr(pos, end - pos));
+                    tags[tag].postings.push_back(posting{id, e.generation});
+                    ++tags[tag].live;
+                    e.tags.push_back(tag);
+                }
+                pos = end;
+            }
+        }
+
+        //drops the bookkeeping for an object that left the cache
+        void forget(const std::string& key) {
+            std::lock_guard<std::mutex> guard(lock);
+            auto found = keys.find(key);
+            if(found != keys.end())
+                release(found);
+        }
+
+        //classifies a cache hit, of all the requests hitting a soft purged object exactly one is
+        //told to REVALIDATE and the rest are served STALE until it stores the fresh copy
+        freshness check(const std::string& key) {
+            std::lock_guard<std::mutex> guard(lock);
+            auto found = keys.find(key);
+            if(found == keys.end())
+                return freshness::FRESH;
+            auto& e = entries[found->second];
+            if(!e.stale)
+                return freshness::FRESH;
+            auto now = clock::now();
+            if(now - e.purged > max_stale)
+                return freshness::MISS;
+            if(e.revalidating && now - e.revalidate_started < revalidate_timeout)
+                return freshness::STALE;
+            //nobody is refreshing it or the one who was gave up
+            e.revalidating = true;
+            e.revalidate_started = now;
+            return freshness::REVALIDATE;
+        }
+
+        size_t purge_url(const std::string& key, purge_mode mode) {
+            std::vector<std::string> victims;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                auto found = keys.find(key);
+                if(found == keys.end())
+                    return 0;
+                apply(found, mode, victims);
+            }
+            return finish(victims, 1);
+        }
+
+        size_t purge_prefix(const std::string& prefix, purge_mode mode) {
+            std::vector<std::string> victims;
+            size_t count = 0;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                auto it = keys.lower_bound(prefix);
+                while(it != keys.end() && it->first.compare(0, prefix.size(), prefix) == 0) {
+                    auto next = std::next(it);
+                    apply(it, mode, victims);
+                    ++count;
+                    it = next;
+                }
+            }
+            return finish(victims, count);
+        }
+
+        //purges every object carrying any of the space separated tags
+        size_t purge_tags(const std::string& surrogate_keys, purge_mode mode) {
+            std::vector<std::string> victims;
+            size_t count = 0;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                size_t pos = 0;
+                while(pos < surrogate_keys.size()) {
+                    while(pos < surrogate_keys.size() && surrogate_keys[pos] == ' ')
+                        ++pos;
+                    size_t end = surrogate_keys.find(' ', pos);
+                    if(end == std::string::npos)
+                        end = surrogate_keys.size();
+                    if(end > pos) {
+                        auto tag = tag_ids.find(surrogate_keys.substr(pos, end - pos));
+                        if(tag != tag_ids.end()) {
+                            //copy, a hard purge unlinks objects from this very posting list
+                            auto postings = tags[tag->second].postings;
+                            for(const auto& p : postings) {
+                                auto& e = entries[p.id];
+                                if(e.generation != p.generation || !e.live)
+                                    continue;
+                                if(mode == purge_mode::SOFT && e.stale)
+                                    continue;
+                                apply(e.key, mode, victims);
+                                ++count;
+                            }
+                        }
+                    }
+                    pos = end;
+                }
+            }
+            return finish(victims, count);
+        }
+
+        //serves the purge endpoint. 'PURGE /some/url' purges one object, 'PURGE /some/prefix*' every
+        //object under the prefix and a surrogate-key request header purges by tag instead of url.
+        //a 'soft-purge: 1' header marks objects stale rather than dropping them. header names are
+        //expected lower case, peer is the client's address. returns the status code and a small
+        //json body, 401 when a token would let the request through and 403 when nothing would
+        std::pair<int, std::string> handle(const std::string& method, const std::string& target,
+                                           const std::unordered_map<std::string, std::string>& headers,
+                                           const sockaddr* peer = nullptr) {
+            if(method != "PURGE")
+                return {405, "{\"error\":\"method not allowed\"}\n"};
+            if(!authorized(headers, peer))
+                return tokens.empty() ? std::make_pair(403, std::string("{\"error\":\"forbidden\"}\n"))
+                                      : std::make_pair(401, std::string("{\"error\":\"unauthorized\"}\n"));
+            auto soft = headers.find("soft-purge");
+            purge_mode mode = soft != headers.end() && soft->second == "1" ? purge_mode::SOFT : purge_mode::HARD;
+            auto start = clock::now();
+            size_t purged;
+            auto surrogate = headers.find("surrogate-key");
+            if(surrogate != headers.end())
+                purged = purge_tags(surrogate->second, mode);
+            else if(!target.empty() && target.back() == '*')
+                purged = purge_prefix(target.substr(0, target.size() - 1), mode);
+            else
+                purged = purge_url(target, mode);
+            auto took = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+            return {purged ? 200 : 404, "{\"purged\":" + std::to_string(purged) + ",\"mode\":\"" +
+                                        (mode == purge_mode::SOFT ? "soft" : "hard") + "\",\"micros\":" +
+                                        std::to_string(took) + "}\n"};
+        }
+
+        size_t size() {
+            std::lock_guard<std::mutex> guard(lock);
+            return keys.size();
+        }
+        //tags some tracked object still carries
+        size_t tag_count() {
+            std::lock_guard<std::mutex> guard(lock);
+            return tag_ids.size();
+        }
+
+    protected:
+        struct posting {
+            uint32_t id;
+            uint32_t generation;
+        };
+        struct entry {
+            std::string key;
+            std::vector<uint32_t> tags;
+            uint32_t generation = 0;
+            bool live = false;
+            bool stale = false;
+            bool revalidating = false;
+            clock::time_point purged;
+            clock::time_point revalidate_started;
+        };
+        struct tag_postings {
+            std::string name;
+            std::vector<posting> postings;
+            size_t dead = 0;
+            //postings of objects still carrying the tag
+            size_t live = 0;
+        };
+        using keys_t = std::map<std::string, uint32_t>;
+
+        uint32_t allocate(const std::string& key) {
+            uint32_t id;
+            if(!free_ids.empty()) {
+                id = free_ids.back();
+                free_ids.pop_back();
+            }
+            else {
+                id = static_cast<uint32_t>(entries.size());
+                entries.emplace_back();
+            }
+            auto& e = entries[id];
+            e.key = key;
+            e.live = true;
+            keys.emplace(key, id);
+            return id;
+        }
+
+        uint32_t intern(const std::string& name) {
+            auto found = tag_ids.find(name);
+            if(found != tag_ids.end())
+                return found->second;
+            uint32_t id;
+            if(!free_tags.empty()) {
+                id = free_tags.back();
+                free_tags.pop_back();
+                tags[id].name = name;
+            }
+            else {
+                id = static_cast<uint32_t>(tags.size());
+                tags.push_back(tag_postings{name, {}, 0, 0});
+            }
+            tag_ids.emplace(name, id);
+            return id;
+        }
+
+        //retires the object's postings by bumping its generation, they are skipped from now on.
+        //a tag left without live postings is dropped and its id reused
+        void unlink(uint32_t id) {
+            auto& e = entries[id];
+            for(auto tag : e.tags) {
+                auto& t = tags[tag];
+                if(--t.live == 0) {
+                    tag_ids.erase(t.name);
+                    t.name.clear();
+                    t.name.shrink_to_fit();
+                    std::vector<posting>().swap(t.postings);
+                    t.dead = 0;
+                    free_tags.push_back(tag);
+                }
+                else if(++t.dead > t.postings.size() / 2) {
+                    compact(t);
+                }
+            }
+            e.tags.clear();
+            ++e.generation;
+        }
+
+        void compact(tag_postings& t) {
+            size_t kept = 0;
+            for(const auto& p : t.postings) {
+                const auto& e = entries[p.id];
+                if(e.live && e.generation == p.generation)
+                    t.postings[kept++] = p;
+            }
+            t.postings.resize(kept);
+            t.dead = 0;
+        }
+
+        void release(keys_t::iterator found) {
+            uint32_t id = found->second;
+            unlink(id);
+            auto& e = entries[id];
+            e.live = false;
+            e.stale = false;
+            e.revalidating = false;
+            e.key.clear();
+            keys.erase(found);
+            free_ids.push_back(id);
+        }
+
+        void apply(const std::string& key, purge_mode mode, std::vector<std::string>& victims) {
+            auto found = keys.find(key);
+            if(found != keys.end())
+                apply(found, mode, victims);
+        }
+
+        void apply(keys_t::iterator found, purge_mode mode, std::vector<std::string>& victims) {
+            if(mode == purge_mode::SOFT) {
+                auto& e = entries[found->second];
+                if(!e.stale) {
+                    e.stale = true;
+                    e.revalidating = false;
+                    e.purged = clock::now();
+                }
+                return;
+            }
+            victims.push_back(found->first);
+            release(found);
+        }
+
+        //drops hard purged objects from the store once our lock is released, eviction callbacks
+        //come back into this index and must not find it held
+        size_t finish(const std::vector<std::string>& victims, size_t count) {
+            for(const auto& key : victims)
+                store.erase(key);
+            return count;
+        }
+
+        bool authorized(const std::unordered_map<std::string, std::string>& headers, const sockaddr* peer) const {
+            if(peer && purgers && purgers->allowed(peer))
+                return true;
+            auto authorization = headers.find("authorization");
+            return authorization != headers.end() && authorization->second.size() > 7 &&
+                   strncasecmp(authorization->second.c_str(), "Bearer ", 7) == 0 && tokens.count(authorization->second.substr(7));
+        }
+
+        object_cache& store;
+        std::unique_ptr<acl::access_list> purgers;
+        std::unordered_set<std::string> tokens;
+        std::chrono::seconds revalidate_timeout;
+        std::chrono::seconds max_stale;
+        std::mutex lock;
+        keys_t keys;
+        std::vector<entry> entries;
+        std::vector<uint32_t> free_ids;
+        std::vector<tag_postings> tags;
+        std::vector<uint32_t> free_tags;
+        std::unordered_map<std::string, uint32_t> tag_ids;
+    };
+}
+
+#endif //__PURGE_HPP__
+
+#ifdef TEST_PURGE
+//g++ -std=c++17 -O2 -DTEST_PURGE -Iinclude -x c++ include/cache/purge.hpp -o purgetest -lpthread
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <thread>
+
+namespace {
+  std::shared_ptr<cache::object> make(const std::string& key, size_t size = 10) {
+    auto o = std::make_shared<cache::object>();
+    o->key = key;
+    o->body.assign(size, 'x');
+    o->expires = cache::clock::now() + std::chrono::hours(1);
+    return o;
+  }
+}
+
+int main() {
+  {
+    cache::object_cache store({{"max_bytes", "1048576"}, {"shards", "1"}});
+    cache::purge_index index(store, {{"revalidate_timeout", "3600"}, {"purge_tokens", "old,secret"}, {"purge_allow", "10.0.0.0/8"}});
+    const std::unordered_map<std::string, std::string> admin{{"authorization", "Bearer secret"}};
+    for(const char* key : {"/a/1", "/a/2", "/b/1"}) {
+      store.put(make(key));
+      index.track(key, std::string("all ") + (key[1] == 'a' ? "tag-a" : "tag-b"));
+    }
+    assert(index.size() == 3 && index.tag_count() == 3);
+    //only a configured token or peer may purge
+    sockaddr_in inside{}, outside{};
+    inside.sin_family = outside.sin_family = AF_INET;
+    inet_pton(AF_INET, "10.1.2.3", &inside.sin_addr);
+    inet_pton(AF_INET, "192.0.2.1", &outside.sin_addr);
+    assert(index.handle("PURGE", "/a/1", {}).first == 401);
+    assert(index.handle("PURGE", "/a/1", {{"authorization", "Bearer wrong"}}).first == 401);
+    assert(index.handle("PURGE", "/a/1", {{"authorization", "Basic secret"}}).first == 401);
+    assert(index.handle("PURGE", "/a/1", {}, reinterpret_cast<sockaddr*>(&outside)).first == 401);
+    assert(index.size() == 3 && store.get("/a/1"));
+    assert(index.handle("PURGE", "/nothing", {}, reinterpret_cast<sockaddr*>(&inside)).first == 404);
+    assert(index.handle("PURGE", "/nothing", {{"authorization", "bearer old"}}).first == 404);
+    auto status = index.handle("PURGE", "/a/1", admin);
+    assert(status.first == 200 && status.second.find("\"purged\":1,\"mode\":\"hard\"") != std::string::npos);
+    assert(!store.get("/a/1") && index.size() == 2);
+    assert(index.handle("PURGE", "/a/1", admin).first == 404);
+    assert(index.handle("GET", "/a/2", admin).first == 405);
+
+    //soft purges keep the object, exactly one request revalidates it, storing it again clears that
+    assert(index.handle("PURGE", "/a*", {{"soft-purge", "1"}, {"authorization", "Bearer secret"}}).first == 200);
+    assert(store.get("/a/2"));
+    assert(index.check("/a/2") == cache::freshness::REVALIDATE);
+    assert(index.check("/a/2") == cache::freshness::STALE);
+    assert(index.check("/b/1") == cache::freshness::FRESH);
+    index.track("/a/2", "all tag-a");
+    assert(index.check("/a/2") == cache::freshness::FRESH);
+
+    //by tag, including postings left behind by retracked objects
+    for(int i = 0; i < 10; ++i)
+      index.track("/b/1", "all tag-b");
+    assert(index.purge_tags("tag-b", cache::purge_mode::HARD) == 1 && !store.get("/b/1"));
+    assert(index.tag_count() == 2);
+    assert(index.purge_tags("all missing", cache::purge_mode::HARD) == 1 && store.size() == 0 && index.size() == 0);
+    //tags go with the last object carrying them
+    assert(index.tag_count() == 0);
+  }
+
+  //nothing configured, nobody purges
+  {
+    cache::object_cache store({{"max_bytes", "1048576"}, {"shards", "1"}});
+    cache::purge_index index(store, {});
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(index.handle("PURGE", "/a", {{"authorization", "Bearer "}}, reinterpret_cast<sockaddr*>(&local)).first == 403);
+  }
+
+  //tags of objects churning through the cache are reclaimed, ids of freed tags are reused
+  {
+    cache::object_cache store({{"max_bytes", "4096"}, {"shards", "1"}});
+    cache::purge_index index(store, {});
+    for(int i = 0; i < 10000; ++i) {
+      std::string key = "/churn/" + std::to_string(i);
+      store.put(make(key, 100));
+      index.track(key, "shared product-" + std::to_string(i) + " product-" + std::to_string(i));
+      if(i % 3 == 0)
+        index.track(key, "shared retagged-" + std::to_string(i));
+      if(i % 7 == 0)
+        index.purge_url(key, cache::purge_mode::HARD);
+    }
+    size_t left = index.size();
+    assert(left == store.size() && left > 0 && index.tag_count() <= 2 * left + 1);
+    assert(index.purge_tags("shared", cache::purge_mode::HARD) == left);
+    assert(index.size() == 0 && index.tag_count() == 0);
+    index.track("/again", "fresh");
+    assert(index.tag_count() == 1 && index.purge_tags("fresh", cache::purge_mode::HARD) == 1);
+  }
+
+  //objects the lru pushes out are forgotten by the index
+  {
+    cache::object_cache store({{"max_bytes", "4096"}, {"shards", "1"}});
+    cache::purge_index index(store, {});
+    for(int i = 0; i < 100; ++i) {
+      std::string key = "/k/" + std::to_string(i);
+      store.put(make(key, 100));
+      index.track(key, "t");
+    }
+    assert(index.size() == store.size() && store.size() < 100);
+  }
+
+  //an index going away while other threads evict into it: its destructor has to wait for
+  //forget() calls already running, asan reports the use after free otherwise
+  cache::object_cache store({{"max_bytes", "8192"}, {"shards", "4"}});
+  std::atomic<bool> done{false};
+  std::vector<std::thread> writers;
+  for(int t = 0; t < 4; ++t)
+    writers.emplace_back([&store, &done, t]() {
+      for(size_t i = 0; !done; ++i)
+        store.put(make(std::to_string(t) + "/" + std::to_string(i), 200));
+    });
+  for(int round = 0; round < 2000; ++round) {
+    auto index = std::make_unique<cache::purge_index>(store, cache::cache_config_t{});
+    index->track("0/" + std::to_string(round), "t");
+    index.reset();
+  }
+  //and a listener replaced under load never runs after on_evict returned, a slow one keeps
+  //the window wide open
+  for(int round = 0; round < 200; ++round) {
+    auto calls = std::make_unique<std::atomic<size_t> >(0);
+    auto* counter = calls.get();
+    store.on_evict([counter](const std::string&) {
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+      counter->fetch_add(1);
+    });
+    store.on_evict(nullptr);
+    calls.reset();
+  }
+  done = true;
+  for(auto& w : writers)
+    w.join();
+  std::cout << "purge ok" << std::endl;
+  return 0;
+}
+#endif
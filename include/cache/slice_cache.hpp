@@ -0,0 +1,407 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __SLICE_CACHE_HPP__
+#define __SLICE_CACHE_HPP__
+
+#include "cache/cache.hpp"
+#include "hashing/xxh64.hpp"
+
+#include <string>
+#include <vector>
+#include <future>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+
+namespace cache {
+    //what an upstream returned for a byte range request. when the upstream ignores the range
+    //and sends the whole object, offset is 0 and bytes holds everything
+    struct slice_response {
+        std::string bytes;
+        uint64_t offset;
+        uint64_t total;
+        //etag or last-modified, a change means every cached slice is stale
+        std::string validator;
+    };
+
+    //issues 'range: bytes=offset-(offset+length-1)' upstream for url
+    using slice_fetcher = std::function<slice_response(const std::string& url, uint64_t offset, uint64_t length)>;
+
+    //a client byte range resolved against the object size, last is inclusive
+    struct byte_range {
+        uint64_t first;
+        uint64_t last;
+        uint64_t total;
+    };
+
+    //the bytes answering a client range together with where they sit in the object
+    struct slice_result {
+        std::string bytes;
+        byte_range range;
+        bool partial;
+    };
+
+    //caches large upstream objects as fixed size slices, each its own object_cache entry, so a
+    //client asking for a few megabytes of a multi gigabyte file only ever pulls and stores the
+    //slices covering that range. slices of one object are stored under a generation derived
+    //from its validator, when the upstream object changes the old slices become unreachable
+    //and age out of the lru on their own
+    class slice_cache {
+    public:
+        slice_cache() = delete;
+        slice_cache(object_cache& store, const cache_config_t& config) :
+            store(store), slice_size(1ul << 20), ttl(std::chrono::seconds(3600)), max_objects(65536) {
+            size_t ttl_seconds = 3600;
+            parse(config, "slice_size", slice_size);
+            parse(config, "slice_ttl", ttl_seconds);
+            parse(config, "max_objects", max_objects);
+            if(slice_size < 4096)
+                throw std::runtime_error(std::to_string(slice_size) + " is not a valid slice_size, use at least 4096");
+            ttl = std::chrono::seconds(ttl_seconds);
+        }
+
+        //answers a client request for url, range_header is the raw value of its range header or empty
+        slice_result read(const std::string& url, const std::string& range_header, const slice_fetcher& fetch) {
+            auto meta = metadata(url);
+            for(size_t attempt = 0; attempt < 3; ++attempt) {
+                if(!meta.known) {
+                    //nothing known about the object yet, the first slice tells us its size and validator
+                    load(url, meta, {0}, fetch);
+                }
+                slice_result result{};
+                result.partial = !range_header.empty();
+                if(!resolve(range_header, meta.total, result.range))
+                    throw std::range_error("Requested range not satisfiable");
+                if(meta.total == 0)
+                    return result;
+
+                uint64_t first_slice = result.range.first / slice_size;
+                uint64_t last_slice = result.range.last / slice_size;
+                std::vector<uint64_t> indices;
+                for(uint64_t i = first_slice; i <= last_slice; ++i)
+                    indices.push_back(i);
+                auto slices = load(url, meta, indices, fetch);
+
+                //every slice names the generation it was stored under. one that is not ours means
+                //the object changed upstream while we (or a reader we waited on) fetched it, so
+                //start over against the new version instead of stitching two versions together
+                bool mixed = false;
+                for(size_t i = 0; i < indices.size() && !mixed; ++i)
+                    mixed = slices[i]->key != slice_key(url, meta.generation, indices[i]);
+                if(mixed) {
+                    meta = metadata(url);
+                    continue;
+                }
+
+                result.bytes.reserve(result.range.last - result.range.first + 1);
+                for(uint64_t i = first_slice; i <= last_slice; ++i) {
+                    const std::string& body = slices[i - first_slice]->body;
+                    uint64_t base = i * slice_size;
+                    uint64_t from = std::max(result.range.first, base) - base;
+                    uint64_t to = std::min(result.range.last + 1, base + body.size()) - base;
+                    if(from < to)
+                        result.bytes.append(body, from, to - from);
+                }
+                return result;
+            }
+            throw std::runtime_error(url + " kept changing upstream while its slices were read");
+        }
+
+        //parses a single 'bytes=' range against total, multi range requests fall back to the whole object
+        static bool resolve(const std::string& header, uint64_t total, byte_range& range) {
+            range = byte_range{0, total ? total - 1 : 0, total};
+            if(header.empty())
+                return true;
+            if(header.compare(0, 6, "bytes=") != 0 || header.find(',') != std::string::npos)
+                return true;
+            auto dash = header.find('-', 6);
+            if(dash == std::string::npos)
+                return true;
+            std::string start = header.substr(6, dash - 6), end = header.substr(dash + 1);
+            try {
+                if(start.empty()) {
+                    uint64_t suffix = std::stoull(end);
+                    if(suffix == 0 || total == 0)
+                        return false;
+                    range.first = suffix >= total ? 0 : total - suffix;
+                    return true;
+                }
+                range.first = std::stoull(start);
+                if(range.first >= total)
+                    return false;
+                if(!end.empty())
+                    range.last = std::min<uint64_t>(std::stoull(end), total - 1);
+                return range.last >= range.first;
+            }
+            catch(...) {
+                return true;
+            }
+        }
+
+        uint64_t get_slice_size() const {
+            return slice_size;
+        }
+
+    protected:
+        struct object_meta {
+            bool known = false;
+            uint64_t total = 0;
+            uint64_t generation = 0;
+        };
+
+        object_meta metadata(const std::string& url) {
+            std::lock_guard<std::mutex> guard(lock);
+            auto found = metas.find(url);
+            if(found == metas.end() || clock::now() >= found->second.expires)
+                return object_meta{};
+            return found->second.meta;
+        }
+
+        void remember(const std::string& url, const object_meta& meta) {
+            std::lock_guard<std::mutex> guard(lock);
+            if(metas.size() >= max_objects && metas.find(url) == metas.end()) {
+                //cheap bound, forgetting sizes only costs one extra first slice fetch
+                metas.erase(metas.begin());
+            }
+            metas[url] = meta_entry{meta, clock::now() + ttl};
+        }
+
+        std::string slice_key(const std::string& url, uint64_t generation, uint64_t index) const {
+            return url + "#slice:" + std::to_string(generation) + ":" + std::to_string(index);
+        }
+
+        //returns the requested slices in order, fetching the missing ones in contiguous runs.
+        //concurrent readers missing the same slice wait for a single fetch instead of stampeding
+        std::vector<std::shared_ptr<const object> > load(const std::string& url, object_meta& meta,
+                                                         const std::vector<uint64_t>& indices, const slice_fetcher& fetch) {
+            std::vector<std::shared_ptr<const object> > slices(indices.size());
+            std::vector<size_t> owned;
+            std::vector<std::string> owned_keys;
+            std::vector<std::pair<size_t, std::shared_future<std::shared_ptr<const object> > > > waiting;
+            std::vector<std::promise<std::shared_ptr<const object> > > promises;
+            auto now = clock::now();
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                for(size_t i = 0; i < indices.size(); ++i) {
+                    auto key = slice_key(url, meta.generation, indices[i]);
+                    if(meta.known) {
+                        auto cached = store.get(key);
+                        if(cached && cached->fresh(now)) {
+                            slices[i] = cached;
+                            continue;
+                        }
+                    }
+                    auto flight = inflight.find(key);
+                    if(flight != inflight.end()) {
+                        waiting.emplace_back(i, flight->second);
+                        continue;
+                    }
+                    promises.emplace_back();
+                    inflight.emplace(key, promises.back().get_future().share());
+                    owned.push_back(i);
+                    owned_keys.push_back(std::move(key));
+                }
+            }
+
+            //fetch our slices as few contiguous upstream ranges as possible
+            size_t promised = 0;
+            try {
+                for(size_t run = 0; run < owned.size();) {
+                    size_t end = run + 1;
+                    while(end < owned.size() && indices[owned[end]] == indices[owned[end - 1]] + 1)
+                        ++end;
+                    uint64_t first = indices[owned[run]];
+                    uint64_t count = indices[owned[end - 1]] - first + 1;
+                    auto response = fetch(url, first * slice_size, count * slice_size);
+                    uint64_t generation = hashing::xxh64::hash(response.validator.data(), response.validator.size(), response.total);
+                    if(!meta.known || meta.generation != generation || meta.total != response.total) {
+                        //first contact or the object changed upstream under us
+                        meta = object_meta{true, response.total, generation};
+                        remember(url, meta);
+                    }
+                    //the bytes may start before what we asked for (a whole object) but never after
+                    uint64_t start = first * slice_size;
+                    if(response.offset > start)
+                        throw std::runtime_error("Upstream answered the range at " + std::to_string(start) + " of " + url +
+                                                 " with bytes from " + std::to_string(response.offset));
+                    uint64_t skip = start - response.offset;
+                    for(size_t i = run; i < end; ++i) {
+                        uint64_t base = indices[owned[i]] * slice_size;
+                        uint64_t offset = skip + base - start;
+                        uint64_t expected = base < response.total ? std::min<uint64_t>(slice_size, response.total - base) : 0;
+                        if(offset + expected > response.bytes.size())
+                            throw std::runtime_error("Upstream sent a short range for " + url);
+                        auto slice = std::make_shared<object>();
+                        slice->key = slice_key(url, meta.generation, indices[owned[i]]);
+                        slice->body = response.bytes.substr(offset, expected);
+                        slice->expires = clock::now() + ttl;
+                        store.put(slice);
+                        slices[owned[i]] = slice;
+                        std::lock_guard<std::mutex> guard(lock);
+                        promises[promised++].set_value(slice);
+                        inflight.erase(owned_keys[i]);
+                    }
+                    run = end;
+                }
+            }
+            catch(...) {
+                auto failure = std::current_exception();
+                std::lock_guard<std::mutex> guard(lock);
+                for(size_t i = promised; i < promises.size(); ++i) {
+                    promises[i].set_exception(failure);
+                    inflight.erase(owned_keys[i]);
+                }
+                throw;
+            }
+
+            for(auto& wait : waiting)
+                slices[wait.first] = wait.second.get();
+            return slices;
+        }
+
+        struct meta_entry {
+            object_meta meta;
+            clock::time_point expires;
+        };
+        object_cache& store;
+        size_t slice_size;
+        std::chrono::seconds ttl;
+        size_t max_objects;
+        std::mutex lock;
+        std::unordered_map<std::string, meta_entry> metas;
+        std::unordered_map<std::string, std::shared_future<std::shared_ptr<const object> > > inflight;
+    };
+}
+
+#endif //__SLICE_CACHE_HPP__
+
+#ifdef TEST_SLICE_CACHE
+//g++ -std=c++17 -O2 -DTEST_SLICE_CACHE -Iinclude -x c++ include/cache/slice_cache.hpp -o slicetest -lpthread
+#include <cassert>
+#include <iostream>
+
+namespace {
+  //an upstream serving one object from memory, counting what it was asked for
+  struct fake_upstream {
+    std::string content;
+    std::string validator = "\"v1\"";
+    size_t fetches = 0;
+    bool ignore_range = false;
+    uint64_t misplace = 0;
+    size_t truncate = 0;
+    std::function<void()> after_fetch;
+    cache::slice_response operator()(const std::string&, uint64_t offset, uint64_t length) {
+      ++fetches;
+      cache::slice_response response{};
+      response.total = content.size();
+      response.validator = validator;
+      if(ignore_range) {
+        response.bytes = content;
+      }
+      else {
+        response.offset = offset + misplace;
+        if(response.offset < content.size())
+          response.bytes = content.substr(response.offset, length);
+        response.bytes.resize(response.bytes.size() - std::min(truncate, response.bytes.size()));
+      }
+      if(after_fetch)
+        after_fetch();
+      return response;
+    }
+  };
+  std::string pattern(size_t size, char seed) {
+    std::string s(size, 0);
+    for(size_t i = 0; i < size; ++i)
+      s[i] = static_cast<char>(seed + i % 61);
+    return s;
+  }
+}
+
+int main() {
+  cache::object_cache store({{"max_bytes", "16777216"}, {"shards", "1"}});
+  cache::slice_cache slices(store, {{"slice_size", "4096"}});
+  fake_upstream upstream;
+  upstream.content = pattern(10000, 'a');
+  cache::slice_fetcher fetch = std::ref(upstream);
+
+  //the first read learns the size from slice 0 then pulls slices 1 and 2 in one range
+  auto result = slices.read("/big", "bytes=4000-8200", fetch);
+  assert(result.partial && result.range.first == 4000 && result.range.last == 8200 && result.range.total == 10000);
+  assert(result.bytes == upstream.content.substr(4000, 4201));
+  assert(upstream.fetches == 2);
+  //now every slice is cached
+  result = slices.read("/big", "", fetch);
+  assert(!result.partial && result.bytes == upstream.content && upstream.fetches == 2);
+  result = slices.read("/big", "bytes=-10", fetch);
+  assert(result.bytes == upstream.content.substr(9990) && upstream.fetches == 2);
+  bool thrown = false;
+  try { slices.read("/big", "bytes=10000-", fetch); } catch(const std::range_error&) { thrown = true; }
+  assert(thrown);
+
+  //an upstream that ignores ranges and sends everything is cut into slices all the same
+  fake_upstream whole;
+  whole.content = pattern(9000, 'A');
+  whole.ignore_range = true;
+  result = slices.read("/whole", "bytes=5000-5009", std::ref(whole));
+  assert(result.bytes == whole.content.substr(5000, 10));
+
+  //bytes starting after the requested offset or short of the slice are refused, not cached
+  fake_upstream misplaced;
+  misplaced.content = pattern(10000, 'b');
+  misplaced.misplace = 100;
+  thrown = false;
+  try { slices.read("/misplaced", "", std::ref(misplaced)); } catch(const std::runtime_error&) { thrown = true; }
+  assert(thrown);
+  fake_upstream truncated;
+  truncated.content = pattern(10000, 'c');
+  truncated.truncate = 1;
+  thrown = false;
+  try { slices.read("/truncated", "", std::ref(truncated)); } catch(const std::runtime_error&) { thrown = true; }
+  assert(thrown);
+  truncated.truncate = 0;
+  assert(slices.read("/truncated", "", std::ref(truncated)).bytes == truncated.content);
+
+  //the object changes upstream between two slices of one read: slice 0 is cached from the
+  //first version, the fetch of slice 1 sees the second, the answer must be all second version
+  fake_upstream changing;
+  changing.content = pattern(8192, 'd');
+  assert(slices.read("/changing", "bytes=0-9", std::ref(changing)).bytes == changing.content.substr(0, 10));
+  std::string second = pattern(8192, 'e');
+  changing.content = second;
+  changing.validator = "\"v2\"";
+  result = slices.read("/changing", "", std::ref(changing));
+  assert(result.bytes == second);
+
+  //and the same when it changes between the two ranges fetched for one read, here slices
+  //1 and 3 are missing and fetched one after the other
+  fake_upstream flapping;
+  flapping.content = pattern(16384, 'f');
+  assert(slices.read("/flapping", "bytes=0-0", std::ref(flapping)).bytes == "f");
+  assert(slices.read("/flapping", "bytes=8192-8192", std::ref(flapping)).bytes == flapping.content.substr(8192, 1));
+  size_t calls = 0;
+  std::string third = pattern(16384, 'g');
+  flapping.after_fetch = [&]() {
+    if(++calls == 1) {
+      flapping.content = third;
+      flapping.validator = "\"v3\"";
+    }
+  };
+  result = slices.read("/flapping", "", std::ref(flapping));
+  assert(result.bytes == third && flapping.fetches == 5);
+
+  //an upstream that never holds still fails the read rather than looping
+  fake_upstream unstable;
+  unstable.content = pattern(8192, 'h');
+  size_t version = 0;
+  unstable.after_fetch = [&]() { unstable.validator = std::to_string(++version); };
+  assert(slices.read("/unstable", "bytes=0-0", std::ref(unstable)).bytes == "h");
+  thrown = false;
+  try { slices.read("/unstable", "", std::ref(unstable)); } catch(const std::runtime_error&) { thrown = true; }
+  assert(thrown);
+
+  std::cout << "slice cache ok" << std::endl;
+  return 0;
+}
+#endif
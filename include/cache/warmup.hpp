@@ -0,0 +1,469 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __WARMUP_HPP__
+#define __WARMUP_HPP__
+
+#include "cache/cache.hpp"
+#include "hashing/xxh64.hpp"
+#include "logging/logging.hpp"
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <list>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace cache {
+    //what a hot key names, warming differs for each
+    enum class hot_kind : uint8_t { OBJECT = 0, STATIC = 1 };
+
+    struct hot_key {
+        hot_kind kind;
+        std::string key;
+        uint64_t hits;
+    };
+
+    //keeps an approximate top k of the most requested keys with the space saving algorithm, a
+    //bounded table where a newcomer replaces the current minimum and inherits its count. the
+    //table is a stream summary: counters hang off a list of buckets of equal count in ascending
+    //order, so a hit moves a counter one bucket up and the minimum is the first bucket, both
+    //constant time whatever the capacity. only one hit in sample_rate is recorded so the
+    //request path mostly pays for a thread local counter. the list is persisted periodically
+    //so a restarted process knows what to warm
+    class hot_keys {
+    public:
+        hot_keys() = delete;
+        explicit hot_keys(const cache_config_t& config) :
+            capacity(4096), sample_rate(16), interval(std::chrono::seconds(60)), stopping(false) {
+            size_t seconds = 60;
+            parse(config, "hot_keys", capacity);
+            parse(config, "hot_sample_rate", sample_rate);
+            parse(config, "persist_interval", seconds);
+            if(capacity == 0 || sample_rate == 0)
+                throw std::runtime_error("hot_keys and hot_sample_rate must be positive");
+            interval = std::chrono::seconds(seconds);
+            auto file = config.find("hot_keys_file");
+            if(file != config.end()) {
+                file_name = file->second;
+                persister = std::thread([this]() { run(); });
+            }
+        }
+        ~hot_keys() {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+            }
+            wake.notify_all();
+            if(persister.joinable())
+                persister.join();
+            //one last snapshot so a clean restart warms from the freshest list, a destructor
+            //must not throw so a failure is only reported
+            if(!file_name.empty()) {
+                try {
+                    save(file_name);
+                }
+                catch(const std::exception& e) {
+                    logging::ERROR(e.what());
+                }
+            }
+        }
+
+        void hit(const std::string& key, hot_kind kind = hot_kind::OBJECT) {
+            thread_local uint64_t seen = 0;
+            if(++seen % sample_rate)
+                return;
+            std::lock_guard<std::mutex> guard(lock);
+            std::string slot_key(1, static_cast<char>(kind));
+            slot_key.append(key);
+            auto found = counts.find(slot_key);
+            if(found != counts.end()) {
+                increment(*found);
+                return;
+            }
+            if(counts.size() < capacity) {
+                if(buckets.empty() || buckets.front().count != 1)
+                    buckets.push_front(bucket{1, {}});
+                auto inserted = counts.emplace(std::move(slot_key), slot{buckets.begin(), {}}).first;
+                auto& keys = buckets.front().keys;
+                inserted->second.position = keys.insert(keys.end(), &inserted->first);
+                return;
+            }
+            //the newcomer takes over a counter of the minimum bucket and goes one up from there
+            auto minimum = buckets.begin();
+            auto position = minimum->keys.begin();
+            counts.erase(**position);
+            auto inserted = counts.emplace(std::move(slot_key), slot{minimum, position}).first;
+            *position = &inserted->first;
+            increment(*inserted);
+        }
+
+        //hottest first
+        std::vector<hot_key> top() {
+            std::vector<hot_key> keys;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                keys.reserve(counts.size());
+                for(auto b = buckets.rbegin(); b != buckets.rend(); ++b)
+                    for(const std::string* k : b->keys)
+                        keys.push_back(hot_key{static_cast<hot_kind>((*k)[0]), k->substr(1), b->count});
+            }
+            return keys;
+        }
+
+        //writes 'CHWK' then per key a kind byte, a varint length and the bytes, then an xxh64 of all
+        //of that. written to a temporary and renamed over the old list so readers never see half a file
+        void save(const std::string& path) {
+            std::string out("CHWK");
+            for(const auto& k : top()) {
+                out.push_back(static_cast<char>(k.kind));
+                for(uint64_t length = k.key.size();; length >>= 7) {
+                    if(length < 0x80) {
+                        out.push_back(static_cast<char>(length));
+                        break;
+                    }
+                    out.push_back(static_cast<char>((length & 0x7f) | 0x80));
+                }
+                out.append(k.key);
+            }
+            uint64_t digest = hashing::xxh64::hash(out.data(), out.size());
+            out.append(reinterpret_cast<const char*>(&digest), sizeof(digest));
+            std::string temporary = path + ".tmp";
+            {
+                std::ofstream file(temporary, std::ofstream::binary | std::ofstream::trunc);
+                file.write(out.data(), static_cast<std::streamsize>(out.size()));
+                if(!file)
+                    throw std::runtime_error("Couldn't write hot key list " + temporary);
+            }
+            if(rename(temporary.c_str(), path.c_str()) != 0)
+                throw std::runtime_error("Couldn't replace hot key list " + path);
+        }
+
+        //reads a list written by save, a missing, truncated or corrupt file yields no keys
+        static std::vector<hot_key> load(const std::string& path) {
+            std::ifstream file(path, std::ifstream::binary);
+            std::string in((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            std::vector<hot_key> keys;
+            if(in.size() < 4 + sizeof(uint64_t) || in.compare(0, 4, "CHWK") != 0)
+                return keys;
+            size_t end = in.size() - sizeof(uint64_t);
+            uint64_t digest;
+            memcpy(&digest, in.data() + end, sizeof(digest));
+            if(digest != hashing::xxh64::hash(in.data(), end))
+                return keys;
+            for(size_t pos = 4; pos < end;) {
+                auto kind = static_cast<hot_kind>(in[pos++]);
+                uint64_t length = 0;
+                for(int shift = 0; pos < end; shift += 7) {
+                    auto byte = static_cast<uint8_t>(in[pos++]);
+                    length |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                    if(!(byte & 0x80))
+                        break;
+                }
+                if(length > end - pos)
+                    return {};
+                keys.push_back(hot_key{kind, in.substr(pos, length), 0});
+                pos += length;
+            }
+            return keys;
+        }
+
+    protected:
+        struct bucket {
+            uint64_t count;
+            //the keys live in counts, whose nodes never move
+            std::list<const std::string*> keys;
+        };
+        using buckets_t = std::list<bucket>;
+        struct slot {
+            buckets_t::iterator owner;
+            std::list<const std::string*>::iterator position;
+        };
+        using counts_t = std::unordered_map<std::string, slot>;
+
+        //moves a counter into the bucket one above its own, creating that bucket if need be
+        void increment(counts_t::value_type& counter) {
+            auto current = counter.second.owner;
+            auto next = std::next(current);
+            if(next == buckets.end() || next->count != current->count + 1)
+                next = buckets.insert(next, bucket{current->count + 1, {}});
+            next->keys.splice(next->keys.end(), current->keys, counter.second.position);
+            counter.second.owner = next;
+            if(current->keys.empty())
+                buckets.erase(current);
+        }
+
+        void run() {
+            std::unique_lock<std::mutex> guard(lock);
+            while(!wake.wait_for(guard, interval, [this]() { return stopping; })) {
+                guard.unlock();
+                try {
+                    save(file_name);
+                }
+                catch(...) {
+                    //a full disk must not take the server down, the next interval tries again
+                }
+                guard.lock();
+            }
+        }
+
+        size_t capacity;
+        size_t sample_rate;
+        std::chrono::seconds interval;
+        std::string file_name;
+        bool stopping;
+        std::mutex lock;
+        std::condition_variable wake;
+        buckets_t buckets;
+        counts_t counts;
+        std::thread persister;
+    };
+
+    //a token bucket shared by all warming threads, refilled continuously at rate per second
+    class rate_limiter {
+    public:
+        explicit rate_limiter(double rate) : rate(rate), tokens(rate), last(clock::now()) {}
+        //blocks until cost tokens were available or stop became true, returns false if stopped
+        bool acquire(double cost, const std::atomic<bool>& stop) {
+            if(rate <= 0)
+                return !stop;
+            std::unique_lock<std::mutex> guard(lock);
+            while(!stop) {
+                auto now = clock::now();
+                tokens = std::min(rate, tokens + rate * std::chrono::duration<double>(now - last).count());
+                last = now;
+                //a request bigger than the bucket goes through once the bucket is full
+                if(tokens >= std::min(cost, rate)) {
+                    tokens -= cost;
+                    return true;
+                }
+                auto wait = std::chrono::duration<double>((std::min(cost, rate) - tokens) / rate);
+                guard.unlock();
+                std::this_thread::sleep_for(std::min<std::chrono::duration<double> >(wait, std::chrono::milliseconds(100)));
+                guard.lock();
+            }
+            return false;
+        }
+    protected:
+        double rate;
+        double tokens;
+        clock::time_point last;
+        std::mutex lock;
+    };
+
+    //brings a restarted process back to a useful hit ratio. object keys are refetched through
+    //the supplied warm function (which stores them in the cache however the caller likes) and
+    //static paths are pulled into the page cache with readahead. several threads work through
+    //the list hottest first, throttled by key and byte rates so live traffic keeps priority
+    using warm_function = std::function<bool(const std::string& key)>;
+    class warmer {
+    public:
+        warmer() = delete;
+        warmer(const cache_config_t& config, warm_function warm_object) :
+            warm_object(std::move(warm_object)), threads(2), keys_rate(200), bytes_rate(64ul << 20),
+            next(0), warmed(0), done(0), stopping(false) {
+            parse(config, "warm_threads", threads);
+            parse(config, "warm_keys_rate", keys_rate);
+            parse(config, "warm_bytes_rate", bytes_rate);
+            if(threads == 0)
+                throw std::runtime_error("warm_threads must be positive");
+        }
+        ~warmer() {
+            stop();
+        }
+
+        //starts warming in the background, returns immediately
+        void start(std::vector<hot_key> list) {
+            keys = std::move(list);
+            key_bucket.reset(new rate_limiter(static_cast<double>(keys_rate)));
+            byte_bucket.reset(new rate_limiter(static_cast<double>(bytes_rate)));
+            for(size_t i = 0; i < std::min(threads, keys.size()); ++i)
+                workers.emplace_back([this]() { work(); });
+            if(workers.empty())
+                finished.notify_all();
+        }
+
+        //waits up to timeout for warming to finish, true if it did. call before accepting
+        //traffic to warm first, or not at all to warm alongside it
+        bool wait(std::chrono::milliseconds timeout) {
+            std::unique_lock<std::mutex> guard(lock);
+            return finished.wait_for(guard, timeout, [this]() { return done == workers.size(); });
+        }
+
+        void stop() {
+            stopping = true;
+            for(auto& worker : workers)
+                if(worker.joinable())
+                    worker.join();
+        }
+
+        size_t warmed_keys() const {
+            return warmed;
+        }
+
+    protected:
+        void work() {
+            while(!stopping) {
+                size_t i = next++;
+                if(i >= keys.size())
+                    break;
+                if(!key_bucket->acquire(1, stopping))
+                    break;
+                const auto& k = keys[i];
+                bool ok = false;
+                try {
+                    ok = k.kind == hot_kind::STATIC ? readahead_file(k.key) : (warm_object && warm_object(k.key));
+                }
+                catch(...) {
+                }
+                if(ok)
+                    ++warmed;
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            ++done;
+            finished.notify_all();
+        }
+
+        //pages the file in chunk by chunk so the byte rate applies to what we actually read
+        bool readahead_file(const std::string& path) {
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if(fd < 0)
+                return false;
+            struct stat st{};
+            if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+                close(fd);
+                return false;
+            }
+            const off_t chunk = 4 << 20;
+            for(off_t offset = 0; offset < st.st_size && !stopping; offset += chunk) {
+                off_t length = std::min(chunk, st.st_size - offset);
+                if(!byte_bucket->acquire(static_cast<double>(length), stopping))
+                    break;
+                posix_fadvise(fd, offset, length, POSIX_FADV_WILLNEED);
+            }
+            close(fd);
+            return true;
+        }
+
+        warm_function warm_object;
+        size_t threads;
+        size_t keys_rate;
+        size_t bytes_rate;
+        std::vector<hot_key> keys;
+        std::unique_ptr<rate_limiter> key_bucket;
+        std::unique_ptr<rate_limiter> byte_bucket;
+        std::atomic<size_t> next;
+        std::atomic<size_t> warmed;
+        size_t done;
+        std::atomic<bool> stopping;
+        std::mutex lock;
+        std::condition_variable finished;
+        std::vector<std::thread> workers;
+    };
+}
+
+#endif //__WARMUP_HPP__
+
+#ifdef TEST_WARMUP
+//g++ -std=c++17 -O2 -DTEST_WARMUP -Iinclude -x c++ include/cache/warmup.hpp -o warmuptest -lpthread
+#include <cassert>
+#include <chrono>
+#include <iostream>
+
+int main() {
+  //exact counts while everything fits, hottest first
+  {
+    cache::hot_keys keys({{"hot_keys", "3"}, {"hot_sample_rate", "1"}});
+    for(int i = 0; i < 5; ++i) keys.hit("/a");
+    for(int i = 0; i < 3; ++i) keys.hit("/b");
+    keys.hit("/c", cache::hot_kind::STATIC);
+    auto top = keys.top();
+    assert(top.size() == 3);
+    assert(top[0].key == "/a" && top[0].hits == 5 && top[1].key == "/b" && top[1].hits == 3);
+    assert(top[2].key == "/c" && top[2].hits == 1 && top[2].kind == cache::hot_kind::STATIC);
+    //a newcomer replaces the minimum and inherits its count plus one
+    keys.hit("/d");
+    top = keys.top();
+    assert(top.size() == 3 && top[2].key == "/d" && top[2].hits == 2);
+    //the same path as another kind is another key
+    keys.hit("/a", cache::hot_kind::STATIC);
+    top = keys.top();
+    assert(top.size() == 3 && top[2].kind == cache::hot_kind::STATIC && top[2].key == "/a" && top[2].hits == 3);
+  }
+
+  //a skewed stream keeps its heavy hitters, and a hit costs the same at any capacity
+  for(const char* capacity : {"64", "65536"}) {
+    cache::hot_keys keys({{"hot_keys", capacity}, {"hot_sample_rate", "1"}});
+    uint64_t state = 1;
+    const int n = 2000000;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < n; ++i) {
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      uint64_t r = state >> 33;
+      keys.hit(r % 4 ? "/hot/" + std::to_string((r >> 2) % 8) : "/cold/" + std::to_string((r >> 2) % 1000000));
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto top = keys.top();
+    for(size_t i = 0; i < 8; ++i)
+      assert(top[i].key.compare(0, 5, "/hot/") == 0);
+    for(size_t i = 1; i < top.size(); ++i)
+      assert(top[i - 1].hits >= top[i].hits);
+    std::cout << "capacity " << capacity << ": " << seconds * 1e9 / n << " ns per hit" << std::endl;
+  }
+
+  //round trip through the file, corrupt files yield nothing
+  char dir[] = "/tmp/warmupXXXXXX";
+  assert(mkdtemp(dir));
+  std::string path = std::string(dir) + "/hot";
+  {
+    cache::hot_keys keys({{"hot_sample_rate", "1"}, {"hot_keys_file", path}, {"persist_interval", "3600"}});
+    keys.hit("/x");
+    keys.hit("/x");
+    keys.hit(std::string(300, 'y'), cache::hot_kind::STATIC);
+  }
+  auto loaded = cache::hot_keys::load(path);
+  assert(loaded.size() == 2 && loaded[0].key == "/x" && loaded[1].key == std::string(300, 'y'));
+  assert(loaded[1].kind == cache::hot_kind::STATIC);
+  {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(6);
+    file.put('!');
+  }
+  assert(cache::hot_keys::load(path).empty());
+  assert(cache::hot_keys::load(path + ".missing").empty());
+
+  //the last snapshot failing is logged, not thrown out of the destructor
+  {
+    cache::hot_keys keys({{"hot_keys_file", std::string(dir) + "/no/such/dir/hot"}, {"persist_interval", "3600"}});
+  }
+
+  //warming goes through the list with the function for objects and readahead for files
+  std::vector<cache::hot_key> list{{cache::hot_kind::OBJECT, "/one", 0}, {cache::hot_kind::OBJECT, "/two", 0},
+                                   {cache::hot_kind::STATIC, path, 0}, {cache::hot_kind::STATIC, path + ".missing", 0}};
+  std::mutex seen_lock;
+  std::vector<std::string> seen;
+  cache::warmer warmer({{"warm_threads", "2"}, {"warm_keys_rate", "0"}}, [&](const std::string& key) {
+    std::lock_guard<std::mutex> guard(seen_lock);
+    seen.push_back(key);
+    return key == "/one";
+  });
+  warmer.start(list);
+  assert(warmer.wait(std::chrono::milliseconds(5000)));
+  assert(seen.size() == 2 && warmer.warmed_keys() == 2);
+
+  unlink(path.c_str());
+  rmdir(dir);
+  std::cout << "warmup ok" << std::endl;
+  return 0;
+}
+#endif
@@ -0,0 +1,75 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __GZIP_HPP__
+#define __GZIP_HPP__
+
+#include <string>
+#include <stdexcept>
+#include <cstdlib>
+#include <zlib.h>
+
+namespace compression {
+    //gzip (not raw deflate) so the body can go out as-is with content-encoding: gzip
+    inline std::string gzip(const std::string& input, int level = Z_BEST_COMPRESSION) {
+        z_stream stream{};
+        if(deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+            throw std::runtime_error("Couldn't initialize gzip stream");
+        std::string out;
+        out.resize(deflateBound(&stream, input.size()));
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+        stream.avail_in = static_cast<uInt>(input.size());
+        stream.next_out = reinterpret_cast<Bytef*>(&out.front());
+        stream.avail_out = static_cast<uInt>(out.size());
+        int result = deflate(&stream, Z_FINISH);
+        deflateEnd(&stream);
+        if(result != Z_STREAM_END)
+            throw std::runtime_error("Couldn't gzip body");
+        out.resize(stream.total_out);
+        return out;
+    }
+
+    //the inverse, for tests and for clients of ours that get gzip back
+    inline std::string gunzip(const std::string& input) {
+        z_stream stream{};
+        if(inflateInit2(&stream, 15 + 16) != Z_OK)
+            throw std::runtime_error("Couldn't initialize gunzip stream");
+        std::string out;
+        char buffer[16384];
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+        stream.avail_in = static_cast<uInt>(input.size());
+        int result;
+        do {
+            stream.next_out = reinterpret_cast<Bytef*>(buffer);
+            stream.avail_out = sizeof(buffer);
+            result = inflate(&stream, Z_NO_FLUSH);
+            if(result != Z_OK && result != Z_STREAM_END) {
+                inflateEnd(&stream);
+                throw std::runtime_error("Couldn't gunzip body");
+            }
+            out.append(buffer, sizeof(buffer) - stream.avail_out);
+        } while(result != Z_STREAM_END && (stream.avail_in || !stream.avail_out));
+        inflateEnd(&stream);
+        if(result != Z_STREAM_END)
+            throw std::runtime_error("Couldn't gunzip truncated body");
+        return out;
+    }
+
+    //true if an accept-encoding header value allows gzip
+    inline bool accepts_gzip(const std::string& accept_encoding) {
+        size_t pos = 0;
+        while((pos = accept_encoding.find("gzip", pos)) != std::string::npos) {
+            pos += 4;
+            size_t end = accept_encoding.find(',', pos);
+            std::string params = accept_encoding.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+            //an explicit q=0 means the client refuses it
+            auto q = params.find("q=");
+            if(q == std::string::npos || std::strtod(params.c_str() + q + 2, nullptr) > 0)
+                return true;
+        }
+        return false;
+    }
+}
+
+#endif //__GZIP_HPP__
@@ -0,0 +1,919 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __RESOLVER_HPP__
+#define __RESOLVER_HPP__
+
+#include "event/loop.hpp"
+
+#include <string>
+#include <vector>
+#include <array>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <algorithm>
+#include <unordered_map>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/random.h>
+
+namespace dns {
+    using clock = std::chrono::steady_clock;
+    using resolver_config_t = std::unordered_map<std::string, std::string>;
+
+    //an ip address without a port, ready to be dropped into a sockaddr
+    struct address {
+        int family;
+        uint8_t bytes[16];
+        //fills storage with this address and port, returns the sockaddr length
+        socklen_t to_sockaddr(uint16_t port, sockaddr_storage& storage) const {
+            memset(&storage, 0, sizeof(storage));
+            if(family == AF_INET) {
+                auto* in = reinterpret_cast<sockaddr_in*>(&storage);
+                in->sin_family = AF_INET;
+                in->sin_port = htons(port);
+                memcpy(&in->sin_addr, bytes, 4);
+                return sizeof(sockaddr_in);
+            }
+            auto* in6 = reinterpret_cast<sockaddr_in6*>(&storage);
+            in6->sin6_family = AF_INET6;
+            in6->sin6_port = htons(port);
+            memcpy(&in6->sin6_addr, bytes, 16);
+            return sizeof(sockaddr_in6);
+        }
+        std::string str() const {
+            char buffer[INET6_ADDRSTRLEN];
+            inet_ntop(family, bytes, buffer, sizeof(buffer));
+            return buffer;
+        }
+    };
+
+    //parses a literal v4 or v6 address
+    inline bool parse_address(const std::string& text, address& out) {
+        memset(&out, 0, sizeof(out));
+        if(inet_pton(AF_INET, text.c_str(), out.bytes) == 1) {
+            out.family = AF_INET;
+            return true;
+        }
+        if(inet_pton(AF_INET6, text.c_str(), out.bytes) == 1) {
+            out.family = AF_INET6;
+            return true;
+        }
+        return false;
+    }
+
+    inline std::string lower(std::string name) {
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+        if(!name.empty() && name.back() == '.')
+            name.pop_back();
+        return name;
+    }
+
+    //builds a recursive query for one name and record type
+    inline std::string build_query(uint16_t id, const std::string& name, uint16_t type) {
+        std::string packet;
+        packet.reserve(name.size() + 18);
+        uint8_t header[12] = {static_cast<uint8_t>(id >> 8), static_cast<uint8_t>(id), 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0};
+        packet.append(reinterpret_cast<char*>(header), sizeof(header));
+        size_t pos = 0;
+        while(pos < name.size()) {
+            size_t dot = name.find('.', pos);
+            if(dot == std::string::npos)
+                dot = name.size();
+            if(dot - pos == 0 || dot - pos > 63)
+                throw std::runtime_error("Invalid dns name " + name);
+            packet.push_back(static_cast<char>(dot - pos));
+            packet.append(name, pos, dot - pos);
+            pos = dot + 1;
+        }
+        packet.push_back('\0');
+        uint8_t tail[4] = {static_cast<uint8_t>(type >> 8), static_cast<uint8_t>(type), 0, 1};
+        packet.append(reinterpret_cast<char*>(tail), sizeof(tail));
+        return packet;
+    }
+
+    //what came back for one query
+    struct answer {
+        uint16_t id = 0;
+        int rcode = 0;
+        bool truncated = false;
+        //the echoed question, which has to be the one that was asked
+        std::string question;
+        uint16_t qtype = 0;
+        uint16_t qclass = 0;
+        std::vector<address> addresses;
+        uint32_t ttl = 0;
+    };
+
+    //skips a possibly compressed name, returns false if it runs off the packet
+    inline bool skip_name(const uint8_t* packet, size_t size, size_t& pos) {
+        while(pos < size) {
+            uint8_t length = packet[pos];
+            if((length & 0xc0) == 0xc0) {
+                pos += 2;
+                return pos <= size;
+            }
+            ++pos;
+            if(length == 0)
+                return true;
+            pos += length;
+        }
+        return false;
+    }
+
+    //reads a possibly compressed name lower cased and dot separated, pos ends up past the name.
+    //false on names that run off the packet, grow past 255 bytes or point around in circles
+    inline bool read_name(const uint8_t* packet, size_t size, size_t& pos, std::string& out) {
+        out.clear();
+        size_t at = pos;
+        bool jumped = false;
+        for(int hops = 0; hops < 64;) {
+            if(at >= size)
+                return false;
+            uint8_t length = packet[at];
+            if((length & 0xc0) == 0xc0) {
+                if(at + 1 >= size)
+                    return false;
+                if(!jumped)
+                    pos = at + 2;
+                jumped = true;
+                at = static_cast<size_t>((length & 0x3f) << 8 | packet[at + 1]);
+                ++hops;
+                continue;
+            }
+            if(length & 0xc0)
+                return false;
+            ++at;
+            if(length == 0) {
+                if(!jumped)
+                    pos = at;
+                return true;
+            }
+            if(at + length > size || out.size() + length + 1 > 255)
+                return false;
+            if(!out.empty())
+                out.push_back('.');
+            for(size_t i = 0; i < length; ++i)
+                out.push_back(static_cast<char>(tolower(packet[at + i])));
+            at += length;
+        }
+        return false;
+    }
+
+    //parses a response to a single question, collecting the records of the asked type and the
+    //smallest ttl among them
+    inline bool parse_answer(const uint8_t* packet, size_t size, answer& out) {
+        if(size < 12)
+            return false;
+        out.id = static_cast<uint16_t>(packet[0] << 8 | packet[1]);
+        if(!(packet[2] & 0x80))
+            return false;
+        out.truncated = packet[2] & 0x02;
+        out.rcode = packet[3] & 0x0f;
+        size_t questions = packet[4] << 8 | packet[5], answers = packet[6] << 8 | packet[7];
+        if(questions != 1)
+            return false;
+        size_t pos = 12;
+        if(!read_name(packet, size, pos, out.question) || pos + 4 > size)
+            return false;
+        out.qtype = static_cast<uint16_t>(packet[pos] << 8 | packet[pos + 1]);
+        out.qclass = static_cast<uint16_t>(packet[pos + 2] << 8 | packet[pos + 3]);
+        pos += 4;
+        out.ttl = UINT32_MAX;
+        for(size_t i = 0; i < answers; ++i) {
+            if(!skip_name(packet, size, pos) || pos + 10 > size)
+                return false;
+            uint16_t type = static_cast<uint16_t>(packet[pos] << 8 | packet[pos + 1]);
+            uint32_t ttl = static_cast<uint32_t>(packet[pos + 4]) << 24 | packet[pos + 5] << 16 | packet[pos + 6] << 8 | packet[pos + 7];
+            uint16_t length = static_cast<uint16_t>(packet[pos + 8] << 8 | packet[pos + 9]);
+            pos += 10;
+            if(pos + length > size)
+                return false;
+            //cname chains come with their targets' records in the same answer section
+            if(type == out.qtype && ((type == 1 && length == 4) || (type == 28 && length == 16))) {
+                address a{};
+                a.family = type == 1 ? AF_INET : AF_INET6;
+                memcpy(a.bytes, packet + pos, length);
+                out.addresses.push_back(a);
+                out.ttl = std::min(out.ttl, ttl);
+            }
+            pos += length;
+        }
+        if(out.addresses.empty())
+            out.ttl = 0;
+        return true;
+    }
+
+    //called on the loop thread with the addresses, empty on failure
+    using callback = std::function<void(const std::vector<address>&, const std::string& error)>;
+
+    //a non blocking stub resolver living on an event loop. queries go out over udp to the
+    //nameservers from resolv.conf, /etc/hosts is consulted first and answers are cached for
+    //their ttl. a cached name used in the last tenth of its ttl is refreshed in the background
+    //so a busy upstream never waits on dns. failures are cached for dns_negative_ttl so a dead
+    //nameserver costs one timeout per name rather than one per request. cached() can be read
+    //from any thread.
+    //every query gets a fresh socket, so a kernel chosen source port, and an id from the kernel
+    //csprng, answers have to echo the question asked and truncated ones are retried over tcp
+    class resolver {
+    public:
+        resolver() = delete;
+        resolver(event::loop& events, const resolver_config_t& config) :
+            events(events), timeout(std::chrono::milliseconds(2000)), attempts(2), min_ttl(1), max_ttl(3600),
+            negative_ttl(5), entropy_used(0) {
+            auto parse = [&config](const char* key, size_t& value) {
+                auto found = config.find(key);
+                if(found == config.end())
+                    return;
+                try {
+                    value = std::stoul(found->second);
+                }
+                catch(...) {
+                    throw std::runtime_error(found->second + " is not a valid " + key);
+                }
+            };
+            size_t timeout_ms = 2000;
+            parse("dns_timeout_ms", timeout_ms);
+            parse("dns_attempts", attempts);
+            parse("dns_min_ttl", min_ttl);
+            parse("dns_max_ttl", max_ttl);
+            parse("dns_negative_ttl", negative_ttl);
+            timeout = std::chrono::milliseconds(timeout_ms);
+            entropy_used = entropy.size();
+            auto hosts_file = config.find("hosts");
+            load_hosts(hosts_file == config.end() ? "/etc/hosts" : hosts_file->second);
+            auto nameserver = config.find("nameserver");
+            if(nameserver != config.end())
+                add_nameserver(nameserver->second);
+            else {
+                auto resolv_conf = config.find("resolv_conf");
+                load_resolv_conf(resolv_conf == config.end() ? "/etc/resolv.conf" : resolv_conf->second);
+            }
+            if(servers.empty())
+                add_nameserver("127.0.0.1");
+        }
+        ~resolver() {
+            //the retry timers call back into this resolver
+            for(auto& l : lookups)
+                events.cancel(l.second.timer);
+            for(auto& q : queries) {
+                events.remove(q.first);
+                close(q.first);
+            }
+        }
+
+        //must be called on the loop thread, done may run before resolve returns
+        void resolve(const std::string& host, callback done) {
+            std::string name = lower(host);
+            address literal{};
+            if(parse_address(name, literal))
+                return done({literal}, "");
+            auto listed = hosts.find(name);
+            if(listed != hosts.end())
+                return done(listed->second, "");
+            auto now = clock::now();
+            bool hit = false, refresh = false;
+            std::vector<address> addresses;
+            std::string error;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                auto found = cache.find(name);
+                if(found != cache.end() && now < found->second.expires) {
+                    hit = true;
+                    addresses = found->second.addresses;
+                    error = found->second.error;
+                    refresh = now >= found->second.prefetch && !addresses.empty();
+                }
+            }
+            if(!hit)
+                return start(name, std::move(done));
+            if(refresh)
+                start(name, nullptr);
+            if(addresses.empty())
+                return done(addresses, error.empty() ? "Name " + name + " does not resolve" : error);
+            done(addresses, "");
+        }
+
+        //cached addresses for host or nothing, never blocks and is safe from any thread. a hit in
+        //the prefetch window schedules a refresh on the loop
+        std::vector<address> cached(const std::string& host) {
+            std::string name = lower(host);
+            address literal{};
+            if(parse_address(name, literal))
+                return {literal};
+            auto listed = hosts.find(name);
+            if(listed != hosts.end())
+                return listed->second;
+            auto now = clock::now();
+            std::lock_guard<std::mutex> guard(lock);
+            auto found = cache.find(name);
+            if(found == cache.end() || now >= found->second.expires) {
+                events.post([this, name]() { resolve(name, [](const std::vector<address>&, const std::string&) {}); });
+                return {};
+            }
+            if(now >= found->second.prefetch && !found->second.prefetching) {
+                found->second.prefetching = true;
+                events.post([this, name]() { resolve(name, [](const std::vector<address>&, const std::string&) {}); });
+            }
+            return found->second.addresses;
+        }
+
+        size_t nameservers() const {
+            return servers.size();
+        }
+
+        //adapts cached() to the socket address lookups upstream pools take
+        std::function<std::vector<sockaddr_storage>(const std::string&, uint16_t)> lookup() {
+            return [this](const std::string& host, uint16_t port) {
+                std::vector<sockaddr_storage> out;
+                for(const auto& a : cached(host)) {
+                    out.emplace_back();
+                    a.to_sockaddr(port, out.back());
+                }
+                return out;
+            };
+        }
+
+    protected:
+        struct server {
+            sockaddr_storage address;
+            socklen_t length;
+        };
+        struct cached_name {
+            std::vector<address> addresses;
+            //why a name has no addresses, empty for a plain nxdomain
+            std::string error;
+            clock::time_point expires;
+            clock::time_point prefetch;
+            bool prefetching;
+        };
+        //one question in flight on its own socket, udp first and tcp after a truncated answer
+        struct query {
+            std::string name;
+            uint16_t id;
+            uint16_t type;
+            //tcp only, the length prefixed question still to write and the answer read so far
+            std::string out;
+            std::string in;
+        };
+        //one in flight resolution of a name, an a and an aaaa query on the same server
+        struct pending_lookup {
+            std::vector<callback> waiters;
+            int fds[2];
+            int pending;
+            size_t server;
+            size_t attempt;
+            std::vector<address> addresses;
+            uint32_t ttl;
+            int rcode;
+            event::timer_id timer;
+        };
+
+        void load_hosts(const std::string& path) {
+            std::ifstream file(path);
+            std::string line;
+            while(std::getline(file, line)) {
+                line = line.substr(0, line.find('#'));
+                std::istringstream fields(line);
+                std::string ip, name;
+                address a{};
+                if(!(fields >> ip) || !parse_address(ip, a))
+                    continue;
+                while(fields >> name)
+                    hosts[lower(name)].push_back(a);
+            }
+        }
+
+        void load_resolv_conf(const std::string& path) {
+            std::ifstream file(path);
+            std::string line;
+            while(std::getline(file, line)) {
+                std::istringstream fields(line);
+                std::string keyword, value;
+                if(!(fields >> keyword >> value))
+                    continue;
+                if(keyword == "nameserver" && servers.size() < 3)
+                    add_nameserver(value);
+                else if(keyword == "options") {
+                    do {
+                        if(value.compare(0, 8, "timeout:") == 0)
+                            timeout = std::chrono::seconds(std::max(1, atoi(value.c_str() + 8)));
+                        else if(value.compare(0, 9, "attempts:") == 0)
+                            attempts = static_cast<size_t>(std::max(1, atoi(value.c_str() + 9)));
+                    } while(fields >> value);
+                }
+            }
+        }
+
+        //'ip' or 'ip:port', v6 addresses with a port need brackets
+        void add_nameserver(const std::string& spec) {
+            std::string host = spec;
+            uint16_t port = 53;
+            auto colon = spec.rfind(':');
+            if(colon != std::string::npos && (spec.front() == '[' || spec.find(':') == colon)) {
+                host = spec.substr(0, colon);
+                port = static_cast<uint16_t>(std::stoul(spec.substr(colon + 1)));
+                if(host.size() > 2 && host.front() == '[')
+                    host = host.substr(1, host.size() - 2);
+            }
+            address a{};
+            if(!parse_address(host, a))
+                throw std::runtime_error(spec + " is not a valid nameserver");
+            server s{};
+            s.length = a.to_sockaddr(port, s.address);
+            servers.push_back(s);
+        }
+
+        //query ids come from the kernel csprng in batches, a predictable sequence lets an off
+        //path attacker race the real answer
+        uint16_t next_id() {
+            if(entropy_used == entropy.size()) {
+                auto* bytes = reinterpret_cast<char*>(entropy.data());
+                size_t filled = 0;
+                while(filled < sizeof(entropy)) {
+                    ssize_t n = getrandom(bytes + filled, sizeof(entropy) - filled, 0);
+                    if(n < 0 && errno == EINTR)
+                        continue;
+                    if(n <= 0)
+                        throw std::runtime_error(std::string("Couldn't get random query ids: ") + strerror(errno));
+                    filled += static_cast<size_t>(n);
+                }
+                entropy_used = 0;
+            }
+            return entropy[entropy_used++];
+        }
+
+        //a non blocking socket connected to the lookup's server, -1 if there is none to be had.
+        //connected udp sockets only ever see datagrams from that server
+        int open_socket(const pending_lookup& l, int type) {
+            const auto& s = servers[l.server];
+            int fd = socket(s.address.ss_family, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if(fd < 0)
+                return -1;
+            if(connect(fd, reinterpret_cast<const sockaddr*>(&s.address), s.length) != 0 && errno != EINPROGRESS) {
+                close(fd);
+                return -1;
+            }
+            return fd;
+        }
+
+        void start(const std::string& name, callback done) {
+            auto found = lookups.find(name);
+            if(found != lookups.end()) {
+                if(done)
+                    found->second.waiters.push_back(std::move(done));
+                return;
+            }
+            auto& l = lookups[name];
+            if(done)
+                l.waiters.push_back(std::move(done));
+            l.server = 0;
+            l.attempt = 0;
+            send(name, l);
+        }
+
+        //a socket that cannot be opened counts as a lost datagram and the timer moves on
+        void send(const std::string& name, pending_lookup& l) {
+            l.pending = 2;
+            l.addresses.clear();
+            l.ttl = UINT32_MAX;
+            l.rcode = 0;
+            for(int i = 0; i < 2; ++i) {
+                l.fds[i] = open_socket(l, SOCK_DGRAM);
+                if(l.fds[i] < 0)
+                    continue;
+                int fd = l.fds[i];
+                query q{name, next_id(), static_cast<uint16_t>(i == 0 ? 1 : 28), "", ""};
+                std::string packet = build_query(q.id, name, q.type);
+                ssize_t sent = ::send(fd, packet.data(), packet.size(), 0);
+                (void)sent;
+                queries.emplace(fd, std::move(q));
+                events.add(fd, EPOLLIN, [this, fd](uint32_t) { receive(fd); });
+            }
+            l.timer = events.after(timeout, [this, name]() { expire(name); });
+        }
+
+        static bool matches(const query& q, const answer& a) {
+            return a.id == q.id && a.qtype == q.type && a.qclass == 1 && a.question == q.name;
+        }
+
+        void receive(int fd) {
+            auto found = queries.find(fd);
+            if(found == queries.end())
+                return;
+            uint8_t packet[4096];
+            ssize_t got;
+            while((got = recv(fd, packet, sizeof(packet), 0)) > 0) {
+                answer a;
+                //anything not answering exactly what was asked is ignored, the real answer may follow
+                if(!parse_answer(packet, static_cast<size_t>(got), a) || !matches(found->second, a))
+                    continue;
+                if(a.truncated)
+                    return retry_tcp(fd);
+                return answered(fd, a);
+            }
+        }
+
+        //the udp answer did not fit, ask the same server the same question over tcp
+        void retry_tcp(int fd) {
+            query q = queries[fd];
+            int slot = drop(fd);
+            auto found = lookups.find(q.name);
+            if(found == lookups.end() || slot < 0)
+                return;
+            auto& l = found->second;
+            int tcp = open_socket(l, SOCK_STREAM);
+            if(tcp < 0)
+                return;
+            q.id = next_id();
+            std::string packet = build_query(q.id, q.name, q.type);
+            q.out.push_back(static_cast<char>(packet.size() >> 8));
+            q.out.push_back(static_cast<char>(packet.size()));
+            q.out += packet;
+            l.fds[slot] = tcp;
+            queries.emplace(tcp, std::move(q));
+            events.add(tcp, EPOLLIN | EPOLLOUT, [this, tcp](uint32_t) { stream(tcp); });
+        }
+
+        void stream(int fd) {
+            auto found = queries.find(fd);
+            if(found == queries.end())
+                return;
+            auto& q = found->second;
+            while(!q.out.empty()) {
+                ssize_t n = ::send(fd, q.out.data(), q.out.size(), MSG_NOSIGNAL);
+                if(n < 0 && (errno == EAGAIN || errno == EINTR))
+                    return;
+                if(n <= 0)
+                    return abandon(fd);
+                q.out.erase(0, static_cast<size_t>(n));
+                if(q.out.empty())
+                    events.modify(fd, EPOLLIN);
+            }
+            char buffer[4096];
+            ssize_t got;
+            while((got = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+                q.in.append(buffer, static_cast<size_t>(got));
+                if(q.in.size() < 2)
+                    continue;
+                size_t length = static_cast<uint8_t>(q.in[0]) << 8 | static_cast<uint8_t>(q.in[1]);
+                if(q.in.size() < 2 + length)
+                    continue;
+                answer a;
+                if(!parse_answer(reinterpret_cast<const uint8_t*>(q.in.data()) + 2, length, a) || !matches(q, a))
+                    return abandon(fd);
+                return answered(fd, a);
+            }
+            if(got == 0 || (errno != EAGAIN && errno != EINTR))
+                abandon(fd);
+        }
+
+        //closes a query's socket, returns which of its lookup's slots it held or -1
+        int drop(int fd) {
+            auto found = queries.find(fd);
+            if(found == queries.end())
+                return -1;
+            auto lookup = lookups.find(found->second.name);
+            queries.erase(found);
+            events.remove(fd);
+            close(fd);
+            if(lookup == lookups.end())
+                return -1;
+            for(int i = 0; i < 2; ++i)
+                if(lookup->second.fds[i] == fd) {
+                    lookup->second.fds[i] = -1;
+                    return i;
+                }
+            return -1;
+        }
+
+        //a broken tcp fallback waits out the timer and moves on like a lost datagram
+        void abandon(int fd) {
+            drop(fd);
+        }
+
+        void answered(int fd, const answer& a) {
+            std::string name = queries[fd].name;
+            drop(fd);
+            auto found = lookups.find(name);
+            if(found == lookups.end())
+                return;
+            auto& l = found->second;
+            l.addresses.insert(l.addresses.end(), a.addresses.begin(), a.addresses.end());
+            if(!a.addresses.empty())
+                l.ttl = std::min(l.ttl, a.ttl);
+            if(a.rcode)
+                l.rcode = a.rcode;
+            if(--l.pending == 0) {
+                events.cancel(l.timer);
+                complete(name, l.addresses, l.addresses.empty() ? negative_ttl : l.ttl, "");
+            }
+        }
+
+        //no answer in time, try the next server or give up
+        void expire(const std::string& name) {
+            auto found = lookups.find(name);
+            if(found == lookups.end())
+                return;
+            auto& l = found->second;
+            for(int fd : l.fds)
+                drop(fd);
+            if(++l.attempt < attempts * servers.size()) {
+                l.server = (l.server + 1) % servers.size();
+                return send(name, l);
+            }
+            complete(name, {}, negative_ttl, "Timed out resolving " + name);
+        }
+
+        void complete(const std::string& name, std::vector<address> addresses, uint64_t ttl, const std::string& error) {
+            auto found = lookups.find(name);
+            for(int fd : found->second.fds)
+                drop(fd);
+            auto waiters = std::move(found->second.waiters);
+            lookups.erase(found);
+            {
+                auto now = clock::now();
+                std::lock_guard<std::mutex> guard(lock);
+                auto& c = cache[name];
+                //a failed background refresh keeps serving the addresses it meant to refresh
+                if(!error.empty() && !c.addresses.empty() && now < c.expires)
+                    c.prefetching = false;
+                else if(error.empty() || negative_ttl) {
+                    ttl = error.empty() ? std::max<uint64_t>(min_ttl, std::min<uint64_t>(ttl, max_ttl)) : ttl;
+                    c.addresses = addresses;
+                    c.error = error;
+                    c.expires = now + std::chrono::seconds(ttl);
+                    c.prefetch = now + std::chrono::milliseconds(ttl * 900);
+                    c.prefetching = false;
+                }
+            }
+            std::string message = error;
+            if(message.empty() && addresses.empty())
+                message = "Name " + name + " does not resolve";
+            for(auto& w : waiters)
+                w(addresses, message);
+        }
+
+        event::loop& events;
+        std::chrono::milliseconds timeout;
+        size_t attempts;
+        size_t min_ttl;
+        size_t max_ttl;
+        size_t negative_ttl;
+        std::array<uint16_t, 64> entropy;
+        size_t entropy_used;
+        std::vector<server> servers;
+        std::unordered_map<std::string, std::vector<address> > hosts;
+        std::unordered_map<std::string, pending_lookup> lookups;
+        std::unordered_map<int, query> queries;
+        std::mutex lock;
+        std::unordered_map<std::string, cached_name> cache;
+    };
+}
+
+#endif //__RESOLVER_HPP__
+
+#ifdef TEST_RESOLVER
+//g++ -std=c++17 -O2 -DTEST_RESOLVER -Iinclude -x c++ include/dns/resolver.hpp -o resolvertest -pthread
+#include <cassert>
+#include <future>
+#include <iostream>
+#include <set>
+#include <poll.h>
+
+namespace {
+  //a nameserver on a loopback port, udp and tcp, whose answers depend on the name asked:
+  //a.test has one a record, spoof.test is preceded by forged answers, big.test is truncated over
+  //udp, missing.test is nxdomain and slow.test never answers
+  struct stand_in {
+    int udp = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    int tcp = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int wake[2];
+    uint16_t port = 0;
+    std::mutex lock;
+    std::unordered_map<std::string, size_t> asked;
+    size_t tcp_asked = 0;
+    std::set<uint16_t> ports;
+    std::set<uint16_t> ids;
+    std::thread worker;
+    stand_in() {
+      assert(pipe(wake) == 0);
+      //the same port for both, retried in the unlikely case tcp has it taken
+      for(;;) {
+        sockaddr_in a{};
+        a.sin_family = AF_INET;
+        a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(a);
+        assert(bind(udp, reinterpret_cast<sockaddr*>(&a), sizeof(a)) == 0);
+        getsockname(udp, reinterpret_cast<sockaddr*>(&a), &length);
+        if(bind(tcp, reinterpret_cast<sockaddr*>(&a), sizeof(a)) == 0 && listen(tcp, 8) == 0) {
+          port = ntohs(a.sin_port);
+          break;
+        }
+        close(udp);
+        udp = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+      }
+      worker = std::thread([this]() { serve(); });
+    }
+    ~stand_in() {
+      assert(write(wake[1], "x", 1) == 1);
+      worker.join();
+      close(udp);
+      close(tcp);
+      close(wake[0]);
+      close(wake[1]);
+    }
+    static void put16(std::string& out, uint16_t v) {
+      out.push_back(static_cast<char>(v >> 8));
+      out.push_back(static_cast<char>(v));
+    }
+    //an answer to query with the given flags and a records, question overridable to forge one
+    static std::string reply(const std::string& query, uint16_t flags, const std::vector<std::string>& records,
+                             const std::string& question = "") {
+      std::string out = query.substr(0, 2);
+      put16(out, flags);
+      put16(out, 1);
+      put16(out, static_cast<uint16_t>(records.size()));
+      put16(out, 0);
+      put16(out, 0);
+      out += question.empty() ? query.substr(12) : question;
+      for(const auto& ip : records) {
+        put16(out, 0xc00c);
+        put16(out, 1);
+        put16(out, 1);
+        out.append("\0\0\0\x3c", 4);
+        put16(out, 4);
+        in_addr a{};
+        inet_pton(AF_INET, ip.c_str(), &a);
+        out.append(reinterpret_cast<char*>(&a), 4);
+      }
+      return out;
+    }
+    //the asked name and type of a query
+    static std::pair<std::string, uint16_t> question(const std::string& query) {
+      std::string name;
+      size_t pos = 12;
+      dns::read_name(reinterpret_cast<const uint8_t*>(query.data()), query.size(), pos, name);
+      return {name, static_cast<uint16_t>(static_cast<uint8_t>(query[pos]) << 8 | static_cast<uint8_t>(query[pos + 1]))};
+    }
+    std::vector<std::string> answers(const std::string& query, bool over_tcp) {
+      auto q = question(query);
+      std::lock_guard<std::mutex> guard(lock);
+      ++asked[q.first];
+      ids.insert(static_cast<uint16_t>(static_cast<uint8_t>(query[0]) << 8 | static_cast<uint8_t>(query[1])));
+      if(q.first == "slow.test")
+        return {};
+      if(q.first == "missing.test")
+        return {reply(query, 0x8183, {})};
+      if(q.second != 1)
+        return {reply(query, 0x8180, {})};
+      if(q.first == "a.test")
+        return {reply(query, 0x8180, {"192.0.2.1"})};
+      if(q.first == "spoof.test") {
+        //right id, wrong name. right id and name, wrong type. then the real one
+        std::string forged_name = query.substr(12);
+        forged_name[1] = 'x';
+        std::string forged_type = query.substr(12);
+        forged_type[forged_type.size() - 3] = 28;
+        return {reply(query, 0x8180, {"203.0.113.66"}, forged_name), reply(query, 0x8180, {"203.0.113.67"}, forged_type),
+                reply(query, 0x8180, {"192.0.2.2"})};
+      }
+      if(q.first == "big.test") {
+        if(!over_tcp)
+          return {reply(query, 0x8380, {})};
+        ++tcp_asked;
+        std::vector<std::string> many;
+        for(int i = 1; i <= 40; ++i)
+          many.push_back("10.0.0." + std::to_string(i));
+        return {reply(query, 0x8180, many)};
+      }
+      return {reply(query, 0x8183, {})};
+    }
+    void serve() {
+      for(;;) {
+        pollfd fds[3] = {{udp, POLLIN, 0}, {tcp, POLLIN, 0}, {wake[0], POLLIN, 0}};
+        poll(fds, 3, -1);
+        if(fds[2].revents)
+          return;
+        if(fds[0].revents) {
+          char buffer[512];
+          sockaddr_in from{};
+          socklen_t length = sizeof(from);
+          ssize_t n = recvfrom(udp, buffer, sizeof(buffer), 0, reinterpret_cast<sockaddr*>(&from), &length);
+          {
+            std::lock_guard<std::mutex> guard(lock);
+            ports.insert(ntohs(from.sin_port));
+          }
+          for(const auto& out : answers(std::string(buffer, static_cast<size_t>(n)), false))
+            sendto(udp, out.data(), out.size(), 0, reinterpret_cast<sockaddr*>(&from), length);
+        }
+        if(fds[1].revents) {
+          int c = accept(tcp, nullptr, nullptr);
+          std::string in;
+          char buffer[512];
+          ssize_t n;
+          while((in.size() < 2 || in.size() < 2 + static_cast<size_t>(static_cast<uint8_t>(in[0]) << 8 | static_cast<uint8_t>(in[1]))) &&
+                (n = read(c, buffer, sizeof(buffer))) > 0)
+            in.append(buffer, static_cast<size_t>(n));
+          for(const auto& out : answers(in.substr(2), true)) {
+            std::string framed;
+            put16(framed, static_cast<uint16_t>(out.size()));
+            framed += out;
+            assert(write(c, framed.data(), framed.size()) == static_cast<ssize_t>(framed.size()));
+          }
+          close(c);
+        }
+      }
+    }
+    size_t count(const std::string& name) {
+      std::lock_guard<std::mutex> guard(lock);
+      return asked[name];
+    }
+  };
+
+  std::pair<std::vector<dns::address>, std::string> lookup(event::loop& events, dns::resolver& r, const std::string& name) {
+    std::promise<std::pair<std::vector<dns::address>, std::string> > result;
+    events.post([&]() {
+      r.resolve(name, [&](const std::vector<dns::address>& addresses, const std::string& error) {
+        result.set_value({addresses, error});
+      });
+    });
+    return result.get_future().get();
+  }
+}
+
+int main() {
+  //compression pointers that loop are refused rather than followed forever
+  const uint8_t looping[] = {0, 1, 0x81, 0x80, 0, 1, 0, 0, 0, 0, 0, 0, 0xc0, 12, 0, 1, 0, 1};
+  dns::answer a;
+  assert(!dns::parse_answer(looping, sizeof(looping), a));
+  //two questions in one answer are refused too
+  std::string twice = dns::build_query(7, "a.test", 1);
+  twice[2] = static_cast<char>(0x81);
+  twice[5] = 2;
+  assert(!dns::parse_answer(reinterpret_cast<const uint8_t*>(twice.data()), twice.size(), a));
+
+  stand_in server;
+  event::loop events;
+  dns::resolver r(events, dns::resolver_config_t{{"nameserver", "127.0.0.1:" + std::to_string(server.port)},
+                                                 {"hosts", "/dev/null"},
+                                                 {"dns_timeout_ms", "200"},
+                                                 {"dns_attempts", "1"}});
+  std::thread runner([&]() { events.run(); });
+
+  auto found = lookup(events, r, "A.test.");
+  assert(found.second.empty() && found.first.size() == 1 && found.first[0].str() == "192.0.2.1");
+  //from the cache, the server is not asked again
+  found = lookup(events, r, "a.test");
+  assert(found.first.size() == 1 && server.count("a.test") == 2 && r.cached("a.test").size() == 1);
+
+  found = lookup(events, r, "spoof.test");
+  assert(found.first.size() == 1 && found.first[0].str() == "192.0.2.2");
+
+  found = lookup(events, r, "big.test");
+  assert(found.second.empty() && found.first.size() == 40 && server.tcp_asked == 1);
+
+  found = lookup(events, r, "missing.test");
+  assert(found.first.empty() && found.second.find("does not resolve") != std::string::npos);
+
+  //a timeout is cached like any other failure, the second ask neither waits nor queries
+  auto started = dns::clock::now();
+  found = lookup(events, r, "slow.test");
+  assert(found.first.empty() && found.second.find("Timed out") != std::string::npos);
+  assert(dns::clock::now() - started >= std::chrono::milliseconds(200));
+  size_t asked = server.count("slow.test");
+  started = dns::clock::now();
+  found = lookup(events, r, "slow.test");
+  assert(found.second.find("Timed out") != std::string::npos && server.count("slow.test") == asked);
+  assert(dns::clock::now() - started < std::chrono::milliseconds(100));
+
+  //every query came from its own port with its own id
+  {
+    std::lock_guard<std::mutex> guard(server.lock);
+    assert(server.ports.size() >= 10 && server.ids.size() >= 10);
+  }
+
+  //a resolver going away mid lookup leaves no timer behind to fire into it
+  {
+    std::promise<void> gone;
+    events.post([&]() {
+      dns::resolver brief(events, dns::resolver_config_t{{"nameserver", "127.0.0.1:" + std::to_string(server.port)},
+                                                         {"hosts", "/dev/null"},
+                                                         {"dns_timeout_ms", "50"}});
+      brief.resolve("slow.test", [](const std::vector<dns::address>&, const std::string&) { assert(false); });
+      gone.set_value();
+    });
+    gone.get_future().get();
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    assert(lookup(events, r, "a.test").first.size() == 1);
+  }
+
+  events.stop();
+  runner.join();
+  std::cout << "resolver ok" << std::endl;
+  return 0;
+}
+#endif
@@ -0,0 +1,321 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __ETAG_HPP__
+#define __ETAG_HPP__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "hashing/xxh64.hpp"
+
+namespace etag {
+    //the classic size and mtime validator, only meaningful on the host that produced it
+    inline std::string weak(const struct stat& st) {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "W/\"%llx-%llx\"", static_cast<unsigned long long>(st.st_size),
+                 static_cast<unsigned long long>(st.st_mtim.tv_sec));
+        return buffer;
+    }
+
+    //a content derived validator, identical for identical bytes on every host
+    inline std::string strong(uint64_t hash, off_t size) {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "\"%016llx-%llx\"", static_cast<unsigned long long>(hash),
+                 static_cast<unsigned long long>(size));
+        return buffer;
+    }
+
+    //weak comparison per rfc 9110, which is what if-none-match uses
+    inline bool matches(const std::string& if_none_match, const std::string& tag) {
+        auto opaque = [](const std::string& s, size_t begin, size_t end) {
+            if(end - begin > 2 && s[begin] == 'W' && s[begin + 1] == '/')
+                begin += 2;
+            return std::make_pair(begin, end);
+        };
+        auto ours = opaque(tag, 0, tag.size());
+        size_t pos = 0;
+        while(pos < if_none_match.size()) {
+            while(pos < if_none_match.size() && (if_none_match[pos] == ' ' || if_none_match[pos] == ','))
+                ++pos;
+            if(pos >= if_none_match.size())
+                break;
+            if(if_none_match[pos] == '*')
+                return true;
+            size_t end = if_none_match.find(',', pos);
+            if(end == std::string::npos)
+                end = if_none_match.size();
+            size_t trimmed = end;
+            while(trimmed > pos && if_none_match[trimmed - 1] == ' ')
+                --trimmed;
+            auto theirs = opaque(if_none_match, pos, trimmed);
+            if(theirs.second - theirs.first == ours.second - ours.first &&
+               if_none_match.compare(theirs.first, theirs.second - theirs.first, tag, ours.first, ours.second - ours.first) == 0)
+                return true;
+            pos = end;
+        }
+        return false;
+    }
+
+    //hands out etags for files, strong ones once a background thread has hashed the content
+    //and weak ones until then, so the request path never reads a file just to validate it
+    using etag_config_t = std::unordered_map<std::string, std::string>;
+    class etag_cache {
+    public:
+        etag_cache() = delete;
+        explicit etag_cache(const etag_config_t& config) :
+            enabled(false), max_entries(65536), max_pending(4096), max_file_size(off_t(1) << 32), stopping(false) {
+            auto parse = [&config](const char* key, size_t& value) {
+                auto found = config.find(key);
+                if(found == config.end())
+                    return;
+                try {
+                    value = std::stoul(found->second);
+                }
+                catch(...) {
+                    throw std::runtime_error(found->second + " is not a valid " + key);
+                }
+            };
+            auto strong_option = config.find("strong");
+            if(strong_option != config.end()) {
+                if(strong_option->second == "on" || strong_option->second == "true")
+                    enabled = true;
+                else if(strong_option->second != "off" && strong_option->second != "false")
+                    throw std::runtime_error(strong_option->second + " is not a valid strong etag setting");
+            }
+            size_t size_cap = static_cast<size_t>(max_file_size);
+            parse("max_entries", max_entries);
+            parse("max_pending", max_pending);
+            parse("max_file_size", size_cap);
+            max_file_size = static_cast<off_t>(size_cap);
+            if(enabled)
+                worker = std::thread([this]() { run(); });
+        }
+        ~etag_cache() {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+            }
+            wake.notify_all();
+            if(worker.joinable())
+                worker.join();
+        }
+
+        //the etag to send for the file at path whose stat the caller already has
+        std::string get(const std::string& path, const struct stat& st) {
+            if(!enabled || !S_ISREG(st.st_mode) || st.st_size > max_file_size)
+                return weak(st);
+            identity id{st};
+            std::lock_guard<std::mutex> guard(lock);
+            auto found = index.find(id.key());
+            if(found != index.end() && found->second->second.id == id) {
+                lru.splice(lru.begin(), lru, found->second);
+                return found->second->second.tag;
+            }
+            //first sight or the file changed, hash it off the request path
+            if(pending.size() < max_pending && queued.insert(id.key()).second) {
+                pending.push_back(job{path, id});
+                wake.notify_one();
+            }
+            return weak(st);
+        }
+
+        size_t size() {
+            std::lock_guard<std::mutex> guard(lock);
+            return lru.size();
+        }
+
+    protected:
+        //what a file must still look like for its hash to be trusted
+        struct identity {
+            dev_t dev;
+            ino_t ino;
+            off_t size;
+            struct timespec mtime;
+            struct timespec ctime;
+            identity() = default;
+            explicit identity(const struct stat& st) :
+                dev(st.st_dev), ino(st.st_ino), size(st.st_size), mtime(st.st_mtim), ctime(st.st_ctim) {}
+            std::string key() const {
+                return std::to_string(dev) + ":" + std::to_string(ino);
+            }
+            bool operator==(const identity& other) const {
+                return dev == other.dev && ino == other.ino && size == other.size &&
+                       mtime.tv_sec == other.mtime.tv_sec && mtime.tv_nsec == other.mtime.tv_nsec &&
+                       ctime.tv_sec == other.ctime.tv_sec && ctime.tv_nsec == other.ctime.tv_nsec;
+            }
+        };
+        struct job {
+            std::string path;
+            identity id;
+        };
+        struct hashed {
+            identity id;
+            std::string tag;
+        };
+
+        void run() {
+            std::vector<char> buffer(1 << 20);
+            std::unique_lock<std::mutex> guard(lock);
+            while(true) {
+                wake.wait(guard, [this]() { return stopping || !pending.empty(); });
+                if(stopping)
+                    return;
+                job next = std::move(pending.front());
+                pending.pop_front();
+                guard.unlock();
+                std::string tag = hash_file(next, buffer);
+                guard.lock();
+                queued.erase(next.id.key());
+                if(tag.empty())
+                    continue;
+                auto key = next.id.key();
+                auto found = index.find(key);
+                if(found != index.end()) {
+                    found->second->second = hashed{next.id, tag};
+                    lru.splice(lru.begin(), lru, found->second);
+                    continue;
+                }
+                lru.emplace_front(key, hashed{next.id, tag});
+                index.emplace(std::move(key), lru.begin());
+                while(lru.size() > max_entries) {
+                    index.erase(lru.back().first);
+                    lru.pop_back();
+                }
+            }
+        }
+
+        //returns an empty string if the file vanished or changed while we read it
+        std::string hash_file(const job& next, std::vector<char>& buffer) {
+            int fd = open(next.path.c_str(), O_RDONLY | O_CLOEXEC);
+            if(fd < 0)
+                return "";
+            struct stat before{};
+            if(fstat(fd, &before) != 0 || !(identity{before} == next.id)) {
+                close(fd);
+                return "";
+            }
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            hashing::xxh64 state;
+            off_t offset = 0;
+            while(true) {
+                ssize_t read = pread(fd, buffer.data(), buffer.size(), offset);
+                if(read < 0 && errno == EINTR)
+                    continue;
+                if(read <= 0)
+                    break;
+                state.update(buffer.data(), static_cast<size_t>(read));
+                offset += read;
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    if(stopping)
+                        break;
+                }
+            }
+            struct stat after{};
+            bool unchanged = fstat(fd, &after) == 0 && identity{after} == next.id && offset == next.id.size;
+            close(fd);
+            return unchanged ? strong(state.digest(), offset) : "";
+        }
+
+        using lru_t = std::list<std::pair<std::string, hashed> >;
+        bool enabled;
+        size_t max_entries;
+        size_t max_pending;
+        off_t max_file_size;
+        bool stopping;
+        std::mutex lock;
+        std::condition_variable wake;
+        lru_t lru;
+        std::unordered_map<std::string, lru_t::iterator> index;
+        std::deque<job> pending;
+        std::unordered_set<std::string> queued;
+        std::thread worker;
+    };
+}
+
+#endif //__ETAG_HPP__
+
+#ifdef TEST_ETAG
+//g++ -std=c++17 -O2 -DTEST_ETAG -Iinclude -x c++ include/etag/etag.hpp -o etagtest -lpthread
+#include <cassert>
+#include <chrono>
+#include <iostream>
+
+int main() {
+  //reference vectors of xxh64 with seed 0
+  assert(hashing::xxh64::hash("", 0) == 0xEF46DB3751D8E999ULL);
+  assert(hashing::xxh64::hash("a", 1) == 0xD24EC4F1A98C6E5BULL);
+  assert(hashing::xxh64::hash("abc", 3) == 0x44BC2CF5AD770999ULL);
+  const std::string long_input = "Nobody inspects the spammish repetition";
+  assert(hashing::xxh64::hash(long_input.data(), long_input.size()) == 0xFBCEA83C8A378BF1ULL);
+  //fed in pieces of any size it is the same hash
+  std::string data;
+  for(int i = 0; i < 1000; ++i)
+    data.push_back(static_cast<char>(i * 31 + 7));
+  for(size_t step : {1, 3, 31, 32, 33, 100}) {
+    hashing::xxh64 state(42);
+    for(size_t at = 0; at < data.size(); at += step)
+      state.update(data.data() + at, std::min(step, data.size() - at));
+    assert(state.digest() == hashing::xxh64::hash(data.data(), data.size(), 42));
+  }
+
+  assert(etag::strong(0x1234, 10) == "\"0000000000001234-a\"");
+  assert(etag::matches("\"x\"", "\"x\""));
+  assert(etag::matches("W/\"x\"", "\"x\""));
+  assert(etag::matches("\"a\", \"x\" ", "W/\"x\""));
+  assert(etag::matches("*", "\"x\""));
+  assert(!etag::matches("\"xy\", \"y\"", "\"x\""));
+  assert(!etag::matches("", "\"x\""));
+
+  char path[] = "/tmp/etagXXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0 && write(fd, "abc", 3) == 3);
+  close(fd);
+  struct stat st{};
+  assert(stat(path, &st) == 0);
+
+  //off by default, only weak tags
+  etag::etag_cache off(etag::etag_config_t{});
+  assert(off.get(path, st) == etag::weak(st) && off.get(path, st)[0] == 'W');
+
+  //the first request gets the weak tag, later ones the content hash
+  etag::etag_cache cache(etag::etag_config_t{{"strong", "on"}});
+  assert(cache.get(path, st) == etag::weak(st));
+  std::string expected = etag::strong(0x44BC2CF5AD770999ULL, 3);
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while(cache.get(path, st) != expected && std::chrono::steady_clock::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  assert(cache.get(path, st) == expected && cache.size() == 1);
+
+  //a changed file is weak again until it was hashed anew
+  fd = open(path, O_WRONLY | O_APPEND);
+  assert(write(fd, "d", 1) == 1);
+  close(fd);
+  struct stat changed{};
+  assert(stat(path, &changed) == 0);
+  assert(cache.get(path, changed) == etag::weak(changed));
+
+  bool thrown = false;
+  try { etag::etag_cache(etag::etag_config_t{{"strong", "maybe"}}); } catch(const std::runtime_error&) { thrown = true; }
+  assert(thrown);
+  unlink(path);
+  std::cout << "etag ok" << std::endl;
+  return 0;
+}
+#endif
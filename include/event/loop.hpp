@@ -0,0 +1,172 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __LOOP_HPP__
+#define __LOOP_HPP__
+
+#include <map>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+namespace event {
+    using clock = std::chrono::steady_clock;
+    //called with the epoll events that fired for a descriptor
+    using handler = std::function<void(uint32_t events)>;
+    using timer_id = uint64_t;
+
+    //a single threaded epoll loop with timers. everything registered runs on the thread that
+    //called run(), other threads hand work over with post()
+    class loop {
+    public:
+        loop() : epoll_fd(epoll_create1(EPOLL_CLOEXEC)), wake_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), next_timer(1), running(false) {
+            if(epoll_fd < 0 || wake_fd < 0)
+                throw std::runtime_error(std::string("Couldn't create event loop: ") + strerror(errno));
+            epoll_event e{};
+            e.events = EPOLLIN;
+            e.data.fd = wake_fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &e);
+        }
+        ~loop() {
+            close(wake_fd);
+            close(epoll_fd);
+        }
+        loop(const loop&) = delete;
+        loop& operator=(const loop&) = delete;
+
+        void add(int fd, uint32_t events, handler callback) {
+            epoll_event e{};
+            e.events = events;
+            e.data.fd = fd;
+            if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &e) != 0)
+                throw std::runtime_error(std::string("Couldn't watch descriptor: ") + strerror(errno));
+            handlers[fd] = std::make_shared<handler>(std::move(callback));
+        }
+        void modify(int fd, uint32_t events) {
+            epoll_event e{};
+            e.events = events;
+            e.data.fd = fd;
+            if(epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &e) != 0)
+                throw std::runtime_error(std::string("Couldn't modify descriptor: ") + strerror(errno));
+        }
+        //safe to call from inside the descriptor's own handler
+        void remove(int fd) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+            handlers.erase(fd);
+        }
+
+        timer_id after(std::chrono::milliseconds delay, std::function<void()> callback) {
+            timer_id id = next_timer++;
+            auto when = clock::now() + delay;
+            timers.emplace(std::make_pair(when, id), std::move(callback));
+            deadlines.emplace(id, when);
+            return id;
+        }
+        void cancel(timer_id id) {
+            auto found = deadlines.find(id);
+            if(found == deadlines.end())
+                return;
+            timers.erase(std::make_pair(found->second, id));
+            deadlines.erase(found);
+        }
+
+        //runs callback on the loop thread, callable from any thread
+        void post(std::function<void()> callback) {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                posted.push_back(std::move(callback));
+            }
+            uint64_t one = 1;
+            ssize_t ignored = write(wake_fd, &one, sizeof(one));
+            (void)ignored;
+        }
+
+        void run() {
+            running = true;
+            owner = std::this_thread::get_id();
+            epoll_event events[256];
+            while(running) {
+                int ready = epoll_wait(epoll_fd, events, 256, timeout());
+                if(ready < 0 && errno != EINTR)
+                    throw std::runtime_error(std::string("epoll_wait failed: ") + strerror(errno));
+                for(int i = 0; i < ready; ++i) {
+                    int fd = events[i].data.fd;
+                    if(fd == wake_fd) {
+                        drain_posted();
+                        continue;
+                    }
+                    auto found = handlers.find(fd);
+                    if(found == handlers.end())
+                        continue;
+                    //hold a reference, the handler may remove itself
+                    auto callback = found->second;
+                    (*callback)(events[i].events);
+                }
+                fire_timers();
+            }
+        }
+
+        //callable from any thread, the loop returns after the current iteration
+        void stop() {
+            post([this]() { running = false; });
+        }
+
+        bool in_loop_thread() const {
+            return owner == std::this_thread::get_id();
+        }
+
+    protected:
+        int timeout() const {
+            if(timers.empty())
+                return -1;
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(timers.begin()->first.first - clock::now()).count();
+            return wait < 0 ? 0 : static_cast<int>(wait + 1);
+        }
+        void fire_timers() {
+            auto now = clock::now();
+            while(!timers.empty() && timers.begin()->first.first <= now) {
+                auto callback = std::move(timers.begin()->second);
+                deadlines.erase(timers.begin()->first.second);
+                timers.erase(timers.begin());
+                callback();
+            }
+        }
+        void drain_posted() {
+            uint64_t count;
+            ssize_t ignored = read(wake_fd, &count, sizeof(count));
+            (void)ignored;
+            std::vector<std::function<void()> > work;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                work.swap(posted);
+            }
+            for(auto& w : work)
+                w();
+        }
+
+        int epoll_fd;
+        int wake_fd;
+        timer_id next_timer;
+        std::atomic<bool> running;
+        std::thread::id owner;
+        std::unordered_map<int, std::shared_ptr<handler> > handlers;
+        std::map<std::pair<clock::time_point, timer_id>, std::function<void()> > timers;
+        std::unordered_map<timer_id, clock::time_point> deadlines;
+        std::mutex lock;
+        std::vector<std::function<void()> > posted;
+    };
+}
+
+#endif //__LOOP_HPP__
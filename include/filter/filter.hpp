@@ -0,0 +1,632 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __FILTER_HPP__
+#define __FILTER_HPP__
+
+#include "http/http.hpp"
+
+#include <atomic>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace filter {
+    using filter_config_t = std::unordered_map<std::string, std::string>;
+
+    //every literal pattern in one aho-corasick automaton, so a text is matched against all of
+    //them in a single pass whatever their number. matching ignores ascii case. bytes that occur
+    //in no pattern share one input class which keeps the transition table to states x classes.
+    //while the automaton sits in its root state no pattern has started, the scan skips ahead to
+    //the next byte that starts one sixteen bytes at a time. with ssse3 a nibble table lookup
+    //tests any set of start bytes. the x86-64 baseline that default flags build for only has
+    //sse2 and compares against up to eight start bytes, real rule sets start with more than
+    //that once letters are folded, so there the skip is byte by byte unless built with -mssse3
+    class automaton {
+    public:
+        static constexpr uint32_t ROOT = 0;
+
+        //pattern ids are handed back by scan
+        void add(const std::string& pattern, uint32_t id) {
+            if(pattern.empty())
+                throw std::runtime_error("An empty filter pattern matches everything");
+            patterns.emplace_back(pattern, id);
+        }
+
+        void build() {
+            //input classes, upper and lower case letters fall into the same one
+            memset(classes, 0, sizeof(classes));
+            class_count = 1;
+            for(auto& p : patterns)
+                for(char c : p.first) {
+                    auto folded = static_cast<uint8_t>(tolower(static_cast<unsigned char>(c)));
+                    if(!classes[folded]) {
+                        classes[folded] = static_cast<uint8_t>(class_count);
+                        classes[toupper(folded)] = static_cast<uint8_t>(class_count);
+                        ++class_count;
+                    }
+                }
+            if(class_count > 256)
+                throw std::runtime_error("Too many filter pattern bytes");
+
+            //the trie, missing edges are NONE until the breadth first pass below fills them in
+            std::vector<std::vector<uint32_t> > outputs(1);
+            delta.assign(class_count, NONE);
+            uint32_t states = 1;
+            for(auto& p : patterns) {
+                uint32_t state = ROOT;
+                for(char c : p.first) {
+                    uint32_t& next = delta[size_t(state) * class_count + classes[static_cast<uint8_t>(c)]];
+                    if(next == NONE) {
+                        next = states++;
+                        delta.resize(size_t(states) * class_count, NONE);
+                        outputs.emplace_back();
+                    }
+                    state = delta[size_t(state) * class_count + classes[static_cast<uint8_t>(c)]];
+                }
+                outputs[state].push_back(p.second);
+            }
+
+            //failure links turned into complete transitions, a state also reports everything
+            //its failure state reports
+            std::vector<uint32_t> failure(states, ROOT);
+            std::vector<uint32_t> queue;
+            queue.reserve(states);
+            for(size_t c = 0; c < class_count; ++c) {
+                uint32_t& next = delta[c];
+                if(next == NONE) {
+                    next = ROOT;
+                    continue;
+                }
+                queue.push_back(next);
+            }
+            for(size_t i = 0; i < queue.size(); ++i) {
+                uint32_t state = queue[i];
+                auto& inherited = outputs[failure[state]];
+                outputs[state].insert(outputs[state].end(), inherited.begin(), inherited.end());
+                for(size_t c = 0; c < class_count; ++c) {
+                    uint32_t& next = delta[size_t(state) * class_count + c];
+                    uint32_t fallback = delta[size_t(failure[state]) * class_count + c];
+                    if(next == NONE) {
+                        next = fallback;
+                        continue;
+                    }
+                    failure[next] = fallback;
+                    queue.push_back(next);
+                }
+            }
+            found.assign(states + 1, 0);
+            ids.clear();
+            for(uint32_t s = 0; s < states; ++s) {
+                found[s] = static_cast<uint32_t>(ids.size());
+                ids.insert(ids.end(), outputs[s].begin(), outputs[s].end());
+            }
+            found[states] = static_cast<uint32_t>(ids.size());
+
+            //the scan wants rows, not states: entries become the offset of the next state's row
+            //with the top bit set when that state reports something
+            if(size_t(states) * class_count >= MATCH)
+                throw std::runtime_error("Too many filter patterns");
+            for(auto& next : delta)
+                next = static_cast<uint32_t>(next * class_count) | (found[next] != found[next + 1] ? MATCH : 0);
+
+            //the bytes that leave the root, what the prefilter looks for. each distinct high
+            //nibble gets a bucket bit, past eight of them buckets are shared and the nibble test
+            //lets some other bytes through
+            starts.clear();
+            memset(starting, 0, sizeof(starting));
+            memset(low_buckets, 0, sizeof(low_buckets));
+            memset(high_buckets, 0, sizeof(high_buckets));
+            size_t buckets = 0;
+            for(size_t b = 0; b < 256; ++b) {
+                if(classes[b] && (delta[classes[b]] & ~MATCH) != ROOT) {
+                    starting[b] = true;
+                    starts.push_back(static_cast<char>(b));
+                    if(!high_buckets[b >> 4])
+                        high_buckets[b >> 4] = static_cast<uint8_t>(1u << (buckets++ % 8));
+                    low_buckets[b & 15] |= high_buckets[b >> 4];
+                }
+            }
+            patterns.clear();
+            patterns.shrink_to_fit();
+        }
+
+        //feeds text to the automaton from state, ROOT or what an earlier scan returned, and
+        //returns where it ended up. on_match gets every pattern id ending in the text and
+        //returns false to stop the scan early
+        template<typename callback>
+        uint32_t scan(uint32_t state, const char* data, size_t size, callback&& on_match) const {
+            const char* end = data + size;
+            while(data < end) {
+                if(state == ROOT) {
+                    data = skip(data, end);
+                    if(data == end)
+                        break;
+                }
+                uint32_t next = delta[state + classes[static_cast<uint8_t>(*data++)]];
+                state = next & ~MATCH;
+                if(!(next & MATCH))
+                    continue;
+                size_t row = state / class_count;
+                for(uint32_t i = found[row]; i < found[row + 1]; ++i)
+                    if(!on_match(ids[i]))
+                        return state;
+            }
+            return state;
+        }
+
+        size_t states() const {
+            return found.empty() ? 0 : found.size() - 1;
+        }
+
+    protected:
+        static constexpr uint32_t NONE = UINT32_MAX;
+        static constexpr uint32_t MATCH = 0x80000000u;
+        static constexpr size_t SIMD_STARTS = 8;
+
+        //the first byte at or after data that starts a pattern, end if there is none
+        const char* skip(const char* data, const char* end) const {
+            //common bytes start patterns often enough that the next one is usually close by
+            for(const char* near = std::min(end, data + 16); data < near; ++data)
+                if(starting[static_cast<uint8_t>(*data)])
+                    return data;
+#if defined(__SSSE3__)
+            //a byte may start a pattern when the buckets of its low nibble hold the bucket of its high nibble
+            __m128i low_table = _mm_loadu_si128(reinterpret_cast<const __m128i*>(low_buckets));
+            __m128i high_table = _mm_loadu_si128(reinterpret_cast<const __m128i*>(high_buckets));
+            __m128i nibble = _mm_set1_epi8(0x0f);
+            while(end - data >= 16) {
+                __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+                __m128i low = _mm_shuffle_epi8(low_table, _mm_and_si128(block, nibble));
+                __m128i high = _mm_shuffle_epi8(high_table, _mm_and_si128(_mm_srli_epi16(block, 4), nibble));
+                __m128i none = _mm_cmpeq_epi8(_mm_and_si128(low, high), _mm_setzero_si128());
+                auto mask = static_cast<unsigned>(~_mm_movemask_epi8(none)) & 0xffffu;
+                for(; mask; mask &= mask - 1)
+                    if(starting[static_cast<uint8_t>(data[__builtin_ctz(mask)])])
+                        return data + __builtin_ctz(mask);
+                data += 16;
+            }
+#elif defined(__SSE2__)
+            if(starts.size() <= SIMD_STARTS) {
+                __m128i wanted[SIMD_STARTS];
+                size_t count = starts.size();
+                for(size_t i = 0; i < count; ++i)
+                    wanted[i] = _mm_set1_epi8(starts[i]);
+                while(end - data >= 16) {
+                    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+                    __m128i hit = _mm_setzero_si128();
+                    for(size_t i = 0; i < count; ++i)
+                        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(block, wanted[i]));
+                    int mask = _mm_movemask_epi8(hit);
+                    if(mask)
+                        return data + __builtin_ctz(static_cast<unsigned>(mask));
+                    data += 16;
+                }
+            }
+#endif
+            while(data < end && !starting[static_cast<uint8_t>(*data)])
+                ++data;
+            return data;
+        }
+
+        std::vector<std::pair<std::string, uint32_t> > patterns;
+        uint8_t classes[256];
+        size_t class_count = 1;
+        std::vector<uint32_t> delta;
+        std::vector<uint32_t> found;
+        std::vector<uint32_t> ids;
+        std::string starts;
+        bool starting[256];
+        uint8_t low_buckets[16];
+        uint8_t high_buckets[16];
+    };
+
+    //where in a request a rule looks
+    enum scope : uint8_t {URI = 1, HEADERS = 2, BODY = 4, ANY = 7};
+
+    struct rule {
+        std::string name;
+        std::string pattern;
+        uint8_t where;
+        //a deny rule rejects the request, a log rule only counts
+        bool deny;
+    };
+
+    //blocks requests carrying known attack signatures. rules come from the filter_rules file,
+    //one 'deny|log name uri|headers|body|any pattern' per line where the pattern is the rest of
+    //the line with \xHH and \\ escapes. all patterns are compiled into one automaton and a
+    //request is scanned once, the target both as sent and percent decoded and each header as
+    //'name: value'. immutable once built, any number of threads may check
+    class request_filter {
+    public:
+        request_filter() = delete;
+        explicit request_filter(const filter_config_t& config) {
+            auto file = config.find("filter_rules");
+            if(file == config.end())
+                throw std::runtime_error("filter_rules is required");
+            load(file->second);
+            for(size_t i = 0; i < rules.size(); ++i)
+                patterns.add(rules[i].pattern, static_cast<uint32_t>(i));
+            patterns.build();
+            counters.reset(new std::atomic<uint64_t>[rules.size()]());
+        }
+        request_filter(const request_filter&) = delete;
+        request_filter& operator=(const request_filter&) = delete;
+
+        //the deny rule the request hit, nullptr to let it through. hits of log rules are
+        //counted on the way, every rule at most once per request
+        const rule* check(const http::request& request) const {
+            const rule* blocked = nullptr;
+            std::vector<bool> seen;
+            auto on_match = [this, &blocked, &seen](uint8_t where) {
+                return [this, &blocked, &seen, where](uint32_t id) {
+                    const rule& r = rules[id];
+                    if(!(r.where & where))
+                        return true;
+                    if(seen.empty())
+                        seen.assign(rules.size(), false);
+                    if(!seen[id]) {
+                        seen[id] = true;
+                        counters[id].fetch_add(1, std::memory_order_relaxed);
+                    }
+                    if(r.deny)
+                        blocked = &r;
+                    return !blocked;
+                };
+            };
+
+            patterns.scan(automaton::ROOT, request.target.data(), request.target.size(), on_match(URI));
+            if(!blocked && request.target.find('%') != std::string::npos) {
+                std::string decoded = percent_decode(request.target);
+                patterns.scan(automaton::ROOT, decoded.data(), decoded.size(), on_match(URI));
+            }
+            for(size_t i = 0; !blocked && i < request.headers.size(); ++i) {
+                const auto& h = request.headers[i];
+                uint32_t state = patterns.scan(automaton::ROOT, h.first.data(), h.first.size(), on_match(HEADERS));
+                if(!blocked)
+                    state = patterns.scan(state, ": ", 2, on_match(HEADERS));
+                if(!blocked)
+                    patterns.scan(state, h.second.data(), h.second.size(), on_match(HEADERS));
+            }
+            if(!blocked && !request.body.empty())
+                patterns.scan(automaton::ROOT, request.body.data(), request.body.size(), on_match(BODY));
+            return blocked;
+        }
+
+        size_t size() const {
+            return rules.size();
+        }
+        size_t states() const {
+            return patterns.states();
+        }
+        const rule& at(size_t index) const {
+            return rules[index];
+        }
+        //how many requests matched the rule
+        uint64_t hits(size_t index) const {
+            return counters[index].load(std::memory_order_relaxed);
+        }
+
+        static std::string percent_decode(const std::string& text) {
+            std::string out;
+            out.reserve(text.size());
+            for(size_t i = 0; i < text.size(); ++i) {
+                if(text[i] == '%' && i + 2 < text.size() && isxdigit(static_cast<unsigned char>(text[i + 1])) &&
+                   isxdigit(static_cast<unsigned char>(text[i + 2]))) {
+                    out.push_back(static_cast<char>(hex(text[i + 1]) << 4 | hex(text[i + 2])));
+                    i += 2;
+                    continue;
+                }
+                out.push_back(text[i]);
+            }
+            return out;
+        }
+
+    protected:
+        static int hex(char c) {
+            return c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+        }
+
+        void load(const std::string& path) {
+            std::ifstream file(path);
+            if(!file)
+                throw std::runtime_error("Couldn't open filter_rules " + path);
+            std::string line;
+            size_t number = 0;
+            while(std::getline(file, line)) {
+                ++number;
+                if(!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                //patterns may contain '#', only whole lines are comments
+                size_t first = line.find_first_not_of(" \t");
+                if(first == std::string::npos || line[first] == '#')
+                    continue;
+                std::istringstream fields(line);
+                std::string action, name, where;
+                fields >> action >> name >> where;
+                std::string rest;
+                std::getline(fields, rest);
+                rest.erase(0, rest.find_first_not_of(" \t"));
+                std::string location = path + ":" + std::to_string(number);
+                rule r{name, unescape(rest, location), 0, action == "deny"};
+                if(action != "deny" && action != "log")
+                    throw std::runtime_error(location + " has no 'deny' or 'log' action");
+                if(where == "uri")
+                    r.where = URI;
+                else if(where == "headers")
+                    r.where = HEADERS;
+                else if(where == "body")
+                    r.where = BODY;
+                else if(where == "any")
+                    r.where = ANY;
+                else
+                    throw std::runtime_error(location + " has no 'uri', 'headers', 'body' or 'any' scope");
+                if(r.pattern.empty())
+                    throw std::runtime_error(location + " has no pattern");
+                rules.push_back(std::move(r));
+            }
+        }
+
+        static std::string unescape(const std::string& text, const std::string& location) {
+            std::string out;
+            for(size_t i = 0; i < text.size(); ++i) {
+                if(text[i] != '\\') {
+                    out.push_back(text[i]);
+                    continue;
+                }
+                if(i + 1 < text.size() && text[i + 1] == '\\') {
+                    out.push_back('\\');
+                    ++i;
+                    continue;
+                }
+                if(i + 3 < text.size() && text[i + 1] == 'x' && isxdigit(static_cast<unsigned char>(text[i + 2])) &&
+                   isxdigit(static_cast<unsigned char>(text[i + 3]))) {
+                    out.push_back(static_cast<char>(hex(text[i + 2]) << 4 | hex(text[i + 3])));
+                    i += 3;
+                    continue;
+                }
+                throw std::runtime_error(location + " has a bad escape, use \\xHH or \\\\");
+            }
+            return out;
+        }
+
+        std::vector<rule> rules;
+        automaton patterns;
+        std::unique_ptr<std::atomic<uint64_t>[]> counters;
+    };
+}
+
+#endif //__FILTER_HPP__
+
+#ifdef TEST_FILTER
+
+#include <set>
+#include <cassert>
+#include <chrono>
+#include <random>
+#include <iostream>
+
+static std::string folded(std::string text) {
+  for(auto& c : text)
+    c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+  return text;
+}
+
+//random patterns and texts over a small alphabet so matches overlap, the pattern bytes spread
+//over more than eight high nibbles so the prefilter's buckets are shared. every (id, end) the
+//automaton reports, fed in random pieces, must be what a find per pattern gives
+static void compare(std::mt19937& random) {
+  static const char alphabet[] = "aAbB0\x01~ \xe9\xc3%:";
+  auto pick = [&random]() {
+    return alphabet[random() % (sizeof(alphabet) - 1)];
+  };
+  filter::automaton a;
+  std::vector<std::string> patterns;
+  for(uint32_t id = 0; id < 40; ++id) {
+    std::string p;
+    for(size_t k = 0, length = 1 + random() % 5; k < length; ++k)
+      p.push_back(pick());
+    patterns.push_back(p);
+    a.add(p, id);
+  }
+  a.build();
+  for(int round = 0; round < 50; ++round) {
+    std::string text;
+    for(size_t k = 0, length = random() % 300; k < length; ++k)
+      text.push_back(random() % 4 ? static_cast<char>('c' + random() % 20) : pick());
+    std::set<std::pair<uint32_t, size_t> > expected, got;
+    std::string lower = folded(text);
+    for(uint32_t id = 0; id < patterns.size(); ++id) {
+      std::string p = folded(patterns[id]);
+      for(size_t at = lower.find(p); at != std::string::npos; at = lower.find(p, at + 1))
+        expected.emplace(id, at + p.size());
+    }
+    uint32_t state = filter::automaton::ROOT;
+    size_t offset = 0, reports = 0;
+    while(offset < text.size()) {
+      size_t piece = std::min(text.size() - offset, static_cast<size_t>(1 + random() % 40));
+      size_t end = offset + piece;
+      //the end of a match is only known per piece, the last byte that moved into a reporting state
+      state = a.scan(state, text.data() + offset, piece, [&](uint32_t id) {
+        std::string p = folded(patterns[id]);
+        ++reports;
+        for(size_t e = offset + 1; e <= end; ++e)
+          if(e >= p.size() && lower.compare(e - p.size(), p.size(), p) == 0 && !got.count(std::make_pair(id, e)) && expected.count(std::make_pair(id, e))) {
+            got.emplace(id, e);
+            break;
+          }
+        return true;
+      });
+      offset = end;
+    }
+    assert(got == expected && reports == expected.size());
+  }
+}
+
+//the rule that blocked, or the empty name
+static std::string verdict(const filter::request_filter& f, const std::string& target, const http::headers_t& headers = {},
+                           const std::string& body = "") {
+  http::request r;
+  r.method = "POST";
+  r.target = target;
+  r.headers = headers;
+  r.body = body;
+  const filter::rule* hit = f.check(r);
+  return hit ? hit->name : "";
+}
+
+static bool refused(const std::string& line) {
+  std::string path = "/tmp/filtertest.bad";
+  std::ofstream(path) << line << '\n';
+  try {
+    filter::request_filter f(filter::filter_config_t{{"filter_rules", path}});
+  }
+  catch(const std::runtime_error&) {
+    remove(path.c_str());
+    return true;
+  }
+  remove(path.c_str());
+  return false;
+}
+
+//checks the matching rules, then requests per second through the automaton against one find per rule:
+//  g++ -std=c++17 -O2 -DTEST_FILTER -Iinclude -x c++ include/filter/filter.hpp -o filterbench
+//  ./filterbench [rules]
+//add -mssse3 for the nibble prefilter
+int main(int argc, char** argv) {
+  size_t count = argc > 1 ? std::stoul(argv[1]) : 2000;
+  std::mt19937 random(7);
+
+  {
+    std::string path = "/tmp/filtertest.rules";
+    std::ofstream(path) << "# whole line comments only, patterns may hold '#'\n"
+                        << "deny sqli uri union select\n"
+                        << "deny traversal any ../\n"
+                        << "log scanner headers user-agent: sqlmap\n"
+                        << "deny script body <script\n"
+                        << "deny nul uri \\x00\n"
+                        << "log anchor uri #top\n"
+                        << "log slash any a\\\\b\r\n"
+                        << "\n";
+    filter::request_filter f(filter::filter_config_t{{"filter_rules", path}});
+    remove(path.c_str());
+    assert(f.size() == 7 && f.at(5).pattern == "#top" && f.at(6).pattern == "a\\b" && f.at(4).pattern == std::string(1, '\0'));
+    //case does not matter, the target is matched as sent and percent decoded
+    assert(verdict(f, "/search?q=1 UNION select") == "sqli");
+    assert(verdict(f, "/search?q=1%20Union%20SeLeCt%20x") == "sqli");
+    assert(verdict(f, "/files/..%2f..%2fetc") == "traversal" && verdict(f, "/a?b=%00") == "nul");
+    assert(verdict(f, "/search?q=union%2") == "" && verdict(f, "/search?q=unionselect") == "");
+    //a pattern may span the header name, the ': ' and the value
+    assert(verdict(f, "/", {{"User-Agent", "SQLMap/1.7"}}) == "" && f.hits(2) == 1);
+    assert(verdict(f, "/", {{"X-Agent", "user-agent: sqlmap"}}) == "" && f.hits(2) == 2);
+    assert(verdict(f, "/", {{"User-Agent", "curl"}, {"X", "sqlmap"}}) == "" && f.hits(2) == 2);
+    //scopes: uri rules don't look at headers or the body, body rules not at the target
+    assert(verdict(f, "/", {{"X-Query", "union select"}}, "union select") == "");
+    assert(verdict(f, "/?q=<script>", {{"X", "<script>"}}) == "");
+    assert(verdict(f, "/", {}, "<p><SCRIPT>alert(1)</script>") == "script");
+    assert(verdict(f, "/", {{"Referer", "http://x/../"}}) == "traversal" && verdict(f, "/", {}, "../") == "traversal");
+    //log rules count once per request however often they match
+    assert(verdict(f, "/a\\b/a\\b", {{"X", "A\\B"}}, "a\\b") == "" && f.hits(6) == 1);
+    assert(verdict(f, "/page#TOP") == "" && f.hits(5) == 1 && f.hits(0) == 2);
+
+    assert(refused("block x any y") && refused("deny x everywhere y") && refused("deny x any") && refused("deny x any \\q"));
+    bool missing = false;
+    try {
+      filter::request_filter none(filter::filter_config_t{});
+    }
+    catch(const std::runtime_error&) {
+      missing = true;
+    }
+    assert(missing);
+    for(int round = 0; round < 20; ++round)
+      compare(random);
+    std::cout << "matches ok" << std::endl;
+  }
+  std::string path = "/tmp/filterbench.rules";
+  std::vector<std::string> literals = {"union select", "../", "<script", "/etc/passwd", "sqlmap", "${jndi:", "cmd.exe", "eval("};
+  {
+    std::ofstream file(path);
+    for(size_t i = 0; i < literals.size(); ++i)
+      file << "deny known-" << i << " any " << literals[i] << '\n';
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789_-=;'()<>";
+    for(size_t i = literals.size(); i < count; ++i) {
+      std::string pattern;
+      size_t length = 6 + random() % 12;
+      for(size_t k = 0; k < length; ++k)
+        pattern.push_back(alphabet[random() % (sizeof(alphabet) - 1)]);
+      literals.push_back(pattern);
+      file << "log random-" << i << " any " << pattern << '\n';
+    }
+  }
+  filter::request_filter f(filter::filter_config_t{{"filter_rules", path}});
+
+  //ordinary browser requests, one in a hundred carries a known signature
+  std::vector<http::request> requests(1000);
+  for(size_t i = 0; i < requests.size(); ++i) {
+    auto& r = requests[i];
+    r.method = "GET";
+    r.target = "/static/app/" + std::to_string(random()) + "/bundle.min.js?v=" + std::to_string(random()) + "&lang=en-US&theme=dark";
+    if(i % 100 == 0)
+      r.target += "&q=1%20UNION%20SELECT%20password%20from%20users";
+    r.headers = {{"Host", "www.example.com"},
+                 {"User-Agent", "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36"},
+                 {"Accept", "text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8"},
+                 {"Accept-Language", "en-US,en;q=0.9"}, {"Accept-Encoding", "gzip, deflate, br"},
+                 {"Referer", "https://www.example.com/products/" + std::to_string(random())},
+                 {"Cookie", "session=" + std::to_string(random()) + std::to_string(random()) + "; theme=dark; consent=yes"}};
+  }
+  size_t bytes = 0;
+  for(auto& r : requests) {
+    bytes += r.target.size();
+    for(auto& h : r.headers)
+      bytes += h.first.size() + 2 + h.second.size();
+  }
+
+  const int rounds = 200;
+  size_t blocked = 0;
+  auto start = std::chrono::steady_clock::now();
+  for(int round = 0; round < rounds; ++round)
+    for(auto& r : requests)
+      blocked += f.check(r) != nullptr;
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << f.size() << " rules, " << f.states() << " states: " << rounds * requests.size() / elapsed / 1e6 << " M requests/s, "
+            << rounds * bytes / elapsed / 1e9 << " GB/s, " << blocked / rounds << " blocked per round" << std::endl;
+
+  //the same work done one rule at a time on lowercased copies
+  size_t naive_blocked = 0, logged = 0;
+  const int naive_rounds = 2;
+  start = std::chrono::steady_clock::now();
+  for(int round = 0; round < naive_rounds; ++round)
+    for(auto& r : requests) {
+      std::vector<std::string> texts = {filter::request_filter::percent_decode(r.target)};
+      for(auto& h : r.headers)
+        texts.push_back(h.first + ": " + h.second);
+      for(auto& t : texts)
+        for(auto& c : t)
+          c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+      bool hit = false;
+      for(size_t k = 0; k < 8 && !hit; ++k)
+        for(auto& t : texts)
+          if(t.find(literals[k]) != std::string::npos)
+            hit = true;
+      for(size_t k = 8; k < literals.size(); ++k)
+        for(auto& t : texts)
+          logged += t.find(literals[k]) != std::string::npos;
+      naive_blocked += hit;
+    }
+  elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << "one find per rule: " << naive_rounds * requests.size() / elapsed / 1e6 << " M requests/s, " << naive_blocked / naive_rounds << " blocked per round, " << logged << " logged" << std::endl;
+  assert(blocked / rounds == naive_blocked / naive_rounds && blocked / rounds == requests.size() / 100);
+  remove(path.c_str());
+  return 0;
+}
+
+#endif
@@ -0,0 +1,71 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __HASH_RING_HPP__
+#define __HASH_RING_HPP__
+
+#include "hashing/xxh64.hpp"
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+
+namespace hashing {
+    //consistent hashing with virtual nodes, each node owns the arcs ending at its points
+    class hash_ring {
+    public:
+        hash_ring() = default;
+        hash_ring(const std::vector<std::string>& nodes, size_t vnodes) : node_count(nodes.size()) {
+            points.reserve(nodes.size() * vnodes);
+            for(size_t n = 0; n < nodes.size(); ++n)
+                for(size_t v = 0; v < vnodes; ++v) {
+                    std::string label = nodes[n] + "#" + std::to_string(v);
+                    points.push_back(point{hashing::xxh64::hash(label.data(), label.size()), static_cast<uint32_t>(n)});
+                }
+            std::sort(points.begin(), points.end(), [](const point& a, const point& b) { return a.hash < b.hash; });
+        }
+
+        //the plain owner of key, what every node agrees on
+        size_t owner(const std::string& key) const {
+            return points[first(key)].node;
+        }
+
+        //consistent hashing with bounded loads: walk clockwise past nodes already carrying more than
+        //factor times the average load, so a hot key range cannot pile everything on one node
+        size_t owner(const std::string& key, const std::vector<std::atomic<uint32_t> >& loads, double factor) const {
+            uint64_t total = 0;
+            for(const auto& l : loads)
+                total += l.load(std::memory_order_relaxed);
+            auto capacity = static_cast<uint64_t>(std::ceil(factor * static_cast<double>(total + 1) / static_cast<double>(node_count)));
+            size_t start = first(key);
+            for(size_t i = 0; i < points.size(); ++i) {
+                const auto& p = points[(start + i) % points.size()];
+                if(loads[p.node].load(std::memory_order_relaxed) < capacity)
+                    return p.node;
+            }
+            return points[start].node;
+        }
+
+        size_t nodes() const {
+            return node_count;
+        }
+
+    protected:
+        struct point {
+            uint64_t hash;
+            uint32_t node;
+        };
+        size_t first(const std::string& key) const {
+            uint64_t h = hashing::xxh64::hash(key.data(), key.size());
+            auto found = std::lower_bound(points.begin(), points.end(), h, [](const point& p, uint64_t v) { return p.hash < v; });
+            return found == points.end() ? 0 : static_cast<size_t>(found - points.begin());
+        }
+        size_t node_count = 0;
+        std::vector<point> points;
+    };
+}
+
+#endif //__HASH_RING_HPP__
@@ -0,0 +1,98 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __XXH64_HPP__
+#define __XXH64_HPP__
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+namespace hashing {
+    //xxh64, small enough to carry here and fast enough that hashing is bound by reads
+    class xxh64 {
+    public:
+        explicit xxh64(uint64_t seed = 0) : total(0), buffered(0) {
+            v[0] = seed + PRIME1 + PRIME2;
+            v[1] = seed + PRIME2;
+            v[2] = seed;
+            v[3] = seed - PRIME1;
+            this->seed = seed;
+        }
+        void update(const void* data, size_t length) {
+            auto* p = static_cast<const uint8_t*>(data);
+            total += length;
+            if(buffered + length < 32) {
+                memcpy(buffer + buffered, p, length);
+                buffered += length;
+                return;
+            }
+            if(buffered) {
+                size_t fill = 32 - buffered;
+                memcpy(buffer + buffered, p, fill);
+                stripe(buffer);
+                p += fill;
+                length -= fill;
+                buffered = 0;
+            }
+            for(; length >= 32; p += 32, length -= 32)
+                stripe(p);
+            memcpy(buffer, p, length);
+            buffered = length;
+        }
+        uint64_t digest() const {
+            uint64_t h;
+            if(total >= 32) {
+                h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+                for(auto lane : v)
+                    h = (h ^ round(0, lane)) * PRIME1 + PRIME4;
+            }
+            else {
+                h = seed + PRIME5;
+            }
+            h += total;
+            const uint8_t* p = buffer;
+            size_t length = buffered;
+            for(; length >= 8; p += 8, length -= 8)
+                h = rotl(h ^ round(0, read64(p)), 27) * PRIME1 + PRIME4;
+            if(length >= 4) {
+                h = rotl(h ^ (read32(p) * PRIME1), 23) * PRIME2 + PRIME3;
+                p += 4;
+                length -= 4;
+            }
+            for(; length; ++p, --length)
+                h = rotl(h ^ (*p * PRIME5), 11) * PRIME1;
+            h ^= h >> 33; h *= PRIME2;
+            h ^= h >> 29; h *= PRIME3;
+            h ^= h >> 32;
+            return h;
+        }
+        static uint64_t hash(const void* data, size_t length, uint64_t seed = 0) {
+            xxh64 state(seed);
+            state.update(data, length);
+            return state.digest();
+        }
+    protected:
+        static constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+        static constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+        static constexpr uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+        static constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+        static constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+        static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+        static uint64_t read64(const uint8_t* p) { uint64_t x; memcpy(&x, p, 8); return x; }
+        static uint64_t read32(const uint8_t* p) { uint32_t x; memcpy(&x, p, 4); return x; }
+        static uint64_t round(uint64_t acc, uint64_t input) { return rotl(acc + input * PRIME2, 31) * PRIME1; }
+        void stripe(const uint8_t* p) {
+            for(int i = 0; i < 4; ++i)
+                v[i] = round(v[i], read64(p + i * 8));
+        }
+        uint64_t v[4];
+        uint64_t seed;
+        uint64_t total;
+        uint8_t buffer[32];
+        size_t buffered;
+    };
+}
+
+#endif //__XXH64_HPP__
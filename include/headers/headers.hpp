@@ -0,0 +1,441 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __HEADERS_HPP__
+#define __HEADERS_HPP__
+
+#include "http/http.hpp"
+
+#include <bitset>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <unordered_map>
+
+namespace headers {
+    using headers_config_t = std::unordered_map<std::string, std::string>;
+
+    //headers we know by number, rules and lookups on them compare an id instead of a name
+    enum id : uint8_t {
+        UNKNOWN = 0, ACCEPT, ACCEPT_ENCODING, ACCEPT_LANGUAGE, ACCEPT_RANGES, ACCESS_CONTROL_ALLOW_ORIGIN, AGE,
+        AUTHORIZATION, CACHE_CONTROL, CONNECTION, CONTENT_DISPOSITION, CONTENT_ENCODING, CONTENT_LENGTH,
+        CONTENT_SECURITY_POLICY, CONTENT_TYPE, COOKIE, DATE, ETAG, EXPIRES, FORWARDED, HOST, IF_MODIFIED_SINCE,
+        IF_NONE_MATCH, KEEP_ALIVE, LAST_MODIFIED, LOCATION, ORIGIN, PRAGMA, PROXY_AUTHORIZATION, RANGE, REFERER,
+        REFERRER_POLICY, SERVER, SET_COOKIE, STRICT_TRANSPORT_SECURITY, TE, TRAILER, TRANSFER_ENCODING, UPGRADE,
+        USER_AGENT, VARY, VIA, X_CONTENT_TYPE_OPTIONS, X_FORWARDED_FOR, X_FORWARDED_PROTO, X_FRAME_OPTIONS,
+        X_POWERED_BY, X_REAL_IP, X_REQUEST_ID, COUNT
+    };
+
+    inline const char* name_of(id header) {
+        static const char* const names[COUNT] = {
+            "", "Accept", "Accept-Encoding", "Accept-Language", "Accept-Ranges", "Access-Control-Allow-Origin", "Age",
+            "Authorization", "Cache-Control", "Connection", "Content-Disposition", "Content-Encoding", "Content-Length",
+            "Content-Security-Policy", "Content-Type", "Cookie", "Date", "ETag", "Expires", "Forwarded", "Host",
+            "If-Modified-Since", "If-None-Match", "Keep-Alive", "Last-Modified", "Location", "Origin", "Pragma",
+            "Proxy-Authorization", "Range", "Referer", "Referrer-Policy", "Server", "Set-Cookie",
+            "Strict-Transport-Security", "TE", "Trailer", "Transfer-Encoding", "Upgrade", "User-Agent", "Vary", "Via",
+            "X-Content-Type-Options", "X-Forwarded-For", "X-Forwarded-Proto", "X-Frame-Options", "X-Powered-By",
+            "X-Real-IP", "X-Request-ID"
+        };
+        return names[header];
+    }
+
+    inline uint32_t folded_hash(const char* text, size_t size) {
+        uint32_t h = 2166136261u;
+        for(size_t i = 0; i < size; ++i)
+            h = (h ^ static_cast<uint8_t>(text[i] | 0x20)) * 16777619u;
+        return h;
+    }
+
+    //the id of a header name in any case, UNKNOWN for the rest. a 256 slot table on a case
+    //folded hash, one strncasecmp confirms the hit
+    inline id lookup(const char* name, size_t length) {
+        struct table {
+            uint8_t slots[256];
+            table() : slots() {
+                for(int i = 1; i < COUNT; ++i) {
+                    const char* n = name_of(static_cast<id>(i));
+                    uint32_t at = folded_hash(n, strlen(n)) & 255;
+                    while(slots[at])
+                        at = (at + 1) & 255;
+                    slots[at] = static_cast<uint8_t>(i);
+                }
+            }
+        };
+        static const table known;
+        for(uint32_t at = folded_hash(name, length) & 255; known.slots[at]; at = (at + 1) & 255) {
+            const char* candidate = name_of(static_cast<id>(known.slots[at]));
+            if(strlen(candidate) == length && strncasecmp(candidate, name, length) == 0)
+                return static_cast<id>(known.slots[at]);
+        }
+        return UNKNOWN;
+    }
+    inline id lookup(const std::string& name) {
+        return lookup(name.data(), name.size());
+    }
+
+    enum class direction : uint8_t {REQUEST, RESPONSE};
+
+    //header rules of one route compiled for one direction. the rules are folded at compile
+    //time: a remove cancels earlier adds of the same header, a set is a remove and an add,
+    //so what is left is one pass dropping headers by id, a few drops by name for headers
+    //without an id, and a block of added lines serialized up front. the bytecode is those
+    //steps in order
+    class program {
+    public:
+        enum op : uint8_t {DROP_IDS, DROP_NAME, APPEND};
+        struct instruction {
+            op code;
+            uint32_t operand;
+        };
+
+        void add(const std::string& name, const std::string& value) {
+            pending.emplace_back(name, value);
+        }
+        void set(const std::string& name, const std::string& value) {
+            remove(name);
+            add(name, value);
+        }
+        void remove(const std::string& name) {
+            id header = lookup(name);
+            pending.erase(std::remove_if(pending.begin(), pending.end(), [&name, header](const std::pair<std::string, std::string>& p) {
+                return header != UNKNOWN ? lookup(p.first) == header : strcasecmp(p.first.c_str(), name.c_str()) == 0;
+            }), pending.end());
+            if(header != UNKNOWN) {
+                drop_ids.set(header);
+            }
+            else if(std::none_of(drop_names.begin(), drop_names.end(), [&name](const std::string& n) { return strcasecmp(n.c_str(), name.c_str()) == 0; })) {
+                drop_names.push_back(name);
+            }
+        }
+
+        //lays the folded rules out as instructions, again after more rules were added
+        void compile() {
+            code.clear();
+            lines.clear();
+            added.clear();
+            if(drop_ids.any())
+                code.push_back(instruction{DROP_IDS, 0});
+            for(uint32_t i = 0; i < drop_names.size(); ++i)
+                code.push_back(instruction{DROP_NAME, i});
+            for(const auto& p : pending) {
+                lines.append(p.first).append(": ").append(p.second).append("\r\n");
+                added.emplace_back(p.first, p.second);
+            }
+            if(!pending.empty())
+                code.push_back(instruction{APPEND, 0});
+        }
+
+        //whether the drop instructions take out a header of this name
+        bool drops(const char* name, size_t length) const {
+            if(code.empty() || code.front().code == APPEND)
+                return false;
+            return drops(lookup(name, length), name, length);
+        }
+        //the same with the id already resolved, a header with one is only ever dropped by it
+        bool drops(id header, const char* name, size_t length) const {
+            if(header != UNKNOWN)
+                return drop_ids.test(header);
+            for(const auto& n : drop_names)
+                if(n.size() == length && strncasecmp(n.data(), name, length) == 0)
+                    return true;
+            return false;
+        }
+
+        //runs the program on headers in one pass. with out the added headers come out as the
+        //ready made lines to write after the others, otherwise they are appended to headers
+        void apply(http::headers_t& headers, std::string* out = nullptr) const {
+            if(code.empty())
+                return;
+            if(code.front().code != APPEND)
+                headers.erase(std::remove_if(headers.begin(), headers.end(), [this](const std::pair<std::string, std::string>& h) {
+                    return drops(h.first.data(), h.first.size());
+                }), headers.end());
+            if(code.back().code == APPEND) {
+                if(out)
+                    out->append(lines);
+                else
+                    headers.insert(headers.end(), added.begin(), added.end());
+            }
+        }
+
+        //the added lines, "Name: value\r\n" each
+        const std::string& appended() const {
+            return lines;
+        }
+
+        bool empty() const {
+            return code.empty();
+        }
+        const std::vector<instruction>& instructions() const {
+            return code;
+        }
+
+    protected:
+        //the folded adds, kept so compile can run again
+        std::vector<std::pair<std::string, std::string> > pending;
+        std::bitset<COUNT> drop_ids;
+        std::vector<std::string> drop_names;
+        std::vector<instruction> code;
+        std::string lines;
+        http::headers_t added;
+    };
+
+    //a response head with the program run while writing it: dropped headers are skipped and
+    //the added lines copied in whole, the response itself is left alone
+    inline std::string serialize_head(const http::response& response, const program& rules) {
+        std::string out;
+        out.reserve(response.headers.size() * 32 + rules.appended().size() + 32);
+        out.append(response.version).push_back(' ');
+        out.append(std::to_string(response.status)).push_back(' ');
+        out.append(response.reason.empty() ? http::reason(response.status) : response.reason).append("\r\n");
+        for(const auto& h : response.headers)
+            if(!rules.drops(h.first.data(), h.first.size()))
+                out.append(h.first).append(": ").append(h.second).append("\r\n");
+        out.append(rules.appended()).append("\r\n");
+        return out;
+    }
+
+    //add, set and remove rules for request and response headers per route, from the
+    //header_rules file with one 'route request|response add|set|remove Name [value]' per line.
+    //a route is a path prefix and takes the rules of every shorter route containing it first,
+    //its own after, so each route ends up with one program per direction
+    class header_rules {
+    public:
+        header_rules() = delete;
+        explicit header_rules(const headers_config_t& config) {
+            auto file = config.find("header_rules");
+            if(file == config.end())
+                throw std::runtime_error("header_rules is required");
+            load(file->second);
+        }
+        header_rules(const header_rules&) = delete;
+        header_rules& operator=(const header_rules&) = delete;
+
+        //the program of the longest route prefixing path, nullptr when no route does
+        const program* find(const std::string& path, direction which) const {
+            const compiled* best = nullptr;
+            for(const auto& r : routes)
+                if(path.compare(0, r.prefix.size(), r.prefix) == 0 && (!best || r.prefix.size() > best->prefix.size()))
+                    best = &r;
+            if(!best)
+                return nullptr;
+            return which == direction::REQUEST ? &best->request : &best->response;
+        }
+
+        size_t size() const {
+            return routes.size();
+        }
+
+    protected:
+        struct rule {
+            direction which;
+            std::string verb;
+            std::string name;
+            std::string value;
+        };
+        struct compiled {
+            std::string prefix;
+            program request;
+            program response;
+        };
+
+        void load(const std::string& path) {
+            std::ifstream file(path);
+            if(!file)
+                throw std::runtime_error("Couldn't open header_rules " + path);
+            std::vector<std::pair<std::string, rule> > rules;
+            std::string line;
+            size_t number = 0;
+            while(std::getline(file, line)) {
+                ++number;
+                if(!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                std::istringstream fields(line);
+                std::string route, which, verb, name, value;
+                if(!(fields >> route) || route[0] == '#')
+                    continue;
+                std::string location = path + ":" + std::to_string(number);
+                if(!(fields >> which >> verb >> name) || (which != "request" && which != "response") ||
+                   (verb != "add" && verb != "set" && verb != "remove"))
+                    throw std::runtime_error(location + " is not 'route request|response add|set|remove Name [value]'");
+                std::getline(fields, value);
+                value.erase(0, value.find_first_not_of(" \t"));
+                if(verb != "remove" && value.empty())
+                    throw std::runtime_error(location + " has no value for " + name);
+                if(name.find_first_of(": \t\r\n") != std::string::npos || value.find_first_of("\r\n") != std::string::npos)
+                    throw std::runtime_error(location + " has a header that would break the message");
+                rules.emplace_back(route, rule{which == "request" ? direction::REQUEST : direction::RESPONSE, verb, name, value});
+            }
+
+            std::vector<std::string> prefixes;
+            for(const auto& r : rules)
+                if(std::find(prefixes.begin(), prefixes.end(), r.first) == prefixes.end())
+                    prefixes.push_back(r.first);
+            //parents first, in file order among rules of the same route
+            for(const auto& prefix : prefixes) {
+                compiled c{prefix, program(), program()};
+                std::vector<std::string> parents;
+                for(const auto& p : prefixes)
+                    if(prefix.compare(0, p.size(), p) == 0)
+                        parents.push_back(p);
+                std::sort(parents.begin(), parents.end(), [](const std::string& a, const std::string& b) { return a.size() < b.size(); });
+                for(const auto& parent : parents)
+                    for(const auto& r : rules)
+                        if(r.first == parent)
+                            apply_rule(r.second.which == direction::REQUEST ? c.request : c.response, r.second);
+                c.request.compile();
+                c.response.compile();
+                routes.push_back(std::move(c));
+            }
+        }
+
+        static void apply_rule(program& p, const rule& r) {
+            if(r.verb == "add")
+                p.add(r.name, r.value);
+            else if(r.verb == "set")
+                p.set(r.name, r.value);
+            else
+                p.remove(r.name);
+        }
+
+        std::vector<compiled> routes;
+    };
+}
+
+#endif //__HEADERS_HPP__
+
+#ifdef TEST_HEADERS
+//g++ -std=c++17 -O2 -DTEST_HEADERS -Iinclude -x c++ include/headers/headers.hpp -o headersbench
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <unistd.h>
+
+static std::unique_ptr<headers::header_rules> load(const std::string& text) {
+  char path[] = "/tmp/header_rulesXXXXXX";
+  int fd = mkstemp(path);
+  assert(write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size()));
+  close(fd);
+  try {
+    std::unique_ptr<headers::header_rules> rules(new headers::header_rules(headers::headers_config_t{{"header_rules", path}}));
+    unlink(path);
+    return rules;
+  }
+  catch(...) {
+    unlink(path);
+    throw;
+  }
+}
+
+static bool refused(const std::string& text) {
+  try {
+    load(text);
+  }
+  catch(const std::runtime_error&) {
+    return true;
+  }
+  return false;
+}
+
+int main() {
+  //ids in any case, nothing for names we don't know
+  assert(headers::lookup("content-length") == headers::CONTENT_LENGTH && headers::lookup("X-REQUEST-ID") == headers::X_REQUEST_ID);
+  assert(headers::lookup("X-Debug") == headers::UNKNOWN && headers::lookup("Content-Lengt") == headers::UNKNOWN);
+  for(int i = 1; i < headers::COUNT; ++i)
+    assert(headers::lookup(headers::name_of(static_cast<headers::id>(i))) == i);
+
+  //a remove cancels earlier adds, a set is a remove and an add, names compare without case
+  headers::program p;
+  p.add("X-Trace", "1");
+  p.add("Cache-Control", "public");
+  p.remove("cache-control");
+  p.set("Server", "cheehttpd");
+  p.remove("x-debug");
+  p.remove("X-DEBUG");
+  p.compile();
+  assert(p.appended() == "X-Trace: 1\r\nServer: cheehttpd\r\n");
+  assert(p.instructions().size() == 3 && p.instructions()[0].code == headers::program::DROP_IDS &&
+         p.instructions()[1].code == headers::program::DROP_NAME && p.instructions()[2].code == headers::program::APPEND);
+  assert(p.drops("SERVER", 6) && p.drops("x-Debug", 7) && !p.drops("X-Trace", 7) && !p.drops("Content-Type", 12));
+  http::headers_t h{{"server", "nginx"}, {"Cache-Control", "private"}, {"X-Debug", "1"}, {"Content-Type", "text/plain"}};
+  p.apply(h);
+  assert((h == http::headers_t{{"Content-Type", "text/plain"}, {"X-Trace", "1"}, {"Server", "cheehttpd"}}));
+  //compiling again changes nothing, adding more and compiling takes them in
+  p.compile();
+  h = {{"Server", "nginx"}};
+  std::string lines;
+  p.apply(h, &lines);
+  assert(h.empty() && lines == p.appended() && p.appended() == "X-Trace: 1\r\nServer: cheehttpd\r\n");
+  p.add("Vary", "Origin");
+  p.compile();
+  h.clear();
+  p.apply(h);
+  assert(h.size() == 3 && h.back().first == "Vary" && p.appended().find("Vary: Origin\r\n") == p.appended().size() - 14);
+  headers::program nothing;
+  nothing.compile();
+  assert(nothing.empty() && !nothing.drops("Server", 6));
+
+  //routes take their parents' rules first, the longest prefix wins
+  auto loaded = load("# comment\n"
+                    "/ response set Server cheehttpd\n"
+                    "/ response remove X-Powered-By\n"
+                    "/ request add X-Forwarded-Proto https\r\n"
+                    "/api response add Cache-Control no-store\n"
+                    "/api response set X-Frame-Options DENY\n"
+                    "/api response remove X-Debug\n"
+                    "/api/public response remove Cache-Control\n"
+                    "/api/public response add Access-Control-Allow-Origin *\n");
+  const headers::header_rules& rules = *loaded;
+  assert(rules.size() == 3);
+  const headers::program* api = rules.find("/api/users", headers::direction::RESPONSE);
+  const headers::program* open = rules.find("/api/public/x", headers::direction::RESPONSE);
+  assert(api && open && rules.find("/other", headers::direction::RESPONSE) == rules.find("/", headers::direction::RESPONSE));
+  assert(rules.find("/api", headers::direction::REQUEST)->appended() == "X-Forwarded-Proto: https\r\n");
+  assert(open->appended() == "Server: cheehttpd\r\nX-Frame-Options: DENY\r\nAccess-Control-Allow-Origin: *\r\n");
+  assert(refused("/ response add X-Empty\n") && refused("/ both add X-A b\n") && refused("/ response replace X-A b\n"));
+  assert(refused("/ response add Bad:Name x\n"));
+
+  http::response base;
+  base.status = 200;
+  base.reason = "OK";
+  base.headers = {{"Content-Type", "application/json"}, {"Content-Length", "42"}, {"X-Powered-By", "php"},
+                  {"Server", "nginx"}, {"x-debug", "1"}, {"Date", "Sun, 18 Oct 2026 00:00:00 GMT"}};
+  const std::string expected = "HTTP/1.1 200 OK\r\n"
+                               "Content-Type: application/json\r\n"
+                               "Content-Length: 42\r\n"
+                               "Date: Sun, 18 Oct 2026 00:00:00 GMT\r\n"
+                               "Server: cheehttpd\r\n"
+                               "Cache-Control: no-store\r\n"
+                               "X-Frame-Options: DENY\r\n\r\n";
+  assert(headers::serialize_head(base, *api) == expected);
+  http::response copy = base;
+  api->apply(copy.headers);
+  assert(http::serialize_head(copy) == expected);
+
+  const int n = 1000000;
+  size_t total = 0;
+  auto start = std::chrono::steady_clock::now();
+  for(int i = 0; i < n; ++i)
+    total += headers::serialize_head(base, *api).size();
+  double compiled = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  start = std::chrono::steady_clock::now();
+  for(int i = 0; i < n; ++i) {
+    http::response r = base;
+    http::set_header(r.headers, "Server", "cheehttpd");
+    http::remove_header(r.headers, "X-Powered-By");
+    r.headers.emplace_back("Cache-Control", "no-store");
+    http::set_header(r.headers, "X-Frame-Options", "DENY");
+    http::remove_header(r.headers, "X-Debug");
+    total += http::serialize_head(r).size();
+  }
+  double naive = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  //the same bytes either way, the by name edits keep Server where it was
+  assert(total == 2 * n * expected.size());
+  std::cout << "program " << n / compiled << " heads/s, by name " << n / naive << " heads/s (" << total << ")" << std::endl;
+  return 0;
+}
+#endif
@@ -0,0 +1,228 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __HTTP_HPP__
+#define __HTTP_HPP__
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <strings.h>
+
+namespace http {
+    //headers keep their arrival order and repeats, lookups are case insensitive
+    using headers_t = std::vector<std::pair<std::string, std::string> >;
+
+    inline bool iequals(const std::string& a, const char* b) {
+        return strcasecmp(a.c_str(), b) == 0;
+    }
+
+    inline const std::string* find_header(const headers_t& headers, const char* name) {
+        for(const auto& h : headers)
+            if(iequals(h.first, name))
+                return &h.second;
+        return nullptr;
+    }
+
+    //replaces every occurrence of name with a single header, or appends it
+    inline void set_header(headers_t& headers, const std::string& name, const std::string& value) {
+        bool replaced = false;
+        for(auto it = headers.begin(); it != headers.end();) {
+            if(iequals(it->first, name.c_str())) {
+                if(replaced) {
+                    it = headers.erase(it);
+                    continue;
+                }
+                it->second = value;
+                replaced = true;
+            }
+            ++it;
+        }
+        if(!replaced)
+            headers.emplace_back(name, value);
+    }
+
+    inline void remove_header(headers_t& headers, const char* name) {
+        for(auto it = headers.begin(); it != headers.end();)
+            it = iequals(it->first, name) ? headers.erase(it) : std::next(it);
+    }
+
+    struct request {
+        std::string method;
+        std::string target;
+        std::string version = "HTTP/1.1";
+        headers_t headers;
+        std::string body;
+    };
+
+    struct response {
+        int status = 0;
+        std::string reason;
+        std::string version = "HTTP/1.1";
+        headers_t headers;
+        std::string body;
+    };
+
+    inline const char* reason(int status) {
+        switch(status) {
+            case 100: return "Continue";
+            case 101: return "Switching Protocols";
+            case 200: return "OK";
+            case 201: return "Created";
+            case 204: return "No Content";
+            case 206: return "Partial Content";
+            case 301: return "Moved Permanently";
+            case 302: return "Found";
+            case 304: return "Not Modified";
+            case 307: return "Temporary Redirect";
+            case 308: return "Permanent Redirect";
+            case 400: return "Bad Request";
+            case 403: return "Forbidden";
+            case 404: return "Not Found";
+            case 405: return "Method Not Allowed";
+            case 408: return "Request Timeout";
+            case 413: return "Content Too Large";
+            case 416: return "Range Not Satisfiable";
+            case 429: return "Too Many Requests";
+            case 500: return "Internal Server Error";
+            case 502: return "Bad Gateway";
+            case 503: return "Service Unavailable";
+            case 504: return "Gateway Timeout";
+            default: return "Unknown";
+        }
+    }
+
+    //finds the end of a message head, returns the offset just past the blank line or 0 if incomplete
+    inline size_t head_length(const char* data, size_t size) {
+        if(size < 4)
+            return 0;
+        const char* found = static_cast<const char*>(memmem(data, size, "\r\n\r\n", 4));
+        return found ? static_cast<size_t>(found - data) + 4 : 0;
+    }
+
+    //parses the header lines between begin and end, throws on anything malformed
+    inline void parse_headers(const char* begin, const char* end, headers_t& headers) {
+        while(begin < end) {
+            const char* eol = static_cast<const char*>(memmem(begin, end - begin, "\r\n", 2));
+            if(!eol)
+                eol = end;
+            if(eol == begin)
+                break;
+            const char* colon = static_cast<const char*>(memchr(begin, ':', eol - begin));
+            if(!colon || colon == begin)
+                throw std::runtime_error("Malformed header line");
+            const char* value = colon + 1;
+            while(value < eol && (*value == ' ' || *value == '\t'))
+                ++value;
+            const char* value_end = eol;
+            while(value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+                --value_end;
+            headers.emplace_back(std::string(begin, colon), std::string(value, value_end));
+            begin = eol + 2;
+        }
+    }
+
+    //parses 'METHOD target HTTP/x.y' and headers, returns the head length or 0 if more bytes are needed
+    inline size_t parse_request_head(const char* data, size_t size, request& out) {
+        size_t length = head_length(data, size);
+        if(!length)
+            return 0;
+        const char* end = data + length - 2;
+        const char* eol = static_cast<const char*>(memmem(data, end - data, "\r\n", 2));
+        const char* first = static_cast<const char*>(memchr(data, ' ', eol - data));
+        const char* second = first ? static_cast<const char*>(memchr(first + 1, ' ', eol - first - 1)) : nullptr;
+        if(!second)
+            throw std::runtime_error("Malformed request line");
+        out.method.assign(data, first);
+        out.target.assign(first + 1, second);
+        out.version.assign(second + 1, eol);
+        if(out.version.compare(0, 5, "HTTP/") != 0)
+            throw std::runtime_error("Malformed request version");
+        out.headers.clear();
+        parse_headers(eol + 2, end, out.headers);
+        return length;
+    }
+
+    //parses 'HTTP/x.y status reason' and headers, returns the head length or 0 if more bytes are needed
+    inline size_t parse_response_head(const char* data, size_t size, response& out) {
+        size_t length = head_length(data, size);
+        if(!length)
+            return 0;
+        const char* end = data + length - 2;
+        const char* eol = static_cast<const char*>(memmem(data, end - data, "\r\n", 2));
+        const char* first = static_cast<const char*>(memchr(data, ' ', eol - data));
+        if(!first || eol - first < 4 || std::string(data, 5) != "HTTP/")
+            throw std::runtime_error("Malformed status line");
+        out.version.assign(data, first);
+        out.status = 0;
+        for(const char* c = first + 1; c < first + 4; ++c) {
+            if(*c < '0' || *c > '9')
+                throw std::runtime_error("Malformed status code");
+            out.status = out.status * 10 + (*c - '0');
+        }
+        out.reason.assign(first + 4 < eol ? first + 5 : eol, eol);
+        out.headers.clear();
+        parse_headers(eol + 2, end, out.headers);
+        return length;
+    }
+
+    inline void append_headers(std::string& out, const headers_t& headers) {
+        for(const auto& h : headers) {
+            out.append(h.first);
+            out.append(": ");
+            out.append(h.second);
+            out.append("\r\n");
+        }
+        out.append("\r\n");
+    }
+
+    //the request head, the body is sent separately so it can be streamed
+    inline std::string serialize_head(const request& r) {
+        std::string out;
+        out.reserve(r.method.size() + r.target.size() + r.headers.size() * 32 + 16);
+        out.append(r.method).push_back(' ');
+        out.append(r.target).push_back(' ');
+        out.append(r.version).append("\r\n");
+        append_headers(out, r.headers);
+        return out;
+    }
+
+    inline std::string serialize_head(const response& r) {
+        std::string out;
+        out.reserve(r.headers.size() * 32 + 32);
+        out.append(r.version).push_back(' ');
+        out.append(std::to_string(r.status)).push_back(' ');
+        out.append(r.reason.empty() ? reason(r.status) : r.reason).append("\r\n");
+        append_headers(out, r.headers);
+        return out;
+    }
+
+    //whether a response to method with this status can carry a body at all
+    inline bool has_body(const std::string& method, int status) {
+        return method != "HEAD" && status >= 200 && status != 204 && status != 304;
+    }
+
+    //http/1.1 defaults to keep-alive, http/1.0 to close
+    inline bool keep_alive(const std::string& version, const headers_t& headers) {
+        const std::string* connection = find_header(headers, "Connection");
+        if(connection) {
+            if(strcasestr(connection->c_str(), "close"))
+                return false;
+            if(strcasestr(connection->c_str(), "keep-alive"))
+                return true;
+        }
+        return version != "HTTP/1.0";
+    }
+
+    //methods safe to send twice, the only ones we retry or hedge
+    inline bool idempotent(const std::string& method) {
+        return method == "GET" || method == "HEAD" || method == "OPTIONS" || method == "PUT" ||
+               method == "DELETE" || method == "TRACE";
+    }
+}
+
+#endif //__HTTP_HPP__
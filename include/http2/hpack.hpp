@@ -0,0 +1,539 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __HPACK_HPP__
+#define __HPACK_HPP__
+
+#include "http/http.hpp"
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace http2 {
+    //anything malformed in a header block, fatal to the whole connection
+    class hpack_error : public std::runtime_error {
+    public:
+        explicit hpack_error(const std::string& what) : std::runtime_error(what) {}
+    };
+
+    namespace hpack {
+        struct field {
+            const char* name;
+            const char* value;
+        };
+
+        //rfc 7541 appendix a, index 1 is the first entry
+        static const field static_table[] = {
+            {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+            {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"}, {":status", "200"},
+            {":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+            {":status", "404"}, {":status", "500"}, {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+            {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+            {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+            {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+            {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""},
+            {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""},
+            {"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""},
+            {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+            {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+            {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+            {"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+            {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""},
+            {"www-authenticate", ""},
+        };
+        static const size_t static_size = sizeof(static_table) / sizeof(static_table[0]);
+
+        struct code {
+            uint32_t bits;
+            uint8_t length;
+        };
+
+        //rfc 7541 appendix b, symbol 256 is eos
+        static const code huffman_codes[257] = {
+            {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+            {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+            {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+            {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+            {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+            {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+            {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+            {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+            {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+            {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+            {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+            {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+            {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+            {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+            {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+            {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+            {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+            {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+            {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+            {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+            {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+            {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+            {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+            {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+            {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+            {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+            {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+            {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+            {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+            {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+            {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+            {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+            {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+            {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+            {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+            {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+            {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+            {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+            {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+            {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+            {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+            {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+            {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+            {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+            {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+            {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+            {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+            {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+            {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+            {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+            {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+            {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+            {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+            {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+            {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+            {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+            {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+            {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+            {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+            {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+            {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+            {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+            {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+            {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+            {0x3fffffff, 30}
+        };
+
+        //a binary tree over the huffman codes, walked a bit at a time when decoding
+        class huffman_tree {
+        public:
+            huffman_tree() {
+                nodes.push_back({{0, 0}, -1});
+                for(int symbol = 0; symbol < 257; ++symbol) {
+                    size_t at = 0;
+                    for(int bit = huffman_codes[symbol].length - 1; bit >= 0; --bit) {
+                        int branch = (huffman_codes[symbol].bits >> bit) & 1;
+                        if(!nodes[at].next[branch]) {
+                            nodes[at].next[branch] = static_cast<uint16_t>(nodes.size());
+                            nodes.push_back({{0, 0}, -1});
+                        }
+                        at = nodes[at].next[branch];
+                    }
+                    nodes[at].symbol = static_cast<int16_t>(symbol);
+                }
+            }
+
+            void decode(const uint8_t* data, size_t size, std::string& out) const {
+                size_t at = 0;
+                int depth = 0;
+                bool ones = true;
+                for(size_t i = 0; i < size; ++i) {
+                    for(int bit = 7; bit >= 0; --bit) {
+                        int branch = (data[i] >> bit) & 1;
+                        at = nodes[at].next[branch];
+                        ++depth;
+                        ones = ones && branch;
+                        if(!at)
+                            throw hpack_error("Invalid huffman code");
+                        if(nodes[at].symbol >= 0) {
+                            if(nodes[at].symbol == 256)
+                                throw hpack_error("Huffman string contains eos");
+                            out.push_back(static_cast<char>(nodes[at].symbol));
+                            at = 0;
+                            depth = 0;
+                            ones = true;
+                        }
+                    }
+                }
+                //whatever is left must be a short prefix of eos, that is all ones
+                if(depth > 7 || !ones)
+                    throw hpack_error("Invalid huffman padding");
+            }
+
+        protected:
+            struct node {
+                uint16_t next[2];
+                int16_t symbol;
+            };
+            std::vector<node> nodes;
+        };
+
+        inline const huffman_tree& tree() {
+            static const huffman_tree instance;
+            return instance;
+        }
+
+        //prefix coded integer, the first byte keeps its bits above the prefix
+        inline void encode_integer(std::string& out, uint8_t first, int prefix, uint64_t value) {
+            uint64_t limit = (uint64_t(1) << prefix) - 1;
+            if(value < limit) {
+                out.push_back(static_cast<char>(first | value));
+                return;
+            }
+            out.push_back(static_cast<char>(first | limit));
+            value -= limit;
+            while(value >= 128) {
+                out.push_back(static_cast<char>((value & 127) | 128));
+                value >>= 7;
+            }
+            out.push_back(static_cast<char>(value));
+        }
+
+        inline uint64_t decode_integer(const uint8_t*& at, const uint8_t* end, int prefix) {
+            if(at == end)
+                throw hpack_error("Truncated integer");
+            uint64_t limit = (uint64_t(1) << prefix) - 1;
+            uint64_t value = *at++ & limit;
+            if(value < limit)
+                return value;
+            for(int shift = 0;; shift += 7) {
+                if(at == end || shift > 56)
+                    throw hpack_error("Truncated or oversized integer");
+                uint8_t b = *at++;
+                value += uint64_t(b & 127) << shift;
+                if(!(b & 128))
+                    return value;
+            }
+        }
+
+        //plain literal strings, huffman would save a fifth on text but costs on every header
+        inline void encode_string(std::string& out, const std::string& value) {
+            encode_integer(out, 0, 7, value.size());
+            out.append(value);
+        }
+
+        inline std::string decode_string(const uint8_t*& at, const uint8_t* end) {
+            if(at == end)
+                throw hpack_error("Truncated string");
+            bool huffman = *at & 128;
+            uint64_t length = decode_integer(at, end, 7);
+            if(length > static_cast<uint64_t>(end - at))
+                throw hpack_error("Truncated string");
+            std::string value;
+            if(huffman)
+                tree().decode(at, static_cast<size_t>(length), value);
+            else
+                value.assign(reinterpret_cast<const char*>(at), static_cast<size_t>(length));
+            at += length;
+            return value;
+        }
+
+        //the fifo of recently indexed fields both sides keep in lockstep
+        class dynamic_table {
+        public:
+            explicit dynamic_table(size_t capacity) : capacity(capacity), used(0) {}
+            static size_t cost(const std::string& name, const std::string& value) {
+                return name.size() + value.size() + 32;
+            }
+            void insert(std::string name, std::string value) {
+                size_t needed = cost(name, value);
+                while(!entries.empty() && used + needed > capacity)
+                    drop();
+                //an entry larger than the table just empties it
+                if(needed > capacity)
+                    return;
+                used += needed;
+                entries.emplace_front(std::move(name), std::move(value));
+            }
+            void resize(size_t size) {
+                capacity = size;
+                while(used > capacity)
+                    drop();
+            }
+            //index 0 is the newest entry
+            const std::pair<std::string, std::string>& at(size_t index) const {
+                if(index >= entries.size())
+                    throw hpack_error("Header index out of range");
+                return entries[index];
+            }
+            size_t size() const {
+                return entries.size();
+            }
+            size_t limit() const {
+                return capacity;
+            }
+        protected:
+            void drop() {
+                used -= cost(entries.back().first, entries.back().second);
+                entries.pop_back();
+            }
+            size_t capacity;
+            size_t used;
+            std::deque<std::pair<std::string, std::string> > entries;
+        };
+    }
+
+    //turns header lists into header blocks. fields found in the static table go out as an index,
+    //repeated fields are indexed in the dynamic table so the second request on a connection
+    //with the same headers costs a byte or two per field. header blocks must be sent in the
+    //order they were encoded
+    class hpack_encoder {
+    public:
+        hpack_encoder() : table(4096), pending_resize(false) {
+            for(size_t i = hpack::static_size; i > 0; --i) {
+                const auto& f = hpack::static_table[i - 1];
+                static_names[f.name] = i;
+                static_fields[std::string(f.name) + '\0' + f.value] = i;
+            }
+        }
+
+        //the peer's settings_header_table_size, we never use more than the default 4096
+        void set_limit(size_t size) {
+            size = std::min<size_t>(size, 4096);
+            if(size != table.limit()) {
+                table.resize(size);
+                pending_resize = true;
+            }
+        }
+
+        //names must already be lowercase
+        void encode(const http::headers_t& headers, std::string& out) {
+            if(pending_resize) {
+                hpack::encode_integer(out, 0x20, 5, table.limit());
+                pending_resize = false;
+            }
+            for(const auto& h : headers) {
+                auto exact = static_fields.find(h.first + '\0' + h.second);
+                if(exact != static_fields.end()) {
+                    hpack::encode_integer(out, 0x80, 7, exact->second);
+                    continue;
+                }
+                size_t dynamic = find(h.first, h.second);
+                if(dynamic) {
+                    hpack::encode_integer(out, 0x80, 7, hpack::static_size + dynamic);
+                    continue;
+                }
+                auto name = static_names.find(h.first);
+                size_t name_index = name == static_names.end() ? 0 : name->second;
+                //credentials are never indexed so they cannot be probed through compression
+                bool sensitive = h.first == "authorization" || h.first == "cookie" || h.first == "proxy-authorization";
+                bool index = !sensitive && hpack::dynamic_table::cost(h.first, h.second) <= table.limit() / 4;
+                if(index)
+                    hpack::encode_integer(out, 0x40, 6, name_index);
+                else
+                    hpack::encode_integer(out, sensitive ? 0x10 : 0x00, 4, name_index);
+                if(!name_index)
+                    hpack::encode_string(out, h.first);
+                hpack::encode_string(out, h.second);
+                if(index)
+                    table.insert(h.first, h.second);
+            }
+        }
+
+    protected:
+        //1 based position in the dynamic table, 0 if absent
+        size_t find(const std::string& name, const std::string& value) const {
+            for(size_t i = 0; i < table.size(); ++i) {
+                const auto& e = table.at(i);
+                if(e.first == name && e.second == value)
+                    return i + 1;
+            }
+            return 0;
+        }
+
+        hpack::dynamic_table table;
+        bool pending_resize;
+        std::unordered_map<std::string, size_t> static_names;
+        std::unordered_map<std::string, size_t> static_fields;
+    };
+
+    //turns header blocks back into header lists, the table follows whatever the peer indexes
+    class hpack_decoder {
+    public:
+        explicit hpack_decoder(size_t max_list_size = 64 * 1024) : table(4096), max_list_size(max_list_size) {}
+
+        http::headers_t decode(const uint8_t* at, size_t size) {
+            const uint8_t* end = at + size;
+            http::headers_t headers;
+            size_t list_size = 0;
+            while(at < end) {
+                uint8_t b = *at;
+                if(b & 0x80) {
+                    size_t index = static_cast<size_t>(hpack::decode_integer(at, end, 7));
+                    headers.push_back(lookup(index));
+                }
+                else if((b & 0xe0) == 0x20) {
+                    size_t size = static_cast<size_t>(hpack::decode_integer(at, end, 5));
+                    if(size > 4096)
+                        throw hpack_error("Dynamic table size update above our limit");
+                    table.resize(size);
+                    continue;
+                }
+                else {
+                    //literal with incremental indexing has a 6 bit prefix, without or never 4
+                    bool index = (b & 0xc0) == 0x40;
+                    size_t name_index = static_cast<size_t>(hpack::decode_integer(at, end, index ? 6 : 4));
+                    std::string name = name_index ? lookup(name_index).first : hpack::decode_string(at, end);
+                    std::string value = hpack::decode_string(at, end);
+                    if(index)
+                        table.insert(name, value);
+                    headers.emplace_back(std::move(name), std::move(value));
+                }
+                list_size += hpack::dynamic_table::cost(headers.back().first, headers.back().second);
+                if(list_size > max_list_size)
+                    throw hpack_error("Header list too large");
+            }
+            return headers;
+        }
+
+    protected:
+        std::pair<std::string, std::string> lookup(size_t index) const {
+            if(index == 0)
+                throw hpack_error("Header index zero");
+            if(index <= hpack::static_size)
+                return {hpack::static_table[index - 1].name, hpack::static_table[index - 1].value};
+            return table.at(index - hpack::static_size - 1);
+        }
+
+        hpack::dynamic_table table;
+        size_t max_list_size;
+    };
+}
+
+#endif //__HPACK_HPP__
+
+#ifdef TEST_HPACK
+//g++ -std=c++17 -O2 -DTEST_HPACK -Iinclude -x c++ include/http2/hpack.hpp -o hpacktest
+#include <cassert>
+#include <iostream>
+
+namespace {
+  std::string bytes(const char* hex) {
+    std::string out;
+    for(const char* at = hex; *at;) {
+      if(*at == ' ') {
+        ++at;
+        continue;
+      }
+      out.push_back(static_cast<char>(std::stoi(std::string(at, 2), nullptr, 16)));
+      at += 2;
+    }
+    return out;
+  }
+  http::headers_t decode(http2::hpack_decoder& decoder, const char* hex) {
+    std::string block = bytes(hex);
+    return decoder.decode(reinterpret_cast<const uint8_t*>(block.data()), block.size());
+  }
+}
+
+//the examples of rfc 7541 appendix c
+int main() {
+  //c.2, one representation of each kind
+  {
+    http2::hpack_decoder decoder;
+    assert(decode(decoder, "400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572") ==
+           (http::headers_t{{"custom-key", "custom-header"}}));
+    assert(decode(decoder, "040c 2f73 616d 706c 652f 7061 7468") == (http::headers_t{{":path", "/sample/path"}}));
+    assert(decode(decoder, "1008 7061 7373 776f 7264 0673 6563 7265 74") == (http::headers_t{{"password", "secret"}}));
+    //only the first was indexed
+    assert(decode(decoder, "82 be") == (http::headers_t{{":method", "GET"}, {"custom-key", "custom-header"}}));
+  }
+
+  http::headers_t first{{":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"}};
+  http::headers_t second = first;
+  second.emplace_back("cache-control", "no-cache");
+  http::headers_t third{{":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"}, {":authority", "www.example.com"},
+                        {"custom-key", "custom-value"}};
+
+  //c.3, requests without huffman, which is also exactly what our encoder writes
+  {
+    const char* blocks[] = {"8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d", "8286 84be 5808 6e6f 2d63 6163 6865",
+                            "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65"};
+    const http::headers_t* lists[] = {&first, &second, &third};
+    http2::hpack_decoder decoder;
+    http2::hpack_encoder encoder;
+    for(int i = 0; i < 3; ++i) {
+      assert(decode(decoder, blocks[i]) == *lists[i]);
+      std::string block;
+      encoder.encode(*lists[i], block);
+      assert(block == bytes(blocks[i]));
+    }
+  }
+
+  //c.4, the same requests with huffman coded strings
+  {
+    http2::hpack_decoder decoder;
+    assert(decode(decoder, "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff") == first);
+    assert(decode(decoder, "8286 84be 5886 a8eb 1064 9cbf") == second);
+    assert(decode(decoder, "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf") == third);
+  }
+
+  //c.6, huffman coded responses evicting from a 256 byte table. the size update in front of the
+  //first block stands in for the settings the example assumes
+  {
+    http2::hpack_decoder decoder;
+    http::headers_t response{{":status", "302"}, {"cache-control", "private"}, {"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+                             {"location", "https://www.example.com"}};
+    assert(decode(decoder, "3fe101 4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504 0b81 66e0 82a6 2d1b ff6e 919d "
+                           "29ad 1718 63c7 8f0b 97c8 e9ae 82ae 43d3") == response);
+    response[0].second = "307";
+    assert(decode(decoder, "4883 640e ff c1 c0 bf") == response);
+    response = {{":status", "200"}, {"cache-control", "private"}, {"date", "Mon, 21 Oct 2013 20:13:22 GMT"},
+                {"location", "https://www.example.com"}, {"content-encoding", "gzip"},
+                {"set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1"}};
+    assert(decode(decoder, "88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d 1bff c05a 839b d9ab 77ad 94e7 821d d7f2 "
+                           "e6c7 b335 dfdf cd5b 3960 d5af 2708 7f36 72c1 ab27 0fb5 291f 9587 3160 65c0 03ed 4ee5 b106 3d50 07") ==
+           response);
+    //only set-cookie, content-encoding and the new date are left, index 65 is gone
+    assert(decode(decoder, "c0") == (http::headers_t{{"date", "Mon, 21 Oct 2013 20:13:22 GMT"}}));
+    bool evicted = false;
+    try {
+      decode(decoder, "c1");
+    }
+    catch(const std::exception&) {
+      evicted = true;
+    }
+    assert(evicted);
+  }
+
+  //credentials go out never indexed, a smaller peer table is announced before the next block
+  {
+    http2::hpack_encoder encoder;
+    http2::hpack_decoder decoder;
+    std::string block;
+    encoder.encode({{"authorization", "Basic c2VjcmV0"}}, block);
+    assert((static_cast<uint8_t>(block[0]) & 0xf0) == 0x10);
+    assert(decoder.decode(reinterpret_cast<const uint8_t*>(block.data()), block.size()) ==
+           (http::headers_t{{"authorization", "Basic c2VjcmV0"}}));
+    encoder.set_limit(256);
+    block.clear();
+    encoder.encode({{"x-a", "1"}}, block);
+    assert(block.compare(0, 3, bytes("3fe101")) == 0);
+    assert(decoder.decode(reinterpret_cast<const uint8_t*>(block.data()), block.size()) == (http::headers_t{{"x-a", "1"}}));
+  }
+
+  //malformed input is an hpack_error
+  const char* broken[] = {"80", "ff ff ff ff ff ff ff ff ff ff 01", "3fe21f", "41 8c f1 e3 c2", "82 00"};
+  for(const char* hex : broken) {
+    http2::hpack_decoder decoder;
+    bool refused = false;
+    try {
+      decode(decoder, hex);
+    }
+    catch(const http2::hpack_error&) {
+      refused = true;
+    }
+    assert(refused);
+  }
+  std::cout << "hpack ok" << std::endl;
+  return 0;
+}
+#endif
@@ -0,0 +1,1408 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __HTTP2_HPP__
+#define __HTTP2_HPP__
+
+#include "http2/hpack.hpp"
+#include "upstream/upstream.hpp"
+
+#include <atomic>
+#include <thread>
+#include <cctype>
+#include <algorithm>
+#include <condition_variable>
+
+namespace http2 {
+    namespace frame {
+        constexpr uint8_t DATA = 0x0;
+        constexpr uint8_t HEADERS = 0x1;
+        constexpr uint8_t PRIORITY = 0x2;
+        constexpr uint8_t RST_STREAM = 0x3;
+        constexpr uint8_t SETTINGS = 0x4;
+        constexpr uint8_t PUSH_PROMISE = 0x5;
+        constexpr uint8_t PING = 0x6;
+        constexpr uint8_t GOAWAY = 0x7;
+        constexpr uint8_t WINDOW_UPDATE = 0x8;
+        constexpr uint8_t CONTINUATION = 0x9;
+
+        constexpr uint8_t END_STREAM = 0x1;
+        constexpr uint8_t ACK = 0x1;
+        constexpr uint8_t END_HEADERS = 0x4;
+        constexpr uint8_t PADDED = 0x8;
+        constexpr uint8_t PRIORITY_FLAG = 0x20;
+    }
+
+    namespace setting {
+        constexpr uint16_t HEADER_TABLE_SIZE = 0x1;
+        constexpr uint16_t ENABLE_PUSH = 0x2;
+        constexpr uint16_t MAX_CONCURRENT_STREAMS = 0x3;
+        constexpr uint16_t INITIAL_WINDOW_SIZE = 0x4;
+        constexpr uint16_t MAX_FRAME_SIZE = 0x5;
+    }
+
+    namespace error {
+        constexpr uint32_t NO_ERROR = 0x0;
+        constexpr uint32_t PROTOCOL_ERROR = 0x1;
+        constexpr uint32_t INTERNAL_ERROR = 0x2;
+        constexpr uint32_t FLOW_CONTROL_ERROR = 0x3;
+        constexpr uint32_t FRAME_SIZE_ERROR = 0x6;
+        constexpr uint32_t REFUSED_STREAM = 0x7;
+        constexpr uint32_t CANCEL = 0x8;
+        constexpr uint32_t COMPRESSION_ERROR = 0x9;
+    }
+
+    constexpr uint32_t MAX_WINDOW = 0x7fffffff;
+    constexpr size_t MAX_FRAME = 16384;
+
+    //what a stream reports back, always on the connection's reader thread. callbacks must not
+    //block for long, every other stream on the connection waits for them. window updates are
+    //sent once data returns, so a sink that does block is backpressure to that backend
+    struct stream_events {
+        std::function<void(int status, http::headers_t& headers)> headers;
+        std::function<void(const char* data, size_t size)> data;
+        std::function<void(http::headers_t& trailers)> trailers;
+        //last call for a stream, NO_ERROR when the response ended normally
+        std::function<void(uint32_t error)> closed;
+    };
+
+    //one multiplexed cleartext http/2 connection (prior knowledge, no upgrade) to a backend,
+    //there is no tls variant (see upstream/tls.hpp). any thread may open streams and send on
+    //them, a reader thread owned by the connection itself parses frames and dispatches them
+    //to the streams
+    class connection : public std::enable_shared_from_this<connection> {
+    public:
+        connection(const upstream::backend& target, std::chrono::milliseconds timeout, uint32_t stream_window, const upstream::address_lookup& lookup = nullptr) :
+            target(target), timeout(timeout), fd(upstream::connection(target, timeout, lookup).detach()),
+            stream_window(std::max<uint32_t>(stream_window, 65535)), connection_window(16 << 20),
+            next_id(1), reserved(0), send_window(65535), initial_window(65535), peer_frame_size(MAX_FRAME),
+            peer_streams(100), peer_table_size(4096), dead(false), draining(false),
+            buffer_start(0), continuing(0), continuing_flags(0), connection_unacked(0) {
+            std::string preface("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+            std::string settings;
+            put_setting(settings, setting::ENABLE_PUSH, 0);
+            put_setting(settings, setting::INITIAL_WINDOW_SIZE, this->stream_window);
+            put_setting(settings, setting::MAX_FRAME_SIZE, MAX_FRAME);
+            append_frame(preface, frame::SETTINGS, 0, 0, settings.data(), settings.size());
+            append_window_update(preface, 0, connection_window - 65535);
+            try {
+                write_all(preface.data(), preface.size());
+            }
+            catch(...) {
+                close(fd);
+                throw;
+            }
+        }
+        ~connection() {
+            close(fd);
+        }
+        connection(const connection&) = delete;
+        connection& operator=(const connection&) = delete;
+
+        //starts the reader, which keeps the connection alive until the socket dies
+        void start(std::function<void()> stream_done) {
+            released = std::move(stream_done);
+            std::thread(&connection::run, this, shared_from_this()).detach();
+        }
+
+        //stops the reader, open streams see INTERNAL_ERROR
+        void shutdown() {
+            ::shutdown(fd, SHUT_RDWR);
+        }
+
+        //claims room for one stream, every open needs a claim
+        bool reserve() {
+            std::lock_guard<std::mutex> guard(lock);
+            if(dead || draining || streams.size() + reserved >= peer_streams)
+                return false;
+            ++reserved;
+            return true;
+        }
+
+        //sends the request headers and returns the new stream id, consumes one reservation.
+        //headers must be lowercase and start with the pseudo headers
+        uint32_t open(const http::headers_t& headers, bool end_stream, stream_events events) {
+            std::string out;
+            uint32_t id;
+            {
+                std::lock_guard<std::mutex> w(writing);
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    --reserved;
+                    if(dead || next_id > MAX_WINDOW)
+                        throw upstream::upstream_error("HTTP/2 connection to " + target.name() + " is closed");
+                    id = next_id;
+                    next_id += 2;
+                    if(next_id > MAX_WINDOW)
+                        draining = true;
+                    auto s = std::make_shared<stream_state>();
+                    s->events = std::move(events);
+                    s->send_window = initial_window;
+                    streams.emplace(id, std::move(s));
+                    encoder.set_limit(peer_table_size);
+                }
+                //the block is encoded and sent under one lock, the peer decodes in the same order
+                std::string block;
+                encoder.encode(headers, block);
+                append_header_block(out, id, block, end_stream);
+                write_all(out.data(), out.size());
+            }
+            flush();
+            return id;
+        }
+
+        //sends body bytes, blocking while either flow control window is closed
+        void send_data(uint32_t id, const char* data, size_t size, bool end_stream) {
+            do {
+                size_t chunk = 0;
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    auto ready = [this, id]() {
+                        auto s = streams.find(id);
+                        return dead || s == streams.end() || (send_window > 0 && s->second->send_window > 0);
+                    };
+                    if(size && !window_open.wait_for(guard, timeout, ready))
+                        throw upstream::upstream_error("Timed out waiting for HTTP/2 flow control window from " + target.name());
+                    if(dead)
+                        throw upstream::upstream_error("HTTP/2 connection to " + target.name() + " is closed");
+                    auto s = streams.find(id);
+                    if(s == streams.end())
+                        throw upstream::upstream_error("HTTP/2 stream was closed by " + target.name());
+                    if(size) {
+                        chunk = static_cast<size_t>(std::min<int64_t>({static_cast<int64_t>(size), peer_frame_size, send_window, s->second->send_window}));
+                        send_window -= static_cast<int64_t>(chunk);
+                        s->second->send_window -= static_cast<int64_t>(chunk);
+                    }
+                }
+                std::string out;
+                append_frame(out, frame::DATA, end_stream && chunk == size ? frame::END_STREAM : 0, id, data, chunk);
+                {
+                    std::lock_guard<std::mutex> w(writing);
+                    write_all(out.data(), out.size());
+                }
+                flush();
+                data += chunk;
+                size -= chunk;
+            } while(size);
+        }
+
+        //ends the request side with trailers, the way grpc clients finish a stream
+        void send_trailers(uint32_t id, const http::headers_t& trailers) {
+            std::string out;
+            {
+                std::lock_guard<std::mutex> w(writing);
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    encoder.set_limit(peer_table_size);
+                }
+                std::string block;
+                encoder.encode(trailers, block);
+                append_header_block(out, id, block, true);
+                write_all(out.data(), out.size());
+            }
+            flush();
+        }
+
+        //abandons a stream, no further callbacks arrive for it
+        void reset(uint32_t id, uint32_t code = error::CANCEL) {
+            std::shared_ptr<stream_state> s;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                auto found = streams.find(id);
+                if(found == streams.end())
+                    return;
+                s = std::move(found->second);
+                streams.erase(found);
+                window_open.notify_all();
+            }
+            uint8_t payload[4];
+            put32(payload, code);
+            std::string out;
+            append_frame(out, frame::RST_STREAM, 0, id, reinterpret_cast<char*>(payload), 4);
+            //queued, so the reader can reset streams too
+            queue_control(out);
+            if(released)
+                released();
+        }
+
+        //streams in flight or claimed
+        size_t load() {
+            std::lock_guard<std::mutex> guard(lock);
+            return streams.size() + reserved;
+        }
+        //false once the connection died or the peer asked us to go away
+        bool usable() {
+            std::lock_guard<std::mutex> guard(lock);
+            return !dead && !draining;
+        }
+        const upstream::backend& peer() const {
+            return target;
+        }
+        //why the connection died, empty while it is alive
+        std::string last_error() {
+            std::lock_guard<std::mutex> guard(lock);
+            return failure;
+        }
+
+    protected:
+        struct stream_state {
+            stream_events events;
+            int64_t send_window = 0;
+            uint32_t unacked = 0;
+            bool responded = false;
+        };
+
+        static void put32(uint8_t* at, uint32_t value) {
+            at[0] = static_cast<uint8_t>(value >> 24);
+            at[1] = static_cast<uint8_t>(value >> 16);
+            at[2] = static_cast<uint8_t>(value >> 8);
+            at[3] = static_cast<uint8_t>(value);
+        }
+        static uint32_t get32(const uint8_t* at) {
+            return (uint32_t(at[0]) << 24) | (uint32_t(at[1]) << 16) | (uint32_t(at[2]) << 8) | at[3];
+        }
+        static void put_setting(std::string& out, uint16_t id, uint32_t value) {
+            uint8_t s[6] = {static_cast<uint8_t>(id >> 8), static_cast<uint8_t>(id)};
+            put32(s + 2, value);
+            out.append(reinterpret_cast<char*>(s), 6);
+        }
+        static void append_frame(std::string& out, uint8_t type, uint8_t flags, uint32_t id, const char* payload, size_t size) {
+            uint8_t h[9] = {static_cast<uint8_t>(size >> 16), static_cast<uint8_t>(size >> 8), static_cast<uint8_t>(size), type, flags};
+            put32(h + 5, id);
+            out.append(reinterpret_cast<char*>(h), 9);
+            out.append(payload, size);
+        }
+        static void append_window_update(std::string& out, uint32_t id, uint32_t increment) {
+            uint8_t payload[4];
+            put32(payload, increment);
+            append_frame(out, frame::WINDOW_UPDATE, 0, id, reinterpret_cast<char*>(payload), 4);
+        }
+        //headers plus as many continuations as the peer's frame size needs
+        void append_header_block(std::string& out, uint32_t id, const std::string& block, bool end_stream) {
+            size_t limit = static_cast<size_t>(peer_frame_size), offset = 0;
+            uint8_t type = frame::HEADERS;
+            do {
+                size_t take = std::min(limit, block.size() - offset);
+                uint8_t flags = offset + take == block.size() ? frame::END_HEADERS : 0;
+                if(type == frame::HEADERS && end_stream)
+                    flags |= frame::END_STREAM;
+                append_frame(out, type, flags, id, block.data() + offset, take);
+                offset += take;
+                type = frame::CONTINUATION;
+            } while(offset < block.size());
+        }
+
+        //writes with the writing lock held, a failed write takes the whole connection down
+        void write_all(const char* data, size_t size) {
+            while(size) {
+                ssize_t sent = ::send(fd, data, size, MSG_NOSIGNAL);
+                if(sent < 0 && errno == EINTR)
+                    continue;
+                if(sent < 0 && errno == EAGAIN) {
+                    pollfd p{fd, POLLOUT, 0};
+                    if(poll(&p, 1, static_cast<int>(timeout.count())) > 0)
+                        continue;
+                    errno = ETIMEDOUT;
+                }
+                if(sent <= 0) {
+                    std::string reason = strerror(errno);
+                    shutdown();
+                    throw upstream::upstream_error("Couldn't write to " + target.name() + ": " + reason);
+                }
+                data += sent;
+                size -= static_cast<size_t>(sent);
+            }
+        }
+
+        //acks and window updates from the reader are queued rather than written directly, so the
+        //reader never waits behind a sender stuck on a full socket. whoever holds the writing
+        //lock last sends them
+        void queue_control(const std::string& frames) {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                control.append(frames);
+            }
+            flush();
+        }
+        void flush() {
+            while(true) {
+                {
+                    //a busy writer sends whatever is queued once it lets go, see below
+                    std::unique_lock<std::mutex> w(writing, std::try_to_lock);
+                    if(!w.owns_lock())
+                        return;
+                    std::string pending;
+                    {
+                        std::lock_guard<std::mutex> guard(lock);
+                        pending.swap(control);
+                    }
+                    if(!pending.empty()) {
+                        try {
+                            write_all(pending.data(), pending.size());
+                        }
+                        catch(const upstream::upstream_error&) {
+                            return;
+                        }
+                    }
+                }
+                //frames queued while we held writing found it taken and were left to us
+                std::lock_guard<std::mutex> guard(lock);
+                if(control.empty() || dead)
+                    return;
+            }
+        }
+
+        //the argument keeps the connection alive for as long as the reader runs
+        void run(std::shared_ptr<connection>) {
+            std::string reason = "closed by " + target.name();
+            try {
+                while(read_frame());
+            }
+            catch(const std::exception& e) {
+                reason = e.what();
+            }
+            fail(reason);
+        }
+
+        //tears down every stream, nothing more can be sent or received
+        void fail(const std::string& reason) {
+            std::unordered_map<uint32_t, std::shared_ptr<stream_state> > lost;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                dead = true;
+                failure = reason;
+                lost.swap(streams);
+                window_open.notify_all();
+            }
+            shutdown();
+            for(auto& s : lost)
+                finish(s.second, error::INTERNAL_ERROR);
+        }
+
+        void finish(const std::shared_ptr<stream_state>& s, uint32_t code) {
+            if(s->events.closed)
+                s->events.closed(code);
+            if(released)
+                released();
+        }
+
+        //the stream, removed from the table when this frame ends it
+        std::shared_ptr<stream_state> find(uint32_t id, bool ending) {
+            std::lock_guard<std::mutex> guard(lock);
+            auto found = streams.find(id);
+            if(found == streams.end())
+                return nullptr;
+            auto s = found->second;
+            if(ending) {
+                streams.erase(found);
+                window_open.notify_all();
+            }
+            return s;
+        }
+
+        //false on orderly close
+        bool fill(size_t wanted) {
+            if(buffer_start > 0 && buffer_start >= buffer.size() / 2) {
+                buffer.erase(0, buffer_start);
+                buffer_start = 0;
+            }
+            while(buffer.size() - buffer_start < wanted) {
+                char chunk[65536];
+                ssize_t got = ::recv(fd, chunk, sizeof(chunk), 0);
+                if(got > 0) {
+                    buffer.append(chunk, static_cast<size_t>(got));
+                    continue;
+                }
+                if(got == 0)
+                    return false;
+                if(errno == EINTR)
+                    continue;
+                if(errno == EAGAIN) {
+                    pollfd p{fd, POLLIN, 0};
+                    poll(&p, 1, -1);
+                    continue;
+                }
+                throw upstream::upstream_error("Couldn't read from " + target.name() + ": " + strerror(errno));
+            }
+            return true;
+        }
+
+        bool read_frame() {
+            if(!fill(9))
+                return false;
+            const auto* h = reinterpret_cast<const uint8_t*>(buffer.data() + buffer_start);
+            size_t length = (size_t(h[0]) << 16) | (size_t(h[1]) << 8) | h[2];
+            uint8_t type = h[3], flags = h[4];
+            uint32_t id = get32(h + 5) & MAX_WINDOW;
+            if(length > MAX_FRAME)
+                return go_away(error::FRAME_SIZE_ERROR, "Oversized HTTP/2 frame");
+            if(!fill(9 + length))
+                return false;
+            const auto* payload = reinterpret_cast<const uint8_t*>(buffer.data() + buffer_start + 9);
+            buffer_start += 9 + length;
+            if(continuing && (type != frame::CONTINUATION || id != continuing))
+                return go_away(error::PROTOCOL_ERROR, "Interleaved HTTP/2 header block");
+            switch(type) {
+                case frame::DATA:
+                    return on_data(id, flags, payload, length);
+                case frame::HEADERS:
+                case frame::CONTINUATION:
+                    return on_headers(type, id, flags, payload, length);
+                case frame::RST_STREAM: {
+                    if(length != 4)
+                        return go_away(error::FRAME_SIZE_ERROR, "Bad RST_STREAM");
+                    auto s = find(id, true);
+                    if(s)
+                        finish(s, get32(payload));
+                    return true;
+                }
+                case frame::SETTINGS:
+                    return on_settings(id, flags, payload, length);
+                case frame::PING: {
+                    if(length != 8)
+                        return go_away(error::FRAME_SIZE_ERROR, "Bad PING");
+                    if(!(flags & frame::ACK)) {
+                        std::string out;
+                        append_frame(out, frame::PING, frame::ACK, 0, reinterpret_cast<const char*>(payload), 8);
+                        queue_control(out);
+                    }
+                    return true;
+                }
+                case frame::GOAWAY:
+                    return on_goaway(payload, length);
+                case frame::WINDOW_UPDATE:
+                    return on_window_update(id, payload, length);
+                case frame::PUSH_PROMISE:
+                    return go_away(error::PROTOCOL_ERROR, "Push promised though disabled");
+                default:
+                    //priority and unknown frame types are ignored
+                    return true;
+            }
+        }
+
+        bool go_away(uint32_t code, const std::string& reason) {
+            uint8_t payload[8];
+            put32(payload, 0);
+            put32(payload + 4, code);
+            std::string out;
+            append_frame(out, frame::GOAWAY, 0, 0, reinterpret_cast<char*>(payload), 8);
+            queue_control(out);
+            throw upstream::upstream_error(reason + " from " + target.name());
+        }
+
+        //strips padding and priority, false if the padding does not fit
+        static bool unpad(uint8_t flags, const uint8_t*& payload, size_t& length, bool priority) {
+            size_t pad = 0;
+            if(flags & frame::PADDED) {
+                if(length < 1)
+                    return false;
+                pad = *payload++;
+                --length;
+            }
+            if(priority && (flags & frame::PRIORITY_FLAG)) {
+                if(length < 5)
+                    return false;
+                payload += 5;
+                length -= 5;
+            }
+            if(pad > length)
+                return false;
+            length -= pad;
+            return true;
+        }
+
+        bool on_data(uint32_t id, uint8_t flags, const uint8_t* payload, size_t length) {
+            if(id == 0)
+                return go_away(error::PROTOCOL_ERROR, "DATA on stream 0");
+            //padding counts against flow control too
+            size_t flow = length;
+            if(!unpad(flags, payload, length, false))
+                return go_away(error::PROTOCOL_ERROR, "Bad DATA padding");
+            bool end = flags & frame::END_STREAM;
+            auto s = find(id, end);
+            if(s && s->events.data && length)
+                s->events.data(reinterpret_cast<const char*>(payload), length);
+            std::string out;
+            connection_unacked += flow;
+            if(connection_unacked >= connection_window / 2) {
+                append_window_update(out, 0, connection_unacked);
+                connection_unacked = 0;
+            }
+            if(s && !end) {
+                s->unacked += static_cast<uint32_t>(flow);
+                if(s->unacked >= stream_window / 2) {
+                    append_window_update(out, id, s->unacked);
+                    s->unacked = 0;
+                }
+            }
+            if(!out.empty())
+                queue_control(out);
+            if(s && end)
+                finish(s, error::NO_ERROR);
+            return true;
+        }
+
+        bool on_headers(uint8_t type, uint32_t id, uint8_t flags, const uint8_t* payload, size_t length) {
+            if(type == frame::HEADERS) {
+                if(id == 0 || !unpad(flags, payload, length, true))
+                    return go_away(error::PROTOCOL_ERROR, "Bad HEADERS");
+                block.clear();
+                continuing = id;
+                continuing_flags = flags;
+            }
+            else if(!continuing) {
+                return go_away(error::PROTOCOL_ERROR, "Unexpected CONTINUATION");
+            }
+            block.append(reinterpret_cast<const char*>(payload), length);
+            if(!(flags & frame::END_HEADERS))
+                return true;
+            continuing = 0;
+            //always decoded, even for streams we reset, to keep the tables in step
+            http::headers_t headers;
+            try {
+                headers = decoder.decode(reinterpret_cast<const uint8_t*>(block.data()), block.size());
+            }
+            catch(const hpack_error& e) {
+                return go_away(error::COMPRESSION_ERROR, e.what());
+            }
+            bool end = continuing_flags & frame::END_STREAM;
+            auto s = find(id, false);
+            if(!s)
+                return true;
+            if(!s->responded) {
+                int status = 0;
+                http::headers_t regular;
+                for(auto& h : headers) {
+                    if(h.first == ":status")
+                        status = std::atoi(h.second.c_str());
+                    else if(h.first.empty() || h.first[0] != ':')
+                        regular.push_back(std::move(h));
+                }
+                if(status < 100 || status > 999) {
+                    reset(id, error::PROTOCOL_ERROR);
+                    finish(s, error::PROTOCOL_ERROR);
+                    return true;
+                }
+                //interim responses are dropped, the final one follows on the same stream
+                if(status < 200 && !end)
+                    return true;
+                s->responded = true;
+                if(s->events.headers)
+                    s->events.headers(status, regular);
+            }
+            else if(end) {
+                if(s->events.trailers)
+                    s->events.trailers(headers);
+            }
+            else {
+                reset(id, error::PROTOCOL_ERROR);
+                finish(s, error::PROTOCOL_ERROR);
+                return true;
+            }
+            if(end && find(id, true))
+                finish(s, error::NO_ERROR);
+            return true;
+        }
+
+        bool on_settings(uint32_t id, uint8_t flags, const uint8_t* payload, size_t length) {
+            if(id != 0 || length % 6 || ((flags & frame::ACK) && length))
+                return go_away(error::PROTOCOL_ERROR, "Bad SETTINGS");
+            if(flags & frame::ACK)
+                return true;
+            //go_away queues through lock, so errors are only raised once it is released
+            uint32_t code = error::NO_ERROR;
+            const char* problem = nullptr;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                for(size_t at = 0; at < length; at += 6) {
+                    uint16_t key = static_cast<uint16_t>((payload[at] << 8) | payload[at + 1]);
+                    uint32_t value = get32(payload + at + 2);
+                    if(key == setting::HEADER_TABLE_SIZE)
+                        peer_table_size = value;
+                    else if(key == setting::MAX_CONCURRENT_STREAMS)
+                        peer_streams = value;
+                    else if(key == setting::MAX_FRAME_SIZE) {
+                        if(value < MAX_FRAME || value > 0xffffff) {
+                            code = error::PROTOCOL_ERROR;
+                            problem = "Bad MAX_FRAME_SIZE";
+                            break;
+                        }
+                        peer_frame_size = value;
+                    }
+                    else if(key == setting::INITIAL_WINDOW_SIZE) {
+                        if(value > MAX_WINDOW) {
+                            code = error::FLOW_CONTROL_ERROR;
+                            problem = "Bad INITIAL_WINDOW_SIZE";
+                            break;
+                        }
+                        //applies retroactively to every open stream
+                        int64_t delta = static_cast<int64_t>(value) - initial_window;
+                        initial_window = value;
+                        for(auto& s : streams)
+                            s.second->send_window += delta;
+                    }
+                }
+                window_open.notify_all();
+            }
+            if(problem)
+                return go_away(code, problem);
+            std::string out;
+            append_frame(out, frame::SETTINGS, frame::ACK, 0, nullptr, 0);
+            queue_control(out);
+            if(released)
+                released();
+            return true;
+        }
+
+        bool on_goaway(const uint8_t* payload, size_t length) {
+            if(length < 8)
+                return go_away(error::FRAME_SIZE_ERROR, "Bad GOAWAY");
+            uint32_t last = get32(payload) & MAX_WINDOW;
+            //streams above last were never processed and are safe to retry elsewhere
+            std::vector<std::shared_ptr<stream_state> > refused;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                draining = true;
+                for(auto s = streams.begin(); s != streams.end();) {
+                    if(s->first > last) {
+                        refused.push_back(std::move(s->second));
+                        s = streams.erase(s);
+                    }
+                    else {
+                        ++s;
+                    }
+                }
+                window_open.notify_all();
+            }
+            for(auto& s : refused)
+                finish(s, error::REFUSED_STREAM);
+            return true;
+        }
+
+        bool on_window_update(uint32_t id, const uint8_t* payload, size_t length) {
+            if(length != 4)
+                return go_away(error::FRAME_SIZE_ERROR, "Bad WINDOW_UPDATE");
+            int64_t increment = get32(payload) & MAX_WINDOW;
+            bool overflow = false;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if(id == 0) {
+                    send_window += increment;
+                    overflow = send_window > MAX_WINDOW;
+                }
+                else {
+                    auto s = streams.find(id);
+                    if(s != streams.end())
+                        s->second->send_window += increment;
+                }
+                window_open.notify_all();
+            }
+            //outside the lock, go_away takes it to queue the frame
+            if(overflow)
+                return go_away(error::FLOW_CONTROL_ERROR, "Connection window overflow");
+            return true;
+        }
+
+        upstream::backend target;
+        std::chrono::milliseconds timeout;
+        int fd;
+        uint32_t stream_window;
+        uint32_t connection_window;
+        std::function<void()> released;
+
+        //senders serialize on writing, which also guards the encoder and stream ids
+        std::mutex writing;
+        hpack_encoder encoder;
+        uint32_t next_id;
+
+        //everything shared with the reader
+        std::mutex lock;
+        std::condition_variable window_open;
+        std::unordered_map<uint32_t, std::shared_ptr<stream_state> > streams;
+        size_t reserved;
+        int64_t send_window;
+        int64_t initial_window;
+        int64_t peer_frame_size;
+        size_t peer_streams;
+        size_t peer_table_size;
+        bool dead;
+        bool draining;
+        std::string failure;
+        std::string control;
+
+        //reader thread only
+        hpack_decoder decoder;
+        std::string buffer;
+        size_t buffer_start;
+        uint32_t continuing;
+        uint8_t continuing_flags;
+        std::string block;
+        uint32_t connection_unacked;
+    };
+
+    //the sending half of one proxied request, the response arrives through its stream_events
+    class stream {
+    public:
+        stream(std::shared_ptr<connection> owner, uint32_t id) : owner(std::move(owner)), id(id) {}
+        void write(const char* data, size_t size, bool end_stream = false) {
+            owner->send_data(id, data, size, end_stream);
+        }
+        void write(const std::string& data, bool end_stream = false) {
+            write(data.data(), data.size(), end_stream);
+        }
+        void finish(const http::headers_t& trailers) {
+            owner->send_trailers(id, trailers);
+        }
+        void cancel() {
+            owner->reset(id);
+        }
+    protected:
+        std::shared_ptr<connection> owner;
+        uint32_t id;
+    };
+
+    //turns a proxied http/1 style request into an http/2 header list
+    inline http::headers_t request_headers(const http::request& request, const upstream::backend& target) {
+        const std::string* host = http::find_header(request.headers, "Host");
+        http::headers_t out{{":method", request.method}, {":scheme", "http"},
+                            {":authority", host ? *host : target.name()}, {":path", request.target}};
+        for(const auto& h : request.headers) {
+            std::string name = h.first;
+            std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+            //connection specific headers do not exist in http/2, te only as trailers
+            if(name == "host" || name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+               name == "transfer-encoding" || name == "upgrade" || (name == "te" && h.second != "trailers"))
+                continue;
+            out.emplace_back(std::move(name), h.second);
+        }
+        return out;
+    }
+
+    //marks a request as a grpc call, grpc needs te: trailers to tell us it wants them
+    inline void grpc_request(http::request& request) {
+        request.method = "POST";
+        if(!http::find_header(request.headers, "Content-Type"))
+            http::set_header(request.headers, "content-type", "application/grpc");
+        http::set_header(request.headers, "te", "trailers");
+    }
+
+    //a length prefixed grpc message, uncompressed
+    inline std::string grpc_frame(const std::string& message) {
+        std::string out(5, '\0');
+        uint32_t size = static_cast<uint32_t>(message.size());
+        for(int i = 0; i < 4; ++i)
+            out[1 + i] = static_cast<char>(size >> (24 - 8 * i));
+        return out + message;
+    }
+
+    //a few multiplexed connections to one backend. streams go to the least loaded connection,
+    //another connection is only opened while every existing one already carries streams, and
+    //once all are full at the peer's max_concurrent_streams new streams wait for a slot
+    class pool {
+    public:
+        pool() = delete;
+        pool(const upstream::backend& target, const upstream::upstream_config_t& config) :
+            target(target), max_connections(4), timeout(std::chrono::milliseconds(5000)), window(1 << 20), connecting(0),
+            slots(std::make_shared<signal>()) {
+            auto parse = [&config](const char* key, size_t& value) {
+                auto found = config.find(key);
+                if(found == config.end())
+                    return;
+                try {
+                    value = std::stoul(found->second);
+                }
+                catch(...) {
+                    throw std::runtime_error(found->second + " is not a valid " + key);
+                }
+            };
+            size_t timeout_ms = 5000, stream_window = window;
+            parse("h2_connections", max_connections);
+            parse("h2_stream_window", stream_window);
+            parse("timeout_ms", timeout_ms);
+            if(max_connections == 0)
+                throw std::runtime_error("h2_connections must be positive");
+            if(stream_window > MAX_WINDOW)
+                throw std::runtime_error("h2_stream_window must be below 2^31");
+            timeout = std::chrono::milliseconds(timeout_ms);
+            window = static_cast<uint32_t>(stream_window);
+        }
+        ~pool() {
+            std::lock_guard<std::mutex> guard(lock);
+            for(auto& c : connections)
+                c->shutdown();
+        }
+
+        //where new connections get their addresses, set before the pool is shared
+        void set_lookup(upstream::address_lookup resolve) {
+            lookup = std::move(resolve);
+        }
+
+        //starts a request, the body follows through the returned stream unless end_stream
+        std::unique_ptr<stream> open(const http::request& request, stream_events events, bool end_stream) {
+            auto c = claim();
+            uint32_t id = c->open(request_headers(request, target), end_stream, std::move(events));
+            return std::unique_ptr<stream>(new stream(std::move(c), id));
+        }
+
+        //one whole request, body bytes go to sink (on the reader thread) or into the response.
+        //trailers, if wanted, land in trailers. a response that goes quiet for timeout_ms is
+        //reset and thrown as an upstream_error, sink is never called after that
+        http::response exchange(const http::request& request, const upstream::body_sink& sink = nullptr, http::headers_t* trailers = nullptr) {
+            struct result {
+                std::mutex lock;
+                std::condition_variable done;
+                bool finished = false;
+                uint32_t error = 0;
+                //when the response was last heard of
+                upstream::clock::time_point heard = upstream::clock::now();
+                http::response response;
+                http::headers_t trailers;
+                //held around sink so an abandoned exchange can be sure it has returned
+                std::mutex sinking;
+                bool abandoned = false;
+            };
+            auto r = std::make_shared<result>();
+            stream_events events;
+            events.headers = [r](int status, http::headers_t& headers) {
+                std::lock_guard<std::mutex> guard(r->lock);
+                r->heard = upstream::clock::now();
+                r->response.status = status;
+                r->response.reason = http::reason(status);
+                r->response.version = "HTTP/2";
+                r->response.headers = std::move(headers);
+            };
+            events.data = [r, sink](const char* data, size_t size) {
+                std::lock_guard<std::mutex> guard(r->sinking);
+                if(r->abandoned)
+                    return;
+                if(sink)
+                    sink(data, size);
+                std::lock_guard<std::mutex> progress(r->lock);
+                r->heard = upstream::clock::now();
+                if(!sink)
+                    r->response.body.append(data, size);
+            };
+            events.trailers = [r](http::headers_t& t) {
+                std::lock_guard<std::mutex> guard(r->lock);
+                r->trailers = std::move(t);
+            };
+            events.closed = [r](uint32_t code) {
+                std::lock_guard<std::mutex> guard(r->lock);
+                r->finished = true;
+                r->error = code;
+                r->done.notify_all();
+            };
+            auto s = open(request, std::move(events), request.body.empty());
+            if(!request.body.empty())
+                s->write(request.body, true);
+            std::unique_lock<std::mutex> guard(r->lock);
+            //the request body counts as being heard of too
+            r->heard = std::max(r->heard, upstream::clock::now());
+            while(!r->done.wait_until(guard, r->heard + timeout, [&r]() { return r->finished; })) {
+                if(upstream::clock::now() < r->heard + timeout)
+                    continue;
+                guard.unlock();
+                s->cancel();
+                {
+                    std::lock_guard<std::mutex> abandon(r->sinking);
+                    r->abandoned = true;
+                }
+                throw upstream::upstream_error("Timed out waiting for HTTP/2 response from " + target.name());
+            }
+            if(r->error != error::NO_ERROR || r->response.status == 0)
+                throw upstream::upstream_error("HTTP/2 stream to " + target.name() + " failed with error " + std::to_string(r->error));
+            if(trailers)
+                *trailers = std::move(r->trailers);
+            return std::move(r->response);
+        }
+
+        size_t size() {
+            std::lock_guard<std::mutex> guard(lock);
+            return connections.size();
+        }
+
+        const upstream::backend& peer() const {
+            return target;
+        }
+
+    protected:
+        //shared with the connections, which may outlive the pool
+        struct signal {
+            std::mutex lock;
+            std::condition_variable freed;
+            uint64_t generation = 0;
+        };
+
+        //a connection with room for one more stream
+        std::shared_ptr<connection> claim() {
+            auto deadline = upstream::clock::now() + timeout;
+            while(true) {
+                uint64_t seen;
+                {
+                    std::lock_guard<std::mutex> guard(slots->lock);
+                    seen = slots->generation;
+                }
+                bool dial = false;
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    //dead and drained connections are dropped, draining ones finish their streams
+                    connections.erase(std::remove_if(connections.begin(), connections.end(), [](const std::shared_ptr<connection>& c) {
+                        return !c->usable();
+                    }), connections.end());
+                    std::vector<std::pair<size_t, connection*> > loads;
+                    for(auto& c : connections)
+                        loads.emplace_back(c->load(), c.get());
+                    std::sort(loads.begin(), loads.end());
+                    bool room = connections.size() + connecting < max_connections;
+                    if(loads.empty() || (room && loads.front().first > 0)) {
+                        if(room) {
+                            ++connecting;
+                            dial = true;
+                        }
+                    }
+                    if(!dial)
+                        for(auto& l : loads)
+                            if(l.second->reserve())
+                                for(auto& c : connections)
+                                    if(c.get() == l.second)
+                                        return c;
+                }
+                if(dial)
+                    return add();
+                std::unique_lock<std::mutex> guard(slots->lock);
+                if(!slots->freed.wait_until(guard, deadline, [this, seen]() { return slots->generation != seen; }))
+                    throw upstream::upstream_error("Timed out waiting for an HTTP/2 stream to " + target.name());
+            }
+        }
+
+        std::shared_ptr<connection> add() {
+            std::shared_ptr<connection> c;
+            try {
+                c = std::make_shared<connection>(target, timeout, window, lookup);
+            }
+            catch(...) {
+                std::lock_guard<std::mutex> guard(lock);
+                --connecting;
+                throw;
+            }
+            auto shared = slots;
+            c->start([shared]() {
+                std::lock_guard<std::mutex> guard(shared->lock);
+                ++shared->generation;
+                shared->freed.notify_all();
+            });
+            c->reserve();
+            std::lock_guard<std::mutex> guard(lock);
+            --connecting;
+            connections.push_back(c);
+            return c;
+        }
+
+        upstream::backend target;
+        size_t max_connections;
+        std::chrono::milliseconds timeout;
+        uint32_t window;
+        upstream::address_lookup lookup;
+        std::mutex lock;
+        size_t connecting;
+        std::vector<std::shared_ptr<connection> > connections;
+        std::shared_ptr<signal> slots;
+    };
+}
+
+#endif //__HTTP2_HPP__
+
+#ifdef TEST_HTTP2
+
+#include "upstream/histogram.hpp"
+
+#include <cassert>
+#include <iostream>
+
+namespace {
+  struct raw_frame {
+    uint8_t type = 0;
+    uint8_t flags = 0;
+    uint32_t id = 0;
+    std::string payload;
+  };
+
+  //the backend end of one h2c connection, driven frame by frame from the test
+  struct fake_peer {
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int fd = -1;
+    upstream::backend target{"127.0.0.1", 0};
+    http2::hpack_encoder encoder;
+    http2::hpack_decoder decoder;
+    fake_peer() {
+      sockaddr_in a{};
+      a.sin_family = AF_INET;
+      a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      socklen_t length = sizeof(a);
+      assert(bind(listener, reinterpret_cast<sockaddr*>(&a), sizeof(a)) == 0 && listen(listener, 8) == 0);
+      getsockname(listener, reinterpret_cast<sockaddr*>(&a), &length);
+      target.port = ntohs(a.sin_port);
+    }
+    //takes over a connection accepted elsewhere, for backends serving more than one
+    explicit fake_peer(int accepted) : listener(-1), fd(accepted) {}
+    ~fake_peer() {
+      if(fd >= 0)
+        close(fd);
+      if(listener >= 0)
+        close(listener);
+    }
+    //takes the next connection and its preface, answering the client's settings
+    void accept_client() {
+      if(fd >= 0)
+        close(fd);
+      fd = accept(listener, nullptr, nullptr);
+      timeval limit{5, 0};
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof(limit));
+      handshake();
+    }
+    //reads the preface, returning the client's settings
+    raw_frame handshake() {
+      std::string preface(24, '\0');
+      assert(read_exactly(&preface[0], 24) && preface == "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+      raw_frame settings = next();
+      assert(settings.type == http2::frame::SETTINGS);
+      return settings;
+    }
+    bool read_exactly(char* at, size_t size) {
+      while(size) {
+        ssize_t got = read(fd, at, size);
+        if(got <= 0)
+          return false;
+        at += got;
+        size -= static_cast<size_t>(got);
+      }
+      return true;
+    }
+    //the next frame, a type 0xff frame once the client closed
+    raw_frame next() {
+      raw_frame f;
+      uint8_t h[9];
+      if(!read_exactly(reinterpret_cast<char*>(h), 9)) {
+        f.type = 0xff;
+        return f;
+      }
+      f.type = h[3];
+      f.flags = h[4];
+      f.id = (uint32_t(h[5] & 0x7f) << 24) | (uint32_t(h[6]) << 16) | (uint32_t(h[7]) << 8) | h[8];
+      f.payload.resize((size_t(h[0]) << 16) | (size_t(h[1]) << 8) | h[2]);
+      if(!f.payload.empty() && !read_exactly(&f.payload[0], f.payload.size()))
+        f.type = 0xff;
+      return f;
+    }
+    //skips frames until one of type comes along
+    raw_frame next(uint8_t type) {
+      raw_frame f;
+      do {
+        f = next();
+      } while(f.type != type && f.type != 0xff);
+      return f;
+    }
+    void send(uint8_t type, uint8_t flags, uint32_t id, const std::string& payload) {
+      std::string out;
+      out.push_back(static_cast<char>(payload.size() >> 16));
+      out.push_back(static_cast<char>(payload.size() >> 8));
+      out.push_back(static_cast<char>(payload.size()));
+      out.push_back(static_cast<char>(type));
+      out.push_back(static_cast<char>(flags));
+      for(int i = 3; i >= 0; --i)
+        out.push_back(static_cast<char>(id >> (8 * i)));
+      out += payload;
+      assert(write(fd, out.data(), out.size()) == static_cast<ssize_t>(out.size()));
+    }
+    static std::string u32(uint32_t v) {
+      return {static_cast<char>(v >> 24), static_cast<char>(v >> 16), static_cast<char>(v >> 8), static_cast<char>(v)};
+    }
+    static std::string setting(uint16_t key, uint32_t value) {
+      return std::string{static_cast<char>(key >> 8), static_cast<char>(key)} + u32(value);
+    }
+  };
+
+  //an h2c grpc echo backend: every stream gets its DATA back, within the client's flow control
+  //windows, then grpc-status 0 trailers once the client ended it. a thread per connection
+  struct echo_peer {
+    fake_peer listening;
+    std::mutex lock;
+    std::vector<int> connections;
+    std::vector<std::thread> sessions;
+    std::thread acceptor;
+    echo_peer() {
+      acceptor = std::thread([this]() {
+        int c;
+        while((c = accept(listening.listener, nullptr, nullptr)) >= 0) {
+          std::lock_guard<std::mutex> guard(lock);
+          connections.push_back(c);
+          sessions.emplace_back([c]() { serve(c); });
+        }
+      });
+    }
+    ~echo_peer() {
+      shutdown(listening.listener, SHUT_RDWR);
+      acceptor.join();
+      for(int c : connections)
+        shutdown(c, SHUT_RDWR);
+      for(auto& t : sessions)
+        t.join();
+    }
+    static uint32_t get32(const std::string& s, size_t at) {
+      return uint32_t(uint8_t(s[at])) << 24 | uint32_t(uint8_t(s[at + 1])) << 16 | uint32_t(uint8_t(s[at + 2])) << 8 | uint8_t(s[at + 3]);
+    }
+    static void serve(int c) {
+      struct stream {
+        std::string pending;
+        int64_t window;
+        bool ended;
+      };
+      fake_peer peer(c);
+      int one = 1;
+      setsockopt(c, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      raw_frame f = peer.handshake();
+      int64_t initial = 65535, window = 65535;
+      std::unordered_map<uint32_t, stream> streams;
+      //the first settings are applied here, later ones in the loop
+      peer.send(http2::frame::SETTINGS, 0, 0, "");
+      for(; f.type != 0xff && f.type != http2::frame::GOAWAY; f = peer.next()) {
+        if(f.type == http2::frame::SETTINGS && !(f.flags & http2::frame::ACK)) {
+          for(size_t at = 0; at + 6 <= f.payload.size(); at += 6)
+            if((uint16_t(uint8_t(f.payload[at])) << 8 | uint8_t(f.payload[at + 1])) == http2::setting::INITIAL_WINDOW_SIZE) {
+              int64_t value = get32(f.payload, at + 2);
+              for(auto& s : streams)
+                s.second.window += value - initial;
+              initial = value;
+            }
+          peer.send(http2::frame::SETTINGS, http2::frame::ACK, 0, "");
+        }
+        else if(f.type == http2::frame::PING && !(f.flags & http2::frame::ACK))
+          peer.send(http2::frame::PING, http2::frame::ACK, 0, f.payload);
+        else if(f.type == http2::frame::WINDOW_UPDATE) {
+          auto s = streams.find(f.id);
+          if(f.id == 0)
+            window += get32(f.payload, 0) & http2::MAX_WINDOW;
+          else if(s != streams.end())
+            s->second.window += get32(f.payload, 0) & http2::MAX_WINDOW;
+        }
+        else if(f.type == http2::frame::HEADERS) {
+          streams[f.id] = stream{"", initial, (f.flags & http2::frame::END_STREAM) != 0};
+          std::string block;
+          peer.encoder.encode({{":status", "200"}, {"content-type", "application/grpc"}}, block);
+          peer.send(http2::frame::HEADERS, http2::frame::END_HEADERS, f.id, block);
+        }
+        else if(f.type == http2::frame::DATA) {
+          auto s = streams.find(f.id);
+          if(s != streams.end()) {
+            s->second.pending += f.payload;
+            s->second.ended = f.flags & http2::frame::END_STREAM;
+          }
+          //what the client sent is handed straight back to it as window
+          if(!f.payload.empty()) {
+            peer.send(http2::frame::WINDOW_UPDATE, 0, 0, fake_peer::u32(static_cast<uint32_t>(f.payload.size())));
+            if(s != streams.end() && !s->second.ended)
+              peer.send(http2::frame::WINDOW_UPDATE, 0, f.id, fake_peer::u32(static_cast<uint32_t>(f.payload.size())));
+          }
+        }
+        else if(f.type == http2::frame::RST_STREAM)
+          streams.erase(f.id);
+        //send what the windows allow, and close the streams with nothing left to send
+        for(auto s = streams.begin(); s != streams.end();) {
+          auto& st = s->second;
+          while(!st.pending.empty() && window > 0 && st.window > 0) {
+            size_t chunk = static_cast<size_t>(std::min<int64_t>({static_cast<int64_t>(st.pending.size()), static_cast<int64_t>(http2::MAX_FRAME), window, st.window}));
+            peer.send(http2::frame::DATA, 0, s->first, st.pending.substr(0, chunk));
+            st.pending.erase(0, chunk);
+            window -= static_cast<int64_t>(chunk);
+            st.window -= static_cast<int64_t>(chunk);
+          }
+          if(st.ended && st.pending.empty()) {
+            std::string block;
+            peer.encoder.encode({{"grpc-status", "0"}}, block);
+            peer.send(http2::frame::HEADERS, http2::frame::END_HEADERS | http2::frame::END_STREAM, s->first, block);
+            s = streams.erase(s);
+          }
+          else
+            ++s;
+        }
+      }
+    }
+  };
+
+  //waits for the reader to notice, the old code deadlocked here with the reader holding lock
+  bool dies(http2::connection& c) {
+    for(int i = 0; i < 500 && c.usable(); ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    return !c.usable();
+  }
+}
+
+//checks frame handling against a scripted peer, then benchmarks unary and streaming grpc style
+//calls against an h2c echo backend that returns every DATA frame it gets followed by grpc-status
+//trailers. that is the in process echo_peer unless a target is given, - keeps it with other sizes:
+//  g++ -std=c++17 -O2 -DTEST_HTTP2 -Iinclude -x c++ include/http2/http2.hpp -pthread -o h2bench
+//  ./h2bench [127.0.0.1:50051|- [concurrency] [calls per thread] [message bytes]]
+int main(int argc, char** argv) {
+  //bad settings and window overflows end in a GOAWAY instead of a reader stuck on its own lock
+  struct violation {
+    uint8_t type;
+    std::string payload;
+    uint32_t code;
+    const char* reason;
+  };
+  std::vector<violation> violations = {
+    {http2::frame::SETTINGS, fake_peer::setting(http2::setting::MAX_FRAME_SIZE, 100), http2::error::PROTOCOL_ERROR, "Bad MAX_FRAME_SIZE"},
+    {http2::frame::SETTINGS, fake_peer::setting(http2::setting::INITIAL_WINDOW_SIZE, 0x80000000u), http2::error::FLOW_CONTROL_ERROR, "Bad INITIAL_WINDOW_SIZE"},
+    {http2::frame::WINDOW_UPDATE, fake_peer::u32(http2::MAX_WINDOW), http2::error::FLOW_CONTROL_ERROR, "Connection window overflow"}};
+  for(const auto& v : violations) {
+    fake_peer peer;
+    auto c = std::make_shared<http2::connection>(peer.target, std::chrono::milliseconds(2000), 65535);
+    peer.accept_client();
+    c->start([]() {});
+    peer.send(v.type, 0, 0, v.payload);
+    raw_frame goaway = peer.next(http2::frame::GOAWAY);
+    assert(goaway.type == http2::frame::GOAWAY && goaway.payload.substr(4) == fake_peer::u32(v.code));
+    assert(dies(*c) && c->last_error().find(v.reason) != std::string::npos);
+  }
+
+  //pings are answered from the control queue
+  {
+    fake_peer peer;
+    auto c = std::make_shared<http2::connection>(peer.target, std::chrono::milliseconds(2000), 65535);
+    peer.accept_client();
+    c->start([]() {});
+    peer.send(http2::frame::PING, 0, 0, "12345678");
+    raw_frame pong = peer.next(http2::frame::PING);
+    assert(pong.flags == http2::frame::ACK && pong.payload == "12345678");
+    c->shutdown();
+  }
+
+  //a normal exchange, one that stalls and one that trickles
+  {
+    fake_peer peer;
+    std::thread backend([&]() {
+      peer.accept_client();
+      peer.send(http2::frame::SETTINGS, 0, 0, "");
+      raw_frame request = peer.next(http2::frame::HEADERS);
+      auto headers = peer.decoder.decode(reinterpret_cast<const uint8_t*>(request.payload.data()), request.payload.size());
+      assert(headers[0] == std::make_pair(std::string(":method"), std::string("GET")) && headers[3].second == "/fine");
+      std::string block;
+      peer.encoder.encode({{":status", "200"}}, block);
+      peer.send(http2::frame::HEADERS, http2::frame::END_HEADERS, request.id, block);
+      peer.send(http2::frame::DATA, http2::frame::END_STREAM, request.id, "hello");
+      //a response that never comes, the client gives up and resets the stream
+      request = peer.next(http2::frame::HEADERS);
+      raw_frame reset = peer.next(http2::frame::RST_STREAM);
+      assert(reset.id == request.id && reset.payload == fake_peer::u32(http2::error::CANCEL));
+      //one that trickles in slower than the timeout overall, but never goes quiet for that long
+      request = peer.next(http2::frame::HEADERS);
+      block.clear();
+      peer.encoder.encode({{":status", "200"}}, block);
+      peer.send(http2::frame::HEADERS, http2::frame::END_HEADERS, request.id, block);
+      for(int i = 0; i < 4; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(150));
+        peer.send(http2::frame::DATA, i == 3 ? http2::frame::END_STREAM : 0, request.id, "slow");
+      }
+      peer.next(0xff);
+    });
+    {
+      //the pool closing its connection at the end of the block lets the peer finish
+      http2::pool backends(peer.target, upstream::upstream_config_t{{"timeout_ms", "300"}});
+      http::request request;
+      request.method = "GET";
+      request.target = "/fine";
+      assert(backends.exchange(request).body == "hello");
+      request.target = "/stuck";
+      auto started = upstream::clock::now();
+      bool timed_out = false;
+      try {
+        backends.exchange(request);
+      }
+      catch(const upstream::upstream_error& e) {
+        timed_out = std::string(e.what()).find("Timed out") != std::string::npos;
+      }
+      assert(timed_out && upstream::clock::now() - started < std::chrono::seconds(2));
+      request.target = "/slow";
+      assert(backends.exchange(request).body == "slowslowslowslow");
+    }
+    backend.join();
+  }
+  std::cout << "http2 ok" << std::endl;
+
+  std::unique_ptr<echo_peer> local;
+  upstream::backend target;
+  if(argc < 2 || std::string(argv[1]) == "-") {
+    local.reset(new echo_peer);
+    target = local->listening.target;
+  }
+  else
+    target = upstream::parse_backend(argv[1]);
+  size_t threads = argc > 2 ? std::stoul(argv[2]) : 64;
+  size_t calls = argc > 3 ? std::stoul(argv[3]) : 1000;
+  size_t bytes = argc > 4 ? std::stoul(argv[4]) : 128;
+  http2::pool backends(target, upstream::upstream_config_t{{"h2_connections", "4"}});
+  std::string message = http2::grpc_frame(std::string(bytes, 'x'));
+
+  //unary calls from many threads multiplexed over the pool
+  upstream::histogram latencies;
+  std::atomic<size_t> failures{0};
+  auto start = upstream::clock::now();
+  std::vector<std::thread> workers;
+  for(size_t t = 0; t < threads; ++t)
+    workers.emplace_back([&]() {
+      for(size_t i = 0; i < calls; ++i) {
+        http::request request;
+        request.target = "/echo.Echo/Echo";
+        request.body = message;
+        http2::grpc_request(request);
+        auto began = upstream::clock::now();
+        try {
+          http::headers_t trailers;
+          auto response = backends.exchange(request, nullptr, &trailers);
+          const std::string* status = http::find_header(trailers, "grpc-status");
+          if(response.body != message || !status || *status != "0")
+            ++failures;
+        }
+        catch(const std::exception& e) {
+          std::cout << e.what() << std::endl;
+          ++failures;
+        }
+        latencies.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(upstream::clock::now() - began).count()));
+      }
+    });
+  for(auto& w : workers)
+    w.join();
+  double seconds = std::chrono::duration<double>(upstream::clock::now() - start).count();
+  uint64_t samples;
+  std::cout << "unary: " << threads * calls / seconds << " calls/s over " << backends.size() << " connections, p50 "
+            << latencies.percentile(0.5, samples) << "us p99 " << latencies.percentile(0.99, samples) << "us, "
+            << failures << " failed" << std::endl;
+
+  //one bidirectional stream, messages flow back while we are still sending
+  std::mutex lock;
+  std::condition_variable done;
+  size_t echoed = 0;
+  bool closed = false;
+  std::string status;
+  http2::stream_events events;
+  events.data = [&](const char*, size_t size) { std::lock_guard<std::mutex> guard(lock); echoed += size; };
+  events.trailers = [&](http::headers_t& trailers) { status = *http::find_header(trailers, "grpc-status"); };
+  events.closed = [&](uint32_t) { std::lock_guard<std::mutex> guard(lock); closed = true; done.notify_all(); };
+  http::request request;
+  request.target = "/echo.Echo/Chat";
+  http2::grpc_request(request);
+  size_t streamed = threads * calls;
+  start = upstream::clock::now();
+  auto chat = backends.open(request, events, false);
+  for(size_t i = 0; i < streamed; ++i)
+    chat->write(message, i + 1 == streamed);
+  std::unique_lock<std::mutex> guard(lock);
+  done.wait(guard, [&]() { return closed; });
+  seconds = std::chrono::duration<double>(upstream::clock::now() - start).count();
+  std::cout << "streaming: " << streamed / seconds << " messages/s, " << echoed * 8 / seconds / 1e6 << " Mbit/s echoed, grpc-status "
+            << status << std::endl;
+  return failures != 0 || echoed != streamed * message.size() || status != "0";
+}
+
+#endif
@@ -0,0 +1,424 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __MIDDLEWARE_HPP__
+#define __MIDDLEWARE_HPP__
+
+#include "server/server.hpp"
+#include "headers/headers.hpp"
+#include "compression/gzip.hpp"
+#include "logging/logging.hpp"
+
+#include <tuple>
+#include <memory>
+#include <unordered_set>
+
+namespace middleware {
+    using middleware_config_t = std::unordered_map<std::string, std::string>;
+
+    //a filter is anything with
+    //  template <typename Next> void operator()(const http::request&, http::response&, const Next& next) const
+    //calling next(request, response) to go on down the chain, or answering without it. they
+    //are const and shared by every loop thread, whatever they keep must be safe for that
+
+    //bearer tokens from the comma separated auth_tokens, anything else gets a 401
+    class auth {
+    public:
+        auth() = delete;
+        explicit auth(const middleware_config_t& config) {
+            auto list = config.find("auth_tokens");
+            if(list == config.end() || list->second.empty())
+                throw std::runtime_error("auth_tokens is required");
+            size_t start = 0;
+            while(start <= list->second.size()) {
+                size_t comma = list->second.find(',', start);
+                if(comma == std::string::npos)
+                    comma = list->second.size();
+                if(comma > start)
+                    tokens.emplace(list->second, start, comma - start);
+                start = comma + 1;
+            }
+        }
+
+        template <typename Next>
+        void operator()(const http::request& request, http::response& response, const Next& next) const {
+            const std::string* authorization = http::find_header(request.headers, "Authorization");
+            if(authorization && authorization->size() > 7 && strncasecmp(authorization->c_str(), "Bearer ", 7) == 0 &&
+               tokens.count(authorization->substr(7)))
+                return next(request, response);
+            response.status = 401;
+            response.headers.emplace_back("WWW-Authenticate", "Bearer");
+        }
+
+    protected:
+        std::unordered_set<std::string> tokens;
+    };
+
+    //the response side of the header_rules programs for the request path
+    class response_headers {
+    public:
+        response_headers() = delete;
+        explicit response_headers(const middleware_config_t& config) : rules(std::make_shared<const headers::header_rules>(config)) {}
+
+        template <typename Next>
+        void operator()(const http::request& request, http::response& response, const Next& next) const {
+            next(request, response);
+            const headers::program* p = rules->find(request.target, headers::direction::RESPONSE);
+            if(p)
+                p->apply(response.headers);
+        }
+
+    protected:
+        std::shared_ptr<const headers::header_rules> rules;
+    };
+
+    //gzips bodies of at least compress_min_length bytes (1024) at compress_level (6) for
+    //clients that take it
+    class compress {
+    public:
+        compress() = delete;
+        explicit compress(const middleware_config_t& config) : min_length(1024), level(6) {
+            auto parse = [&config](const char* key, size_t& value) {
+                auto found = config.find(key);
+                if(found == config.end())
+                    return;
+                try {
+                    value = std::stoul(found->second);
+                }
+                catch(...) {
+                    throw std::runtime_error(found->second + " is not a valid " + key);
+                }
+            };
+            parse("compress_min_length", min_length);
+            parse("compress_level", level);
+            if(level > 9)
+                throw std::runtime_error(std::to_string(level) + " is not a valid compress_level");
+        }
+
+        template <typename Next>
+        void operator()(const http::request& request, http::response& response, const Next& next) const {
+            next(request, response);
+            if(response.body.size() < min_length || (response.status != 0 && response.status != 200))
+                return;
+            const std::string* accept = http::find_header(request.headers, "Accept-Encoding");
+            if(!accept || !compression::accepts_gzip(*accept) || http::find_header(response.headers, "Content-Encoding"))
+                return;
+            response.body = compression::gzip(response.body, static_cast<int>(level));
+            response.headers.emplace_back("Content-Encoding", "gzip");
+            response.headers.emplace_back("Vary", "Accept-Encoding");
+        }
+
+    protected:
+        size_t min_length;
+        size_t level;
+    };
+
+    //one line per request to a logger, the logging singleton unless another is given
+    class access_log {
+    public:
+        access_log() = delete;
+        explicit access_log(const middleware_config_t&) : out(&logging::get_logger()) {}
+        explicit access_log(logging::logger& out) : out(&out) {}
+
+        template <typename Next>
+        void operator()(const http::request& request, http::response& response, const Next& next) const {
+            auto start = std::chrono::steady_clock::now();
+            next(request, response);
+            auto took = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+            std::string line;
+            line.reserve(request.method.size() + request.target.size() + 48);
+            line.append(request.method).push_back(' ');
+            line.append(request.target).push_back(' ');
+            line.append(std::to_string(response.status ? response.status : 200)).push_back(' ');
+            line.append(std::to_string(response.body.size())).push_back(' ');
+            line.append(std::to_string(took)).append("us");
+            out->log(line, logging::log_level::INFO);
+        }
+
+    protected:
+        logging::logger* out;
+    };
+
+    //filters composed at compile time: each filter gets the rest of the chain as a lambda of
+    //its own type, so the whole chain is one call graph the compiler can inline down to the
+    //handler. the first filter is the outermost
+    template <typename Handler, typename... Filters>
+    class pipeline {
+    public:
+        explicit pipeline(Handler handler, Filters... filters) : handler(std::move(handler)), filters(std::move(filters)...) {}
+
+        void operator()(const http::request& request, http::response& response) const {
+            step<0>(request, response);
+        }
+
+    protected:
+        template <size_t I>
+        void step(const http::request& request, http::response& response) const {
+            if constexpr(I == sizeof...(Filters))
+                handler(request, response);
+            else
+                std::get<I>(filters)(request, response, [this](const http::request& q, http::response& r) { step<I + 1>(q, r); });
+        }
+
+        Handler handler;
+        std::tuple<Filters...> filters;
+    };
+
+    //a pipeline usable wherever a server::handler goes
+    template <typename Handler, typename... Filters>
+    pipeline<Handler, Filters...> compose(Handler handler, Filters... filters) {
+        return pipeline<Handler, Filters...>(std::move(handler), std::move(filters)...);
+    }
+
+    //the runtime fallback, for chains only known from configuration: every filter is behind
+    //a virtual call and gets the rest of the chain as a cursor into the list
+    class dynamic_pipeline;
+    struct cursor {
+        const dynamic_pipeline* chain;
+        size_t next;
+        inline void operator()(const http::request& request, http::response& response) const;
+    };
+
+    class filter {
+    public:
+        virtual ~filter() = default;
+        virtual void handle(const http::request& request, http::response& response, const cursor& next) const = 0;
+    };
+
+    //any compile time filter behind the virtual interface
+    template <typename F>
+    class adapter : public filter {
+    public:
+        explicit adapter(F f) : f(std::move(f)) {}
+        void handle(const http::request& request, http::response& response, const cursor& next) const final {
+            f(request, response, next);
+        }
+    protected:
+        F f;
+    };
+
+    //a factory for filters by name, like the logger factory, so the chain can be listed in
+    //configuration and filters of your own can be registered next to the built in ones
+    using filter_creator = filter *(*)(const middleware_config_t&);
+    class filter_factory {
+    public:
+        filter_factory() {
+            creators.emplace("auth", [](const middleware_config_t& config)->filter*{return new adapter<auth>(auth(config));});
+            creators.emplace("headers", [](const middleware_config_t& config)->filter*{return new adapter<response_headers>(response_headers(config));});
+            creators.emplace("compress", [](const middleware_config_t& config)->filter*{return new adapter<compress>(compress(config));});
+            creators.emplace("log", [](const middleware_config_t& config)->filter*{return new adapter<access_log>(access_log(config));});
+        }
+        void add(const std::string& name, filter_creator creator) {
+            creators[name] = creator;
+        }
+        filter* produce(const std::string& name, const middleware_config_t& config) const {
+            auto found = creators.find(name);
+            if(found != creators.end())
+                return found->second(config);
+            throw std::runtime_error("Couldn't produce filter for name: " + name);
+        }
+    protected:
+        std::unordered_map<std::string, filter_creator> creators;
+    };
+
+    inline filter_factory& get_factory() {
+        static filter_factory factory_singleton{};
+        return factory_singleton;
+    }
+
+    //the filters named in the comma separated middleware, outermost first, then handler
+    class dynamic_pipeline {
+    public:
+        dynamic_pipeline() = delete;
+        dynamic_pipeline(const middleware_config_t& config, server::handler handler) : handler(std::move(handler)) {
+            auto list = config.find("middleware");
+            if(list == config.end())
+                return;
+            size_t start = 0;
+            while(start <= list->second.size()) {
+                size_t comma = list->second.find(',', start);
+                if(comma == std::string::npos)
+                    comma = list->second.size();
+                std::string name = list->second.substr(start, comma - start);
+                name.erase(0, name.find_first_not_of(" \t"));
+                name.erase(name.find_last_not_of(" \t") + 1);
+                if(!name.empty())
+                    filters.emplace_back(get_factory().produce(name, config));
+                start = comma + 1;
+            }
+        }
+        dynamic_pipeline(const dynamic_pipeline&) = delete;
+        dynamic_pipeline& operator=(const dynamic_pipeline&) = delete;
+
+        //filters built elsewhere, appended innermost
+        void add(std::unique_ptr<filter> f) {
+            filters.push_back(std::move(f));
+        }
+
+        void operator()(const http::request& request, http::response& response) const {
+            run(0, request, response);
+        }
+
+        void run(size_t i, const http::request& request, http::response& response) const {
+            if(i == filters.size())
+                handler(request, response);
+            else
+                filters[i]->handle(request, response, cursor{this, i + 1});
+        }
+
+        size_t size() const {
+            return filters.size();
+        }
+
+    protected:
+        server::handler handler;
+        std::vector<std::unique_ptr<filter> > filters;
+    };
+
+    inline void cursor::operator()(const http::request& request, http::response& response) const {
+        chain->run(next, request, response);
+    }
+}
+
+#endif //__MIDDLEWARE_HPP__
+
+#ifdef TEST_MIDDLEWARE
+//g++ -std=c++17 -O2 -DTEST_MIDDLEWARE -Iinclude -x c++ include/middleware/middleware.hpp -pthread -lssl -lcrypto -lz -ldl -o middlewarebench
+#include <cassert>
+#include <iostream>
+
+struct count {
+  template <typename Next>
+  void operator()(const http::request& request, http::response& response, const Next& next) const {
+    next(request, response);
+    ++response.status;
+  }
+};
+
+int main() {
+  char path[] = "/tmp/header_rulesXXXXXX";
+  int fd = mkstemp(path);
+  std::string text = "/ response set X-Frame-Options DENY\n/ response remove X-Powered-By\n";
+  if(write(fd, text.data(), text.size()) != static_cast<ssize_t>(text.size()))
+    return 1;
+  close(fd);
+  middleware::middleware_config_t config{{"auth_tokens", "secret,other"}, {"header_rules", path},
+                                         {"middleware", "null_log,auth,headers,compress"}};
+  //a null logger, the chains are measured rather than the log sink
+  static logging::logger sink(config);
+  middleware::get_factory().add("null_log", [](const middleware::middleware_config_t&)->middleware::filter* {
+    return new middleware::adapter<middleware::access_log>(middleware::access_log(sink));
+  });
+  //a small json answer, or one past compress_min_length under /big
+  auto endpoint = [](const http::request& request, http::response& response) {
+    response.headers.emplace_back("Content-Type", "application/json");
+    response.headers.emplace_back("X-Powered-By", "bench");
+    response.body = request.target.compare(0, 4, "/big") == 0 ? "[" + std::string(2000, '1') + "]" : "{\"ok\":true}";
+  };
+
+  auto inlined = middleware::compose(endpoint, middleware::access_log(sink), middleware::auth(config),
+                                     middleware::response_headers(config), middleware::compress(config));
+  middleware::dynamic_pipeline virtuals(config, endpoint);
+
+  auto call = [](const auto& chain, const std::string& target, const http::headers_t& headers) {
+    http::request q;
+    q.method = "GET";
+    q.target = target;
+    q.headers = headers;
+    http::response r;
+    chain(q, r);
+    return r;
+  };
+
+  //a missing, wrong or non bearer token is a 401 with a challenge, the handler never runs
+  middleware::auth gate(config);
+  auto handled = [](const http::request&, http::response& response) { response.body = "handled"; };
+  for(const http::headers_t& headers : {http::headers_t{}, http::headers_t{{"Authorization", "Bearer nope"}},
+                                        http::headers_t{{"Authorization", "Basic secret"}}, http::headers_t{{"Authorization", "Bearer "}}}) {
+    auto r = call(middleware::compose(handled, gate), "/", headers);
+    const std::string* challenge = http::find_header(r.headers, "WWW-Authenticate");
+    assert(r.status == 401 && challenge && *challenge == "Bearer" && r.body.empty());
+  }
+  auto let_in = call(middleware::compose(handled, gate), "/", {{"Authorization", "bearer other"}});
+  assert(let_in.status == 0 && let_in.body == "handled" && !http::find_header(let_in.headers, "WWW-Authenticate"));
+
+  //gzip only from compress_min_length on and only for clients that take it
+  auto sized = [](const http::request& request, http::response& response) {
+    response.body = std::string(std::stoul(request.target.substr(1)), 'z');
+  };
+  auto squeeze = middleware::compose(sized, middleware::compress(middleware::middleware_config_t{{"compress_min_length", "100"}}));
+  http::headers_t gzip_ok{{"Accept-Encoding", "deflate, gzip"}};
+  auto below = call(squeeze, "/99", gzip_ok), at = call(squeeze, "/100", gzip_ok);
+  assert(below.body == std::string(99, 'z') && !http::find_header(below.headers, "Content-Encoding"));
+  const std::string* encoding = http::find_header(at.headers, "Content-Encoding");
+  const std::string* vary = http::find_header(at.headers, "Vary");
+  assert(encoding && *encoding == "gzip" && vary && *vary == "Accept-Encoding");
+  assert(at.body.size() < 100 && compression::gunzip(at.body) == std::string(100, 'z'));
+  for(const http::headers_t& headers : {http::headers_t{}, http::headers_t{{"Accept-Encoding", "br"}}, http::headers_t{{"Accept-Encoding", "gzip;q=0"}}}) {
+    auto plain = call(squeeze, "/5000", headers);
+    assert(plain.body.size() == 5000 && plain.headers.empty());
+  }
+
+  //the header rules set and remove on the way out, other headers are left alone
+  auto shaped = call(middleware::compose(endpoint, middleware::response_headers(config)), "/", {});
+  unlink(path);
+  const std::string* frame = http::find_header(shaped.headers, "X-Frame-Options");
+  assert(frame && *frame == "DENY" && !http::find_header(shaped.headers, "X-Powered-By") && http::find_header(shaped.headers, "Content-Type"));
+
+  //both chains answer alike, whatever path the request takes through them
+  for(const auto& target : {std::string("/"), std::string("/big")})
+    for(const http::headers_t& headers : {http::headers_t{{"Authorization", "Bearer secret"}, {"Accept-Encoding", "gzip"}},
+                                          http::headers_t{{"Authorization", "Bearer secret"}}, http::headers_t{{"Accept-Encoding", "gzip"}}}) {
+      auto a = call(inlined, target, headers), b = call(virtuals, target, headers);
+      assert(a.status == b.status && a.headers == b.headers && a.body == b.body);
+    }
+  assert(http::find_header(call(inlined, "/big", {{"Authorization", "Bearer secret"}, {"Accept-Encoding", "gzip"}}).headers, "Content-Encoding"));
+
+  //a filter nobody registered is a configuration error
+  bool unknown = false;
+  try {
+    middleware::dynamic_pipeline broken(middleware::middleware_config_t{{"auth_tokens", "secret"}, {"middleware", "auth, nonesuch"}}, endpoint);
+  }
+  catch(const std::runtime_error& e) {
+    unknown = std::string(e.what()).find("nonesuch") != std::string::npos;
+  }
+  assert(unknown);
+
+  http::request request;
+  request.method = "GET";
+  request.target = "/api/items?id=7";
+  request.headers = {{"Host", "localhost"}, {"Authorization", "Bearer secret"}, {"Accept-Encoding", "gzip"}};
+  http::response response;
+  auto measure = [&request, &response](const char* what, const auto& a, const auto& b, int n) {
+    for(int round = 0; round < 2; ++round) {
+      auto start = std::chrono::steady_clock::now();
+      for(int i = 0; i < n; ++i) {
+        response.status = 0;
+        response.headers.clear();
+        a(request, response);
+      }
+      double first = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      start = std::chrono::steady_clock::now();
+      for(int i = 0; i < n; ++i) {
+        response.status = 0;
+        response.headers.clear();
+        b(request, response);
+      }
+      double second = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      std::cout << what << ": compile time chain " << first * 1e9 / n << " ns, virtual chain " << second * 1e9 / n
+                << " ns per request" << std::endl;
+    }
+  };
+  measure("log, auth, headers, compress", inlined, virtuals, 2000000);
+
+  //the dispatch alone, eight filters doing next to nothing
+  auto nothing = [](const http::request&, http::response&) {};
+  auto inlined_counts = middleware::compose(nothing, count(), count(), count(), count(), count(), count(), count(), count());
+  middleware::dynamic_pipeline virtual_counts(middleware::middleware_config_t{}, nothing);
+  for(int i = 0; i < 8; ++i)
+    virtual_counts.add(std::unique_ptr<middleware::filter>(new middleware::adapter<count>(count())));
+  measure("eight counting filters", inlined_counts, virtual_counts, 50000000);
+  return 0;
+}
+#endif
@@ -0,0 +1,73 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __LISTEN_HPP__
+#define __LISTEN_HPP__
+
+#include <string>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <netdb.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+namespace net {
+    //opens a listening socket on 'host:port', reuse_port lets one listener per loop share the port
+    inline int listen_on(const std::string& spec, bool reuse_port, int backlog = 4096) {
+        //like a backend but an empty or '*' host is any address and port 0 any free port
+        auto colon = spec.rfind(':');
+        if(colon == std::string::npos)
+            throw std::runtime_error(spec + " is not a valid listen address, expected host:port");
+        std::string host = spec.substr(0, colon), port = spec.substr(colon + 1);
+        if(host.size() > 2 && host.front() == '[' && host.back() == ']')
+            host = host.substr(1, host.size() - 2);
+        try {
+            if(std::stoul(port) > 65535)
+                throw std::out_of_range("port");
+        }
+        catch(...) {
+            throw std::runtime_error(spec + " is not a valid listen port");
+        }
+        addrinfo hints{}, *results = nullptr;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        int error = getaddrinfo(host.empty() || host == "*" ? nullptr : host.c_str(), port.c_str(), &hints, &results);
+        if(error != 0)
+            throw std::runtime_error("Couldn't resolve " + spec + ": " + gai_strerror(error));
+        int fd = -1;
+        std::string failure;
+        for(auto* ai = results; ai && fd < 0; ai = ai->ai_next) {
+            fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if(fd < 0)
+                continue;
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if(reuse_port)
+                setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+            if(bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || listen(fd, backlog) != 0) {
+                failure = strerror(errno);
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(results);
+        if(fd < 0)
+            throw std::runtime_error("Couldn't listen on " + spec + ": " + failure);
+        return fd;
+    }
+
+    //the port a socket is bound to, useful after listening on port 0
+    inline uint16_t local_port(int fd) {
+        sockaddr_storage address{};
+        socklen_t length = sizeof(address);
+        getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length);
+        return ntohs(address.ss_family == AF_INET6 ? reinterpret_cast<sockaddr_in6*>(&address)->sin6_port : reinterpret_cast<sockaddr_in*>(&address)->sin_port);
+    }
+}
+
+#endif //__LISTEN_HPP__
@@ -0,0 +1,129 @@
+/*
+ * Created on 10/18/26.
+ */
+
+/*
+ * the c interface of cheehttpd plugins. a plugin is a shared object exporting
+ * cheehttpd_plugin(), which returns a chee_plugin describing the hooks it
+ * implements. everything handed to a hook is a view into the server's own
+ * request buffers: valid only until the hook returns, never to be written to.
+ * anything a plugin hands back (a response) has to stay valid until the hook
+ * returns too, the server copies it before going on. a server runs the hooks
+ * on all of its threads, one plugin state sees calls from several at once.
+ * on_body gets a request's whole body in one chunk with last set once it is
+ * all in, requests without a body don't get the call
+ *
+ * every struct one side fills in for the other starts with struct_size, the
+ * sizeof it had in the header its writer was built against. fields are only
+ * ever added at the end, so a reader checks CHEE_HAS before touching one that
+ * came later than the oldest header it accepts: a plugin built against an
+ * older header has shorter hook tables, one built against a newer header sees
+ * shorter requests. abi_version changes only when a field moves or goes away.
+ * chee_str and chee_header never change
+ */
+
+#ifndef __CHEEHTTPD_PLUGIN_H__
+#define __CHEEHTTPD_PLUGIN_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHEE_PLUGIN_ABI 1
+#define CHEE_PLUGIN_ENTRY "cheehttpd_plugin"
+
+/* whether the struct s of type T was written by someone knowing field */
+#define CHEE_HAS(T, s, field) ((s)->struct_size >= offsetof(T, field) + sizeof(((T*)0)->field))
+
+/* what a hook returns: go on with the next plugin, or stop here. a positive
+ * value from on_accept, on_headers or on_body is an http status to answer
+ * with (on_accept just closes), from on_handler CHEE_HANDLED means the
+ * response was filled in */
+#define CHEE_DECLINED 0
+#define CHEE_HANDLED 1
+
+typedef struct chee_str {
+    const char* data;
+    size_t size;
+} chee_str;
+
+typedef struct chee_header {
+    chee_str name;
+    chee_str value;
+} chee_header;
+
+typedef struct chee_connection {
+    uint32_t struct_size;
+    const struct sockaddr* peer;
+    socklen_t peer_length;
+    int fd;
+} chee_connection;
+
+typedef struct chee_request {
+    uint32_t struct_size;
+    const chee_connection* connection;
+    chee_str method;
+    chee_str target;
+    chee_str version;
+    const chee_header* headers;
+    size_t header_count;
+} chee_request;
+
+/* zeroed by the server, a plugin sets no field its struct_size leaves out */
+typedef struct chee_response {
+    uint32_t struct_size;
+    int status;
+    const chee_header* headers;
+    size_t header_count;
+    chee_str body;
+} chee_response;
+
+typedef struct chee_log_entry {
+    uint32_t struct_size;
+    const chee_request* request;
+    int status;
+    uint64_t bytes_sent;
+    uint64_t duration_us;
+} chee_log_entry;
+
+/* what the server offers a plugin when it starts */
+typedef struct chee_host {
+    uint32_t abi_version;
+    uint32_t struct_size;
+    void* opaque;
+    /* a configuration value or NULL */
+    const char* (*config)(void* opaque, const char* key);
+    /* logs at 0 trace, 1 debug, 2 info, 3 warn, 4 error */
+    void (*log)(void* opaque, int level, const char* message);
+} chee_host;
+
+typedef struct chee_plugin {
+    uint32_t abi_version;
+    /* sizeof(chee_plugin), hooks past it are taken as NULL */
+    uint32_t struct_size;
+    const char* name;
+    /* returns the state passed to every hook, NULL fails the load */
+    void* (*init)(const chee_host* host);
+    void (*fini)(void* state);
+    /* any hook may be NULL */
+    int (*on_accept)(void* state, const chee_connection* connection);
+    int (*on_headers)(void* state, const chee_request* request);
+    int (*on_handler)(void* state, const chee_request* request, chee_response* response);
+    int (*on_body)(void* state, const chee_request* request, chee_str chunk, int last);
+    void (*on_log)(void* state, const chee_log_entry* entry);
+} chee_plugin;
+
+/* the shortest chee_plugin a server takes, the one of the first abi_version */
+#define CHEE_PLUGIN_MIN_SIZE (offsetof(chee_plugin, on_log) + sizeof(((chee_plugin*)0)->on_log))
+
+typedef const chee_plugin* (*chee_plugin_entry)(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__CHEEHTTPD_PLUGIN_H__*/
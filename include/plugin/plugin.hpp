@@ -0,0 +1,524 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __PLUGIN_HPP__
+#define __PLUGIN_HPP__
+
+#include "plugin/cheehttpd_plugin.h"
+#include "http/http.hpp"
+#include "logging/logging.hpp"
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <time.h>
+#include <dlfcn.h>
+
+namespace plugin {
+    using plugin_config_t = std::unordered_map<std::string, std::string>;
+
+    enum hook : uint8_t {ACCEPT, HEADERS, HANDLER, BODY, LOG, HOOKS};
+
+    inline const char* hook_name(hook h) {
+        static const char* const names[HOOKS] = {"accept", "headers", "handler", "body", "log"};
+        return names[h];
+    }
+
+    inline chee_str view(const std::string& s) {
+        return chee_str{s.data(), s.size()};
+    }
+
+    //a request as plugins see it: pointers into the strings of the http::request, nothing
+    //copied but the array of header pointers, which is kept around for the next request
+    class request_view {
+    public:
+        request_view() = default;
+        request_view(const request_view&) = delete;
+        request_view& operator=(const request_view&) = delete;
+
+        const chee_request& bind(const http::request& r, const chee_connection* connection = nullptr) {
+            headers.resize(r.headers.size());
+            for(size_t i = 0; i < r.headers.size(); ++i)
+                headers[i] = chee_header{view(r.headers[i].first), view(r.headers[i].second)};
+            request.struct_size = sizeof(chee_request);
+            request.connection = connection;
+            request.method = view(r.method);
+            request.target = view(r.target);
+            request.version = view(r.version);
+            request.headers = headers.data();
+            request.header_count = headers.size();
+            return request;
+        }
+        const chee_request& get() const {
+            return request;
+        }
+
+    protected:
+        std::vector<chee_header> headers;
+        chee_request request{};
+    };
+
+    struct hook_stats {
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> nanoseconds{0};
+    };
+
+    //plugins loaded with dlopen from the comma separated list in plugins, each exporting
+    //cheehttpd_plugin() from cheehttpd_plugin.h. hooks run in load order, a plugin that leaves
+    //a hook NULL is not on that hook's list at all so it costs nothing there. with
+    //plugin_timing on every call is timed per plugin and hook, which costs two clock reads
+    class plugins {
+    public:
+        plugins() = delete;
+        explicit plugins(const plugin_config_t& config) : settings(config) {
+            auto timing = config.find("plugin_timing");
+            timed = timing != config.end() && (timing->second == "on" || timing->second == "1");
+            host.abi_version = CHEE_PLUGIN_ABI;
+            host.struct_size = sizeof(chee_host);
+            host.opaque = this;
+            host.config = [](void* opaque, const char* key) -> const char* {
+                auto* self = static_cast<plugins*>(opaque);
+                auto found = self->settings.find(key);
+                return found == self->settings.end() ? nullptr : found->second.c_str();
+            };
+            host.log = [](void*, int level, const char* message) {
+                if(level < 0 || level > static_cast<int>(logging::log_level::ERROR))
+                    level = static_cast<int>(logging::log_level::ERROR);
+                logging::log(message, static_cast<logging::log_level>(level));
+            };
+            auto list = config.find("plugins");
+            if(list == config.end())
+                return;
+            try {
+                size_t start = 0;
+                while(start <= list->second.size()) {
+                    size_t comma = list->second.find(',', start);
+                    if(comma == std::string::npos)
+                        comma = list->second.size();
+                    std::string path = list->second.substr(start, comma - start);
+                    path.erase(0, path.find_first_not_of(" \t"));
+                    path.erase(path.find_last_not_of(" \t") + 1);
+                    if(!path.empty())
+                        load(path);
+                    start = comma + 1;
+                }
+            }
+            catch(...) {
+                unload();
+                throw;
+            }
+        }
+        plugins(const plugins&) = delete;
+        plugins& operator=(const plugins&) = delete;
+        ~plugins() {
+            unload();
+        }
+
+        //a plugin linked into the binary, handle is what dlopen gave back if anything
+        void add(const chee_plugin* p, void* handle = nullptr) {
+            //every hook so far is in the shortest table taken, the ones added later get a
+            //CHEE_HAS check before they are looked at
+            if(!p || p->abi_version != CHEE_PLUGIN_ABI || p->struct_size < CHEE_PLUGIN_MIN_SIZE) {
+                if(handle)
+                    dlclose(handle);
+                throw std::runtime_error(std::string("Plugin ") + (p && p->name ? p->name : "?") + " was built for another plugin abi");
+            }
+            void* state = p->init ? p->init(&host) : nullptr;
+            if(p->init && !state) {
+                if(handle)
+                    dlclose(handle);
+                throw std::runtime_error(std::string("Plugin ") + (p->name ? p->name : "?") + " failed to start");
+            }
+            loaded.emplace_back(new instance{p, state, handle, {}});
+            instance* i = loaded.back().get();
+            if(p->on_accept)
+                accepts.push_back({p->on_accept, state, &i->stats[ACCEPT]});
+            if(p->on_headers)
+                headers.push_back({p->on_headers, state, &i->stats[HEADERS]});
+            if(p->on_handler)
+                handlers.push_back({p->on_handler, state, &i->stats[HANDLER]});
+            if(p->on_body)
+                bodies.push_back({p->on_body, state, &i->stats[BODY]});
+            if(p->on_log)
+                logs.push_back({p->on_log, state, &i->stats[LOG]});
+        }
+
+        //0 to go on, otherwise the status to close with
+        int accept(const chee_connection& connection) {
+            for(const auto& h : accepts) {
+                int result = run(h, [&] { return h.function(h.state, &connection); });
+                if(result != CHEE_DECLINED)
+                    return result;
+            }
+            return CHEE_DECLINED;
+        }
+
+        //0 to go on, otherwise the status to answer with
+        int on_headers(const chee_request& request) {
+            for(const auto& h : headers) {
+                int result = run(h, [&] { return h.function(h.state, &request); });
+                if(result != CHEE_DECLINED)
+                    return result;
+            }
+            return CHEE_DECLINED;
+        }
+
+        //the first plugin taking the request fills response, false when none did
+        bool handle(const chee_request& request, http::response& response) {
+            for(const auto& h : handlers) {
+                chee_response out{};
+                out.struct_size = sizeof(out);
+                if(run(h, [&] { return h.function(h.state, &request, &out); }) != CHEE_HANDLED)
+                    continue;
+                response.status = out.status > 0 ? out.status : 200;
+                response.headers.clear();
+                response.headers.reserve(out.header_count);
+                for(size_t i = 0; i < out.header_count; ++i)
+                    response.headers.emplace_back(std::string(out.headers[i].name.data, out.headers[i].name.size),
+                                                  std::string(out.headers[i].value.data, out.headers[i].value.size));
+                response.body.assign(out.body.data ? out.body.data : "", out.body.size);
+                return true;
+            }
+            return false;
+        }
+
+        //0 to go on, otherwise the status to answer with
+        int body(const chee_request& request, const char* data, size_t size, bool last) {
+            for(const auto& h : bodies) {
+                int result = run(h, [&] { return h.function(h.state, &request, chee_str{data, size}, last ? 1 : 0); });
+                if(result != CHEE_DECLINED)
+                    return result;
+            }
+            return CHEE_DECLINED;
+        }
+
+        void log(const chee_log_entry& entry) {
+            for(const auto& h : logs)
+                run(h, [&] { h.function(h.state, &entry); return 0; });
+        }
+
+        //whether any plugin is on a hook, so callers can skip building views for it
+        bool wants(hook h) const {
+            switch(h) {
+                case ACCEPT: return !accepts.empty();
+                case HEADERS: return !headers.empty();
+                case HANDLER: return !handlers.empty();
+                case BODY: return !bodies.empty();
+                default: return !logs.empty();
+            }
+        }
+
+        size_t size() const {
+            return loaded.size();
+        }
+        const char* name(size_t i) const {
+            return loaded[i]->plugin->name ? loaded[i]->plugin->name : "";
+        }
+        const hook_stats& statistics(size_t i, hook h) const {
+            return loaded[i]->stats[h];
+        }
+
+    protected:
+        struct instance {
+            const chee_plugin* plugin;
+            void* state;
+            void* handle;
+            std::array<hook_stats, HOOKS> stats;
+        };
+        template <typename F>
+        struct bound {
+            F function;
+            void* state;
+            hook_stats* stats;
+        };
+
+        template <typename B, typename Call>
+        int run(const B& h, Call&& call) const {
+            if(!timed)
+                return call();
+            timespec before{}, after{};
+            clock_gettime(CLOCK_MONOTONIC, &before);
+            int result = call();
+            clock_gettime(CLOCK_MONOTONIC, &after);
+            h.stats->calls.fetch_add(1, std::memory_order_relaxed);
+            h.stats->nanoseconds.fetch_add((after.tv_sec - before.tv_sec) * 1000000000ull + after.tv_nsec - before.tv_nsec,
+                                           std::memory_order_relaxed);
+            return result;
+        }
+
+        void load(const std::string& path) {
+            //RTLD_LOCAL so two plugins can use the same symbol names
+            void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+            if(!handle)
+                throw std::runtime_error("Couldn't load plugin " + path + ": " + dlerror());
+            auto entry = reinterpret_cast<chee_plugin_entry>(dlsym(handle, CHEE_PLUGIN_ENTRY));
+            if(!entry) {
+                dlclose(handle);
+                throw std::runtime_error("Plugin " + path + " has no " CHEE_PLUGIN_ENTRY "()");
+            }
+            add(entry(), handle);
+        }
+
+        void unload() {
+            accepts.clear();
+            headers.clear();
+            handlers.clear();
+            bodies.clear();
+            logs.clear();
+            while(!loaded.empty()) {
+                auto& i = loaded.back();
+                if(i->plugin->fini)
+                    i->plugin->fini(i->state);
+                if(i->handle)
+                    dlclose(i->handle);
+                loaded.pop_back();
+            }
+        }
+
+        plugin_config_t settings;
+        chee_host host{};
+        bool timed = false;
+        std::vector<std::unique_ptr<instance> > loaded;
+        std::vector<bound<decltype(chee_plugin::on_accept)> > accepts;
+        std::vector<bound<decltype(chee_plugin::on_headers)> > headers;
+        std::vector<bound<decltype(chee_plugin::on_handler)> > handlers;
+        std::vector<bound<decltype(chee_plugin::on_body)> > bodies;
+        std::vector<bound<decltype(chee_plugin::on_log)> > logs;
+    };
+}
+
+#endif //__PLUGIN_HPP__
+
+#ifdef TEST_PLUGIN_SO
+//the plugin TEST_PLUGIN loads, a shared object like any other plugin:
+//g++ -std=c++17 -O2 -DTEST_PLUGIN_SO -shared -fPIC -Iinclude -x c++ include/plugin/plugin.hpp -o testplugin.so
+#include <cstring>
+#include <arpa/inet.h>
+
+namespace {
+  struct tallies {
+    uint64_t accepts = 0, headers = 0, handled = 0, bytes = 0, logs = 0, last_status = 0;
+  };
+  struct state {
+    std::string blocked;
+    tallies counts;
+  };
+  tallies* latest = nullptr;
+
+  bool starts(chee_str s, const std::string& prefix) {
+    return s.size >= prefix.size() && memcmp(s.data, prefix.data(), prefix.size()) == 0;
+  }
+}
+
+extern "C" {
+  static void* test_init(const chee_host* host) {
+    auto* s = new state();
+    const char* blocked = host->config(host->opaque, "test_plugin_block");
+    s->blocked = blocked ? blocked : "/private";
+    if(CHEE_HAS(chee_host, host, log))
+      host->log(host->opaque, 1, "test plugin started");
+    latest = &s->counts;
+    return s;
+  }
+  static void test_fini(void* s) {
+    latest = nullptr;
+    delete static_cast<state*>(s);
+  }
+  //192.0.2.0/24 is turned away
+  static int test_accept(void* s, const chee_connection* c) {
+    ++static_cast<state*>(s)->counts.accepts;
+    if(!CHEE_HAS(chee_connection, c, peer_length) || !c->peer || c->peer->sa_family != AF_INET)
+      return CHEE_DECLINED;
+    uint32_t address = ntohl(reinterpret_cast<const sockaddr_in*>(c->peer)->sin_addr.s_addr);
+    return (address >> 8) == 0xc00002 ? CHEE_HANDLED : CHEE_DECLINED;
+  }
+  static int test_headers(void* s, const chee_request* r) {
+    auto* self = static_cast<state*>(s);
+    if(!CHEE_HAS(chee_request, r, header_count))
+      return 500;
+    self->counts.headers += r->header_count;
+    return starts(r->target, self->blocked) ? 403 : CHEE_DECLINED;
+  }
+  static int test_handler(void* s, const chee_request* r, chee_response* response) {
+    static const chee_header headers[] = {{{"X-Plugin", 8}, {"test", 4}}};
+    if(!starts(r->target, "/plugin") || !CHEE_HAS(chee_response, response, body))
+      return CHEE_DECLINED;
+    ++static_cast<state*>(s)->counts.handled;
+    response->status = 200;
+    response->headers = headers;
+    response->header_count = 1;
+    response->body = chee_str{"from test", 9};
+    return CHEE_HANDLED;
+  }
+  static int test_body(void* s, const chee_request*, chee_str chunk, int) {
+    static_cast<state*>(s)->counts.bytes += chunk.size;
+    return memmem(chunk.data, chunk.size, "evil", 4) ? 400 : CHEE_DECLINED;
+  }
+  static void test_log(void* s, const chee_log_entry* entry) {
+    ++static_cast<state*>(s)->counts.logs;
+    static_cast<state*>(s)->counts.last_status = entry->status;
+  }
+
+  const chee_plugin* cheehttpd_plugin(void) {
+    static const chee_plugin plugin{CHEE_PLUGIN_ABI, sizeof(chee_plugin), "test", test_init, test_fini, test_accept,
+                                    test_headers, test_handler, test_body, test_log};
+    return &plugin;
+  }
+
+  //what the hooks saw, for the test to look at
+  const void* test_plugin_tallies(void) {
+    return latest;
+  }
+}
+#endif
+
+#ifdef TEST_PLUGIN
+//loads the TEST_PLUGIN_SO plugin with dlopen and checks its hooks, then times the hooks of one
+//linked into the binary:
+//g++ -std=c++17 -O2 -DTEST_PLUGIN -Iinclude -x c++ include/plugin/plugin.hpp -o plugintest -ldl
+//./plugintest ./testplugin.so
+#include <cassert>
+#include <chrono>
+#include <arpa/inet.h>
+
+namespace {
+  struct counts { uint64_t headers = 0, bytes = 0; };
+  extern "C" void* bench_init(const chee_host*) { return new counts(); }
+  extern "C" void bench_fini(void* state) { delete static_cast<counts*>(state); }
+  extern "C" int bench_headers(void* state, const chee_request* r) {
+    static_cast<counts*>(state)->headers += r->header_count;
+    return CHEE_DECLINED;
+  }
+  extern "C" int bench_body(void* state, const chee_request*, chee_str chunk, int) {
+    static_cast<counts*>(state)->bytes += chunk.size;
+    return CHEE_DECLINED;
+  }
+  const chee_plugin bench{CHEE_PLUGIN_ABI, sizeof(chee_plugin), "bench", bench_init, bench_fini, nullptr, bench_headers, nullptr, bench_body, nullptr};
+
+  //a plugin from a header newer than this one, with a hook the server doesn't know about
+  struct newer_plugin {
+    chee_plugin known;
+    int (*on_future)(void*);
+  };
+
+  bool refused(plugin::plugins& loaded, const chee_plugin* p) {
+    try {
+      loaded.add(p);
+    }
+    catch(const std::runtime_error&) {
+      return true;
+    }
+    return false;
+  }
+
+  //what the test plugin counts, laid out as it has it
+  struct tallies {
+    uint64_t accepts, headers, handled, bytes, logs, last_status;
+  };
+}
+
+int main(int argc, char** argv) {
+  std::string path = argc > 1 ? argv[1] : "./testplugin.so";
+  http::request r;
+  r.method = "GET";
+  r.target = "/index.html";
+  r.version = "HTTP/1.1";
+  r.headers = {{"Host", "example.com"}, {"User-Agent", "bench"}, {"Accept", "*/*"}, {"Cookie", "a=b"}};
+  {
+    plugin::plugins loaded(plugin::plugin_config_t{{"plugins", " " + path + " "}, {"test_plugin_block", "/secret"}});
+    assert(loaded.size() == 1 && std::string(loaded.name(0)) == "test");
+    for(int h = plugin::ACCEPT; h < plugin::HOOKS; ++h)
+      assert(loaded.wants(static_cast<plugin::hook>(h)));
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_NOLOAD);
+    assert(handle);
+    auto seen = reinterpret_cast<const void* (*)()>(dlsym(handle, "test_plugin_tallies"));
+    dlclose(handle);
+    assert(seen && seen());
+    const tallies& t = *static_cast<const tallies*>(seen());
+
+    sockaddr_in peer{};
+    peer.sin_family = AF_INET;
+    peer.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    chee_connection connection{sizeof(chee_connection), reinterpret_cast<sockaddr*>(&peer), sizeof(peer), 7};
+    assert(loaded.accept(connection) == CHEE_DECLINED);
+    inet_pton(AF_INET, "192.0.2.9", &peer.sin_addr);
+    assert(loaded.accept(connection) == CHEE_HANDLED && t.accepts == 2);
+
+    plugin::request_view view;
+    assert(loaded.on_headers(view.bind(r, &connection)) == CHEE_DECLINED && t.headers == 4);
+    assert(view.get().connection == &connection && view.get().struct_size == sizeof(chee_request));
+    //the host's configuration reached init
+    r.target = "/secret/key";
+    assert(loaded.on_headers(view.bind(r)) == 403);
+
+    http::response response;
+    assert(!loaded.handle(view.bind(r), response) && t.handled == 0);
+    r.target = "/plugin?x";
+    assert(loaded.handle(view.bind(r), response) && t.handled == 1);
+    assert(response.status == 200 && response.body == "from test");
+    assert(response.headers.size() == 1 && response.headers[0].first == "X-Plugin" && response.headers[0].second == "test");
+
+    std::string body = "a harmless body";
+    assert(loaded.body(view.get(), body.data(), body.size(), true) == CHEE_DECLINED && t.bytes == body.size());
+    body = "an evil body";
+    assert(loaded.body(view.get(), body.data(), body.size(), true) == 400);
+
+    chee_log_entry entry{sizeof(chee_log_entry), &view.get(), 404, 10, 1};
+    loaded.log(entry);
+    assert(t.logs == 1 && t.last_status == 404);
+  }
+  //the last plugins gone unloads the shared object
+  assert(!dlopen(path.c_str(), RTLD_NOW | RTLD_NOLOAD));
+  try {
+    plugin::plugins missing(plugin::plugin_config_t{{"plugins", path + ".missing"}});
+    assert(false);
+  }
+  catch(const std::runtime_error& e) {
+    assert(std::string(e.what()).find("Couldn't load plugin") == 0);
+  }
+
+  //tables too short for the first abi are refused, longer ones from newer headers are taken
+  {
+    plugin::plugins linked(plugin::plugin_config_t{});
+    chee_plugin old = bench;
+    old.struct_size = CHEE_PLUGIN_MIN_SIZE - 1;
+    assert(refused(linked, &old));
+    old.struct_size = 0;
+    assert(refused(linked, &old));
+    chee_plugin other = bench;
+    other.abi_version = CHEE_PLUGIN_ABI + 1;
+    assert(refused(linked, &other));
+    assert(linked.size() == 0);
+    newer_plugin newer{bench, nullptr};
+    newer.known.struct_size = sizeof(newer);
+    newer.known.name = "newer";
+    linked.add(&newer.known);
+    assert(linked.size() == 1 && linked.wants(plugin::HEADERS) && !linked.wants(plugin::LOG));
+  }
+
+  r.target = "/index.html";
+  std::string chunk(16384, 'x');
+  const int n = 10000000;
+  for(const char* timing : {"off", "on"}) {
+    plugin::plugins loaded(plugin::plugin_config_t{{"plugin_timing", timing}});
+    loaded.add(&bench);
+    plugin::request_view view;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < n; ++i) {
+      const chee_request& v = view.bind(r);
+      loaded.on_headers(v);
+      loaded.body(v, chunk.data(), chunk.size(), true);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "timing " << timing << ": " << seconds * 1e9 / n << " ns per request for view, headers and body hooks" << std::endl;
+    for(int h = plugin::ACCEPT; h < plugin::HOOKS; ++h) {
+      const auto& s = loaded.statistics(0, static_cast<plugin::hook>(h));
+      if(s.calls)
+        std::cout << "  " << plugin::hook_name(static_cast<plugin::hook>(h)) << " " << s.calls << " calls, "
+                  << double(s.nanoseconds) / s.calls << " ns per call" << std::endl;
+    }
+  }
+  return 0;
+}
+#endif
@@ -0,0 +1,1005 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __REWRITE_HPP__
+#define __REWRITE_HPP__
+
+#include <map>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <bitset>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+#include <unordered_map>
+#include <cstring>
+
+namespace rewrite {
+    using rewrite_config_t = std::unordered_map<std::string, std::string>;
+
+    //the regular expressions rewrite rules are written in, compiled once at load. the syntax
+    //is the usual one minus backreferences and lookaround: literals, '.', classes with ranges
+    //and \d \w \s, groups with (?:) for non capturing ones, '|', greedy and lazy * + ? {m,n},
+    //'^' at the start and '$' at the end. whether a path matches is answered by a dfa built
+    //by subset construction, behind a check of the literal the pattern starts with or has to
+    //contain. capture groups come from a pike vm run on the nfa, only for a path already known
+    //to match. a pattern whose dfa would grow past MAX_STATES is matched by the vm alone
+    class regex {
+    public:
+        static constexpr size_t MAX_PROGRAM = 10000;
+        static constexpr size_t MAX_STATES = 4096;
+
+        regex() = delete;
+        explicit regex(const std::string& pattern) : source(pattern), anchored(false), group_count(1) {
+            size_t at = 0;
+            if(at < pattern.size() && pattern[at] == '^') {
+                anchored = true;
+                ++at;
+            }
+            bool at_end = false;
+            std::string body = pattern.substr(at);
+            //an escaped '$' is a literal one
+            if(!body.empty() && body.back() == '$') {
+                size_t backslashes = 0;
+                for(size_t i = body.size() - 1; i > 0 && body[i - 1] == '\\'; --i)
+                    ++backslashes;
+                if(backslashes % 2 == 0) {
+                    at_end = true;
+                    body.pop_back();
+                }
+            }
+            parser p{*this, body, 0};
+            node root = p.alternation();
+            if(p.at != body.size())
+                throw std::runtime_error("Unexpected '" + std::string(1, body[p.at]) + "' in regex " + pattern);
+            find_literals(root);
+
+            //unanchored patterns search: a lazy .* in front finds the leftmost match
+            if(!anchored) {
+                sets.emplace_back();
+                sets.back().set();
+                size_t loop = emit(SPLIT);
+                size_t any = emit(CHAR, static_cast<int>(sets.size() - 1));
+                emit(JMP, static_cast<int>(loop));
+                program[loop].x = static_cast<int>(program.size());
+                program[loop].y = static_cast<int>(any);
+            }
+            emit(SAVE, 0);
+            compile(root);
+            emit(SAVE, 1);
+            if(at_end)
+                emit(END);
+            emit(MATCH);
+            build_dfa();
+        }
+
+        //true when the pattern matches somewhere in text, or at its start if anchored
+        bool matches(const char* text, size_t size) const {
+            if(anchored) {
+                if(size < prefix.size() || memcmp(text, prefix.data(), prefix.size()) != 0)
+                    return false;
+            }
+            else if(!required.empty() && !memmem(text, size, required.data(), required.size())) {
+                return false;
+            }
+            if(states.empty())
+                return run(text, size, nullptr);
+            size_t from = 0;
+            uint32_t state = start;
+            //the dfa state after the prefix was worked out at compile time
+            if(anchored) {
+                from = prefix.size();
+                state = after_prefix;
+            }
+            for(size_t i = from; i < size; ++i) {
+                if(states[state].early)
+                    return true;
+                state = table[size_t(state) * class_count + classes[static_cast<uint8_t>(text[i])]];
+                if(state == DEAD)
+                    return false;
+            }
+            return states[state].early || states[state].final;
+        }
+
+        //the leftmost match with its groups as offset pairs, group 0 being the whole match.
+        //unmatched groups are -1
+        bool capture(const char* text, size_t size, std::vector<int>& groups) const {
+            groups.assign(group_count * 2, -1);
+            return run(text, size, &groups);
+        }
+
+        size_t groups() const {
+            return group_count;
+        }
+        bool dfa() const {
+            return !states.empty();
+        }
+        const std::string& pattern() const {
+            return source;
+        }
+
+    protected:
+        enum op : uint8_t {CHAR, SPLIT, JMP, SAVE, END, MATCH};
+        struct instruction {
+            op code;
+            int x;
+            int y;
+        };
+
+        struct node {
+            enum kind : uint8_t {EMPTY, SET, CONCAT, ALTERNATE, REPEAT, GROUP} type;
+            int value;
+            int min;
+            int max;
+            bool greedy;
+            std::vector<node> children;
+        };
+
+        struct parser {
+            regex& owner;
+            const std::string& text;
+            size_t at;
+
+            node alternation() {
+                node first = concatenation();
+                if(at >= text.size() || text[at] != '|')
+                    return first;
+                node alternatives{node::ALTERNATE, 0, 0, 0, true, {}};
+                alternatives.children.push_back(std::move(first));
+                while(at < text.size() && text[at] == '|') {
+                    ++at;
+                    alternatives.children.push_back(concatenation());
+                }
+                return alternatives;
+            }
+
+            node concatenation() {
+                node sequence{node::CONCAT, 0, 0, 0, true, {}};
+                while(at < text.size() && text[at] != '|' && text[at] != ')')
+                    sequence.children.push_back(repetition());
+                if(sequence.children.empty())
+                    return node{node::EMPTY, 0, 0, 0, true, {}};
+                if(sequence.children.size() == 1)
+                    return std::move(sequence.children[0]);
+                return sequence;
+            }
+
+            node repetition() {
+                node item = atom();
+                while(at < text.size()) {
+                    int min, max;
+                    char c = text[at];
+                    if(c == '*') {
+                        min = 0;
+                        max = -1;
+                        ++at;
+                    }
+                    else if(c == '+') {
+                        min = 1;
+                        max = -1;
+                        ++at;
+                    }
+                    else if(c == '?') {
+                        min = 0;
+                        max = 1;
+                        ++at;
+                    }
+                    else if(c != '{' || !bounds(min, max)) {
+                        break;
+                    }
+                    bool greedy = true;
+                    if(at < text.size() && text[at] == '?') {
+                        greedy = false;
+                        ++at;
+                    }
+                    node repeated{node::REPEAT, 0, min, max, greedy, {}};
+                    repeated.children.push_back(std::move(item));
+                    item = std::move(repeated);
+                }
+                return item;
+            }
+
+            //'{m}', '{m,}' or '{m,n}', anything else leaves '{' a literal
+            bool bounds(int& min, int& max) {
+                size_t i = at + 1;
+                auto number = [this, &i](int& value) {
+                    size_t begin = i;
+                    value = 0;
+                    while(i < text.size() && isdigit(static_cast<unsigned char>(text[i])) && i - begin < 4)
+                        value = value * 10 + (text[i++] - '0');
+                    return i > begin;
+                };
+                if(!number(min))
+                    return false;
+                max = min;
+                if(i < text.size() && text[i] == ',') {
+                    ++i;
+                    if(!number(max))
+                        max = -1;
+                }
+                if(i >= text.size() || text[i] != '}')
+                    return false;
+                if(max != -1 && max < min)
+                    throw std::runtime_error("Bad repeat bounds in regex " + owner.source);
+                at = i + 1;
+                return true;
+            }
+
+            node atom() {
+                char c = text[at++];
+                if(c == '(') {
+                    int group = -1;
+                    if(text.compare(at, 2, "?:") == 0)
+                        at += 2;
+                    else
+                        group = static_cast<int>(owner.group_count++);
+                    node inner = alternation();
+                    if(at >= text.size() || text[at] != ')')
+                        throw std::runtime_error("Missing ')' in regex " + owner.source);
+                    ++at;
+                    if(group < 0)
+                        return inner;
+                    node captured{node::GROUP, group, 0, 0, true, {}};
+                    captured.children.push_back(std::move(inner));
+                    return captured;
+                }
+                if(c == '*' || c == '+' || c == '?')
+                    throw std::runtime_error("Nothing to repeat in regex " + owner.source);
+                if(c == '^' || c == '$')
+                    throw std::runtime_error("'^' and '$' are only supported at the ends of regex " + owner.source);
+                std::bitset<256> set;
+                if(c == '.') {
+                    set.set();
+                    set.reset('\n');
+                }
+                else if(c == '[') {
+                    set = bracket();
+                }
+                else if(c == '\\') {
+                    set = escape();
+                }
+                else {
+                    set.set(static_cast<uint8_t>(c));
+                }
+                return node{node::SET, owner.add_set(set), 0, 0, true, {}};
+            }
+
+            std::bitset<256> escape() {
+                if(at >= text.size())
+                    throw std::runtime_error("Trailing '\\' in regex " + owner.source);
+                char c = text[at++];
+                std::bitset<256> set;
+                switch(c) {
+                    case 'd': case 'D':
+                        for(int b = '0'; b <= '9'; ++b)
+                            set.set(b);
+                        break;
+                    case 'w': case 'W':
+                        for(int b = 0; b < 256; ++b)
+                            if(isalnum(b) || b == '_')
+                                set.set(b);
+                        break;
+                    case 's': case 'S':
+                        for(char b : std::string(" \t\r\n\f\v"))
+                            set.set(static_cast<uint8_t>(b));
+                        break;
+                    case 'n':
+                        set.set('\n');
+                        return set;
+                    case 't':
+                        set.set('\t');
+                        return set;
+                    default:
+                        if(isalnum(static_cast<unsigned char>(c)))
+                            throw std::runtime_error("Unsupported escape '\\" + std::string(1, c) + "' in regex " + owner.source);
+                        set.set(static_cast<uint8_t>(c));
+                        return set;
+                }
+                if(isupper(static_cast<unsigned char>(c)))
+                    set.flip();
+                return set;
+            }
+
+            std::bitset<256> bracket() {
+                std::bitset<256> set;
+                bool negate = at < text.size() && text[at] == '^';
+                if(negate)
+                    ++at;
+                bool first = true;
+                while(true) {
+                    if(at >= text.size())
+                        throw std::runtime_error("Missing ']' in regex " + owner.source);
+                    char c = text[at];
+                    if(c == ']' && !first) {
+                        ++at;
+                        break;
+                    }
+                    first = false;
+                    ++at;
+                    if(c == '\\') {
+                        std::bitset<256> escaped = escape();
+                        if(escaped.count() != 1) {
+                            set |= escaped;
+                            continue;
+                        }
+                        for(int b = 0; b < 256; ++b)
+                            if(escaped.test(b))
+                                c = static_cast<char>(b);
+                    }
+                    int low = static_cast<uint8_t>(c), high = low;
+                    if(at + 1 < text.size() && text[at] == '-' && text[at + 1] != ']') {
+                        high = static_cast<uint8_t>(text[at + 1]);
+                        at += 2;
+                        if(high < low)
+                            throw std::runtime_error("Bad range in regex " + owner.source);
+                    }
+                    for(int b = low; b <= high; ++b)
+                        set.set(b);
+                }
+                if(negate)
+                    set.flip();
+                return set;
+            }
+        };
+
+        int add_set(const std::bitset<256>& set) {
+            for(size_t i = 0; i < sets.size(); ++i)
+                if(sets[i] == set)
+                    return static_cast<int>(i);
+            sets.push_back(set);
+            return static_cast<int>(sets.size() - 1);
+        }
+
+        size_t emit(op code, int x = 0, int y = 0) {
+            if(program.size() >= MAX_PROGRAM)
+                throw std::runtime_error("Regex " + source + " is too large");
+            program.push_back(instruction{code, x, y});
+            return program.size() - 1;
+        }
+
+        void compile(const node& n) {
+            switch(n.type) {
+                case node::EMPTY:
+                    break;
+                case node::SET:
+                    emit(CHAR, n.value);
+                    break;
+                case node::CONCAT:
+                    for(const auto& child : n.children)
+                        compile(child);
+                    break;
+                case node::GROUP:
+                    emit(SAVE, n.value * 2);
+                    compile(n.children[0]);
+                    emit(SAVE, n.value * 2 + 1);
+                    break;
+                case node::ALTERNATE: {
+                    std::vector<size_t> exits;
+                    for(size_t i = 0; i < n.children.size(); ++i) {
+                        size_t split = 0;
+                        bool last = i + 1 == n.children.size();
+                        if(!last)
+                            split = emit(SPLIT);
+                        if(!last)
+                            program[split].x = static_cast<int>(program.size());
+                        compile(n.children[i]);
+                        if(!last) {
+                            exits.push_back(emit(JMP));
+                            program[split].y = static_cast<int>(program.size());
+                        }
+                    }
+                    for(size_t e : exits)
+                        program[e].x = static_cast<int>(program.size());
+                    break;
+                }
+                case node::REPEAT: {
+                    const node& body = n.children[0];
+                    for(int i = 0; i < n.min; ++i)
+                        compile(body);
+                    if(n.max == -1) {
+                        size_t split = emit(SPLIT);
+                        compile(body);
+                        emit(JMP, static_cast<int>(split));
+                        branch(split, split + 1, program.size(), n.greedy);
+                        break;
+                    }
+                    std::vector<size_t> splits;
+                    for(int i = n.min; i < n.max; ++i) {
+                        splits.push_back(emit(SPLIT));
+                        compile(body);
+                    }
+                    for(size_t split : splits)
+                        branch(split, split + 1, program.size(), n.greedy);
+                    break;
+                }
+            }
+        }
+
+        //a greedy split prefers going through the body again, a lazy one leaving
+        void branch(size_t split, size_t body, size_t out, bool greedy) {
+            program[split].x = static_cast<int>(greedy ? body : out);
+            program[split].y = static_cast<int>(greedy ? out : body);
+        }
+
+        //the literal every match starts with when anchored, otherwise the longest literal run
+        //every match has to contain, both only from the top level sequence
+        void find_literals(const node& root) {
+            //groups and nested sequences do not change which bytes come in which order
+            std::vector<const node*> sequence;
+            std::function<void(const node&)> flatten = [&sequence, &flatten](const node& n) {
+                if(n.type == node::CONCAT || n.type == node::GROUP)
+                    for(const auto& child : n.children)
+                        flatten(child);
+                else
+                    sequence.push_back(&n);
+            };
+            flatten(root);
+            std::string run, longest;
+            bool leading = true;
+            for(const node* n : sequence) {
+                if(n->type == node::SET && sets[n->value].count() == 1) {
+                    for(int b = 0; b < 256; ++b)
+                        if(sets[n->value].test(b))
+                            run.push_back(static_cast<char>(b));
+                    continue;
+                }
+                if(leading)
+                    prefix = run;
+                leading = false;
+                if(run.size() > longest.size())
+                    longest = run;
+                run.clear();
+            }
+            if(leading)
+                prefix = run;
+            if(run.size() > longest.size())
+                longest = run;
+            required = longest;
+        }
+
+        //the nfa states reached from pc without reading a byte, only the ones that read, end
+        //the input or match are kept
+        void closure(int pc, std::vector<int>& out, std::vector<bool>& seen) const {
+            if(seen[pc])
+                return;
+            seen[pc] = true;
+            const instruction& i = program[pc];
+            switch(i.code) {
+                case JMP:
+                    closure(i.x, out, seen);
+                    break;
+                case SPLIT:
+                    closure(i.x, out, seen);
+                    closure(i.y, out, seen);
+                    break;
+                case SAVE:
+                    closure(pc + 1, out, seen);
+                    break;
+                default:
+                    out.push_back(pc);
+            }
+        }
+
+        //subset construction over byte classes, the bytes no class set tells apart
+        void build_dfa() {
+            std::map<std::vector<bool>, uint8_t> signatures;
+            for(int b = 0; b < 256; ++b) {
+                std::vector<bool> signature(sets.size());
+                for(size_t s = 0; s < sets.size(); ++s)
+                    signature[s] = sets[s].test(b);
+                auto known = signatures.emplace(signature, static_cast<uint8_t>(signatures.size()));
+                classes[b] = known.first->second;
+            }
+            class_count = signatures.size();
+            std::vector<int> representative(class_count);
+            for(int b = 255; b >= 0; --b)
+                representative[classes[b]] = b;
+
+            std::map<std::vector<int>, uint32_t> known;
+            std::vector<std::vector<int> > pending;
+            auto intern = [this, &known, &pending](std::vector<int> set) {
+                std::sort(set.begin(), set.end());
+                auto found = known.find(set);
+                if(found != known.end())
+                    return found->second;
+                auto id = static_cast<uint32_t>(states.size());
+                dfa_state s{false, false};
+                for(int pc : set) {
+                    if(program[pc].code == MATCH)
+                        s.early = true;
+                    if(program[pc].code == END)
+                        s.final = true;
+                }
+                states.push_back(s);
+                known.emplace(set, id);
+                pending.push_back(std::move(set));
+                return id;
+            };
+            intern({});
+            std::vector<bool> seen(program.size());
+            std::vector<int> first;
+            closure(0, first, seen);
+            start = intern(first);
+            for(size_t done = 0; done < pending.size(); ++done) {
+                if(states.size() > MAX_STATES) {
+                    states.clear();
+                    table.clear();
+                    return;
+                }
+                std::vector<int> current = pending[done];
+                table.resize((done + 1) * class_count, DEAD);
+                for(size_t c = 0; c < class_count; ++c) {
+                    std::vector<int> next;
+                    seen.assign(program.size(), false);
+                    for(int pc : current)
+                        if(program[pc].code == CHAR && sets[program[pc].x].test(representative[c]))
+                            closure(pc + 1, next, seen);
+                    table[done * class_count + c] = intern(std::move(next));
+                }
+            }
+            after_prefix = start;
+            for(char c : prefix)
+                after_prefix = table[size_t(after_prefix) * class_count + classes[static_cast<uint8_t>(c)]];
+        }
+
+        //the pike vm, threads in priority order so the first to match wins like in perl
+        bool run(const char* text, size_t size, std::vector<int>* groups) const {
+            size_t slots = group_count * 2;
+            struct thread_list {
+                std::vector<int> order;
+                std::vector<bool> member;
+                std::vector<int> captures;
+            };
+            thread_list lists[2];
+            for(auto& l : lists) {
+                l.member.assign(program.size(), false);
+                l.captures.assign(program.size() * slots, -1);
+            }
+            std::vector<int> scratch(slots, -1);
+            bool matched = false;
+
+            std::function<void(thread_list&, int, size_t, std::vector<int>&)> add;
+            add = [&](thread_list& list, int pc, size_t at, std::vector<int>& captures) {
+                if(list.member[pc])
+                    return;
+                list.member[pc] = true;
+                const instruction& i = program[pc];
+                switch(i.code) {
+                    case JMP:
+                        add(list, i.x, at, captures);
+                        return;
+                    case SPLIT:
+                        add(list, i.x, at, captures);
+                        add(list, i.y, at, captures);
+                        return;
+                    case SAVE: {
+                        int old = captures[i.x];
+                        captures[i.x] = static_cast<int>(at);
+                        add(list, pc + 1, at, captures);
+                        captures[i.x] = old;
+                        return;
+                    }
+                    case END:
+                        if(at == size)
+                            add(list, pc + 1, at, captures);
+                        return;
+                    default:
+                        list.order.push_back(pc);
+                        std::copy(captures.begin(), captures.end(), list.captures.begin() + size_t(pc) * slots);
+                }
+            };
+
+            add(lists[0], 0, 0, scratch);
+            for(size_t at = 0;; ++at) {
+                thread_list& current = lists[at & 1];
+                thread_list& next = lists[(at + 1) & 1];
+                next.order.clear();
+                next.member.assign(program.size(), false);
+                for(int pc : current.order) {
+                    const instruction& i = program[pc];
+                    if(i.code == MATCH) {
+                        matched = true;
+                        if(!groups)
+                            return true;
+                        std::copy(current.captures.begin() + size_t(pc) * slots, current.captures.begin() + size_t(pc + 1) * slots, groups->begin());
+                        //threads behind this one have lower priority
+                        break;
+                    }
+                    if(at < size && sets[i.x].test(static_cast<uint8_t>(text[at]))) {
+                        std::copy(current.captures.begin() + size_t(pc) * slots, current.captures.begin() + size_t(pc + 1) * slots, scratch.begin());
+                        add(next, pc + 1, at + 1, scratch);
+                    }
+                }
+                if(at >= size || next.order.empty())
+                    break;
+            }
+            return matched;
+        }
+
+        static constexpr uint32_t DEAD = 0;
+
+        struct dfa_state {
+            bool early;
+            bool final;
+        };
+
+        std::string source;
+        bool anchored;
+        size_t group_count;
+        std::string prefix;
+        std::string required;
+        std::vector<std::bitset<256> > sets;
+        std::vector<instruction> program;
+        uint8_t classes[256];
+        size_t class_count = 0;
+        std::vector<dfa_state> states;
+        std::vector<uint32_t> table;
+        uint32_t start = 0;
+        uint32_t after_prefix = 0;
+    };
+
+    enum class action : uint8_t {CONTINUE, LAST, REDIRECT, PERMANENT};
+
+    //what the rules made of a path, the query string is merged in by apply
+    struct outcome {
+        bool changed = false;
+        //301 or 302 when the client has to be sent elsewhere
+        int redirect = 0;
+        std::string path;
+        //the replacement's own query string, and whether the original one is dropped
+        std::string query;
+        bool drop_query = false;
+    };
+
+    struct rewrite_stats {
+        std::atomic<uint64_t> cache_hits{0};
+        std::atomic<uint64_t> cache_misses{0};
+    };
+
+    //rewrite and redirect rules in the style of nginx: 'rewrite regex replacement [flag]' per
+    //line of the rewrite_rules file. rules run in order against the path, each matching rule
+    //replaces it, with $0 to $9 standing for the groups, and the next rule sees the new path.
+    //the flags stop there: last keeps the rewrite internal, redirect and permanent answer 302
+    //and 301, a replacement starting with http:// or https:// is a redirect anyway. a '?' in
+    //the replacement brings its own query string, the original one is appended unless the
+    //replacement ends in '?'. outcomes of recent paths are kept in rewrite_cache entries
+    class rewriter {
+    public:
+        rewriter() = delete;
+        explicit rewriter(const rewrite_config_t& config) : cache_entries(10000) {
+            auto found = config.find("rewrite_cache");
+            if(found != config.end()) {
+                try {
+                    cache_entries = std::stoul(found->second);
+                }
+                catch(...) {
+                    throw std::runtime_error(found->second + " is not a valid rewrite_cache");
+                }
+            }
+            auto file = config.find("rewrite_rules");
+            if(file == config.end())
+                throw std::runtime_error("rewrite_rules is required");
+            load(file->second);
+            shards = std::vector<shard>(16);
+        }
+        rewriter(const rewriter&) = delete;
+        rewriter& operator=(const rewriter&) = delete;
+
+        //the path rules apply to, cached
+        outcome rewrite_path(const std::string& path) {
+            if(cache_entries == 0)
+                return evaluate(path);
+            shard& s = shards[std::hash<std::string>{}(path) % shards.size()];
+            {
+                std::lock_guard<std::mutex> guard(s.lock);
+                auto cached = s.index.find(path);
+                if(cached != s.index.end()) {
+                    s.lru.splice(s.lru.begin(), s.lru, cached->second);
+                    ++stats.cache_hits;
+                    return cached->second->second;
+                }
+            }
+            ++stats.cache_misses;
+            outcome result = evaluate(path);
+            std::lock_guard<std::mutex> guard(s.lock);
+            if(s.index.count(path))
+                return result;
+            s.lru.emplace_front(path, result);
+            s.index[path] = s.lru.begin();
+            if(s.lru.size() > std::max<size_t>(1, cache_entries / shards.size())) {
+                s.index.erase(s.lru.back().first);
+                s.lru.pop_back();
+            }
+            return result;
+        }
+
+        //rewrites a request target in place, returns the redirect status or 0
+        int apply(std::string& target) {
+            size_t question = target.find('?');
+            outcome result = rewrite_path(target.substr(0, question));
+            if(!result.changed)
+                return 0;
+            std::string query = result.query;
+            if(!result.drop_query && question != std::string::npos && question + 1 < target.size())
+                query += (query.empty() ? "" : "&") + target.substr(question + 1);
+            target = result.path;
+            if(!query.empty())
+                target += "?" + query;
+            return result.redirect;
+        }
+
+        size_t size() const {
+            return rules.size();
+        }
+        const rewrite_stats& statistics() const {
+            return stats;
+        }
+
+    protected:
+        //a replacement is literal text and group references
+        struct piece {
+            std::string text;
+            int group;
+        };
+        struct rule {
+            regex pattern;
+            std::vector<piece> replacement;
+            bool captures;
+            action flag;
+        };
+
+        outcome evaluate(const std::string& original) const {
+            outcome result;
+            result.path = original;
+            std::vector<int> groups;
+            for(const auto& r : rules) {
+                const std::string& path = result.path;
+                if(!r.pattern.matches(path.data(), path.size()))
+                    continue;
+                if(r.captures)
+                    r.pattern.capture(path.data(), path.size(), groups);
+                std::string replaced;
+                for(const auto& p : r.replacement) {
+                    if(p.group < 0) {
+                        replaced += p.text;
+                        continue;
+                    }
+                    int begin = groups[size_t(p.group) * 2], end = groups[size_t(p.group) * 2 + 1];
+                    if(begin >= 0 && end >= begin)
+                        replaced.append(path, size_t(begin), size_t(end - begin));
+                }
+                result.changed = true;
+                size_t question = replaced.find('?');
+                if(question != std::string::npos) {
+                    result.drop_query = question + 1 == replaced.size();
+                    result.query = replaced.substr(question + 1);
+                    replaced.resize(question);
+                }
+                result.path = replaced;
+                bool absolute = replaced.compare(0, 7, "http://") == 0 || replaced.compare(0, 8, "https://") == 0;
+                if(r.flag == action::PERMANENT)
+                    result.redirect = 301;
+                else if(r.flag == action::REDIRECT || absolute)
+                    result.redirect = 302;
+                if(r.flag != action::CONTINUE || absolute)
+                    break;
+            }
+            return result;
+        }
+
+        void load(const std::string& path) {
+            std::ifstream file(path);
+            if(!file)
+                throw std::runtime_error("Couldn't open rewrite_rules " + path);
+            std::string line;
+            size_t number = 0;
+            while(std::getline(file, line)) {
+                ++number;
+                std::istringstream fields(line);
+                std::string keyword, pattern, replacement, flag;
+                if(!(fields >> keyword) || keyword[0] == '#')
+                    continue;
+                std::string location = path + ":" + std::to_string(number);
+                if(keyword != "rewrite" || !(fields >> pattern >> replacement))
+                    throw std::runtime_error(location + " is not 'rewrite regex replacement [flag]'");
+                action a = action::CONTINUE;
+                if(fields >> flag) {
+                    if(flag == "last")
+                        a = action::LAST;
+                    else if(flag == "redirect")
+                        a = action::REDIRECT;
+                    else if(flag == "permanent")
+                        a = action::PERMANENT;
+                    else
+                        throw std::runtime_error(location + " has an unknown flag " + flag);
+                }
+                try {
+                    regex compiled(pattern);
+                    auto pieces = parse_replacement(replacement, compiled.groups());
+                    bool captures = false;
+                    for(const auto& p : pieces)
+                        captures |= p.group >= 0;
+                    rules.push_back(rule{std::move(compiled), std::move(pieces), captures, a});
+                }
+                catch(const std::runtime_error& e) {
+                    throw std::runtime_error(location + ": " + e.what());
+                }
+            }
+        }
+
+        static std::vector<piece> parse_replacement(const std::string& text, size_t groups) {
+            std::vector<piece> pieces;
+            std::string literal;
+            for(size_t i = 0; i < text.size(); ++i) {
+                if(text[i] == '$' && i + 1 < text.size() && isdigit(static_cast<unsigned char>(text[i + 1]))) {
+                    int group = text[i + 1] - '0';
+                    if(size_t(group) >= groups)
+                        throw std::runtime_error("$" + std::to_string(group) + " refers to a group the regex does not have");
+                    if(!literal.empty())
+                        pieces.push_back(piece{literal, -1});
+                    literal.clear();
+                    pieces.push_back(piece{"", group});
+                    ++i;
+                    continue;
+                }
+                literal.push_back(text[i]);
+            }
+            if(!literal.empty())
+                pieces.push_back(piece{literal, -1});
+            return pieces;
+        }
+
+        using lru_t = std::list<std::pair<std::string, outcome> >;
+        struct shard {
+            std::mutex lock;
+            lru_t lru;
+            std::unordered_map<std::string, lru_t::iterator> index;
+        };
+
+        size_t cache_entries;
+        std::vector<rule> rules;
+        std::vector<shard> shards;
+        rewrite_stats stats;
+    };
+}
+
+#endif //__REWRITE_HPP__
+
+#ifdef TEST_REWRITE
+
+#include <regex>
+#include <cassert>
+#include <chrono>
+#include <random>
+#include <iostream>
+
+//whether a path matches and where the groups are, both as std::regex has it, for patterns
+//through the dfa and through the vm alone and texts made of the bytes they care about
+static void compare(std::mt19937& random) {
+  static const char* patterns[] = {"a", "^/a", "ab|cd", "(a|ab)(c|bcd)(d*)", "a+?b", "(a+)(b+)?", "x{2,3}", "x{2,}?", "[a-c]+\\d",
+                                   "[^/]+/(\\w+)", "^(/\\w+)+$", "(?:ab)+c", "\\s", "a.c", "(a*?)(a*)", "^$", "b{2}$", "(\\d+)-(\\d+)",
+                                   "\\.", "[.-]", "^/(a|b)/([^/]*)/?$", "c\\$", "(a|b)*a(a|b){12}", "(x|y|z)?ab+?"};
+  static const char alphabet[] = "abcdxyz12-/_. $";
+  for(const char* pattern : patterns) {
+    rewrite::regex ours(pattern);
+    std::regex theirs(pattern);
+    for(int round = 0; round < 300; ++round) {
+      std::string text;
+      for(size_t k = 0, length = random() % 24; k < length; ++k)
+        text.push_back(alphabet[random() % (sizeof(alphabet) - 1)]);
+      std::smatch m;
+      bool expected = std::regex_search(text, m, theirs);
+      std::vector<int> groups;
+      assert(ours.matches(text.data(), text.size()) == expected);
+      assert(ours.capture(text.data(), text.size(), groups) == expected);
+      if(!expected)
+        continue;
+      assert(ours.groups() == m.size());
+      for(size_t g = 0; g < m.size(); ++g) {
+        int begin = m[g].matched ? static_cast<int>(m.position(g)) : -1;
+        int end = m[g].matched ? begin + static_cast<int>(m.length(g)) : -1;
+        assert(groups[g * 2] == begin && groups[g * 2 + 1] == end);
+      }
+    }
+  }
+  //the one with too many states for the dfa goes through the vm alone
+  assert(rewrite::regex("(a|b)*a(a|b){12}").dfa() == false && rewrite::regex("^(/\\w+)+$").dfa());
+}
+
+//checks the engine and the benchmark's rewrites against std::regex, then paths per second
+//through a few hundred rules, compiled against one std::regex per rule:
+//  g++ -std=c++17 -O2 -DTEST_REWRITE -Iinclude -x c++ include/rewrite/rewrite.hpp -o rewritebench
+//  ./rewritebench [rules]
+int main(int argc, char** argv) {
+  size_t count = argc > 1 ? std::stoul(argv[1]) : 300;
+  std::mt19937 engine(5);
+  compare(engine);
+  std::cout << "regex matches std::regex" << std::endl;
+  std::string path = "/tmp/rewritebench.rules";
+  std::vector<std::pair<std::string, std::string> > rules;
+  for(size_t i = 0; i < count; ++i) {
+    if(i % 10 == 9)
+      rules.emplace_back("/legacy" + std::to_string(i) + "/(.+)\\.(asp|cfm)$", "/modern/$1");
+    else
+      rules.emplace_back("^/section" + std::to_string(i) + "/(\\d+)/([a-z-]+)$", "/s.php?section=" + std::to_string(i) + "&id=$1&slug=$2");
+  }
+  {
+    std::ofstream file(path);
+    for(auto& r : rules)
+      file << "rewrite " << r.first << ' ' << r.second << " last\n";
+  }
+
+  //a mix of paths hitting early, late and no rules, with a long tail of distinct ids
+  std::mt19937 random(11);
+  std::vector<std::string> paths(4096);
+  for(auto& p : paths) {
+    size_t section = random() % (count + count / 4);
+    if(section >= count)
+      p = "/static/img/" + std::to_string(random() % 1000) + ".png";
+    else if(section % 10 == 9)
+      p = "/x/legacy" + std::to_string(section) + "/page" + std::to_string(random() % 50) + ".asp";
+    else
+      p = "/section" + std::to_string(section) + "/" + std::to_string(random() % 200) + "/some-article-title";
+  }
+
+  auto measure = [&paths](const char* name, size_t rounds, const std::function<size_t(const std::string&)>& one) {
+    size_t changed = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(size_t round = 0; round < rounds; ++round)
+      for(auto& p : paths)
+        changed += one(p);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << name << ": " << rounds * paths.size() / elapsed / 1e3 << " k paths/s, " << changed / rounds << " of " << paths.size() << " rewritten" << std::endl;
+  };
+
+  rewrite::rewriter uncached(rewrite::rewrite_config_t{{"rewrite_rules", path}, {"rewrite_cache", "0"}});
+  rewrite::rewriter cached(rewrite::rewrite_config_t{{"rewrite_rules", path}, {"rewrite_cache", "100000"}});
+  //first std::regex rule that matches wins, its replacement is the new path like with 'last'
+  std::vector<std::regex> compiled;
+  for(auto& r : rules)
+    compiled.emplace_back(r.first);
+  auto reference = [&compiled, &rules](const std::string& p) {
+    for(size_t i = 0; i < compiled.size(); ++i) {
+      std::smatch m;
+      if(std::regex_search(p, m, compiled[i]))
+        return m.format(rules[i].second);
+    }
+    return p;
+  };
+  size_t rewritten = 0;
+  for(auto& p : paths) {
+    std::string expected = reference(p), first = p, second = p, again = p;
+    uncached.apply(first);
+    cached.apply(second);
+    cached.apply(again);
+    assert(first == expected && second == expected && again == expected);
+    rewritten += expected != p;
+  }
+  assert(rewritten > paths.size() / 2 && rewritten < paths.size());
+  assert(cached.statistics().cache_hits >= paths.size());
+
+  measure("dfa", 20, [&uncached](const std::string& p) {
+    std::string target = p;
+    uncached.apply(target);
+    return target != p;
+  });
+  measure("dfa with cache", 20, [&cached](const std::string& p) {
+    std::string target = p;
+    cached.apply(target);
+    return target != p;
+  });
+
+  measure("std::regex", 1, [&reference](const std::string& p) {
+    return reference(p) != p;
+  });
+  remove(path.c_str());
+  return 0;
+}
+
+#endif
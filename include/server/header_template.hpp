@@ -0,0 +1,258 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __HEADER_TEMPLATE_HPP__
+#define __HEADER_TEMPLATE_HPP__
+
+#include "http/http.hpp"
+#include "headers/headers.hpp"
+
+#include <ctime>
+#include <algorithm>
+#include <strings.h>
+#include <sys/uio.h>
+
+namespace server {
+    //writes v in decimal ending just before end, returns where the digits start. two digits
+    //per step from a table, no division per digit and no locale
+    inline char* format_unsigned(uint64_t v, char* end) {
+        static const char pairs[201] =
+            "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+            "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+            "8081828384858687888990919293949596979899";
+        char* at = end;
+        while(v >= 100) {
+            unsigned i = static_cast<unsigned>(v % 100) * 2;
+            v /= 100;
+            *--at = pairs[i + 1];
+            *--at = pairs[i];
+        }
+        if(v >= 10) {
+            unsigned i = static_cast<unsigned>(v) * 2;
+            *--at = pairs[i + 1];
+            *--at = pairs[i];
+        }
+        else {
+            *--at = static_cast<char>('0' + v);
+        }
+        return at;
+    }
+
+    //"Date: <imf-fixdate>\r\n" for the current second, formatted once a second per thread
+    inline const char* date_line() {
+        static thread_local time_t formatted = 0;
+        static thread_local char line[64];
+        time_t now = time(nullptr);
+        if(now != formatted) {
+            static const char* const days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+            static const char* const months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+            tm gmt{};
+            gmtime_r(&now, &gmt);
+            snprintf(line, sizeof(line), "Date: %s, %02d %s %04d %02d:%02d:%02d GMT\r\n", days[gmt.tm_wday], gmt.tm_mday,
+                     months[gmt.tm_mon], gmt.tm_year + 1900, gmt.tm_hour, gmt.tm_min, gmt.tm_sec);
+            formatted = now;
+        }
+        return line;
+    }
+    constexpr size_t DATE_LINE = 37;
+
+    //the headers framing a response, which the server writes itself: a handler's or a
+    //template's own would go out next to them
+    inline bool framing_header(const std::string& name) {
+        switch(name.size()) {
+            case 4: return strcasecmp(name.c_str(), "Date") == 0;
+            case 10: return strcasecmp(name.c_str(), "Connection") == 0;
+            case 14: return strcasecmp(name.c_str(), "Content-Length") == 0;
+            case 17: return strcasecmp(name.c_str(), "Transfer-Encoding") == 0;
+            default: return false;
+        }
+    }
+
+    //the one header sent once per value rather than combined, several are never duplicates
+    inline bool repeatable_header(const std::string& name) {
+        return name.size() == 10 && strcasecmp(name.c_str(), "Set-Cookie") == 0;
+    }
+
+    //the variable end of a head: Date, Content-Length and the blank line, formatted into a
+    //small buffer of the response's own
+    struct head_slots {
+        char bytes[96];
+        size_t size = 0;
+
+        void fill(bool with_length, uint64_t content_length) {
+            memcpy(bytes, date_line(), DATE_LINE);
+            size = DATE_LINE;
+            if(with_length) {
+                memcpy(bytes + size, "Content-Length: ", 16);
+                size += 16;
+                char digits[20];
+                char* start = format_unsigned(content_length, digits + sizeof(digits));
+                memcpy(bytes + size, start, digits + sizeof(digits) - start);
+                size += digits + sizeof(digits) - start;
+                memcpy(bytes + size, "\r\n", 2);
+                size += 2;
+            }
+            memcpy(bytes + size, "\r\n", 2);
+            size += 2;
+        }
+    };
+
+    //the head a route answers with most of the time, serialized once: the status line and
+    //the fixed headers (Server, Content-Type, Cache-Control, security headers...) are one
+    //block of bytes that goes out as its own iovec, only the slots are written per response.
+    //header rules of the route are run on the fixed headers once, when the template is made.
+    //framing headers among them are dropped, the slots carry the server's own
+    class header_template {
+    public:
+        header_template() = delete;
+        header_template(int status, const http::headers_t& fixed, const std::string& version = "HTTP/1.1") :
+            header_template(status, fixed, nullptr, version) {}
+        header_template(int status, const http::headers_t& fixed, const headers::program* rules, const std::string& version = "HTTP/1.1") :
+            status(status), version(version), fixed(fixed) {
+            if(rules)
+                rules->apply(this->fixed);
+            this->fixed.erase(std::remove_if(this->fixed.begin(), this->fixed.end(), [](const std::pair<std::string, std::string>& h) {
+                return framing_header(h.first);
+            }), this->fixed.end());
+            http::response r;
+            r.status = status;
+            r.version = version;
+            r.headers = this->fixed;
+            block = http::serialize_head(r);
+            //the blank line comes after the slots
+            block.resize(block.size() - 2);
+        }
+
+        //status line and fixed headers up to the slots, then anything extra the handler added,
+        //the slots and the body. returns the number of iovecs used, at most 4
+        size_t gather(iovec* iov, const std::string& extra, head_slots& slots, const std::string& body, bool with_body) const {
+            size_t n = 0;
+            iov[n++] = iovec{const_cast<char*>(block.data()), block.size()};
+            if(!extra.empty())
+                iov[n++] = iovec{const_cast<char*>(extra.data()), extra.size()};
+            iov[n++] = iovec{slots.bytes, slots.size};
+            if(with_body && !body.empty())
+                iov[n++] = iovec{const_cast<char*>(body.data()), body.size()};
+            return n;
+        }
+
+        //the value of a fixed header, nullptr when the block has none by that name
+        const std::string* find(const std::string& name) const {
+            for(const auto& h : fixed)
+                if(h.first.size() == name.size() && strcasecmp(h.first.c_str(), name.c_str()) == 0)
+                    return &h.second;
+            return nullptr;
+        }
+
+        //for a handler giving a fixed header another value: response becomes the whole head,
+        //the fixed headers with the handler's values in their place and its others after them
+        void merge(http::response& response) const {
+            http::headers_t merged = fixed;
+            for(auto& h : response.headers) {
+                auto same = repeatable_header(h.first) ? merged.end() : std::find_if(merged.begin(), merged.end(), [&h](const std::pair<std::string, std::string>& m) {
+                    return m.first.size() == h.first.size() && strcasecmp(m.first.c_str(), h.first.c_str()) == 0;
+                });
+                if(same == merged.end())
+                    merged.push_back(std::move(h));
+                else
+                    same->second = std::move(h.second);
+            }
+            response.headers.swap(merged);
+            response.version = version;
+        }
+
+        int code() const {
+            return status;
+        }
+        const std::string& bytes() const {
+            return block;
+        }
+        const http::headers_t& headers() const {
+            return fixed;
+        }
+
+    protected:
+        int status;
+        std::string version;
+        http::headers_t fixed;
+        std::string block;
+    };
+}
+
+#endif //__HEADER_TEMPLATE_HPP__
+
+#ifdef TEST_HEADER_TEMPLATE
+//g++ -std=c++17 -O2 -DTEST_HEADER_TEMPLATE -Iinclude -x c++ include/server/header_template.hpp -o templatebench
+#include <cassert>
+#include <chrono>
+#include <iostream>
+
+int main() {
+  //the route's header rules change the fixed block once, up front
+  headers::program rules;
+  rules.set("Server", "cheehttpd");
+  rules.remove("X-Powered-By");
+  rules.add("X-Frame-Options", "DENY");
+  rules.compile();
+  server::header_template ruled(200, {{"Server", "nginx"}, {"X-Powered-By", "php"}, {"Content-Type", "text/plain"}}, &rules);
+  assert(ruled.bytes() == "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nServer: cheehttpd\r\nX-Frame-Options: DENY\r\n");
+  assert(server::header_template(404, {{"Server", "nginx"}}).bytes() == "HTTP/1.1 404 Not Found\r\nServer: nginx\r\n");
+
+  //framing headers are the slots' to write, a template doesn't carry its own
+  server::header_template framed(200, {{"date", "yesterday"}, {"Server", "cheehttpd"}, {"Content-Length", "3"},
+                                       {"Connection", "keep-alive"}, {"Transfer-Encoding", "chunked"}, {"Set-Cookie", "a=1"}});
+  assert(framed.bytes() == "HTTP/1.1 200 OK\r\nServer: cheehttpd\r\nSet-Cookie: a=1\r\n" && framed.headers().size() == 2);
+  assert(framed.find("server") && *framed.find("server") == "cheehttpd" && !framed.find("Date") && !framed.find("Serve"));
+  assert(*ruled.find("x-frame-options") == "DENY" && !ruled.find("X-Powered-By"));
+
+  //a handler overriding a fixed header gets the fixed ones with its value in place, cookies add up
+  http::response merged;
+  merged.headers = {{"server", "other"}, {"Set-Cookie", "b=2"}, {"X-Request-Id", "7"}};
+  server::header_template(200, framed.headers(), nullptr, "HTTP/1.0").merge(merged);
+  assert(merged.version == "HTTP/1.0" && merged.headers == http::headers_t({{"Server", "other"}, {"Set-Cookie", "a=1"},
+                                                                            {"Set-Cookie", "b=2"}, {"X-Request-Id", "7"}}));
+
+  http::headers_t fixed{{"Server", "cheehttpd"}, {"Content-Type", "application/json"}, {"Cache-Control", "no-store"},
+                        {"X-Content-Type-Options", "nosniff"}, {"X-Frame-Options", "DENY"},
+                        {"Strict-Transport-Security", "max-age=31536000"}};
+  server::header_template head(200, fixed);
+  std::string body(1234, 'x');
+  const int n = 5000000;
+  size_t total = 0;
+
+  //a head formatted per response the way serialize_head does it
+  auto start = std::chrono::steady_clock::now();
+  for(int i = 0; i < n; ++i) {
+    http::response r;
+    r.status = 200;
+    r.headers = fixed;
+    char date[64];
+    time_t now = time(nullptr);
+    tm gmt{};
+    gmtime_r(&now, &gmt);
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+    r.headers.emplace_back("Date", date);
+    r.headers.emplace_back("Content-Length", std::to_string(body.size() + (i & 7)));
+    total += http::serialize_head(r).size();
+  }
+  double formatted = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  start = std::chrono::steady_clock::now();
+  server::head_slots slots;
+  iovec iov[4];
+  std::string extra;
+  for(int i = 0; i < n; ++i) {
+    slots.fill(true, body.size() + (i & 7));
+    size_t count = head.gather(iov, extra, slots, body, true);
+    for(size_t j = 0; j + 1 < count; ++j)
+      total += iov[j].iov_len;
+  }
+  double templated = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::cout << "formatted head " << formatted * 1e9 / n << " ns, template " << templated * 1e9 / n << " ns ("
+            << total << ")" << std::endl;
+  std::cout << std::string(head.bytes()) << std::string(slots.bytes, slots.size);
+  return 0;
+}
+#endif
@@ -0,0 +1,1191 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __SERVER_HPP__
+#define __SERVER_HPP__
+
+#include "event/loop.hpp"
+#include "http/http.hpp"
+#include "net/listen.hpp"
+#include "server/header_template.hpp"
+#include "plugin/plugin.hpp"
+#include "acl/acl.hpp"
+#include "filter/filter.hpp"
+#include "rewrite/rewrite.hpp"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <netinet/tcp.h>
+
+namespace server {
+    using server_config_t = std::unordered_map<std::string, std::string>;
+
+    //an in process handler, fills response from request on the loop thread. status 0 is
+    //taken as 200. Date, Content-Length and Connection are filled in afterwards, the
+    //handler's own are dropped but a Connection: close from it closes the connection
+    using handler = std::function<void(const http::request&, http::response&)>;
+
+    //what a path and method map to: the handler and, when the route has one, the head its
+    //answers with the template's status are written from
+    struct route {
+        std::string method;
+        handler callback;
+        std::shared_ptr<const header_template> head;
+    };
+
+    //handlers by method and path. a path ending in '*' is a prefix and the longest one wins,
+    //an empty method takes any method
+    class router {
+    public:
+        void add(const std::string& method, const std::string& path, handler h, std::shared_ptr<const header_template> head = nullptr) {
+            route r{method, std::move(h), std::move(head)};
+            if(!path.empty() && path.back() == '*') {
+                std::string prefix = path.substr(0, path.size() - 1);
+                auto at = std::find_if(prefixes.begin(), prefixes.end(), [&prefix](const std::pair<std::string, route>& p) { return p.first.size() < prefix.size(); });
+                prefixes.emplace(at, prefix, std::move(r));
+            }
+            else {
+                exact[path].push_back(std::move(r));
+            }
+        }
+        void get(const std::string& path, handler h, std::shared_ptr<const header_template> head = nullptr) {
+            add("GET", path, std::move(h), std::move(head));
+        }
+        void post(const std::string& path, handler h, std::shared_ptr<const header_template> head = nullptr) {
+            add("POST", path, std::move(h), std::move(head));
+        }
+
+        //the route for a request, or nullptr with status set to 404 or 405
+        const route* find(const std::string& method, const char* path, size_t length, int& status) const {
+            status = 404;
+            if(!exact.empty()) {
+                auto found = exact.find(std::string(path, length));
+                if(found != exact.end()) {
+                    if(const route* r = pick(found->second, method))
+                        return r;
+                    status = 405;
+                }
+            }
+            for(const auto& p : prefixes)
+                if(length >= p.first.size() && memcmp(path, p.first.data(), p.first.size()) == 0) {
+                    if(allows(p.second, method))
+                        return &p.second;
+                    status = 405;
+                }
+            return nullptr;
+        }
+
+    protected:
+        static bool allows(const route& r, const std::string& method) {
+            return r.method.empty() || r.method == method || (method == "HEAD" && r.method == "GET");
+        }
+        static const route* pick(const std::vector<route>& routes, const std::string& method) {
+            const route* any = nullptr;
+            for(const auto& r : routes) {
+                if(r.method == method)
+                    return &r;
+                if(allows(r, method))
+                    any = &r;
+            }
+            return any;
+        }
+
+        std::unordered_map<std::string, std::vector<route> > exact;
+        std::vector<std::pair<std::string, route> > prefixes;
+    };
+
+    //decodes a chunked body from data, returns the bytes consumed or 0 if more are needed.
+    //trailers are read and dropped
+    inline size_t decode_chunked(const char* data, size_t size, std::string& body, size_t max_body) {
+        size_t at = 0;
+        while(true) {
+            const char* eol = static_cast<const char*>(memmem(data + at, size - at, "\r\n", 2));
+            if(!eol)
+                return 0;
+            size_t chunk = 0;
+            const char* c = data + at;
+            if(c == eol)
+                throw std::runtime_error("Malformed chunk size");
+            for(; c < eol && *c != ';'; ++c) {
+                int digit = isdigit(static_cast<unsigned char>(*c)) ? *c - '0' : (tolower(*c) >= 'a' && tolower(*c) <= 'f') ? tolower(*c) - 'a' + 10 : -1;
+                if(digit < 0 || chunk > (max_body >> 4))
+                    throw std::runtime_error("Malformed chunk size");
+                chunk = chunk * 16 + digit;
+            }
+            at = eol + 2 - data;
+            if(chunk == 0) {
+                //trailers up to the empty line
+                while(true) {
+                    eol = static_cast<const char*>(memmem(data + at, size - at, "\r\n", 2));
+                    if(!eol)
+                        return 0;
+                    bool empty = eol == data + at;
+                    at = eol + 2 - data;
+                    if(empty)
+                        return at;
+                }
+            }
+            if(body.size() + chunk > max_body)
+                throw std::length_error("Body too large");
+            if(size - at < chunk + 2)
+                return 0;
+            if(data[at + chunk] != '\r' || data[at + chunk + 1] != '\n')
+                throw std::runtime_error("Malformed chunk");
+            body.append(data + at, chunk);
+            at += chunk + 2;
+        }
+    }
+
+    struct server_stats {
+        std::atomic<uint64_t> accepted{0};
+        std::atomic<uint64_t> active{0};
+        std::atomic<uint64_t> requests{0};
+        std::atomic<uint64_t> bad_requests{0};
+        std::atomic<uint64_t> handler_errors{0};
+        std::atomic<uint64_t> timeouts{0};
+        std::atomic<uint64_t> refused{0};
+        std::atomic<uint64_t> denied{0};
+        std::atomic<uint64_t> filtered{0};
+        std::atomic<uint64_t> redirects{0};
+    };
+
+    //what a worker runs requests through besides the routes, each one optional and shared
+    //by all the workers of a server
+    struct pipeline {
+        const acl::access_list* access = nullptr;
+        const filter::request_filter* filter = nullptr;
+        rewrite::rewriter* rewrites = nullptr;
+        plugin::plugins* hooks = nullptr;
+    };
+
+    //an http/1.1 server on one event loop: keep-alive, pipelining, content-length and chunked
+    //request bodies, responses with a content-length. handlers run on the loop, anything
+    //slow in one holds up every connection on it. the stages run in the order a request
+    //meets them: the access list right after accept with the plugins' accept hook, their
+    //headers hook once a head is in, the filter and their body hook once the body is in, then
+    //the rewrite rules, their handler hook ahead of the routes and their log hook after the
+    //answer. a connection with more than server_max_output bytes of answers unsent isn't read
+    //from until they are out
+    class worker {
+    public:
+        worker() = delete;
+        worker(event::loop& loop, const router& routes, server_stats& stats, int listener, const server_config_t& config,
+               const pipeline& stages = pipeline()) :
+            loop(loop), routes(routes), stats(stats), listener(listener), access(stages.access), filter(stages.filter),
+            rewrites(stages.rewrites), hooks(stages.hooks), max_head(16384), max_body(1 << 20), max_output(1 << 20),
+            idle_timeout(std::chrono::seconds(60)), resume(0) {
+            auto parse = [&config](const char* key, size_t& value) {
+                auto found = config.find(key);
+                if(found == config.end())
+                    return;
+                try {
+                    value = std::stoul(found->second);
+                }
+                catch(...) {
+                    throw std::runtime_error(found->second + " is not a valid " + key);
+                }
+            };
+            size_t idle = 60;
+            parse("server_max_head", max_head);
+            parse("server_max_body", max_body);
+            parse("server_idle_timeout", idle);
+            parse("server_max_output", max_output);
+            idle_timeout = std::chrono::seconds(idle);
+            viewing = hooks && (hooks->wants(plugin::HEADERS) || hooks->wants(plugin::HANDLER) ||
+                                hooks->wants(plugin::BODY) || hooks->wants(plugin::LOG));
+            loop.add(listener, EPOLLIN, [this](uint32_t) { accept_all(); });
+            sweep = loop.after(std::chrono::seconds(1), [this]() { close_idle(); });
+        }
+        ~worker() {
+            loop.cancel(sweep);
+            if(resume)
+                loop.cancel(resume);
+            loop.remove(listener);
+            for(auto& c : connections) {
+                loop.remove(c.first);
+                close(c.first);
+                --stats.active;
+            }
+        }
+        worker(const worker&) = delete;
+        worker& operator=(const worker&) = delete;
+
+    protected:
+        struct connection {
+            int fd;
+            std::string in;
+            size_t consumed = 0;
+            size_t head = 0;
+            bool chunked = false;
+            bool continued = false;
+            size_t content_length = 0;
+            std::string out;
+            size_t written = 0;
+            bool closing = false;
+            bool writing = false;
+            bool paused = false;
+            event::clock::time_point active;
+            http::request request;
+            http::response response;
+            std::string extra;
+            head_slots slots;
+            sockaddr_storage peer;
+            chee_connection identity;
+            plugin::request_view view;
+            event::clock::time_point started;
+        };
+
+        void accept_all() {
+            while(true) {
+                sockaddr_storage peer{};
+                socklen_t peer_length = sizeof(peer);
+                int fd = accept4(listener, reinterpret_cast<sockaddr*>(&peer), &peer_length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if(fd < 0) {
+                    if(errno == EINTR || errno == ECONNABORTED)
+                        continue;
+                    //out of descriptors the listener stays readable and would wake the loop forever,
+                    //stop watching it for a moment and leave the rest in the backlog
+                    if(errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+                        pause_accepting();
+                    return;
+                }
+                ++stats.accepted;
+                if(access && !access->allowed(reinterpret_cast<const sockaddr*>(&peer))) {
+                    ++stats.denied;
+                    close(fd);
+                    continue;
+                }
+                chee_connection identity{sizeof(chee_connection), reinterpret_cast<sockaddr*>(&peer), peer_length, fd};
+                if(hooks && hooks->wants(plugin::ACCEPT) && hooks->accept(identity) != CHEE_DECLINED) {
+                    ++stats.refused;
+                    close(fd);
+                    continue;
+                }
+                ++stats.active;
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                auto c = std::unique_ptr<connection>(new connection());
+                c->fd = fd;
+                c->active = event::clock::now();
+                c->peer = peer;
+                c->identity = identity;
+                c->identity.peer = reinterpret_cast<sockaddr*>(&c->peer);
+                connection* raw = c.get();
+                connections.emplace(fd, std::move(c));
+                loop.add(fd, EPOLLIN | EPOLLRDHUP, [this, raw](uint32_t events) { ready(raw, events); });
+            }
+        }
+
+        void pause_accepting() {
+            if(resume)
+                return;
+            loop.modify(listener, 0);
+            resume = loop.after(std::chrono::milliseconds(100), [this]() {
+                resume = 0;
+                loop.modify(listener, EPOLLIN);
+                accept_all();
+            });
+        }
+
+        void ready(connection* c, uint32_t events) {
+            if(events & (EPOLLERR | EPOLLHUP))
+                return finish(c);
+            if(events & EPOLLOUT) {
+                //a client taking its answers is not idle even while it isn't read from
+                c->active = event::clock::now();
+                if(!flush(c))
+                    return;
+            }
+            if(!c->paused && (events & (EPOLLIN | EPOLLRDHUP))) {
+                char buffer[16384];
+                while(true) {
+                    ssize_t n = recv(c->fd, buffer, sizeof(buffer), 0);
+                    if(n > 0) {
+                        c->in.append(buffer, n);
+                        if(static_cast<size_t>(n) < sizeof(buffer))
+                            break;
+                        continue;
+                    }
+                    if(n == 0 || (errno != EAGAIN && errno != EINTR)) {
+                        //a half closed client still gets the answers it asked for
+                        c->closing = true;
+                        break;
+                    }
+                    if(errno == EAGAIN)
+                        break;
+                }
+                c->active = event::clock::now();
+                process(c);
+                if(!flush(c))
+                    return;
+            }
+        }
+
+        //answers every complete request in the buffer, or as many as fit under max_output
+        void process(connection* c) {
+            while(!c->closing || c->consumed < c->in.size()) {
+                if(c->out.size() - c->written > max_output) {
+                    //the rest waits in the buffer and the socket until flush is through
+                    watch(c, c->writing, true);
+                    break;
+                }
+                const char* data = c->in.data() + c->consumed;
+                size_t size = c->in.size() - c->consumed;
+                if(!c->head) {
+                    size_t length = 0;
+                    try {
+                        length = http::parse_request_head(data, size, c->request);
+                    }
+                    catch(...) {
+                        ++stats.bad_requests;
+                        return fail(c, 400);
+                    }
+                    if(!length) {
+                        if(size > max_head)
+                            return fail(c, 400);
+                        break;
+                    }
+                    c->head = length;
+                    c->request.body.clear();
+                    c->chunked = false;
+                    c->content_length = 0;
+                    c->continued = false;
+                    const std::string* encoding = http::find_header(c->request.headers, "Transfer-Encoding");
+                    const std::string* length_header = http::find_header(c->request.headers, "Content-Length");
+                    if(encoding) {
+                        if(strcasecmp(encoding->c_str(), "chunked") != 0) {
+                            ++stats.bad_requests;
+                            return fail(c, 400);
+                        }
+                        c->chunked = true;
+                    }
+                    else if(length_header) {
+                        char* end = nullptr;
+                        errno = 0;
+                        unsigned long long value = strtoull(length_header->c_str(), &end, 10);
+                        if(length_header->empty() || *end || errno || !isdigit(static_cast<unsigned char>((*length_header)[0]))) {
+                            ++stats.bad_requests;
+                            return fail(c, 400);
+                        }
+                        if(value > max_body)
+                            return fail(c, 413);
+                        c->content_length = value;
+                    }
+                    if(viewing) {
+                        c->view.bind(c->request, &c->identity);
+                        if(hooks->wants(plugin::LOG))
+                            c->started = event::clock::now();
+                        if(hooks->wants(plugin::HEADERS)) {
+                            int status = hooks->on_headers(c->view.get());
+                            if(status != CHEE_DECLINED)
+                                return fail(c, answerable(status));
+                        }
+                    }
+                }
+                data += c->head;
+                size -= c->head;
+                size_t body = 0;
+                if(c->chunked) {
+                    try {
+                        body = decode_chunked(data, size, c->request.body, max_body);
+                    }
+                    catch(const std::length_error&) {
+                        return fail(c, 413);
+                    }
+                    catch(...) {
+                        ++stats.bad_requests;
+                        return fail(c, 400);
+                    }
+                    if(!body) {
+                        c->request.body.clear();
+                        continue_if_expected(c);
+                        break;
+                    }
+                }
+                else {
+                    if(size < c->content_length) {
+                        continue_if_expected(c);
+                        break;
+                    }
+                    body = c->content_length;
+                    c->request.body.assign(data, body);
+                }
+                if(filter && filter->check(c->request)) {
+                    ++stats.filtered;
+                    return fail(c, 403);
+                }
+                if(hooks && hooks->wants(plugin::BODY) && (c->chunked || c->content_length)) {
+                    int status = hooks->body(c->view.get(), c->request.body.data(), c->request.body.size(), true);
+                    if(status != CHEE_DECLINED)
+                        return fail(c, answerable(status));
+                }
+                c->consumed += c->head + body;
+                c->head = 0;
+                if(!respond(c))
+                    break;
+            }
+            //drop what was answered once it is a good part of the buffer
+            if(c->consumed && (c->consumed == c->in.size() || c->consumed > 65536)) {
+                c->in.erase(0, c->consumed);
+                c->consumed = 0;
+            }
+        }
+
+        void continue_if_expected(connection* c) {
+            if(c->continued)
+                return;
+            c->continued = true;
+            const std::string* expect = http::find_header(c->request.headers, "Expect");
+            if(expect && strcasecmp(expect->c_str(), "100-continue") == 0)
+                c->out.append("HTTP/1.1 100 Continue\r\n\r\n");
+        }
+
+        //false when the connection closes after this answer
+        bool respond(connection* c) {
+            ++stats.requests;
+            http::request& request = c->request;
+            http::response& response = c->response;
+            response.status = 0;
+            response.reason.clear();
+            response.headers.clear();
+            response.body.clear();
+            bool keep = http::keep_alive(request.version, request.headers);
+            size_t path_length = request.target.find('?');
+            if(path_length == std::string::npos)
+                path_length = request.target.size();
+            int status = 404;
+            bool handled = false;
+            if(rewrites) {
+                int redirect = rewrites->apply(request.target);
+                path_length = std::min(request.target.find('?'), request.target.size());
+                //the views plugins get point into the target, which may just have moved
+                if(viewing)
+                    c->view.bind(request, &c->identity);
+                if(redirect) {
+                    ++stats.redirects;
+                    response.status = redirect;
+                    response.headers.emplace_back("Location", request.target);
+                    handled = true;
+                }
+            }
+            //a plugin taking the request answers instead of any route
+            if(!handled)
+                handled = hooks && hooks->wants(plugin::HANDLER) && hooks->handle(c->view.get(), response);
+            const route* r = handled ? nullptr : routes.find(request.method, request.target.data(), path_length, status);
+            if(r) {
+                try {
+                    r->callback(request, response);
+                    if(response.status == 0)
+                        response.status = 200;
+                }
+                catch(...) {
+                    ++stats.handler_errors;
+                    response.status = 500;
+                    response.headers.clear();
+                    response.body.clear();
+                }
+            }
+            else if(!handled) {
+                response.status = status;
+            }
+            drop_framing(response.headers, keep);
+            bool close_after = !keep || c->closing;
+            bool body = http::has_body(request.method, response.status);
+            c->slots.fill(response.status >= 200 && response.status != 204 && response.status != 304, response.body.size());
+            iovec iov[4];
+            size_t count = 0;
+            bool templated = r && r->head && response.status == r->head->code() && response.reason.empty();
+            if(templated) {
+                //the template block goes out as is, only what the handler added is serialized.
+                //a fixed header repeated with its value is already there, one with another value
+                //takes the serialized way below with the handler's value in its place
+                c->extra.clear();
+                for(const auto& h : response.headers) {
+                    const std::string* fixed = repeatable_header(h.first) ? nullptr : r->head->find(h.first);
+                    if(fixed && *fixed != h.second) {
+                        templated = false;
+                        break;
+                    }
+                    if(!fixed)
+                        c->extra.append(h.first).append(": ").append(h.second).append("\r\n");
+                }
+                if(!templated)
+                    r->head->merge(response);
+            }
+            if(templated) {
+                if(close_after)
+                    c->extra.append("Connection: close\r\n");
+                count = r->head->gather(iov, c->extra, c->slots, response.body, body);
+            }
+            else {
+                if(close_after)
+                    response.headers.emplace_back("Connection", "close");
+                c->extra = http::serialize_head(response);
+                c->extra.resize(c->extra.size() - 2);
+                iov[count++] = iovec{&c->extra[0], c->extra.size()};
+                iov[count++] = iovec{c->slots.bytes, c->slots.size};
+                if(body && !response.body.empty())
+                    iov[count++] = iovec{&response.body[0], response.body.size()};
+            }
+            //the last answer of a batch with nothing queued before it is written straight from
+            //its pieces, otherwise they are queued so a pipelined batch leaves in one send
+            emit(c, iov, count, c->out.empty() && c->consumed == c->in.size());
+            if(hooks && hooks->wants(plugin::LOG)) {
+                uint64_t sent = 0;
+                for(size_t i = 0; i < count; ++i)
+                    sent += iov[i].iov_len;
+                auto took = std::chrono::duration_cast<std::chrono::microseconds>(event::clock::now() - c->started).count();
+                chee_log_entry entry{sizeof(chee_log_entry), &c->view.get(), response.status, sent, static_cast<uint64_t>(took)};
+                hooks->log(entry);
+            }
+            if(!keep)
+                c->closing = true;
+            return keep;
+        }
+
+        void emit(connection* c, const iovec* iov, size_t count, bool direct) {
+            size_t sent = 0;
+            if(direct) {
+                msghdr message{};
+                message.msg_iov = const_cast<iovec*>(iov);
+                message.msg_iovlen = count;
+                ssize_t n;
+                do {
+                    n = sendmsg(c->fd, &message, MSG_NOSIGNAL);
+                } while(n < 0 && errno == EINTR);
+                //errors other than a full socket come back on the next flush
+                if(n > 0)
+                    sent = n;
+            }
+            for(size_t i = 0; i < count; ++i) {
+                if(sent >= iov[i].iov_len) {
+                    sent -= iov[i].iov_len;
+                    continue;
+                }
+                c->out.append(static_cast<const char*>(iov[i].iov_base) + sent, iov[i].iov_len - sent);
+                sent = 0;
+            }
+        }
+
+        //takes the framing headers a handler set out of its answer, the slots have the server's
+        static void drop_framing(http::headers_t& headers, bool& keep) {
+            if(headers.empty())
+                return;
+            headers.erase(std::remove_if(headers.begin(), headers.end(), [&keep](const std::pair<std::string, std::string>& h) {
+                if(!framing_header(h.first))
+                    return false;
+                if(h.first.size() == 10 && strcasestr(h.second.c_str(), "close"))
+                    keep = false;
+                return true;
+            }), headers.end());
+        }
+
+        //what a plugin status is answered with, anything not a status is the plugin's fault
+        static int answerable(int status) {
+            return status >= 100 && status <= 599 ? status : 500;
+        }
+
+        void fail(connection* c, int status) {
+            c->in.clear();
+            c->consumed = 0;
+            c->head = 0;
+            c->closing = true;
+            c->out.append("HTTP/1.1 ").append(std::to_string(status)).push_back(' ');
+            c->out.append(http::reason(status)).append("\r\nConnection: close\r\nContent-Length: 0\r\n\r\n");
+        }
+
+        //writes what is queued, false when the connection is gone. once a paused connection's
+        //answers are out the requests waiting behind them are taken up again
+        bool flush(connection* c) {
+            while(true) {
+                while(c->written < c->out.size()) {
+                    ssize_t n = send(c->fd, c->out.data() + c->written, c->out.size() - c->written, MSG_NOSIGNAL);
+                    if(n > 0) {
+                        c->written += n;
+                        continue;
+                    }
+                    if(n < 0 && errno == EINTR)
+                        continue;
+                    if(n < 0 && errno == EAGAIN) {
+                        watch(c, true, c->paused);
+                        return true;
+                    }
+                    finish(c);
+                    return false;
+                }
+                c->out.clear();
+                c->written = 0;
+                if(!c->paused)
+                    break;
+                watch(c, c->writing, false);
+                process(c);
+            }
+            if(c->closing) {
+                finish(c);
+                return false;
+            }
+            watch(c, false, false);
+            return true;
+        }
+
+        //what the loop wakes the connection for: its socket turning writable while answers are
+        //queued, readable unless it is paused
+        void watch(connection* c, bool writing, bool paused) {
+            if(c->writing == writing && c->paused == paused)
+                return;
+            c->writing = writing;
+            c->paused = paused;
+            loop.modify(c->fd, (paused ? 0u : static_cast<uint32_t>(EPOLLIN | EPOLLRDHUP)) | (writing ? static_cast<uint32_t>(EPOLLOUT) : 0u));
+        }
+
+        void finish(connection* c) {
+            int fd = c->fd;
+            loop.remove(fd);
+            close(fd);
+            connections.erase(fd);
+            --stats.active;
+        }
+
+        void close_idle() {
+            auto cutoff = event::clock::now() - idle_timeout;
+            std::vector<connection*> idle;
+            for(auto& c : connections)
+                if(c.second->active < cutoff)
+                    idle.push_back(c.second.get());
+            for(auto* c : idle) {
+                ++stats.timeouts;
+                finish(c);
+            }
+            sweep = loop.after(std::chrono::seconds(1), [this]() { close_idle(); });
+        }
+
+        event::loop& loop;
+        const router& routes;
+        server_stats& stats;
+        int listener;
+        const acl::access_list* access;
+        const filter::request_filter* filter;
+        rewrite::rewriter* rewrites;
+        plugin::plugins* hooks;
+        bool viewing;
+        size_t max_head;
+        size_t max_body;
+        size_t max_output;
+        std::chrono::seconds idle_timeout;
+        event::timer_id sweep;
+        event::timer_id resume;
+        std::unordered_map<int, std::unique_ptr<connection> > connections;
+    };
+
+    //the embeddable server: handlers are registered on routes() before start(), then
+    //server_threads loops each accept on their own SO_REUSEPORT listener of server_listen.
+    //the access list, request filter and rewrite rules are on when their keys are set
+    //(access_allow, access_deny or access_list, filter_rules, rewrite_rules), the plugins
+    //listed in plugins are loaded up front. all of them are shared by every loop
+    class http_server {
+    public:
+        http_server() = delete;
+        explicit http_server(const server_config_t& config) :
+            config(config), threads(std::thread::hardware_concurrency()), hooks(config) {
+            if(config.count("access_allow") || config.count("access_deny") || config.count("access_list"))
+                access.reset(new acl::access_list(config));
+            if(config.count("filter_rules"))
+                filter.reset(new filter::request_filter(config));
+            if(config.count("rewrite_rules"))
+                rewrites.reset(new rewrite::rewriter(config));
+            auto found = config.find("server_threads");
+            if(found != config.end()) {
+                try {
+                    threads = std::stoul(found->second);
+                }
+                catch(...) {
+                    throw std::runtime_error(found->second + " is not a valid server_threads");
+                }
+            }
+            if(threads == 0)
+                threads = 1;
+            auto address = config.find("server_listen");
+            if(address == config.end())
+                throw std::runtime_error("server_listen is required");
+            //the first listener settles port 0, the others bind the same port
+            listeners.push_back(net::listen_on(address->second, true));
+            std::string spec = address->second.substr(0, address->second.rfind(':') + 1) + std::to_string(port());
+            try {
+                for(size_t i = 1; i < threads; ++i)
+                    listeners.push_back(net::listen_on(spec, true));
+            }
+            catch(...) {
+                for(int l : listeners)
+                    close(l);
+                throw;
+            }
+        }
+        ~http_server() {
+            stop();
+            for(int l : listeners)
+                close(l);
+        }
+        http_server(const http_server&) = delete;
+        http_server& operator=(const http_server&) = delete;
+
+        router& routes() {
+            return table;
+        }
+
+        //plugins linked into the binary are added here before start()
+        plugin::plugins& plugins() {
+            return hooks;
+        }
+
+        //starts the loops, returns right away
+        void start() {
+            if(!running.empty())
+                return;
+            pipeline stages;
+            stages.access = access.get();
+            stages.filter = filter.get();
+            stages.rewrites = rewrites.get();
+            stages.hooks = &hooks;
+            for(size_t i = 0; i < listeners.size(); ++i) {
+                loops.emplace_back(new event::loop());
+                workers.emplace_back(new worker(*loops.back(), table, stats, listeners[i], config, stages));
+            }
+            for(auto& l : loops) {
+                event::loop* raw = l.get();
+                running.emplace_back([raw]() { raw->run(); });
+            }
+        }
+
+        //stops the loops and waits for them, open connections are closed
+        void stop() {
+            for(auto& l : loops)
+                l->stop();
+            for(auto& t : running)
+                t.join();
+            running.clear();
+            workers.clear();
+            loops.clear();
+        }
+
+        uint16_t port() const {
+            return net::local_port(listeners.front());
+        }
+
+        const server_stats& statistics() const {
+            return stats;
+        }
+
+    protected:
+        server_config_t config;
+        size_t threads;
+        plugin::plugins hooks;
+        std::unique_ptr<acl::access_list> access;
+        std::unique_ptr<filter::request_filter> filter;
+        std::unique_ptr<rewrite::rewriter> rewrites;
+        router table;
+        server_stats stats;
+        std::vector<int> listeners;
+        std::vector<std::unique_ptr<event::loop> > loops;
+        std::vector<std::unique_ptr<worker> > workers;
+        std::vector<std::thread> running;
+    };
+}
+
+#endif //__SERVER_HPP__
+
+#ifdef TEST_SERVER
+
+#include "stream/proxy.hpp"
+
+#include <cassert>
+#include <fstream>
+#include <iostream>
+#include <sys/resource.h>
+
+//requests per second from an in process json endpoint, straight and through a stream proxy
+//hop in front of it like a separate service would need:
+//  g++ -std=c++17 -O2 -DTEST_SERVER -Iinclude -x c++ include/server/server.hpp -pthread -lssl -lcrypto -lz -ldl -o serverbench
+//  ./serverbench [seconds] [client threads] [pipelined requests]
+static int dial(uint16_t port) {
+  int s = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_in a{};
+  a.sin_family = AF_INET;
+  a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  a.sin_port = htons(port);
+  if(connect(s, reinterpret_cast<sockaddr*>(&a), sizeof(a)) != 0) {
+    close(s);
+    return -1;
+  }
+  int one = 1;
+  setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return s;
+}
+
+//sends request on a new connection and reads until the server closes it
+static std::string exchange(uint16_t port, const std::string& request) {
+  int s = dial(port);
+  if(s < 0)
+    return "";
+  std::string in;
+  char buffer[4096];
+  ssize_t n = write(s, request.data(), request.size());
+  while(n > 0 && (n = read(s, buffer, sizeof(buffer))) > 0)
+    in.append(buffer, n);
+  close(s);
+  return in;
+}
+
+//a plugin linked into the binary, on every hook of the request path
+namespace hooked {
+  std::atomic<bool> turn_away{false};
+  std::atomic<uint64_t> logged{0}, bytes{0};
+  bool starts(chee_str s, const char* prefix) {
+    return s.size >= strlen(prefix) && memcmp(s.data, prefix, strlen(prefix)) == 0;
+  }
+  extern "C" int on_accept(void*, const chee_connection* c) {
+    return turn_away && c->peer && c->peer->sa_family == AF_INET ? CHEE_HANDLED : CHEE_DECLINED;
+  }
+  extern "C" int on_headers(void*, const chee_request* r) {
+    return starts(r->target, "/blocked") ? 403 : CHEE_DECLINED;
+  }
+  extern "C" int on_handler(void*, const chee_request* r, chee_response* response) {
+    static const chee_header headers[] = {{{"X-Plugin", 8}, {"linked", 6}}};
+    if(!starts(r->target, "/plugin"))
+      return CHEE_DECLINED;
+    response->headers = headers;
+    response->header_count = 1;
+    response->body = chee_str{"from plugin", 11};
+    return CHEE_HANDLED;
+  }
+  extern "C" int on_body(void*, const chee_request*, chee_str chunk, int last) {
+    bytes += chunk.size;
+    return !last || memmem(chunk.data, chunk.size, "evil", 4) ? 400 : CHEE_DECLINED;
+  }
+  extern "C" void on_log(void*, const chee_log_entry* entry) {
+    if(entry->status && entry->bytes_sent && entry->request->method.size)
+      ++logged;
+  }
+  const chee_plugin plugin{CHEE_PLUGIN_ABI, sizeof(chee_plugin), "hooked", nullptr, nullptr, on_accept, on_headers, on_handler, on_body, on_log};
+}
+
+static void check_plugins() {
+  server::http_server s(server::server_config_t{{"server_listen", "127.0.0.1:0"}, {"server_threads", "1"}});
+  s.plugins().add(&hooked::plugin);
+  s.routes().get("/hello", [](const http::request&, http::response& response) { response.body = "hello"; });
+  s.routes().post("/upload", [](const http::request& request, http::response& response) {
+    response.body = std::to_string(request.body.size());
+  });
+  s.start();
+  uint16_t port = s.port();
+  std::string answer = exchange(port, "GET /hello HTTP/1.1\r\nConnection: close\r\n\r\n");
+  assert(answer.compare(0, 12, "HTTP/1.1 200") == 0 && answer.substr(answer.size() - 5) == "hello");
+  answer = exchange(port, "GET /blocked/x HTTP/1.1\r\nConnection: close\r\n\r\n");
+  assert(answer.compare(0, 12, "HTTP/1.1 403") == 0);
+  answer = exchange(port, "GET /plugin HTTP/1.1\r\nConnection: close\r\n\r\n");
+  assert(answer.compare(0, 12, "HTTP/1.1 200") == 0 && answer.find("\r\nX-Plugin: linked\r\n") != std::string::npos);
+  assert(answer.substr(answer.size() - 11) == "from plugin");
+  answer = exchange(port, "POST /upload HTTP/1.1\r\nContent-Length: 9\r\nConnection: close\r\n\r\nall right");
+  assert(answer.compare(0, 12, "HTTP/1.1 200") == 0 && answer.substr(answer.size() - 5) == "\r\n\r\n9");
+  answer = exchange(port, "POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n4\r\nevil\r\n0\r\n\r\n");
+  assert(answer.compare(0, 12, "HTTP/1.1 400") == 0 && hooked::bytes == 13);
+  //bodiless requests don't reach on_body
+  exchange(port, "GET /hello HTTP/1.1\r\nConnection: close\r\n\r\n");
+  assert(hooked::bytes == 13);
+  //answers from routes and from the plugin are logged, refusals before an answer aren't
+  assert(hooked::logged == 4);
+  hooked::turn_away = true;
+  assert(exchange(port, "GET /hello HTTP/1.1\r\nConnection: close\r\n\r\n").empty());
+  hooked::turn_away = false;
+  s.stop();
+  assert(s.statistics().refused == 1 && s.statistics().accepted == 7);
+}
+
+//the access list, filter and rewrite rules, each switched on by its configuration keys
+static void check_stages() {
+  std::ofstream("/tmp/servertest.filter") << "deny sqli uri union select\n" << "deny script body <script\n";
+  std::ofstream("/tmp/servertest.rewrite") << "rewrite ^/old/(.*)$ /hello?from=$1 last\n" << "rewrite ^/gone$ https://example.com/ permanent\n";
+  std::string seen;
+  auto echo = [&seen](const http::request& request, http::response& response) {
+    seen = request.target;
+    response.body = "hello";
+  };
+  {
+    server::http_server s(server::server_config_t{{"server_listen", "127.0.0.1:0"}, {"server_threads", "1"},
+                                                  {"filter_rules", "/tmp/servertest.filter"},
+                                                  {"rewrite_rules", "/tmp/servertest.rewrite"}});
+    s.routes().get("/hello", echo);
+    s.routes().post("/hello", echo);
+    s.start();
+    uint16_t port = s.port();
+    std::string answer = exchange(port, "GET /old/page?x=1 HTTP/1.1\r\nConnection: close\r\n\r\n");
+    assert(answer.compare(0, 12, "HTTP/1.1 200") == 0 && seen == "/hello?from=page&x=1");
+    answer = exchange(port, "GET /gone HTTP/1.1\r\nConnection: close\r\n\r\n");
+    assert(answer.compare(0, 12, "HTTP/1.1 301") == 0 && answer.find("\r\nLocation: https://example.com/\r\n") != std::string::npos);
+    //the filter sees the request as sent, before any rewrite
+    answer = exchange(port, "GET /old/union%20select HTTP/1.1\r\nConnection: close\r\n\r\n");
+    assert(answer.compare(0, 12, "HTTP/1.1 403") == 0);
+    answer = exchange(port, "POST /hello HTTP/1.1\r\nContent-Length: 16\r\nConnection: close\r\n\r\n<script>x</script");
+    assert(answer.compare(0, 12, "HTTP/1.1 403") == 0);
+    s.stop();
+    assert(s.statistics().filtered == 2 && s.statistics().redirects == 1 && s.statistics().requests == 2);
+  }
+  {
+    server::http_server s(server::server_config_t{{"server_listen", "127.0.0.1:0"}, {"server_threads", "1"},
+                                                  {"access_deny", "127.0.0.0/8"}});
+    s.routes().get("/hello", echo);
+    s.start();
+    assert(exchange(s.port(), "GET /hello HTTP/1.1\r\nConnection: close\r\n\r\n").empty());
+    s.stop();
+    assert(s.statistics().denied == 1 && s.statistics().active == 0 && s.statistics().requests == 0);
+  }
+}
+
+static size_t occurrences(const std::string& text, const std::string& part) {
+  size_t n = 0;
+  for(size_t at = text.find(part); at != std::string::npos; at = text.find(part, at + 1))
+    ++n;
+  return n;
+}
+
+//every header a handler repeats goes out once: the framing ones are the server's, fixed ones of a
+//template with the same value are in the block and with another value the handler's win
+static void check_duplicates() {
+  //short idle timeout so a connection left open fails the test rather than hanging it
+  server::http_server s(server::server_config_t{{"server_listen", "127.0.0.1:0"}, {"server_threads", "1"},
+                                                {"server_idle_timeout", "1"}});
+  s.routes().get("/framed", [](const http::request&, http::response& response) {
+    response.headers = {{"Date", "yesterday"}, {"content-length", "999"}, {"Connection", "close"}, {"X-Id", "1"}};
+    response.body = "framed";
+  });
+  auto head = std::make_shared<const server::header_template>(200, http::headers_t{{"Server", "cheehttpd"},
+                                                                                   {"Content-Type", "application/json"},
+                                                                                   {"Set-Cookie", "a=1"}});
+  s.routes().get("/same", [](const http::request&, http::response& response) {
+    response.headers = {{"server", "cheehttpd"}, {"Date", "yesterday"}, {"Set-Cookie", "b=2"}, {"X-Id", "2"}};
+    response.body = "same";
+  }, head);
+  s.routes().get("/other", [](const http::request&, http::response& response) {
+    response.headers = {{"Content-Type", "text/plain"}, {"X-Id", "3"}};
+    response.body = "other";
+  }, head);
+  s.start();
+  //the handler's Connection: close ends a keep-alive connection
+  std::string answer = exchange(s.port(), "GET /framed HTTP/1.1\r\n\r\n");
+  assert(answer.compare(0, 12, "HTTP/1.1 200") == 0 && answer.substr(answer.size() - 6) == "framed");
+  assert(occurrences(answer, "Date: ") == 1 && answer.find("yesterday") == std::string::npos);
+  assert(occurrences(answer, "ontent-") == 1 && answer.find("Content-Length: 6\r\n") != std::string::npos);
+  assert(occurrences(answer, "Connection: ") == 1 && answer.find("\r\nConnection: close\r\n") != std::string::npos);
+  answer = exchange(s.port(), "GET /same HTTP/1.1\r\nConnection: close\r\n\r\n");
+  assert(answer.compare(0, 12, "HTTP/1.1 200") == 0 && answer.substr(answer.size() - 4) == "same");
+  assert(occurrences(answer, "erver: ") == 1 && occurrences(answer, "Date: ") == 1 && occurrences(answer, "X-Id: 2") == 1);
+  assert(answer.find("Set-Cookie: a=1\r\n") != std::string::npos && answer.find("Set-Cookie: b=2\r\n") != std::string::npos);
+  answer = exchange(s.port(), "GET /other HTTP/1.1\r\nConnection: close\r\n\r\n");
+  assert(answer.compare(0, 12, "HTTP/1.1 200") == 0 && answer.substr(answer.size() - 5) == "other");
+  assert(occurrences(answer, "Content-Type: ") == 1 && answer.find("Content-Type: text/plain\r\n") != std::string::npos);
+  assert(occurrences(answer, "Server: cheehttpd") == 1 && occurrences(answer, "Set-Cookie: a=1") == 1 && occurrences(answer, "X-Id: 3") == 1);
+  assert(occurrences(answer, "Content-Length: 5\r\n") == 1 && occurrences(answer, "Connection: close") == 1);
+  s.stop();
+}
+
+//a client pipelining more than it reads makes the server stop reading from it instead of
+//queueing every answer, and it goes on once the client catches up
+static void check_backpressure() {
+  std::atomic<uint64_t> answered{0};
+  server::http_server s(server::server_config_t{{"server_listen", "127.0.0.1:0"}, {"server_threads", "1"},
+                                                {"server_max_output", "8192"}});
+  s.routes().get("/big", [&answered](const http::request&, http::response& response) {
+    ++answered;
+    response.body.assign(16384, 'b');
+  });
+  s.start();
+  int c = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int small = 4096;
+  setsockopt(c, SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+  sockaddr_in a{};
+  a.sin_family = AF_INET;
+  a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  a.sin_port = htons(s.port());
+  assert(connect(c, reinterpret_cast<sockaddr*>(&a), sizeof(a)) == 0);
+  const size_t n = 4000;
+  std::string batch;
+  for(size_t i = 0; i < n; ++i)
+    batch += "GET /big HTTP/1.1\r\n\r\n";
+  std::thread writer([c, &batch]() {
+    for(size_t at = 0; at < batch.size();) {
+      ssize_t w = write(c, batch.data() + at, batch.size() - at);
+      assert(w > 0);
+      at += w;
+    }
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(300));
+  uint64_t held = answered;
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  assert(answered == held && held < n / 2);
+  //one empty line ends each head, the bodies have none
+  size_t heads = 0;
+  std::string in;
+  char buffer[65536];
+  while(heads < n) {
+    ssize_t got = read(c, buffer, sizeof(buffer));
+    assert(got > 0);
+    in.append(buffer, got);
+    size_t at = 0, end;
+    while((end = in.find("\r\n\r\n", at)) != std::string::npos) {
+      ++heads;
+      at = end + 4;
+    }
+    in.erase(0, std::max(at, in.size() - std::min<size_t>(in.size(), 3)));
+  }
+  writer.join();
+  close(c);
+  s.stop();
+  std::cout << "pipelining without reading: " << held << " of " << n << " answered until the client read" << std::endl;
+  assert(answered == n);
+}
+
+//out of descriptors the server backs off instead of spinning on a readable listener, and picks
+//the waiting connections up once descriptors are free again
+static void check_descriptors() {
+  server::http_server s(server::server_config_t{{"server_listen", "127.0.0.1:0"}, {"server_threads", "1"}});
+  s.routes().get("/hello", [](const http::request&, http::response& response) { response.body = "hello"; });
+  s.start();
+  rlimit limit{};
+  getrlimit(RLIMIT_NOFILE, &limit);
+  rlimit lowered = limit;
+  lowered.rlim_cur = std::min<rlim_t>(limit.rlim_cur, 4096);
+  setrlimit(RLIMIT_NOFILE, &lowered);
+  std::vector<int> waiting;
+  for(int i = 0; i < 3; ++i)
+    waiting.push_back(socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  std::vector<int> hogs;
+  for(int fd; (fd = dup(0)) >= 0;)
+    hogs.push_back(fd);
+  sockaddr_in a{};
+  a.sin_family = AF_INET;
+  a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  a.sin_port = htons(s.port());
+  for(int w : waiting)
+    assert(connect(w, reinterpret_cast<sockaddr*>(&a), sizeof(a)) == 0);
+  auto cpu = []() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec * 1000000L + usage.ru_utime.tv_usec + usage.ru_stime.tv_sec * 1000000L + usage.ru_stime.tv_usec;
+  };
+  long before = cpu();
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  long spent = cpu() - before;
+  assert(s.statistics().accepted == 0);
+  for(int fd : hogs)
+    close(fd);
+  setrlimit(RLIMIT_NOFILE, &limit);
+  std::string request = "GET /hello HTTP/1.1\r\nConnection: close\r\n\r\n";
+  for(int w : waiting) {
+    char buffer[256];
+    assert(write(w, request.data(), request.size()) == static_cast<ssize_t>(request.size()));
+    ssize_t got = read(w, buffer, sizeof(buffer));
+    assert(got > 12 && memcmp(buffer, "HTTP/1.1 200", 12) == 0);
+    close(w);
+  }
+  std::cout << "out of descriptors: " << spent / 1000 << "ms cpu in 500ms" << std::endl;
+  assert(spent < 150000);
+  s.stop();
+  assert(s.statistics().accepted == 3);
+}
+
+static double measure(uint16_t port, const std::string& path, double seconds, size_t threads, size_t depth) {
+  std::atomic<uint64_t> done{0}, errors{0};
+  auto until = event::clock::now() + std::chrono::duration_cast<event::clock::duration>(std::chrono::duration<double>(seconds));
+  std::string batch;
+  for(size_t i = 0; i < depth; ++i)
+    batch += "GET " + path + "?id=42 HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  std::vector<std::thread> clients;
+  for(size_t t = 0; t < threads; ++t)
+    clients.emplace_back([&]() {
+      int s = dial(port);
+      if(s < 0) {
+        ++errors;
+        return;
+      }
+      std::string in;
+      char buffer[65536];
+      while(event::clock::now() < until) {
+        if(write(s, batch.data(), batch.size()) != static_cast<ssize_t>(batch.size())) {
+          ++errors;
+          break;
+        }
+        //every answer ends with the same json document
+        size_t answers = 0;
+        while(answers < depth) {
+          ssize_t n = read(s, buffer, sizeof(buffer));
+          if(n <= 0) {
+            ++errors;
+            close(s);
+            return;
+          }
+          in.append(buffer, n);
+          size_t at;
+          while((at = in.find("\"ok\":true}")) != std::string::npos) {
+            in.erase(0, at + 10);
+            ++answers;
+          }
+        }
+        done += depth;
+      }
+      close(s);
+    });
+  for(auto& c : clients)
+    c.join();
+  if(errors)
+    std::cout << errors << " errors" << std::endl;
+  return done / seconds;
+}
+
+int main(int argc, char** argv) {
+  double seconds = argc > 1 ? std::stod(argv[1]) : 3;
+  size_t threads = argc > 2 ? std::stoul(argv[2]) : 8;
+  size_t depth = argc > 3 ? std::stoul(argv[3]) : 1;
+  check_plugins();
+  check_stages();
+  check_duplicates();
+  check_backpressure();
+  check_descriptors();
+
+  server::http_server s(server::server_config_t{{"server_listen", "127.0.0.1:0"}, {"server_threads", "2"}});
+  //the same answer with its fixed headers added by the handler and from a header template
+  http::headers_t fixed{{"Server", "cheehttpd"}, {"Content-Type", "application/json"}, {"Cache-Control", "no-store"},
+                        {"X-Content-Type-Options", "nosniff"}, {"X-Frame-Options", "DENY"}};
+  auto json = [](const http::request& request, http::response& response) {
+    auto query = request.target.find("id=");
+    std::string id = query == std::string::npos ? "0" : request.target.substr(query + 3);
+    response.body = "{\"id\":" + id + ",\"name\":\"cheehttpd\",\"ok\":true}";
+  };
+  s.routes().get("/json", [json, fixed](const http::request& request, http::response& response) {
+    response.headers = fixed;
+    json(request, response);
+  });
+  s.routes().get("/templated", json, std::make_shared<const server::header_template>(200, fixed));
+  s.start();
+
+  event::loop loop;
+  stream::proxy proxy(loop, stream::stream_config_t{{"stream_listen", "127.0.0.1:0"},
+                                                    {"stream_backends", "127.0.0.1:" + std::to_string(s.port())}});
+  std::thread runner([&loop]() { loop.run(); });
+
+  std::cout << "in process: " << measure(s.port(), "/json", seconds, threads, depth) << " requests/s" << std::endl;
+  std::cout << "in process with a header template: " << measure(s.port(), "/templated", seconds, threads, depth) << " requests/s" << std::endl;
+  std::cout << "behind a proxy hop: " << measure(proxy.port(), "/json", seconds, threads, depth) << " requests/s" << std::endl;
+
+  loop.stop();
+  runner.join();
+  s.stop();
+  const auto& stats = s.statistics();
+  std::cout << "accepted " << stats.accepted << ", requests " << stats.requests << ", bad " << stats.bad_requests << std::endl;
+  return 0;
+}
+
+#endif
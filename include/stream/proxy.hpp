@@ -0,0 +1,506 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __PROXY_HPP__
+#define __PROXY_HPP__
+
+#include "tunnel/tunnel.hpp"
+#include "hashing/hash_ring.hpp"
+#include "acl/acl.hpp"
+#include "net/listen.hpp"
+
+#include <atomic>
+#include <arpa/inet.h>
+
+namespace stream {
+    using stream_config_t = std::unordered_map<std::string, std::string>;
+
+    enum class balance {ROUND_ROBIN, LEAST_CONNECTIONS, SOURCE_HASH};
+
+    struct proxy_stats {
+        std::atomic<uint64_t> accepted{0};
+        std::atomic<uint64_t> active{0};
+        std::atomic<uint64_t> connect_failures{0};
+        std::atomic<uint64_t> rejected{0};
+        std::atomic<uint64_t> denied{0};
+        std::atomic<uint64_t> bytes_in{0};
+        std::atomic<uint64_t> bytes_out{0};
+    };
+
+    //a layer 4 listener: accepted connections are forwarded byte for byte to one of the
+    //backends through splice tunnels, no protocol is parsed. connects to backends are non
+    //blocking on the loop, a backend that refuses or times out is skipped for fail_timeout
+    //and the connection tries the next one. one proxy per loop, give each its own listener
+    //with stream_reuseport to spread accepts over several loops
+    class proxy {
+    public:
+        proxy() = delete;
+        proxy(event::loop& loop, const stream_config_t& config) :
+            loop(loop), tunnels(loop, config), mode(balance::ROUND_ROBIN), connect_timeout(std::chrono::milliseconds(3000)),
+            fail_timeout(std::chrono::seconds(10)), max_connections(65536), next(0), listener(-1), resume(0) {
+            auto parse = [&config](const char* key, size_t& value) {
+                auto found = config.find(key);
+                if(found == config.end())
+                    return;
+                try {
+                    value = std::stoul(found->second);
+                }
+                catch(...) {
+                    throw std::runtime_error(found->second + " is not a valid " + key);
+                }
+            };
+            size_t timeout_ms = 3000, fail_seconds = 10, reuse_port = 0;
+            parse("stream_connect_timeout_ms", timeout_ms);
+            parse("stream_fail_timeout", fail_seconds);
+            parse("stream_max_connections", max_connections);
+            parse("stream_reuseport", reuse_port);
+            connect_timeout = std::chrono::milliseconds(timeout_ms);
+            fail_timeout = std::chrono::seconds(fail_seconds);
+
+            auto mode_name = config.find("stream_balance");
+            if(mode_name != config.end()) {
+                if(mode_name->second == "round_robin")
+                    mode = balance::ROUND_ROBIN;
+                else if(mode_name->second == "least_conn")
+                    mode = balance::LEAST_CONNECTIONS;
+                else if(mode_name->second == "source_hash")
+                    mode = balance::SOURCE_HASH;
+                else
+                    throw std::runtime_error(mode_name->second + " is not a valid stream_balance");
+            }
+
+            //backends are resolved once here, the loop never waits on dns
+            auto list = config.find("stream_backends");
+            if(list == config.end() || list->second.empty())
+                throw std::runtime_error("stream_backends is required");
+            std::vector<std::string> names;
+            size_t start = 0;
+            while(start <= list->second.size()) {
+                size_t comma = list->second.find(',', start);
+                std::string spec = list->second.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+                if(!spec.empty())
+                    names.push_back(spec);
+                if(comma == std::string::npos)
+                    break;
+                start = comma + 1;
+            }
+            backends.reset(new target[names.size()]);
+            backend_count = names.size();
+            for(size_t i = 0; i < names.size(); ++i)
+                resolve(names[i], backends[i]);
+            loads = std::vector<std::atomic<uint32_t> >(backend_count);
+            ring = hashing::hash_ring(names, 160);
+
+            //client addresses are checked before anything is spent on them
+            if(config.count("access_allow") || config.count("access_deny") || config.count("access_list"))
+                access.reset(new acl::access_list(config));
+
+            auto address = config.find("stream_listen");
+            if(address == config.end())
+                throw std::runtime_error("stream_listen is required");
+            listener = net::listen_on(address->second, reuse_port != 0);
+            try {
+                loop.add(listener, EPOLLIN, [this](uint32_t) { accept_all(); });
+            }
+            catch(...) {
+                close(listener);
+                throw;
+            }
+        }
+        ~proxy() {
+            if(resume)
+                loop.cancel(resume);
+            if(listener >= 0) {
+                loop.remove(listener);
+                close(listener);
+            }
+        }
+        proxy(const proxy&) = delete;
+        proxy& operator=(const proxy&) = delete;
+
+        const proxy_stats& statistics() const {
+            return stats;
+        }
+
+        //the port actually bound, useful when listening on port 0
+        uint16_t port() const {
+            return net::local_port(listener);
+        }
+
+    protected:
+        struct target {
+            std::string name;
+            sockaddr_storage address;
+            socklen_t length;
+            event::clock::time_point down_until;
+        };
+
+        //a client waiting for its backend connect to finish
+        struct pending {
+            int client;
+            int upstream = -1;
+            size_t backend = 0;
+            size_t attempts = 0;
+            std::string source;
+            event::timer_id timer = 0;
+        };
+
+        static void resolve(const std::string& spec, target& t) {
+            auto b = upstream::parse_backend(spec);
+            addrinfo hints{}, *results = nullptr;
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            int error = getaddrinfo(b.host.c_str(), std::to_string(b.port).c_str(), &hints, &results);
+            if(error != 0)
+                throw std::runtime_error("Couldn't resolve stream backend " + spec + ": " + gai_strerror(error));
+            t.name = spec;
+            memcpy(&t.address, results->ai_addr, results->ai_addrlen);
+            t.length = results->ai_addrlen;
+            freeaddrinfo(results);
+        }
+
+        static std::string source_of(const sockaddr_storage& address) {
+            char text[INET6_ADDRSTRLEN] = {};
+            if(address.ss_family == AF_INET)
+                inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in*>(&address)->sin_addr, text, sizeof(text));
+            else if(address.ss_family == AF_INET6)
+                inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6*>(&address)->sin6_addr, text, sizeof(text));
+            return text;
+        }
+
+        void accept_all() {
+            while(true) {
+                sockaddr_storage address{};
+                socklen_t length = sizeof(address);
+                int client = accept4(listener, reinterpret_cast<sockaddr*>(&address), &length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if(client < 0) {
+                    if(errno == EINTR || errno == ECONNABORTED)
+                        continue;
+                    //out of descriptors the listener stays readable and would wake the loop forever,
+                    //stop watching it for a moment and leave the rest in the backlog
+                    if(errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+                        pause_accepting();
+                    return;
+                }
+                ++stats.accepted;
+                if(access && !access->allowed(reinterpret_cast<const sockaddr*>(&address))) {
+                    ++stats.denied;
+                    close(client);
+                    continue;
+                }
+                if(stats.active >= max_connections) {
+                    ++stats.rejected;
+                    close(client);
+                    continue;
+                }
+                ++stats.active;
+                int one = 1;
+                setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                auto p = std::make_shared<pending>();
+                p->client = client;
+                if(mode == balance::SOURCE_HASH)
+                    p->source = source_of(address);
+                attempt(p, pick(p->source));
+            }
+        }
+
+        void pause_accepting() {
+            if(resume)
+                return;
+            loop.modify(listener, 0);
+            resume = loop.after(std::chrono::milliseconds(100), [this]() {
+                resume = 0;
+                loop.modify(listener, EPOLLIN);
+                accept_all();
+            });
+        }
+
+        //the backend for a new connection, skipping ones marked down unless all are
+        size_t pick(const std::string& source) {
+            auto now = event::clock::now();
+            size_t chosen = 0;
+            if(mode == balance::SOURCE_HASH) {
+                chosen = ring.owner(source);
+            }
+            else if(mode == balance::LEAST_CONNECTIONS) {
+                //ties are broken by the rotating start so equal backends share the load
+                size_t offset = next++;
+                uint32_t best = UINT32_MAX;
+                for(size_t i = 0; i < backend_count; ++i) {
+                    size_t b = (offset + i) % backend_count;
+                    uint32_t load = loads[b].load(std::memory_order_relaxed);
+                    if(backends[b].down_until <= now && load < best) {
+                        best = load;
+                        chosen = b;
+                    }
+                }
+                return chosen;
+            }
+            else {
+                chosen = next++ % backend_count;
+            }
+            for(size_t i = 0; i < backend_count; ++i) {
+                size_t b = (chosen + i) % backend_count;
+                if(backends[b].down_until <= now)
+                    return b;
+            }
+            return chosen;
+        }
+
+        void attempt(const std::shared_ptr<pending>& p, size_t b) {
+            while(p->attempts++ < backend_count) {
+                p->backend = b;
+                const auto& t = backends[b];
+                p->upstream = socket(t.address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+                if(p->upstream >= 0) {
+                    int one = 1;
+                    setsockopt(p->upstream, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    if(::connect(p->upstream, reinterpret_cast<const sockaddr*>(&t.address), t.length) == 0)
+                        return connected(p);
+                    if(errno == EINPROGRESS) {
+                        std::weak_ptr<pending> weak = p;
+                        loop.add(p->upstream, EPOLLOUT, [this, weak](uint32_t) {
+                            if(auto p = weak.lock())
+                                writable(p);
+                        });
+                        //the timer keeps the pending connect alive
+                        p->timer = loop.after(connect_timeout, [this, p]() {
+                            p->timer = 0;
+                            failed(p);
+                        });
+                        return;
+                    }
+                    close(p->upstream);
+                    p->upstream = -1;
+                }
+                mark_down(b);
+                b = (b + 1) % backend_count;
+            }
+            ++stats.connect_failures;
+            --stats.active;
+            close(p->client);
+        }
+
+        void writable(const std::shared_ptr<pending>& p) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(p->upstream, SOL_SOCKET, SO_ERROR, &error, &length);
+            if(error != 0)
+                return failed(p);
+            loop.cancel(p->timer);
+            p->timer = 0;
+            loop.remove(p->upstream);
+            connected(p);
+        }
+
+        void failed(const std::shared_ptr<pending>& p) {
+            if(p->timer)
+                loop.cancel(p->timer);
+            p->timer = 0;
+            loop.remove(p->upstream);
+            close(p->upstream);
+            p->upstream = -1;
+            mark_down(p->backend);
+            attempt(p, (p->backend + 1) % backend_count);
+        }
+
+        void mark_down(size_t b) {
+            backends[b].down_until = event::clock::now() + fail_timeout;
+        }
+
+        void connected(const std::shared_ptr<pending>& p) {
+            size_t b = p->backend;
+            ++loads[b];
+            tunnels.add(p->client, p->upstream, [this, b](const tunnel::totals& t) {
+                --loads[b];
+                --stats.active;
+                stats.bytes_in += t.to_upstream;
+                stats.bytes_out += t.to_client;
+            });
+        }
+
+        event::loop& loop;
+        tunnel::tunnels tunnels;
+        balance mode;
+        std::chrono::milliseconds connect_timeout;
+        std::chrono::seconds fail_timeout;
+        size_t max_connections;
+        size_t next;
+        int listener;
+        event::timer_id resume;
+        std::unique_ptr<target[]> backends;
+        size_t backend_count;
+        std::vector<std::atomic<uint32_t> > loads;
+        hashing::hash_ring ring;
+        std::unique_ptr<acl::access_list> access;
+        proxy_stats stats;
+    };
+}
+
+#endif //__PROXY_HPP__
+
+#ifdef TEST_STREAM
+
+#include <cassert>
+#include <iostream>
+#include <sys/resource.h>
+
+//connections per second and throughput through the proxy against a local echo server:
+//  g++ -std=c++17 -O2 -DTEST_STREAM -Iinclude -x c++ include/stream/proxy.hpp -pthread -o streambench
+//  ./streambench [seconds] [client threads]
+static void echo_server(int listener) {
+  while(true) {
+    int c = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    if(c < 0)
+      return;
+    std::thread([c]() {
+      char buffer[65536];
+      ssize_t n;
+      while((n = read(c, buffer, sizeof(buffer))) > 0)
+        for(ssize_t off = 0; off < n;) {
+          ssize_t w = write(c, buffer + off, n - off);
+          if(w <= 0)
+            break;
+          off += w;
+        }
+      close(c);
+    }).detach();
+  }
+}
+
+static int dial(uint16_t port) {
+  int s = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_in a{};
+  a.sin_family = AF_INET;
+  a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  a.sin_port = htons(port);
+  if(connect(s, reinterpret_cast<sockaddr*>(&a), sizeof(a)) != 0) {
+    close(s);
+    return -1;
+  }
+  return s;
+}
+
+int main(int argc, char** argv) {
+  double seconds = argc > 1 ? std::stod(argv[1]) : 3;
+  size_t threads = argc > 2 ? std::stoul(argv[2]) : 8;
+  int echo = net::listen_on("127.0.0.1:0", false);
+  fcntl(echo, F_SETFL, 0);
+  sockaddr_in bound{};
+  socklen_t length = sizeof(bound);
+  getsockname(echo, reinterpret_cast<sockaddr*>(&bound), &length);
+  std::thread(echo_server, echo).detach();
+
+  event::loop loop;
+  stream::proxy proxy(loop, stream::stream_config_t{{"stream_listen", "127.0.0.1:0"}, {"stream_balance", "least_conn"},
+                                                    {"stream_backends", "127.0.0.1:" + std::to_string(ntohs(bound.sin_port))}});
+  uint16_t port = proxy.port();
+  std::thread runner([&loop]() { loop.run(); });
+
+  //connections per second, each one a connect, a one byte echo and a close
+  std::atomic<uint64_t> connections{0}, errors{0};
+  auto until = upstream::clock::now() + std::chrono::duration_cast<upstream::clock::duration>(std::chrono::duration<double>(seconds));
+  std::vector<std::thread> clients;
+  for(size_t t = 0; t < threads; ++t)
+    clients.emplace_back([&]() {
+      while(upstream::clock::now() < until) {
+        int s = dial(port);
+        char c = 'x';
+        if(s < 0 || write(s, &c, 1) != 1 || read(s, &c, 1) != 1)
+          ++errors;
+        else
+          ++connections;
+        if(s >= 0) {
+          //reset rather than linger in time wait, the benchmark would run out of ports
+          linger off{1, 0};
+          setsockopt(s, SOL_SOCKET, SO_LINGER, &off, sizeof(off));
+          close(s);
+        }
+      }
+    });
+  for(auto& c : clients)
+    c.join();
+  clients.clear();
+  std::cout << "connections: " << connections / seconds << "/s, " << errors << " errors" << std::endl;
+
+  //throughput, each client streams while reading the echo back
+  std::atomic<uint64_t> echoed{0};
+  auto start = upstream::clock::now();
+  until = start + std::chrono::duration_cast<upstream::clock::duration>(std::chrono::duration<double>(seconds));
+  for(size_t t = 0; t < threads; ++t)
+    clients.emplace_back([&]() {
+      int s = dial(port);
+      if(s < 0)
+        return;
+      std::thread reader([s, &echoed]() {
+        char buffer[65536];
+        ssize_t n;
+        while((n = read(s, buffer, sizeof(buffer))) > 0)
+          echoed += static_cast<uint64_t>(n);
+      });
+      std::string block(1 << 20, 'x');
+      while(upstream::clock::now() < until)
+        if(write(s, block.data(), block.size()) <= 0)
+          break;
+      shutdown(s, SHUT_WR);
+      reader.join();
+      close(s);
+    });
+  for(auto& c : clients)
+    c.join();
+  double elapsed = std::chrono::duration<double>(upstream::clock::now() - start).count();
+  std::cout << "throughput: " << echoed * 8 / elapsed / 1e9 << " Gbit/s echoed over " << threads << " connections" << std::endl;
+
+  //out of descriptors the proxy backs off instead of spinning on a readable listener, and picks
+  //the waiting connections up once descriptors are free again
+  const auto& counters = proxy.statistics();
+  //the throughput tunnels hand their descriptors back first, or they would free some mid test
+  while(counters.active)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  rlimit limit{};
+  getrlimit(RLIMIT_NOFILE, &limit);
+  rlimit lowered = limit;
+  lowered.rlim_cur = std::min<rlim_t>(limit.rlim_cur, 4096);
+  setrlimit(RLIMIT_NOFILE, &lowered);
+  std::vector<int> waiting;
+  for(int i = 0; i < 3; ++i)
+    waiting.push_back(socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  std::vector<int> hogs;
+  for(int fd; (fd = dup(0)) >= 0;)
+    hogs.push_back(fd);
+  uint64_t accepted = counters.accepted;
+  sockaddr_in a{};
+  a.sin_family = AF_INET;
+  a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  a.sin_port = htons(port);
+  for(int w : waiting)
+    assert(connect(w, reinterpret_cast<sockaddr*>(&a), sizeof(a)) == 0);
+  auto cpu = []() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec * 1000000L + usage.ru_utime.tv_usec + usage.ru_stime.tv_sec * 1000000L + usage.ru_stime.tv_usec;
+  };
+  long before = cpu();
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  long spent = cpu() - before;
+  assert(counters.accepted == accepted);
+  for(int fd : hogs)
+    close(fd);
+  setrlimit(RLIMIT_NOFILE, &limit);
+  for(int w : waiting) {
+    char c = 'y';
+    assert(write(w, &c, 1) == 1 && read(w, &c, 1) == 1 && c == 'y');
+    close(w);
+  }
+  std::cout << "out of descriptors: " << spent / 1000 << "ms cpu in 500ms, " << counters.accepted - accepted << " accepted after" << std::endl;
+  assert(spent < 150000 && counters.accepted == accepted + 3);
+
+  loop.stop();
+  runner.join();
+  const auto& stats = proxy.statistics();
+  std::cout << "accepted " << stats.accepted << ", failed connects " << stats.connect_failures << ", bytes in " << stats.bytes_in << std::endl;
+  return errors != 0;
+}
+
+#endif
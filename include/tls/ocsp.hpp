@@ -0,0 +1,617 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __OCSP_HPP__
+#define __OCSP_HPP__
+
+#include "tls/sni.hpp"
+#include "upstream/upstream.hpp"
+
+#include <memory>
+#include <thread>
+#include <condition_variable>
+#include <ctime>
+#include <sys/stat.h>
+#include <openssl/ocsp.h>
+#include <openssl/x509v3.h>
+
+namespace tls {
+    struct stapling_stats {
+        std::atomic<uint64_t> stapled{0};
+        std::atomic<uint64_t> refreshed{0};
+        std::atomic<uint64_t> failures{0};
+    };
+
+    //staples ocsp responses to our certificates so clients skip their own round trip to the
+    //ca. responses sit in memory and the handshake only copies the current one out, fetching
+    //from the responder or rereading ssl_stapling_dir happens on a background thread well
+    //before the response expires. a certificate added for the first time is stapled from the
+    //first refresh on, handshakes before that go without. an entry lives as long as the
+    //certificate it was added for, so certificates the sni lru evicts stop being refreshed once
+    //their last handshake is done. must outlive the contexts it was added to
+    class stapler {
+    public:
+        stapler() = delete;
+        explicit stapler(const tls_config_t& config) :
+            refresh(3600), retry(300), timeout(5000), stopping(false) {
+            auto parse = [&config](const char* key, size_t& value) {
+                auto found = config.find(key);
+                if(found == config.end())
+                    return;
+                try {
+                    value = std::stoul(found->second);
+                }
+                catch(...) {
+                    throw std::runtime_error(found->second + " is not a valid " + key);
+                }
+            };
+            size_t refresh_seconds = 3600, retry_seconds = 300, timeout_ms = 5000;
+            parse("ssl_stapling_refresh", refresh_seconds);
+            parse("ssl_stapling_retry", retry_seconds);
+            parse("ssl_stapling_timeout_ms", timeout_ms);
+            if(refresh_seconds < 60)
+                throw std::runtime_error("ssl_stapling_refresh must be at least 60");
+            if(retry_seconds == 0 || timeout_ms == 0)
+                throw std::runtime_error("ssl_stapling_retry and ssl_stapling_timeout_ms must be positive");
+            refresh = static_cast<time_t>(refresh_seconds);
+            retry = static_cast<time_t>(retry_seconds);
+            timeout = std::chrono::milliseconds(timeout_ms);
+            //a responder url overrides the one in the certificates, a directory means offline
+            //operation with responses '<serial in hex>.der' put there by something else
+            auto responder = config.find("ssl_stapling_responder");
+            if(responder != config.end())
+                responder_override = responder->second;
+            auto directory = config.find("ssl_stapling_dir");
+            if(directory != config.end())
+                files = directory->second;
+            worker = std::thread([this]() { run(); });
+        }
+        ~stapler() {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+            }
+            wake.notify_all();
+            worker.join();
+        }
+        stapler(const stapler&) = delete;
+        stapler& operator=(const stapler&) = delete;
+
+        //staples for the certificate of ctx, call it after the certificate and chain are set.
+        //certificates::configure_callback fits, so lazily loaded contexts get stapled as well.
+        //false when there is nothing to staple with, no issuer in the chain or no responder
+        bool add(SSL_CTX* ctx) {
+            X509* certificate = SSL_CTX_get0_certificate(ctx);
+            if(!certificate)
+                return false;
+            unsigned char digest[EVP_MAX_MD_SIZE];
+            unsigned int digest_length = 0;
+            if(X509_digest(certificate, EVP_sha256(), digest, &digest_length) != 1)
+                return false;
+            std::string key(reinterpret_cast<const char*>(digest), digest_length);
+
+            std::unique_lock<std::mutex> guard(lock);
+            //the same certificate loaded again, or still loaded elsewhere, shares its entry
+            std::shared_ptr<entry> shared = entries[key].lock();
+            if(!shared) {
+                guard.unlock();
+                shared.reset(make_entry(ctx, certificate));
+                if(!shared)
+                    return false;
+                guard.lock();
+                auto& slot = entries[key];
+                if(auto raced = slot.lock())
+                    shared = raced;
+                else
+                    slot = shared;
+                wake.notify_all();
+            }
+            guard.unlock();
+            if(!X509_get_ex_data(certificate, index()))
+                X509_set_ex_data(certificate, index(), new std::shared_ptr<entry>(std::move(shared)));
+            SSL_CTX_set_tlsext_status_cb(ctx, &stapler::on_status);
+            SSL_CTX_set_tlsext_status_arg(ctx, this);
+            return true;
+        }
+
+        //true once a valid response for the certificate of ctx is in memory
+        bool ready(SSL_CTX* ctx) const {
+            entry* e = of(SSL_CTX_get0_certificate(ctx));
+            return e && current(*e) != nullptr;
+        }
+
+        //certificates still being stapled for
+        size_t size() {
+            std::lock_guard<std::mutex> guard(lock);
+            size_t live = 0;
+            for(auto& e : entries)
+                live += !e.second.expired();
+            return live;
+        }
+
+        const stapling_stats& statistics() const {
+            return stats;
+        }
+
+    protected:
+        //a verified der response and when it stops being valid
+        struct answer {
+            std::string der;
+            time_t next_update;
+        };
+
+        struct entry {
+            ~entry() {
+                OCSP_CERTID_free(id);
+                sk_X509_pop_free(chain, X509_free);
+                X509_free(issuer);
+            }
+            OCSP_CERTID* id = nullptr;
+            STACK_OF(X509)* chain = nullptr;
+            X509* issuer = nullptr;
+            std::string responder;
+            std::string serial;
+            time_t refresh_at = 0;
+            time_t file_changed = 0;
+            //swapped whole by the worker, read by handshakes without a lock
+            std::shared_ptr<const answer> response;
+        };
+
+        //each certificate holds a reference to its entry, dropped when openssl frees it
+        static int index() {
+            static int slot = X509_get_ex_new_index(0, nullptr, nullptr, nullptr, [](void*, void* data, CRYPTO_EX_DATA*, int, long, void*) {
+                delete static_cast<std::shared_ptr<entry>*>(data);
+            });
+            return slot;
+        }
+        static entry* of(X509* certificate) {
+            auto* shared = certificate ? static_cast<std::shared_ptr<entry>*>(X509_get_ex_data(certificate, index())) : nullptr;
+            return shared ? shared->get() : nullptr;
+        }
+
+        static std::shared_ptr<const answer> current(const entry& e) {
+            auto response = std::atomic_load(&e.response);
+            if(response && response->next_update && response->next_update < time(nullptr))
+                return nullptr;
+            return response;
+        }
+
+        entry* make_entry(SSL_CTX* ctx, X509* certificate) {
+            STACK_OF(X509)* chain = nullptr;
+            SSL_CTX_get0_chain_certs(ctx, &chain);
+            X509* issuer = nullptr;
+            for(int i = 0; chain && i < sk_X509_num(chain) && !issuer; ++i)
+                if(X509_check_issued(sk_X509_value(chain, i), certificate) == X509_V_OK)
+                    issuer = sk_X509_value(chain, i);
+            if(!issuer)
+                return nullptr;
+            std::unique_ptr<entry> e(new entry());
+            if(responder_override.empty()) {
+                STACK_OF(OPENSSL_STRING)* urls = X509_get1_ocsp(certificate);
+                if(urls && sk_OPENSSL_STRING_num(urls) > 0)
+                    e->responder = sk_OPENSSL_STRING_value(urls, 0);
+                X509_email_free(urls);
+            }
+            else {
+                e->responder = responder_override;
+            }
+            if(e->responder.empty() && files.empty())
+                return nullptr;
+            e->id = OCSP_cert_to_id(nullptr, certificate, issuer);
+            e->chain = X509_chain_up_ref(chain);
+            if(X509_up_ref(issuer) == 1)
+                e->issuer = issuer;
+            BIGNUM* serial = ASN1_INTEGER_to_BN(X509_get0_serialNumber(certificate), nullptr);
+            char* hex = serial ? BN_bn2hex(serial) : nullptr;
+            if(hex)
+                e->serial = hex;
+            OPENSSL_free(hex);
+            BN_free(serial);
+            if(!e->id || !e->chain || !e->issuer || e->serial.empty())
+                return nullptr;
+            return e.release();
+        }
+
+        //runs in the handshake when the client asked for a staple, only copies bytes
+        static int on_status(SSL* ssl, void* arg) {
+            auto* self = static_cast<stapler*>(arg);
+            entry* e = of(SSL_get_certificate(ssl));
+            auto response = e ? current(*e) : nullptr;
+            if(!response)
+                return SSL_TLSEXT_ERR_NOACK;
+            auto* copy = static_cast<unsigned char*>(OPENSSL_malloc(response->der.size()));
+            if(!copy)
+                return SSL_TLSEXT_ERR_NOACK;
+            memcpy(copy, response->der.data(), response->der.size());
+            SSL_set_tlsext_status_ocsp_resp(ssl, copy, static_cast<long>(response->der.size()));
+            ++self->stats.stapled;
+            return SSL_TLSEXT_ERR_OK;
+        }
+
+        void run() {
+            std::unique_lock<std::mutex> guard(lock);
+            while(!stopping) {
+                time_t now = time(nullptr);
+                time_t next = now + refresh;
+                std::vector<std::shared_ptr<entry> > due;
+                for(auto e = entries.begin(); e != entries.end();) {
+                    auto live = e->second.lock();
+                    if(!live) {
+                        e = entries.erase(e);
+                        continue;
+                    }
+                    if(live->refresh_at <= now)
+                        due.push_back(std::move(live));
+                    else
+                        next = std::min(next, live->refresh_at);
+                    ++e;
+                }
+                if(due.empty()) {
+                    wake.wait_until(guard, std::chrono::system_clock::from_time_t(next));
+                    continue;
+                }
+                //the references keep the entries alive without the lock, even if their
+                //certificates are freed meanwhile
+                guard.unlock();
+                for(auto& e : due) {
+                    time_t when = update(*e);
+                    guard.lock();
+                    e->refresh_at = when;
+                    bool stop = stopping;
+                    guard.unlock();
+                    if(stop)
+                        break;
+                }
+                guard.lock();
+            }
+        }
+
+        //refreshes one response, returns when to look at it again. a failed refresh keeps
+        //the old response as long as it is valid
+        time_t update(entry& e) {
+            std::string der;
+            bool got = files.empty() ? fetch(e, der) : read_file(e, der);
+            time_t now = time(nullptr);
+            if(!got) {
+                if(!files.empty() && e.file_changed)
+                    return now + refresh;
+                ++stats.failures;
+                return now + retry;
+            }
+            time_t next_update = 0;
+            if(!verify(e, der, next_update)) {
+                ++stats.failures;
+                return now + retry;
+            }
+            std::atomic_store(&e.response, std::shared_ptr<const answer>(new answer{std::move(der), next_update}));
+            ++stats.refreshed;
+            //halfway to the expiry at the latest, so a slow responder has time to recover
+            time_t when = now + refresh;
+            if(next_update)
+                when = std::min(when, now + std::max<time_t>(60, (next_update - now) / 2));
+            return when;
+        }
+
+        //false when the file is missing or did not change since we read it
+        bool read_file(entry& e, std::string& der) {
+            std::string path = files + "/" + e.serial + ".der";
+            struct stat st{};
+            if(stat(path.c_str(), &st) != 0 || st.st_mtime == e.file_changed)
+                return false;
+            std::ifstream file(path, std::ifstream::binary);
+            der.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            if(!file && !file.eof())
+                return false;
+            e.file_changed = st.st_mtime;
+            return !der.empty();
+        }
+
+        //one ocsp request over plain http, responders serving https only are not supported
+        bool fetch(entry& e, std::string& der) {
+            char* host = nullptr;
+            char* port = nullptr;
+            char* path = nullptr;
+            int secure = 0;
+            if(OCSP_parse_url(e.responder.c_str(), &host, &port, &path, &secure) != 1) {
+                ERR_clear_error();
+                return false;
+            }
+            upstream::backend target{host, static_cast<uint16_t>(atoi(port))};
+            std::string target_path = path;
+            OPENSSL_free(host);
+            OPENSSL_free(port);
+            OPENSSL_free(path);
+            if(secure || target.port == 0)
+                return false;
+
+            OCSP_REQUEST* request = OCSP_REQUEST_new();
+            OCSP_CERTID* id = OCSP_CERTID_dup(e.id);
+            if(!request || !id || !OCSP_request_add0_id(request, id)) {
+                OCSP_CERTID_free(id);
+                OCSP_REQUEST_free(request);
+                return false;
+            }
+            unsigned char* encoded = nullptr;
+            int length = i2d_OCSP_REQUEST(request, &encoded);
+            OCSP_REQUEST_free(request);
+            if(length <= 0)
+                return false;
+            http::request post;
+            post.method = "POST";
+            post.target = target_path;
+            post.version = "HTTP/1.1";
+            post.body.assign(reinterpret_cast<const char*>(encoded), static_cast<size_t>(length));
+            OPENSSL_free(encoded);
+            http::set_header(post.headers, "Host", target.port == 80 ? target.host : target.name());
+            http::set_header(post.headers, "Content-Type", "application/ocsp-request");
+            http::set_header(post.headers, "Content-Length", std::to_string(post.body.size()));
+            http::set_header(post.headers, "Connection", "close");
+            try {
+                upstream::connection c(target, timeout);
+                http::response response = c.exchange(post);
+                if(response.status != 200)
+                    return false;
+                der = std::move(response.body);
+                return !der.empty();
+            }
+            catch(const std::exception&) {
+                return false;
+            }
+        }
+
+        //a response is only stapled when it is signed by the issuer or its delegate, answers
+        //for our certificate with a known status and is within its validity window. the issuer
+        //is the trust anchor, a delegated responder's certificate has to chain up to it
+        bool verify(entry& e, const std::string& der, time_t& next_update) {
+            const unsigned char* at = reinterpret_cast<const unsigned char*>(der.data());
+            OCSP_RESPONSE* response = d2i_OCSP_RESPONSE(nullptr, &at, static_cast<long>(der.size()));
+            OCSP_BASICRESP* basic = nullptr;
+            X509_STORE* store = X509_STORE_new();
+            bool good = false;
+            if(store && (X509_STORE_add_cert(store, e.issuer) != 1 || X509_STORE_set_flags(store, X509_V_FLAG_PARTIAL_CHAIN) != 1)) {
+                X509_STORE_free(store);
+                store = nullptr;
+            }
+            if(response && store && OCSP_response_status(response) == OCSP_RESPONSE_STATUS_SUCCESSFUL &&
+               (basic = OCSP_response_get1_basic(response)) && OCSP_basic_verify(basic, e.chain, store, OCSP_TRUSTOTHER) == 1) {
+                int status = V_OCSP_CERTSTATUS_UNKNOWN, reason = 0;
+                ASN1_GENERALIZEDTIME* revoked = nullptr;
+                ASN1_GENERALIZEDTIME* this_update = nullptr;
+                ASN1_GENERALIZEDTIME* next = nullptr;
+                if(OCSP_resp_find_status(basic, e.id, &status, &reason, &revoked, &this_update, &next) == 1 &&
+                   status != V_OCSP_CERTSTATUS_UNKNOWN && OCSP_check_validity(this_update, next, 300, -1) == 1) {
+                    good = true;
+                    next_update = 0;
+                    std::tm parts{};
+                    if(next && ASN1_TIME_to_tm(next, &parts) == 1)
+                        next_update = timegm(&parts);
+                }
+            }
+            ERR_clear_error();
+            X509_STORE_free(store);
+            OCSP_BASICRESP_free(basic);
+            OCSP_RESPONSE_free(response);
+            return good;
+        }
+
+        time_t refresh;
+        time_t retry;
+        std::chrono::milliseconds timeout;
+        std::string responder_override;
+        std::string files;
+        std::mutex lock;
+        std::condition_variable wake;
+        bool stopping;
+        std::unordered_map<std::string, std::weak_ptr<entry> > entries;
+        stapling_stats stats;
+        std::thread worker;
+    };
+}
+
+#endif //__OCSP_HPP__
+
+#ifdef TEST_OCSP
+//g++ -std=c++17 -O2 -DTEST_OCSP -Iinclude -x c++ include/tls/ocsp.hpp -o ocsptest -lssl -lcrypto -pthread
+#include <cassert>
+#include <cstdio>
+#include <iostream>
+#include <unistd.h>
+#include <openssl/pem.h>
+
+namespace {
+  //a certificate with its key, signed by issuer or by itself
+  struct identity {
+    EVP_PKEY* key = EVP_EC_gen("P-256");
+    X509* certificate = X509_new();
+    identity(const char* name, long serial, const identity* issuer = nullptr, const char* usage = nullptr) {
+      X509_set_version(certificate, 2);
+      ASN1_INTEGER_set(X509_get_serialNumber(certificate), serial);
+      X509_gmtime_adj(X509_getm_notBefore(certificate), -60);
+      X509_gmtime_adj(X509_getm_notAfter(certificate), 3600);
+      X509_set_pubkey(certificate, key);
+      X509_NAME_add_entry_by_txt(X509_get_subject_name(certificate), "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>(name), -1, -1, 0);
+      X509* signer = issuer ? issuer->certificate : certificate;
+      X509_set_issuer_name(certificate, X509_get_subject_name(signer));
+      X509V3_CTX v3;
+      X509V3_set_ctx_nodb(&v3);
+      X509V3_set_ctx(&v3, signer, certificate, nullptr, nullptr, 0);
+      auto extend = [&](int nid, const char* value) {
+        X509_EXTENSION* extension = X509V3_EXT_conf_nid(nullptr, &v3, nid, value);
+        X509_add_ext(certificate, extension, -1);
+        X509_EXTENSION_free(extension);
+      };
+      extend(NID_basic_constraints, issuer ? "critical,CA:FALSE" : "critical,CA:TRUE");
+      if(usage)
+        extend(NID_ext_key_usage, usage);
+      assert(X509_sign(certificate, issuer ? issuer->key : key, EVP_sha256()) > 0);
+    }
+    ~identity() {
+      X509_free(certificate);
+      EVP_PKEY_free(key);
+    }
+    //the certificate, the chain up to ca and the key, the way ssl_certificate_map wants them
+    void write(const std::string& path, const identity& ca) const {
+      FILE* out = fopen(path.c_str(), "w");
+      assert(out);
+      PEM_write_X509(out, certificate);
+      PEM_write_X509(out, ca.certificate);
+      PEM_write_PrivateKey(out, key, nullptr, nullptr, 0, nullptr, nullptr);
+      fclose(out);
+    }
+  };
+
+  //a good status for subject valid for an hour, signed by signer. delegates ship their certificate
+  std::string respond(const identity& subject, const identity& ca, const identity& signer, bool delegated) {
+    OCSP_CERTID* id = OCSP_cert_to_id(nullptr, subject.certificate, ca.certificate);
+    OCSP_BASICRESP* basic = OCSP_BASICRESP_new();
+    ASN1_TIME* now = X509_gmtime_adj(nullptr, -60);
+    ASN1_TIME* later = X509_gmtime_adj(nullptr, 3600);
+    assert(OCSP_basic_add1_status(basic, id, V_OCSP_CERTSTATUS_GOOD, 0, nullptr, now, later));
+    assert(OCSP_basic_sign(basic, signer.certificate, signer.key, EVP_sha256(), nullptr, delegated ? 0 : OCSP_NOCERTS) == 1);
+    OCSP_RESPONSE* response = OCSP_response_create(OCSP_RESPONSE_STATUS_SUCCESSFUL, basic);
+    unsigned char* der = nullptr;
+    int length = i2d_OCSP_RESPONSE(response, &der);
+    std::string out(reinterpret_cast<char*>(der), static_cast<size_t>(length));
+    OPENSSL_free(der);
+    OCSP_RESPONSE_free(response);
+    ASN1_TIME_free(now);
+    ASN1_TIME_free(later);
+    OCSP_BASICRESP_free(basic);
+    OCSP_CERTID_free(id);
+    return out;
+  }
+
+  void put(const std::string& path, const std::string& data) {
+    FILE* out = fopen(path.c_str(), "wb");
+    assert(out && fwrite(data.data(), 1, data.size(), out) == data.size());
+    fclose(out);
+  }
+
+  //a context of its own copy of the certificate, the way loading it from a file would
+  SSL_CTX* context(const identity& leaf, const identity& ca) {
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    X509* copy = X509_dup(leaf.certificate);
+    assert(SSL_CTX_use_certificate(ctx, copy) == 1 && SSL_CTX_use_PrivateKey(ctx, leaf.key) == 1);
+    X509_free(copy);
+    assert(SSL_CTX_add1_chain_cert(ctx, ca.certificate) == 1);
+    return ctx;
+  }
+
+  template<typename predicate_t>
+  bool eventually(predicate_t done) {
+    for(int i = 0; i < 300 && !done(); ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    return done();
+  }
+
+  //an in memory handshake asking for a staple, what the client got stapled
+  std::string handshake(SSL_CTX* server_context) {
+    SSL_CTX* client_context = SSL_CTX_new(TLS_client_method());
+    SSL* client = SSL_new(client_context);
+    SSL* server = SSL_new(server_context);
+    BIO* client_side = nullptr;
+    BIO* server_side = nullptr;
+    assert(BIO_new_bio_pair(&client_side, 0, &server_side, 0) == 1);
+    SSL_set_bio(client, client_side, client_side);
+    SSL_set_bio(server, server_side, server_side);
+    SSL_set_tlsext_status_type(client, TLSEXT_STATUSTYPE_ocsp);
+    SSL_set_connect_state(client);
+    SSL_set_accept_state(server);
+    int done = 0;
+    for(int i = 0; i < 100 && done != 2; ++i)
+      done = (SSL_do_handshake(client) == 1) + (SSL_do_handshake(server) == 1);
+    assert(done == 2);
+    const unsigned char* staple = nullptr;
+    long length = SSL_get_tlsext_status_ocsp_resp(client, &staple);
+    std::string out = length > 0 ? std::string(reinterpret_cast<const char*>(staple), static_cast<size_t>(length)) : "";
+    SSL_free(client);
+    SSL_free(server);
+    SSL_CTX_free(client_context);
+    return out;
+  }
+}
+
+int main() {
+  char directory[] = "/tmp/ocsptest-XXXXXX";
+  assert(mkdtemp(directory));
+  std::string dir = directory;
+  identity ca("ca", 1), stranger("stranger", 2);
+  identity direct("direct", 0x1001, &ca), delegated("delegated", 0x1002, &ca), forged("forged", 0x1003, &ca), misused("misused", 0x1004, &ca);
+  identity responder("responder", 0x2001, &ca, "OCSPSigning"), impostor("impostor", 0x2002, &stranger, "OCSPSigning");
+  identity plain("plain", 0x2003, &ca);
+
+  //signed by the issuer itself, by a delegated responder, by responders that aren't delegates
+  std::string by_issuer = respond(direct, ca, ca, false);
+  put(dir + "/1001.der", by_issuer);
+  std::string by_delegate = respond(delegated, ca, responder, true);
+  put(dir + "/1002.der", by_delegate);
+  put(dir + "/1003.der", respond(forged, ca, impostor, true));
+  //a certificate from the right ca without the ocsp signing purpose is no delegate either
+  put(dir + "/1004.der", respond(misused, ca, plain, true));
+
+  tls::stapler stapler(tls::tls_config_t{{"ssl_stapling_dir", dir}});
+  SSL_CTX* ctx_direct = context(direct, ca);
+  SSL_CTX* ctx_delegated = context(delegated, ca);
+  SSL_CTX* ctx_forged = context(forged, ca);
+  SSL_CTX* ctx_misused = context(misused, ca);
+  assert(stapler.add(ctx_direct) && stapler.add(ctx_delegated) && stapler.add(ctx_forged) && stapler.add(ctx_misused));
+  //adding a context twice changes nothing
+  assert(stapler.add(ctx_direct) && stapler.size() == 4);
+  assert(eventually([&] { return stapler.ready(ctx_direct) && stapler.ready(ctx_delegated); }));
+  assert(eventually([&] { return stapler.statistics().failures == 2; }));
+  assert(!stapler.ready(ctx_forged) && !stapler.ready(ctx_misused) && stapler.statistics().refreshed == 2);
+
+  //the handshake staples exactly the verified response, or nothing
+  assert(handshake(ctx_direct) == by_issuer && handshake(ctx_delegated) == by_delegate);
+  assert(handshake(ctx_forged).empty() && stapler.statistics().stapled == 2);
+
+  //no issuer in the chain is nothing to staple with
+  SSL_CTX* alone = SSL_CTX_new(TLS_server_method());
+  assert(SSL_CTX_use_certificate(alone, plain.certificate) == 1 && !stapler.add(alone));
+  SSL_CTX_free(alone);
+
+  //entries go with the last context holding their certificate
+  SSL_CTX_free(ctx_forged);
+  SSL_CTX_free(ctx_misused);
+  assert(stapler.size() == 2);
+  SSL_CTX_free(ctx_direct);
+  SSL_CTX_free(ctx_delegated);
+  assert(stapler.size() == 0);
+
+  //certificates the sni lru evicts stop being stapled for
+  direct.write(dir + "/direct.pem", ca);
+  delegated.write(dir + "/delegated.pem", ca);
+  put(dir + "/map", "direct.test direct.pem\ndelegated.test delegated.pem\n");
+  {
+    tls::certificates sni(tls::tls_config_t{{"ssl_certificate_map", dir + "/map"}, {"ssl_certificate_cache", "1"}},
+                          [&stapler](SSL_CTX* ctx) { stapler.add(ctx); });
+    SSL_CTX* first = sni.select("direct.test");
+    assert(eventually([&] { return stapler.ready(first); }) && handshake(first) == by_issuer);
+    SSL_CTX_free(first);
+    SSL_CTX* second = sni.select("delegated.test");
+    assert(sni.statistics().evictions == 1 && stapler.size() == 1);
+    assert(eventually([&] { return stapler.ready(second); }) && handshake(second) == by_delegate);
+    SSL_CTX_free(second);
+  }
+  assert(stapler.size() == 0);
+
+  auto refused = [](const tls::tls_config_t& bad) {
+    try {
+      tls::stapler broken(bad);
+    }
+    catch(const std::runtime_error&) {
+      return true;
+    }
+    return false;
+  };
+  assert(refused(tls::tls_config_t{{"ssl_stapling_refresh", "10"}}));
+  assert(refused(tls::tls_config_t{{"ssl_stapling_retry", "0"}}));
+  assert(refused(tls::tls_config_t{{"ssl_stapling_timeout_ms", "soon"}}));
+  for(const char* file : {"1001.der", "1002.der", "1003.der", "1004.der", "direct.pem", "delegated.pem", "map"})
+    unlink((dir + "/" + file).c_str());
+  rmdir(directory);
+  std::cout << "ocsp ok" << std::endl;
+  return 0;
+}
+#endif
@@ -0,0 +1,575 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __SESSION_CACHE_HPP__
+#define __SESSION_CACHE_HPP__
+
+#include "hashing/xxh64.hpp"
+
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <stdexcept>
+#include <unordered_map>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <openssl/ssl.h>
+
+namespace tls {
+    using tls_config_t = std::unordered_map<std::string, std::string>;
+
+    //server side tls sessions shared by every worker process through a named shared memory
+    //segment, so a client resuming on another worker than the one that did its handshake still
+    //resumes. the segment is an array of fixed size slots grouped in sets of WAYS, a session id
+    //hashes to one set and each set has its own process shared robust mutex. a full set evicts
+    //its least recently used slot, a worker dying with a set locked only costs that set
+    class session_cache {
+    public:
+        static constexpr uint32_t WAYS = 8;
+        static constexpr uint32_t MAGIC = 0x43485343;
+
+        session_cache() = delete;
+        explicit session_cache(const tls_config_t& config) :
+            name("/cheehttpd-sessions"), timeout(300), segment(nullptr), length(0), fd(-1), owner(getpid()) {
+            auto parse = [&config](const char* key, size_t& value) {
+                auto found = config.find(key);
+                if(found == config.end())
+                    return;
+                try {
+                    value = std::stoul(found->second);
+                }
+                catch(...) {
+                    throw std::runtime_error(found->second + " is not a valid " + key);
+                }
+            };
+            size_t slots = 65536, slot_size = 1024, seconds = 300;
+            parse("ssl_session_cache_slots", slots);
+            parse("ssl_session_cache_slot_size", slot_size);
+            parse("ssl_session_timeout", seconds);
+            auto found = config.find("ssl_session_cache_name");
+            if(found != config.end())
+                name = found->second;
+            if(name.size() < 2 || name[0] != '/' || name.find('/', 1) != std::string::npos)
+                throw std::runtime_error(name + " is not a valid ssl_session_cache_name, expected /name");
+            if(slot_size < sizeof(slot) + 64 || slot_size % 8)
+                throw std::runtime_error("ssl_session_cache_slot_size must be a multiple of 8 and above " + std::to_string(sizeof(slot) + 64));
+            timeout = static_cast<long>(seconds);
+            uint32_t sets = static_cast<uint32_t>(std::max<size_t>(1, (slots + WAYS - 1) / WAYS));
+            open_segment(sets, static_cast<uint32_t>(slot_size));
+        }
+        //the last process to let go removes the name, it alone gets the lock exclusively. workers
+        //forked after construction share the lock of the process that built the cache and leave
+        //the name to it
+        ~session_cache() {
+            if(owner == getpid() && lock(F_WRLCK, false) && named()) {
+                header()->magic.store(0, std::memory_order_release);
+                shm_unlink(name.c_str());
+            }
+            release();
+        }
+        session_cache(const session_cache&) = delete;
+        session_cache& operator=(const session_cache&) = delete;
+
+        //drops the segment name, processes that have it mapped keep using it
+        static void remove(const std::string& name) {
+            shm_unlink(name.c_str());
+        }
+
+        //copies a serialized session in, false if it does not fit a slot
+        bool store(const unsigned char* id, size_t id_length, const unsigned char* data, size_t size, time_t expires) {
+            if(id_length == 0 || id_length > sizeof(slot::id) || size > capacity())
+                return false;
+            uint64_t hash = hashing::xxh64::hash(id, id_length);
+            set_lock guard(*this, hash);
+            time_t now = time(nullptr);
+            //the same id is overwritten, otherwise an empty or expired way, otherwise the oldest
+            slot* victim = find(guard.set, hash, id, id_length);
+            if(!victim) {
+                for(uint32_t w = 0; w < WAYS; ++w) {
+                    slot* s = way(guard.set, w);
+                    if(!s->used || s->expires <= now) {
+                        victim = s;
+                        break;
+                    }
+                    if(!victim || s->last_used < victim->last_used)
+                        victim = s;
+                }
+                if(victim->used && victim->expires > now)
+                    header()->evictions.fetch_add(1, std::memory_order_relaxed);
+            }
+            victim->used = 1;
+            victim->hash = hash;
+            victim->id_length = static_cast<uint8_t>(id_length);
+            memcpy(victim->id, id, id_length);
+            victim->size = static_cast<uint32_t>(size);
+            victim->expires = expires;
+            victim->last_used = tick();
+            memcpy(victim->data(), data, size);
+            header()->stores.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        //copies the session with this id out, false if absent or expired
+        bool fetch(const unsigned char* id, size_t id_length, std::string& out) {
+            if(id_length == 0 || id_length > sizeof(slot::id))
+                return miss();
+            uint64_t hash = hashing::xxh64::hash(id, id_length);
+            set_lock guard(*this, hash);
+            slot* s = find(guard.set, hash, id, id_length);
+            if(!s)
+                return miss();
+            if(s->expires <= time(nullptr)) {
+                s->used = 0;
+                return miss();
+            }
+            s->last_used = tick();
+            out.assign(reinterpret_cast<const char*>(s->data()), s->size);
+            header()->hits.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        void erase(const unsigned char* id, size_t id_length) {
+            if(id_length == 0 || id_length > sizeof(slot::id))
+                return;
+            uint64_t hash = hashing::xxh64::hash(id, id_length);
+            set_lock guard(*this, hash);
+            slot* s = find(guard.set, hash, id, id_length);
+            if(s)
+                s->used = 0;
+        }
+
+        //routes the sessions of ctx through this cache. tickets are turned off since their keys
+        //are per process, tls 1.3 then resumes through session ids that land here as well
+        void attach(SSL_CTX* ctx) {
+            SSL_CTX_set_ex_data(ctx, index(), this);
+            SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+            SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+            SSL_CTX_set_timeout(ctx, timeout);
+            static const unsigned char context[] = "cheehttpd";
+            SSL_CTX_set_session_id_context(ctx, context, sizeof(context) - 1);
+            SSL_CTX_sess_set_new_cb(ctx, &session_cache::on_new);
+            SSL_CTX_sess_set_get_cb(ctx, &session_cache::on_get);
+            SSL_CTX_sess_set_remove_cb(ctx, &session_cache::on_remove);
+        }
+
+        //largest serialized session a slot takes
+        size_t capacity() const {
+            return header()->slot_size - sizeof(slot);
+        }
+
+        //counters summed over every process using the segment
+        uint64_t hits() const {
+            return header()->hits.load(std::memory_order_relaxed);
+        }
+        uint64_t misses() const {
+            return header()->misses.load(std::memory_order_relaxed);
+        }
+        uint64_t stores() const {
+            return header()->stores.load(std::memory_order_relaxed);
+        }
+        uint64_t evictions() const {
+            return header()->evictions.load(std::memory_order_relaxed);
+        }
+
+    protected:
+        struct layout {
+            std::atomic<uint32_t> magic;
+            uint32_t sets;
+            uint32_t slot_size;
+            std::atomic<uint64_t> clock;
+            std::atomic<uint64_t> hits;
+            std::atomic<uint64_t> misses;
+            std::atomic<uint64_t> stores;
+            std::atomic<uint64_t> evictions;
+        };
+        struct slot {
+            uint64_t hash;
+            uint64_t last_used;
+            int64_t expires;
+            uint32_t size;
+            uint8_t used;
+            uint8_t id_length;
+            uint8_t id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+            uint8_t padding[6];
+            unsigned char* data() {
+                return reinterpret_cast<unsigned char*>(this + 1);
+            }
+        };
+
+        //locks the set a hash maps to, recovering it if the previous owner died holding it
+        struct set_lock {
+            set_lock(session_cache& cache, uint64_t hash) : cache(cache), set(static_cast<uint32_t>(hash % cache.header()->sets)) {
+                pthread_mutex_t* m = cache.mutex(set);
+                if(pthread_mutex_lock(m) == EOWNERDEAD) {
+                    for(uint32_t w = 0; w < WAYS; ++w)
+                        cache.way(set, w)->used = 0;
+                    pthread_mutex_consistent(m);
+                }
+            }
+            ~set_lock() {
+                pthread_mutex_unlock(cache.mutex(set));
+            }
+            session_cache& cache;
+            uint32_t set;
+        };
+
+        layout* header() const {
+            return static_cast<layout*>(segment);
+        }
+        size_t locks_offset() const {
+            return (sizeof(layout) + 63) & ~size_t(63);
+        }
+        size_t slots_offset(uint32_t sets) const {
+            return (locks_offset() + sets * sizeof(pthread_mutex_t) + 63) & ~size_t(63);
+        }
+        pthread_mutex_t* mutex(uint32_t set) const {
+            return reinterpret_cast<pthread_mutex_t*>(static_cast<char*>(segment) + locks_offset()) + set;
+        }
+        slot* way(uint32_t set, uint32_t w) const {
+            size_t index = size_t(set) * WAYS + w;
+            return reinterpret_cast<slot*>(static_cast<char*>(segment) + slots_offset(header()->sets) + index * header()->slot_size);
+        }
+        slot* find(uint32_t set, uint64_t hash, const unsigned char* id, size_t id_length) const {
+            for(uint32_t w = 0; w < WAYS; ++w) {
+                slot* s = way(set, w);
+                if(s->used && s->hash == hash && s->id_length == id_length && !memcmp(s->id, id, id_length))
+                    return s;
+            }
+            return nullptr;
+        }
+        uint64_t tick() {
+            return header()->clock.fetch_add(1, std::memory_order_relaxed);
+        }
+        bool miss() {
+            header()->misses.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        //creates the segment, or attaches to the one another worker already created. every user
+        //holds a shared lock on it for its lifetime, the creator holds it exclusively until the
+        //segment is initialized so attachers block on it rather than poll
+        void open_segment(uint32_t sets, uint32_t slot_size) {
+            ino_t half_made = 0;
+            for(int attempt = 0; attempt < 100; ++attempt) {
+                if(create(sets, slot_size) || attach(sets, slot_size, half_made))
+                    return;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            throw std::runtime_error("Couldn't open session cache " + name + ": it keeps being removed under us");
+        }
+
+        bool create(uint32_t sets, uint32_t slot_size) {
+            length = slots_offset(sets) + size_t(sets) * WAYS * slot_size;
+            fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+            if(fd < 0 && errno == EEXIST)
+                return false;
+            if(fd < 0)
+                throw std::runtime_error("Couldn't open session cache " + name + ": " + strerror(errno));
+            if(!lock(F_WRLCK, true) || ftruncate(fd, static_cast<off_t>(length)) != 0 ||
+               (segment = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+                std::string reason = strerror(errno);
+                segment = nullptr;
+                shm_unlink(name.c_str());
+                release();
+                throw std::runtime_error("Couldn't create session cache " + name + ": " + reason);
+            }
+            initialize(sets, slot_size);
+            lock(F_RDLCK, true);
+            return true;
+        }
+
+        //false when the segment found has no magic and the name should be tried again
+        bool attach(uint32_t sets, uint32_t slot_size, ino_t& half_made) {
+            fd = shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0600);
+            if(fd < 0 && errno == ENOENT)
+                return false;
+            if(fd < 0)
+                throw std::runtime_error("Couldn't open session cache " + name + ": " + strerror(errno));
+            struct stat st{};
+            if(!lock(F_RDLCK, true) || fstat(fd, &st) != 0) {
+                std::string reason = strerror(errno);
+                release();
+                throw std::runtime_error("Couldn't lock session cache " + name + ": " + reason);
+            }
+            length = static_cast<size_t>(st.st_size);
+            if(length >= sizeof(layout)) {
+                segment = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if(segment == MAP_FAILED) {
+                    std::string reason = strerror(errno);
+                    segment = nullptr;
+                    release();
+                    throw std::runtime_error("Couldn't map session cache " + name + ": " + reason);
+                }
+                if(header()->magic.load(std::memory_order_acquire) == MAGIC) {
+                    //whoever created it decides the geometry, a different configuration is a mistake
+                    if(header()->sets == sets && header()->slot_size == slot_size && length >= slots_offset(sets) + size_t(sets) * WAYS * slot_size)
+                        return true;
+                    release();
+                    throw std::runtime_error("Session cache " + name + " exists with another layout, remove it or change ssl_session_cache_name");
+                }
+            }
+            //no magic under the shared lock means nobody is initializing it: the last user retired
+            //it, or its creator died half way. a creator that has yet to take its lock looks the
+            //same for a few microseconds, so only a segment found half made twice is removed
+            if(half_made == st.st_ino && named())
+                shm_unlink(name.c_str());
+            half_made = st.st_ino;
+            release();
+            return false;
+        }
+
+        bool lock(short type, bool wait) {
+            struct flock range{};
+            range.l_type = type;
+            range.l_whence = SEEK_SET;
+            //open file description locks, so two caches in one process don't share theirs
+            int result;
+            do
+                result = fcntl(fd, wait ? F_OFD_SETLKW : F_OFD_SETLK, &range);
+            while(result != 0 && errno == EINTR);
+            return result == 0;
+        }
+
+        //whether the name still refers to the segment we have open
+        bool named() const {
+            struct stat ours{}, linked{};
+            return fstat(fd, &ours) == 0 && stat(("/dev/shm" + name).c_str(), &linked) == 0 &&
+                   ours.st_ino == linked.st_ino && ours.st_dev == linked.st_dev;
+        }
+
+        void release() {
+            if(segment)
+                munmap(segment, length);
+            segment = nullptr;
+            if(fd >= 0)
+                close(fd);
+            fd = -1;
+        }
+
+        void initialize(uint32_t sets, uint32_t slot_size) {
+            layout* h = header();
+            h->sets = sets;
+            h->slot_size = slot_size;
+            pthread_mutexattr_t attributes;
+            pthread_mutexattr_init(&attributes);
+            pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+            pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+            for(uint32_t s = 0; s < sets; ++s)
+                pthread_mutex_init(mutex(s), &attributes);
+            pthread_mutexattr_destroy(&attributes);
+            //the slots are already zero, fresh shared memory always is
+            h->magic.store(MAGIC, std::memory_order_release);
+        }
+
+        static int index() {
+            static int slot = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+            return slot;
+        }
+        static session_cache* of(SSL* ssl) {
+            return static_cast<session_cache*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), index()));
+        }
+
+        //returns 0, openssl keeps its reference since we only keep a copy
+        static int on_new(SSL* ssl, SSL_SESSION* session) {
+            session_cache* cache = of(ssl);
+            unsigned int id_length = 0;
+            const unsigned char* id = SSL_SESSION_get_id(session, &id_length);
+            int size = i2d_SSL_SESSION(session, nullptr);
+            if(!cache || size <= 0 || static_cast<size_t>(size) > cache->capacity())
+                return 0;
+            std::string buffer(static_cast<size_t>(size), '\0');
+            unsigned char* at = reinterpret_cast<unsigned char*>(&buffer.front());
+            i2d_SSL_SESSION(session, &at);
+            time_t expires = static_cast<time_t>(SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session));
+            cache->store(id, id_length, reinterpret_cast<const unsigned char*>(buffer.data()), buffer.size(), expires);
+            return 0;
+        }
+
+        static SSL_SESSION* on_get(SSL* ssl, const unsigned char* id, int id_length, int* copy) {
+            *copy = 0;
+            session_cache* cache = of(ssl);
+            std::string data;
+            if(!cache || id_length <= 0 || !cache->fetch(id, static_cast<size_t>(id_length), data))
+                return nullptr;
+            const unsigned char* at = reinterpret_cast<const unsigned char*>(data.data());
+            return d2i_SSL_SESSION(nullptr, &at, static_cast<long>(data.size()));
+        }
+
+        static void on_remove(SSL_CTX* ctx, SSL_SESSION* session) {
+            auto* cache = static_cast<session_cache*>(SSL_CTX_get_ex_data(ctx, index()));
+            unsigned int id_length = 0;
+            const unsigned char* id = SSL_SESSION_get_id(session, &id_length);
+            if(cache)
+                cache->erase(id, id_length);
+        }
+
+        std::string name;
+        long timeout;
+        void* segment;
+        size_t length;
+        int fd;
+        pid_t owner;
+    };
+}
+
+#endif //__SESSION_CACHE_HPP__
+
+#ifdef TEST_SESSION_CACHE
+//g++ -std=c++17 -O2 -DTEST_SESSION_CACHE -Iinclude -x c++ include/tls/session_cache.hpp -o sessioncachetest -lssl -lcrypto -pthread
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <sys/wait.h>
+
+//takes a set lock and dies with it held
+struct dying_worker : tls::session_cache {
+  using tls::session_cache::session_cache;
+  void die_holding(const std::string& id) {
+    set_lock guard(*this, hashing::xxh64::hash(id.data(), id.size()));
+    _exit(0);
+  }
+};
+
+static const unsigned char* bytes(const std::string& s) {
+  return reinterpret_cast<const unsigned char*>(s.data());
+}
+
+static bool put(tls::session_cache& cache, const std::string& id, const std::string& data, time_t expires = time(nullptr) + 60) {
+  return cache.store(bytes(id), id.size(), bytes(data), data.size(), expires);
+}
+
+static std::string get(tls::session_cache& cache, const std::string& id) {
+  std::string out;
+  return cache.fetch(bytes(id), id.size(), out) ? out : "";
+}
+
+static bool linked(const std::string& name) {
+  int fd = shm_open(name.c_str(), O_RDWR, 0600);
+  if(fd >= 0)
+    close(fd);
+  return fd >= 0;
+}
+
+//runs body in a child, true if it exited cleanly
+template<typename body_t>
+static pid_t spawn(body_t body) {
+  pid_t pid = fork();
+  if(pid == 0) {
+    body();
+    _exit(0);
+  }
+  return pid;
+}
+
+static bool reap(pid_t pid) {
+  int status = 0;
+  return waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main() {
+  std::string name = "/cheehttpd-test-" + std::to_string(getpid());
+  tls::tls_config_t config{{"ssl_session_cache_name", name}, {"ssl_session_cache_slots", "64"}};
+  tls::session_cache::remove(name);
+
+  //two workers that each open the cache see each other's sessions, the last one out removes it
+  int first[2], second[2];
+  assert(pipe(first) == 0 && pipe(second) == 0);
+  char go = 0;
+  pid_t a = spawn([&] {
+    tls::session_cache cache(config);
+    if(!put(cache, "session-a", "alpha") || write(first[1], "x", 1) != 1 || read(second[0], &go, 1) != 1)
+      _exit(1);
+    if(get(cache, "session-b") != "beta" || cache.stores() != 2)
+      _exit(2);
+  });
+  pid_t b = spawn([&] {
+    if(read(first[0], &go, 1) != 1)
+      _exit(1);
+    tls::session_cache cache(config);
+    if(get(cache, "session-a") != "alpha" || !put(cache, "session-b", "beta") || cache.hits() != 1)
+      _exit(2);
+    //a is still attached, b leaving must not take the name with it
+    if(write(second[1], "x", 1) != 1)
+      _exit(3);
+  });
+  assert(reap(a) && reap(b));
+  assert(!linked(name));
+
+  //workers forked from the process that built the cache leave the name to it
+  {
+    auto cache = std::make_unique<tls::session_cache>(config);
+    pid_t workers[2];
+    for(int w = 0; w < 2; ++w)
+      workers[w] = spawn([&cache, w] {
+        if(!put(*cache, "worker-" + std::to_string(w), "data"))
+          _exit(1);
+        cache.reset();
+      });
+    assert(reap(workers[0]) && reap(workers[1]));
+    assert(linked(name) && cache->stores() == 2 && get(*cache, "worker-1") == "data");
+    //a second cache in the same process keeps it alive as well
+    auto another = std::make_unique<tls::session_cache>(config);
+    cache.reset();
+    assert(linked(name) && get(*another, "worker-0") == "data");
+    another.reset();
+    assert(!linked(name));
+  }
+
+  //a segment whose creator died before initializing it, sized or not, is replaced
+  for(off_t size : {off_t(0), off_t(1 << 20)}) {
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    assert(fd >= 0 && ftruncate(fd, size) == 0);
+    close(fd);
+    tls::session_cache cache(config);
+    assert(put(cache, "fresh", "start") && get(cache, "fresh") == "start" && cache.stores() == 1);
+  }
+  assert(!linked(name));
+
+  //a different geometry under the same name is refused without disturbing the first
+  {
+    tls::session_cache cache(config);
+    bool refused = false;
+    try {
+      tls::session_cache other(tls::tls_config_t{{"ssl_session_cache_name", name}, {"ssl_session_cache_slots", "128"}});
+    }
+    catch(const std::runtime_error&) {
+      refused = true;
+    }
+    assert(refused && linked(name));
+    assert(put(cache, "still", "works") && get(cache, "still") == "works");
+  }
+  assert(!linked(name));
+
+  //a worker dying with a set locked costs that set its sessions, not the cache
+  {
+    dying_worker cache(tls::tls_config_t{{"ssl_session_cache_name", name}, {"ssl_session_cache_slots", "8"}});
+    assert(put(cache, "before", "lost"));
+    assert(reap(spawn([&] { cache.die_holding("before"); })));
+    assert(get(cache, "before").empty());
+    assert(put(cache, "after", "kept") && get(cache, "after") == "kept");
+  }
+
+  //one set of eight ways evicts its least recently used session, expired ones are misses
+  {
+    tls::session_cache cache(tls::tls_config_t{{"ssl_session_cache_name", name}, {"ssl_session_cache_slots", "8"}});
+    for(int i = 0; i < 8; ++i)
+      assert(put(cache, "id-" + std::to_string(i), "v" + std::to_string(i)));
+    assert(get(cache, "id-0") == "v0");
+    assert(put(cache, "id-8", "v8") && cache.evictions() == 1);
+    assert(get(cache, "id-1").empty() && get(cache, "id-0") == "v0" && get(cache, "id-8") == "v8");
+    assert(put(cache, "old", "gone", time(nullptr) - 1) && get(cache, "old").empty());
+    assert(!put(cache, "big", std::string(cache.capacity() + 1, 'x')));
+  }
+  assert(!linked(name));
+  std::cout << "session cache ok" << std::endl;
+  return 0;
+}
+#endif
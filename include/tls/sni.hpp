@@ -0,0 +1,565 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __SNI_HPP__
+#define __SNI_HPP__
+
+#include "hashing/xxh64.hpp"
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <functional>
+#include <unordered_map>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+namespace tls {
+    using tls_config_t = std::unordered_map<std::string, std::string>;
+
+    //the most recent openssl error as text
+    inline std::string last_error() {
+        char text[256] = "unknown tls error";
+        unsigned long code = ERR_get_error();
+        if(code)
+            ERR_error_string_n(code, text, sizeof(text));
+        ERR_clear_error();
+        return text;
+    }
+
+    //host names to certificate entries, built once from the certificate map. exact names and
+    //wildcards share one open addressing table, a wildcard '*.example.com' is stored under
+    //'.example.com' so looking up the parent of a name needs no copy. a wildcard covers exactly
+    //one label as rfc 6125 says, 'a.b.example.com' does not match '*.example.com'
+    class name_table {
+    public:
+        static constexpr uint32_t NONE = UINT32_MAX;
+
+        //name is lowercase, '*.' wildcards allowed
+        void add(const std::string& name, uint32_t entry) {
+            keys.push_back(std::make_pair(name.compare(0, 2, "*.") == 0 ? name.substr(1) : name, entry));
+        }
+
+        //lays the names out in the table, later duplicates lose to the first one
+        void build() {
+            size_t size = 16;
+            while(size < keys.size() * 2)
+                size <<= 1;
+            buckets.assign(size, bucket{0, 0, 0, NONE});
+            names.clear();
+            for(auto& k : keys) {
+                uint64_t hash = hashing::xxh64::hash(k.first.data(), k.first.size());
+                size_t at = hash & (size - 1);
+                bool duplicate = false;
+                for(; buckets[at].entry != NONE; at = (at + 1) & (size - 1)) {
+                    if(matches(buckets[at], hash, k.first.data(), k.first.size())) {
+                        duplicate = true;
+                        break;
+                    }
+                }
+                if(duplicate)
+                    continue;
+                buckets[at] = bucket{hash, static_cast<uint32_t>(names.size()), static_cast<uint32_t>(k.first.size()), k.second};
+                names.append(k.first);
+            }
+            keys.clear();
+            keys.shrink_to_fit();
+        }
+
+        //the entry for a lowercase host name, the exact name first and then its wildcard
+        uint32_t find(const char* name, size_t length) const {
+            //wildcards are keyed by their leading dot, no host name starts with one
+            if(length == 0 || name[0] == '.')
+                return NONE;
+            uint32_t exact = probe(name, length);
+            if(exact != NONE)
+                return exact;
+            const char* dot = static_cast<const char*>(memchr(name, '.', length));
+            if(!dot || dot == name)
+                return NONE;
+            return probe(dot, length - static_cast<size_t>(dot - name));
+        }
+
+    protected:
+        struct bucket {
+            uint64_t hash;
+            uint32_t name;
+            uint32_t length;
+            uint32_t entry;
+        };
+
+        bool matches(const bucket& b, uint64_t hash, const char* name, size_t length) const {
+            return b.hash == hash && b.length == length && !memcmp(names.data() + b.name, name, length);
+        }
+
+        uint32_t probe(const char* name, size_t length) const {
+            if(buckets.empty())
+                return NONE;
+            uint64_t hash = hashing::xxh64::hash(name, length);
+            size_t mask = buckets.size() - 1;
+            for(size_t at = hash & mask; buckets[at].entry != NONE; at = (at + 1) & mask)
+                if(matches(buckets[at], hash, name, length))
+                    return buckets[at].entry;
+            return NONE;
+        }
+
+        std::vector<std::pair<std::string, uint32_t> > keys;
+        std::vector<bucket> buckets;
+        std::string names;
+    };
+
+    struct sni_stats {
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> loads{0};
+        std::atomic<uint64_t> evictions{0};
+        std::atomic<uint64_t> unknown{0};
+        std::atomic<uint64_t> failures{0};
+        std::atomic<uint64_t> refused{0};
+    };
+
+    //picks the server certificate by the name the client sent. startup only reads the
+    //certificate map, a certificate and its key are loaded into their own SSL_CTX the first
+    //time a handshake asks for one of its names and kept in an lru of ssl_certificate_cache
+    //contexts. a context evicted while handshakes still use it lives on through their
+    //references. names not in the map get the default certificate, or the handshake fails
+    //when there is none. a certificate that fails to load is not retried for
+    //ssl_certificate_retry seconds, handshakes for it fail from memory meanwhile
+    class certificates {
+    public:
+        //applied to every context this creates, the place for protocols, alpn and the session cache
+        using configure_callback = std::function<void(SSL_CTX*)>;
+
+        certificates() = delete;
+        explicit certificates(const tls_config_t& config, configure_callback configure = nullptr) :
+            configure(std::move(configure)), capacity(1000), retry(60), base(nullptr), has_default(false) {
+            auto parse = [&config](const char* key, size_t& value) {
+                auto found = config.find(key);
+                if(found == config.end())
+                    return;
+                try {
+                    value = std::stoul(found->second);
+                }
+                catch(...) {
+                    throw std::runtime_error(found->second + " is not a valid " + key);
+                }
+            };
+            parse("ssl_certificate_cache", capacity);
+            if(capacity == 0)
+                throw std::runtime_error("ssl_certificate_cache must be positive");
+            size_t seconds = 60;
+            parse("ssl_certificate_retry", seconds);
+            retry = std::chrono::seconds(seconds);
+            auto map = config.find("ssl_certificate_map");
+            if(map != config.end())
+                load_map(map->second);
+
+            //the default certificate is the one thing loaded up front
+            base = SSL_CTX_new(TLS_server_method());
+            if(!base)
+                throw std::runtime_error("Couldn't create tls context: " + last_error());
+            auto certificate = config.find("ssl_certificate");
+            if(certificate != config.end()) {
+                auto key = config.find("ssl_certificate_key");
+                std::string reason;
+                if(!use(base, certificate->second, key == config.end() ? certificate->second : key->second, reason)) {
+                    SSL_CTX_free(base);
+                    throw std::runtime_error(reason);
+                }
+                has_default = true;
+            }
+            try {
+                if(this->configure)
+                    this->configure(base);
+            }
+            catch(...) {
+                SSL_CTX_free(base);
+                throw;
+            }
+            SSL_CTX_set_tlsext_servername_callback(base, &certificates::on_servername);
+            SSL_CTX_set_tlsext_servername_arg(base, this);
+        }
+        ~certificates() {
+            for(auto& c : recent)
+                SSL_CTX_free(c.second);
+            SSL_CTX_free(base);
+        }
+        certificates(const certificates&) = delete;
+        certificates& operator=(const certificates&) = delete;
+
+        //the context listeners create their SSL objects from
+        SSL_CTX* context() const {
+            return base;
+        }
+
+        //the context for a host name, loading it if needed. nullptr for names the map does not
+        //cover, and throws when the certificate files are unusable. the caller owns a reference
+        SSL_CTX* select(const std::string& host) {
+            std::string name = lower(host);
+            uint32_t entry = table.find(name.data(), name.size());
+            if(entry == name_table::NONE) {
+                ++stats.unknown;
+                return nullptr;
+            }
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                auto found = index.find(entry);
+                if(found != index.end()) {
+                    recent.splice(recent.begin(), recent, found->second);
+                    SSL_CTX_up_ref(found->second->second);
+                    ++stats.hits;
+                    return found->second->second;
+                }
+                auto failed = broken.find(entry);
+                if(failed != broken.end()) {
+                    if(std::chrono::steady_clock::now() < failed->second.until) {
+                        ++stats.refused;
+                        throw std::runtime_error(failed->second.reason);
+                    }
+                    broken.erase(failed);
+                }
+            }
+            //the files are read without the lock, two handshakes racing for the same cold
+            //certificate both load it and the second one's copy is dropped
+            SSL_CTX* loaded;
+            try {
+                loaded = load(entry);
+            }
+            catch(const std::exception& e) {
+                std::lock_guard<std::mutex> guard(lock);
+                broken[entry] = failure{std::chrono::steady_clock::now() + retry, e.what()};
+                throw;
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            auto found = index.find(entry);
+            if(found != index.end()) {
+                SSL_CTX_free(loaded);
+                recent.splice(recent.begin(), recent, found->second);
+                SSL_CTX_up_ref(found->second->second);
+                return found->second->second;
+            }
+            recent.emplace_front(entry, loaded);
+            index[entry] = recent.begin();
+            while(recent.size() > capacity) {
+                index.erase(recent.back().first);
+                SSL_CTX_free(recent.back().second);
+                recent.pop_back();
+                ++stats.evictions;
+            }
+            SSL_CTX_up_ref(loaded);
+            return loaded;
+        }
+
+        //distinct certificate files in the map and how many are loaded right now
+        size_t entries() const {
+            return files.size();
+        }
+        size_t loaded() {
+            std::lock_guard<std::mutex> guard(lock);
+            return recent.size();
+        }
+        const sni_stats& statistics() const {
+            return stats;
+        }
+
+    protected:
+        struct files_t {
+            std::string certificate;
+            std::string key;
+        };
+        struct failure {
+            std::chrono::steady_clock::time_point until;
+            std::string reason;
+        };
+
+        static std::string lower(std::string name) {
+            for(auto& c : name)
+                c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+            //a trailing dot names the same host
+            if(!name.empty() && name.back() == '.')
+                name.pop_back();
+            return name;
+        }
+
+        //one certificate per line, 'names certificate [key]' where names is a comma list of
+        //host names and '*.domain' wildcards. relative paths are relative to the map file, the
+        //key defaults to the certificate file for pems holding both
+        void load_map(const std::string& path) {
+            std::ifstream file(path);
+            if(!file)
+                throw std::runtime_error("Couldn't open ssl_certificate_map " + path);
+            std::string directory = path.find('/') == std::string::npos ? "" : path.substr(0, path.rfind('/') + 1);
+            auto resolve = [&directory](const std::string& name) {
+                return name.empty() || name[0] == '/' ? name : directory + name;
+            };
+            std::unordered_map<std::string, uint32_t> seen;
+            std::string line;
+            size_t number = 0;
+            while(std::getline(file, line)) {
+                ++number;
+                line = line.substr(0, line.find('#'));
+                std::istringstream fields(line);
+                std::string names, certificate, key;
+                if(!(fields >> names))
+                    continue;
+                if(!(fields >> certificate))
+                    throw std::runtime_error(path + ":" + std::to_string(number) + " has no certificate for " + names);
+                if(!(fields >> key))
+                    key = certificate;
+                certificate = resolve(certificate);
+                key = resolve(key);
+                //names sharing the same files share the loaded context as well
+                auto known = seen.emplace(certificate + '\n' + key, static_cast<uint32_t>(files.size()));
+                if(known.second)
+                    files.push_back(files_t{certificate, key});
+                size_t start = 0;
+                while(start < names.size()) {
+                    size_t comma = names.find(',', start);
+                    std::string name = lower(names.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+                    if(name.empty() || name == "*." || name.find('*', name.compare(0, 2, "*.") == 0 ? 1 : 0) != std::string::npos)
+                        throw std::runtime_error(path + ":" + std::to_string(number) + " has an invalid name in " + names);
+                    table.add(name, known.first->second);
+                    start = comma == std::string::npos ? names.size() : comma + 1;
+                }
+            }
+            table.build();
+        }
+
+        static bool use(SSL_CTX* ctx, const std::string& certificate, const std::string& key, std::string& reason) {
+            if(SSL_CTX_use_certificate_chain_file(ctx, certificate.c_str()) != 1) {
+                reason = "Couldn't load certificate " + certificate + ": " + last_error();
+                return false;
+            }
+            if(SSL_CTX_use_PrivateKey_file(ctx, key.c_str(), SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(ctx) != 1) {
+                reason = "Couldn't load key " + key + " for " + certificate + ": " + last_error();
+                return false;
+            }
+            return true;
+        }
+
+        SSL_CTX* load(uint32_t entry) {
+            SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+            if(!ctx)
+                throw std::runtime_error("Couldn't create tls context: " + last_error());
+            std::string reason;
+            if(!use(ctx, files[entry].certificate, files[entry].key, reason)) {
+                SSL_CTX_free(ctx);
+                ++stats.failures;
+                throw std::runtime_error(reason);
+            }
+            try {
+                if(configure)
+                    configure(ctx);
+            }
+            catch(...) {
+                SSL_CTX_free(ctx);
+                throw;
+            }
+            ++stats.loads;
+            return ctx;
+        }
+
+        //runs inside the handshake right after the client hello was parsed. switching the
+        //context swaps the certificate and key, session resumption stays with the base context
+        static int on_servername(SSL* ssl, int* alert, void* arg) {
+            auto* self = static_cast<certificates*>(arg);
+            const char* name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+            SSL_CTX* chosen = nullptr;
+            if(name) {
+                try {
+                    chosen = self->select(name);
+                }
+                catch(const std::exception&) {
+                    *alert = SSL_AD_INTERNAL_ERROR;
+                    return SSL_TLSEXT_ERR_ALERT_FATAL;
+                }
+            }
+            if(chosen) {
+                SSL_set_SSL_CTX(ssl, chosen);
+                SSL_CTX_free(chosen);
+                return SSL_TLSEXT_ERR_OK;
+            }
+            if(self->has_default)
+                return SSL_TLSEXT_ERR_OK;
+            *alert = SSL_AD_UNRECOGNIZED_NAME;
+            return SSL_TLSEXT_ERR_ALERT_FATAL;
+        }
+
+        configure_callback configure;
+        size_t capacity;
+        std::chrono::steady_clock::duration retry;
+        SSL_CTX* base;
+        bool has_default;
+        name_table table;
+        std::vector<files_t> files;
+        std::mutex lock;
+        std::list<std::pair<uint32_t, SSL_CTX*> > recent;
+        std::unordered_map<uint32_t, std::list<std::pair<uint32_t, SSL_CTX*> >::iterator> index;
+        std::unordered_map<uint32_t, failure> broken;
+        sni_stats stats;
+    };
+}
+
+#endif //__SNI_HPP__
+
+#ifdef TEST_SNI
+//g++ -std=c++17 -O2 -DTEST_SNI -Iinclude -x c++ include/tls/sni.hpp -o snitest -lssl -lcrypto
+#include <cassert>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+//a throwaway self signed certificate and its key in one pem
+static void write_pem(const std::string& path, const std::string& common_name) {
+  EVP_PKEY* key = EVP_EC_gen("P-256");
+  X509* certificate = X509_new();
+  X509_set_version(certificate, 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+  X509_gmtime_adj(X509_getm_notBefore(certificate), -60);
+  X509_gmtime_adj(X509_getm_notAfter(certificate), 3600);
+  X509_set_pubkey(certificate, key);
+  X509_NAME* name = X509_get_subject_name(certificate);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>(common_name.c_str()), -1, -1, 0);
+  X509_set_issuer_name(certificate, name);
+  assert(X509_sign(certificate, key, EVP_sha256()) > 0);
+  FILE* out = fopen(path.c_str(), "w");
+  assert(out);
+  PEM_write_X509(out, certificate);
+  PEM_write_PrivateKey(out, key, nullptr, nullptr, 0, nullptr, nullptr);
+  fclose(out);
+  X509_free(certificate);
+  EVP_PKEY_free(key);
+}
+
+//the common name of the certificate a context serves, then drops the caller's reference
+static std::string served(SSL_CTX* ctx) {
+  assert(ctx);
+  char text[256] = "";
+  X509_NAME_get_text_by_NID(X509_get_subject_name(SSL_CTX_get0_certificate(ctx)), NID_commonName, text, sizeof(text));
+  SSL_CTX_free(ctx);
+  return text;
+}
+
+static bool fails(tls::certificates& c, const std::string& host) {
+  try {
+    c.select(host);
+  }
+  catch(const std::runtime_error&) {
+    return true;
+  }
+  return false;
+}
+
+int main() {
+  //exact names before wildcards, a wildcard covers one label, the first of duplicates wins
+  tls::name_table table;
+  table.add("www.example.com", 0);
+  table.add("*.example.com", 1);
+  table.add("example.com", 2);
+  table.add("*.example.com", 3);
+  table.add("www.example.com", 4);
+  for(uint32_t i = 0; i < 200; ++i)
+    table.add("host" + std::to_string(i) + ".test", 10 + i);
+  table.build();
+  auto find = [&table](const std::string& name) {
+    return table.find(name.data(), name.size());
+  };
+  assert(find("www.example.com") == 0 && find("mail.example.com") == 1 && find("example.com") == 2);
+  assert(find("a.b.example.com") == tls::name_table::NONE && find(".example.com") == tls::name_table::NONE);
+  assert(find("com") == tls::name_table::NONE && find("xexample.com") == tls::name_table::NONE && find("") == tls::name_table::NONE);
+  for(uint32_t i = 0; i < 200; ++i)
+    assert(find("host" + std::to_string(i) + ".test") == 10 + i);
+  assert(find("host200.test") == tls::name_table::NONE);
+  assert(tls::name_table().find("a", 1) == tls::name_table::NONE);
+
+  char directory[] = "/tmp/snitest-XXXXXX";
+  assert(mkdtemp(directory));
+  std::string dir = directory;
+  write_pem(dir + "/a.pem", "a");
+  write_pem(dir + "/b.pem", "b");
+  write_pem(dir + "/c.pem", "c");
+  write_pem(dir + "/default.pem", "default");
+  {
+    FILE* map = fopen((dir + "/map").c_str(), "w");
+    //relative paths resolve next to the map, names sharing files share a context
+    fputs("# comment\n"
+          "a.test,*.a.test a.pem\n"
+          "b.test b.pem b.pem\n"
+          "alias.test b.pem\n"
+          "c.test c.pem\n"
+          "broken.test missing.pem\n", map);
+    fclose(map);
+  }
+  tls::tls_config_t config{{"ssl_certificate_map", dir + "/map"}, {"ssl_certificate_cache", "2"}, {"ssl_certificate_retry", "1"},
+                           {"ssl_certificate", dir + "/default.pem"}};
+  size_t configured = 0;
+  tls::certificates c(config, [&configured](SSL_CTX*) { ++configured; });
+  assert(c.entries() == 4 && c.loaded() == 0 && configured == 1);
+  assert(c.select("unknown.test") == nullptr && c.statistics().unknown == 1);
+
+  //case and a trailing dot don't matter, wildcards and aliases find their files
+  assert(served(c.select("A.Test.")) == "a" && served(c.select("www.a.test")) == "a");
+  assert(served(c.select("b.test")) == "b" && served(c.select("alias.test")) == "b");
+  assert(c.statistics().loads == 2 && c.statistics().hits == 2 && c.loaded() == 2 && configured == 3);
+
+  //the least recently used context goes when a third is needed
+  assert(served(c.select("a.test")) == "a");
+  assert(served(c.select("c.test")) == "c");
+  assert(c.loaded() == 2 && c.statistics().evictions == 1);
+  assert(served(c.select("a.test")) == "a" && c.statistics().loads == 3);
+  assert(served(c.select("b.test")) == "b" && c.statistics().loads == 4 && c.statistics().evictions == 2);
+
+  //a context evicted while a handshake holds it stays usable
+  SSL_CTX* held = c.select("c.test");
+  assert(c.statistics().loads == 5);
+  assert(served(c.select("a.test")) == "a");
+  assert(served(c.select("b.test")) == "b" && c.loaded() == 2);
+  assert(served(held) == "c");
+
+  //a certificate that fails to load is not read again until the retry delay passes
+  assert(fails(c, "broken.test") && c.statistics().failures == 1);
+  assert(fails(c, "broken.test") && fails(c, "broken.test"));
+  assert(c.statistics().failures == 1 && c.statistics().refused == 2);
+  write_pem(dir + "/missing.pem", "mended");
+  assert(fails(c, "broken.test") && c.statistics().failures == 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+  assert(served(c.select("broken.test")) == "mended" && c.statistics().failures == 1);
+
+  //configuration errors
+  auto refused = [](const tls::tls_config_t& bad) {
+    try {
+      tls::certificates broken(bad);
+    }
+    catch(const std::runtime_error&) {
+      return true;
+    }
+    return false;
+  };
+  assert(refused(tls::tls_config_t{{"ssl_certificate_cache", "0"}}));
+  assert(refused(tls::tls_config_t{{"ssl_certificate_retry", "soon"}}));
+  assert(refused(tls::tls_config_t{{"ssl_certificate_map", dir + "/nothing"}}));
+  assert(refused(tls::tls_config_t{{"ssl_certificate", dir + "/nothing.pem"}}));
+  {
+    FILE* map = fopen((dir + "/bad").c_str(), "w");
+    fputs("a.*.test a.pem\n", map);
+    fclose(map);
+  }
+  assert(refused(tls::tls_config_t{{"ssl_certificate_map", dir + "/bad"}}));
+  for(const char* file : {"a.pem", "b.pem", "c.pem", "default.pem", "missing.pem", "map", "bad"})
+    unlink((dir + "/" + file).c_str());
+  rmdir(directory);
+  std::cout << "sni ok" << std::endl;
+  return 0;
+}
+#endif
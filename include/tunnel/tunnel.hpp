@@ -0,0 +1,603 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __TUNNEL_HPP__
+#define __TUNNEL_HPP__
+
+#include "event/loop.hpp"
+#include "upstream/upstream.hpp"
+
+#include <memory>
+#include <vector>
+#include <fcntl.h>
+
+namespace tunnel {
+    using tunnel_config_t = std::unordered_map<std::string, std::string>;
+
+    //bytes moved by a finished tunnel
+    struct totals {
+        uint64_t to_upstream;
+        uint64_t to_client;
+        bool timed_out;
+    };
+    using close_callback = std::function<void(const totals&)>;
+
+    //empty pipes left behind by closed tunnels, so the next tunnel skips pipe2 and fcntl.
+    //only ever touched on the loop thread
+    class pipe_cache {
+    public:
+        pipe_cache(size_t pipe_size, size_t max_cached) : pipe_size(pipe_size), max_cached(max_cached) {}
+        ~pipe_cache() {
+            for(auto& p : cached) {
+                close(p.first);
+                close(p.second);
+            }
+        }
+        pipe_cache(const pipe_cache&) = delete;
+        pipe_cache& operator=(const pipe_cache&) = delete;
+
+        std::pair<int, int> get() {
+            if(!cached.empty()) {
+                auto p = cached.back();
+                cached.pop_back();
+                return p;
+            }
+            int fds[2];
+            if(pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0)
+                throw std::runtime_error(std::string("Couldn't create tunnel pipe: ") + strerror(errno));
+            //best effort, the default 64k is fine if we are over the pipe-max-size limit
+            fcntl(fds[1], F_SETPIPE_SZ, static_cast<int>(pipe_size));
+            return {fds[0], fds[1]};
+        }
+        //only pipes known to be empty come back here
+        void put(std::pair<int, int> p) {
+            if(cached.size() < max_cached) {
+                cached.push_back(p);
+                return;
+            }
+            close(p.first);
+            close(p.second);
+        }
+        size_t size() const {
+            return pipe_size;
+        }
+    protected:
+        size_t pipe_size;
+        size_t max_cached;
+        std::vector<std::pair<int, int> > cached;
+    };
+
+    //shovels bytes between a client and an upstream socket after an upgrade or CONNECT. each
+    //direction splices socket -> pipe -> socket so the payload never enters user space, except
+    //for the few bytes that were already read before the tunnel started. a side that closes
+    //its writing half gets passed on as a half close, the tunnel ends when both directions are
+    //done, on any error or when nothing moved for the idle timeout. lives on one loop thread
+    class tunnel : public std::enable_shared_from_this<tunnel> {
+    public:
+        //takes ownership of both sockets, early bytes are what was read past the request or
+        //response head and still has to reach the other side
+        static std::shared_ptr<tunnel> open(event::loop& loop, pipe_cache& pipes, int client, int upstream,
+                                            std::chrono::milliseconds idle_timeout, close_callback done = nullptr,
+                                            std::string early_to_upstream = "", std::string early_to_client = "") {
+            std::shared_ptr<tunnel> t(new tunnel(loop, pipes, client, upstream, idle_timeout, std::move(done)));
+            t->ways[0].pending = std::move(early_to_upstream);
+            t->ways[1].pending = std::move(early_to_client);
+            t->start();
+            return t;
+        }
+        ~tunnel() {
+            finish(false);
+        }
+        tunnel(const tunnel&) = delete;
+        tunnel& operator=(const tunnel&) = delete;
+
+        //ends the tunnel now, from the loop thread
+        void close_now() {
+            finish(false);
+        }
+
+    protected:
+        //one direction, from -> pipe -> to
+        struct way {
+            int from;
+            int to;
+            std::pair<int, int> pipe{-1, -1};
+            size_t in_pipe = 0;
+            std::string pending;
+            size_t pending_sent = 0;
+            bool eof = false;
+            bool shut = false;
+            uint64_t moved = 0;
+        };
+
+        tunnel(event::loop& loop, pipe_cache& pipes, int client, int upstream, std::chrono::milliseconds idle_timeout, close_callback done) :
+            loop(loop), pipes(pipes), client(client), upstream(upstream), idle_timeout(idle_timeout), done(std::move(done)),
+            timer(0), closed(false) {
+            ways[0].from = client;
+            ways[0].to = upstream;
+            ways[1].from = upstream;
+            ways[1].to = client;
+        }
+
+        void start() {
+            for(int fd : {client, upstream})
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            try {
+                ways[0].pipe = pipes.get();
+                ways[1].pipe = pipes.get();
+                //edge triggered, every wakeup pumps until the kernel says EAGAIN
+                std::weak_ptr<tunnel> self = shared_from_this();
+                auto wake = [self](uint32_t) {
+                    if(auto t = self.lock())
+                        t->pump();
+                };
+                loop.add(client, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, wake);
+                loop.add(upstream, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, wake);
+            }
+            catch(...) {
+                finish(false);
+                throw;
+            }
+            //the loop keeps us alive through the idle timer
+            last_activity = event::clock::now();
+            arm(idle_timeout);
+            pump();
+        }
+
+        void arm(std::chrono::milliseconds delay) {
+            auto self = shared_from_this();
+            timer = loop.after(delay, [self]() {
+                self->timer = 0;
+                auto quiet = std::chrono::duration_cast<std::chrono::milliseconds>(event::clock::now() - self->last_activity);
+                if(quiet >= self->idle_timeout)
+                    self->finish(true);
+                else
+                    self->arm(self->idle_timeout - quiet);
+            });
+        }
+
+        void pump() {
+            if(closed)
+                return;
+            bool progress = false;
+            for(auto& w : ways)
+                if(!move(w, progress))
+                    return finish(false);
+            if(progress)
+                last_activity = event::clock::now();
+            if(ways[0].shut && ways[1].shut)
+                finish(false);
+        }
+
+        //moves what it can in one direction, false on a hard error
+        bool move(way& w, bool& progress) {
+            while(w.pending_sent < w.pending.size()) {
+                ssize_t n = ::send(w.to, w.pending.data() + w.pending_sent, w.pending.size() - w.pending_sent, MSG_NOSIGNAL);
+                if(n < 0)
+                    return errno == EAGAIN || errno == EINTR;
+                w.pending_sent += static_cast<size_t>(n);
+                w.moved += static_cast<uint64_t>(n);
+                progress = true;
+            }
+            while(!w.shut) {
+                if(w.in_pipe) {
+                    ssize_t n = splice(w.pipe.first, nullptr, w.to, nullptr, w.in_pipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                    if(n < 0)
+                        return errno == EAGAIN || errno == EINTR;
+                    w.in_pipe -= static_cast<size_t>(n);
+                    w.moved += static_cast<uint64_t>(n);
+                    progress = true;
+                    continue;
+                }
+                if(w.eof) {
+                    //everything the source sent has been delivered, pass the close on
+                    shutdown(w.to, SHUT_WR);
+                    w.shut = true;
+                    break;
+                }
+                ssize_t n = splice(w.from, nullptr, w.pipe.second, nullptr, pipes.size(), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if(n < 0)
+                    return errno == EAGAIN || errno == EINTR;
+                if(n == 0)
+                    w.eof = true;
+                w.in_pipe += static_cast<size_t>(n);
+                progress = true;
+            }
+            return true;
+        }
+
+        void finish(bool timed_out) {
+            if(closed)
+                return;
+            closed = true;
+            if(timer)
+                loop.cancel(timer);
+            timer = 0;
+            for(int fd : {client, upstream}) {
+                loop.remove(fd);
+                close(fd);
+            }
+            for(auto& w : ways) {
+                if(w.pipe.first < 0)
+                    continue;
+                if(w.in_pipe == 0) {
+                    pipes.put(w.pipe);
+                }
+                else {
+                    close(w.pipe.first);
+                    close(w.pipe.second);
+                }
+                w.pipe = {-1, -1};
+            }
+            if(done)
+                done(totals{ways[0].moved, ways[1].moved, timed_out});
+        }
+
+        event::loop& loop;
+        pipe_cache& pipes;
+        int client;
+        int upstream;
+        std::chrono::milliseconds idle_timeout;
+        close_callback done;
+        event::timer_id timer;
+        bool closed;
+        event::clock::time_point last_activity;
+        way ways[2];
+    };
+
+    //true for requests asking to switch protocols, websocket being the usual one
+    inline bool is_upgrade(const http::request& request) {
+        const std::string* connection = http::find_header(request.headers, "Connection");
+        return connection && strcasestr(connection->c_str(), "upgrade") && http::find_header(request.headers, "Upgrade");
+    }
+
+    //an upstream that agreed to switch protocols
+    struct upgraded {
+        http::response response;
+        int upstream;
+        //bytes the upstream sent right behind its 101, they belong to the client
+        std::string early;
+    };
+
+    //forwards an upgrade request. on a 101 the socket is handed back ready to tunnel, any
+    //other answer is a normal response and the socket is closed
+    inline upgraded upgrade(const upstream::backend& target, const http::request& request, std::chrono::milliseconds timeout,
+                            const upstream::address_lookup& lookup = nullptr) {
+        upstream::connection c(target, timeout, lookup);
+        upgraded result{};
+        result.upstream = -1;
+        c.send(request);
+        c.read_response(request.method, result.response);
+        if(result.response.status == 101) {
+            result.early = c.take_buffered();
+            result.upstream = c.detach();
+        }
+        return result;
+    }
+
+    //opens the socket a CONNECT asked for, the target is 'host:port'
+    inline int connect(const std::string& authority, std::chrono::milliseconds timeout, const upstream::address_lookup& lookup = nullptr) {
+        upstream::connection c(upstream::parse_backend(authority), timeout, lookup);
+        return c.detach();
+    }
+
+    //runs tunnels on one loop with the configured pipe size and idle timeout. the tunnels still
+    //open when it goes away are closed then, from the loop thread or once the loop has stopped
+    class tunnels {
+    public:
+        tunnels() = delete;
+        tunnels(event::loop& loop, const tunnel_config_t& config) : loop(loop), idle_timeout(std::chrono::seconds(300)) {
+            auto parse = [&config](const char* key, size_t& value) {
+                auto found = config.find(key);
+                if(found == config.end())
+                    return;
+                try {
+                    value = std::stoul(found->second);
+                }
+                catch(...) {
+                    throw std::runtime_error(found->second + " is not a valid " + key);
+                }
+            };
+            size_t idle_seconds = 300, pipe_size = 64 * 1024, cached = 256;
+            parse("tunnel_idle_timeout", idle_seconds);
+            parse("tunnel_pipe_size", pipe_size);
+            parse("tunnel_cached_pipes", cached);
+            if(idle_seconds == 0)
+                throw std::runtime_error("tunnel_idle_timeout must be positive");
+            if(pipe_size < 4096)
+                throw std::runtime_error("tunnel_pipe_size must be at least 4096");
+            idle_timeout = std::chrono::seconds(idle_seconds);
+            pipes.reset(new pipe_cache(pipe_size, cached));
+        }
+        ~tunnels() {
+            //their done callbacks are not run, whoever passed them is on its way out as well
+            closing = true;
+            auto open = std::move(live);
+            for(auto& t : open)
+                if(auto alive = t.second.lock())
+                    alive->close_now();
+        }
+        tunnels(const tunnels&) = delete;
+        tunnels& operator=(const tunnels&) = delete;
+
+        //callable from any thread, the tunnel starts on the loop
+        void add(int client, int upstream, close_callback done = nullptr, std::string early_to_upstream = "", std::string early_to_client = "") {
+            auto work = [this, client, upstream, done, early_to_upstream, early_to_client]() mutable {
+                uint64_t id = ++opened;
+                live[id];
+                try {
+                    auto closed = [this, id, done](const totals& t) {
+                        live.erase(id);
+                        if(done && !closing)
+                            done(t);
+                    };
+                    auto t = tunnel::open(loop, *pipes, client, upstream, idle_timeout, std::move(closed), std::move(early_to_upstream), std::move(early_to_client));
+                    //unless it already finished inside open
+                    auto found = live.find(id);
+                    if(found != live.end())
+                        found->second = t;
+                }
+                catch(const std::exception&) {
+                    //open already closed both sockets
+                    live.erase(id);
+                }
+            };
+            if(loop.in_loop_thread())
+                work();
+            else
+                loop.post(std::move(work));
+        }
+
+        //tunnels open right now, loop thread only
+        size_t size() const {
+            return live.size();
+        }
+
+    protected:
+        event::loop& loop;
+        std::chrono::milliseconds idle_timeout;
+        std::unique_ptr<pipe_cache> pipes;
+        std::unordered_map<uint64_t, std::weak_ptr<tunnel> > live;
+        uint64_t opened = 0;
+        bool closing = false;
+    };
+}
+
+#endif //__TUNNEL_HPP__
+
+#ifdef TEST_TUNNEL
+//g++ -std=c++17 -O2 -DTEST_TUNNEL -Iinclude -x c++ include/tunnel/tunnel.hpp -o tunneltest -pthread
+#include <arpa/inet.h>
+#include <cassert>
+#include <future>
+#include <iostream>
+
+namespace {
+  //a loopback listener, so both ends of every pair are real tcp sockets splice can work with
+  struct listener {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    uint16_t port = 0;
+    listener() {
+      sockaddr_in a{};
+      a.sin_family = AF_INET;
+      a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      socklen_t length = sizeof(a);
+      assert(bind(fd, reinterpret_cast<sockaddr*>(&a), sizeof(a)) == 0 && listen(fd, 16) == 0);
+      getsockname(fd, reinterpret_cast<sockaddr*>(&a), &length);
+      port = ntohs(a.sin_port);
+    }
+    ~listener() {
+      close(fd);
+    }
+    //a connected (outside, inside) pair, inside is what the tunnel gets
+    std::pair<int, int> pair() {
+      int outside = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      sockaddr_in a{};
+      a.sin_family = AF_INET;
+      a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      a.sin_port = htons(port);
+      assert(::connect(outside, reinterpret_cast<sockaddr*>(&a), sizeof(a)) == 0);
+      return {outside, accept(fd, nullptr, nullptr)};
+    }
+  };
+  std::string pattern(size_t size, char seed) {
+    std::string s(size, '\0');
+    for(size_t i = 0; i < size; ++i)
+      s[i] = static_cast<char>(seed + (i * 31 + i / 4093) % 61);
+    return s;
+  }
+  //reads until the other side's writing half closes
+  std::string read_all(int fd) {
+    std::string out;
+    char buffer[65536];
+    ssize_t n;
+    while((n = read(fd, buffer, sizeof(buffer))) > 0)
+      out.append(buffer, static_cast<size_t>(n));
+    return out;
+  }
+  void write_all(int fd, const std::string& data) {
+    size_t sent = 0;
+    while(sent < data.size()) {
+      ssize_t n = write(fd, data.data() + sent, data.size() - sent);
+      assert(n > 0);
+      sent += static_cast<size_t>(n);
+    }
+  }
+  bool closed(int fd) {
+    return fcntl(fd, F_GETFD) < 0;
+  }
+}
+
+int main() {
+  event::loop loop;
+  std::thread runner([&]() { loop.run(); });
+  tunnel::tunnels tunnels(loop, tunnel::tunnel_config_t{{"tunnel_idle_timeout", "1"}, {"tunnel_pipe_size", "65536"}});
+  listener sockets;
+
+  //megabytes both ways at once through the pipes, early bytes first, each half close passed on
+  {
+    auto client = sockets.pair(), upstream = sockets.pair();
+    std::promise<tunnel::totals> finished;
+    tunnels.add(client.second, upstream.second, [&](const tunnel::totals& t) { finished.set_value(t); }, "early-up|", "early-down|");
+    std::string up = pattern(5 << 20, 'a'), down = pattern(3 << 20, 'A');
+    std::string got_up, got_down;
+    std::thread upstream_side([&]() {
+      write_all(upstream.first, down);
+      got_up = read_all(upstream.first);
+      //the client finished sending but still reads, the upstream gets the last word
+      write_all(upstream.first, "after half close");
+      shutdown(upstream.first, SHUT_WR);
+    });
+    write_all(client.first, up);
+    shutdown(client.first, SHUT_WR);
+    got_down = read_all(client.first);
+    upstream_side.join();
+    assert(got_up == "early-up|" + up);
+    assert(got_down == "early-down|" + down + "after half close");
+    auto totals = finished.get_future().get();
+    assert(totals.to_upstream == got_up.size() && totals.to_client == got_down.size() && !totals.timed_out);
+    assert(closed(client.second) && closed(upstream.second));
+    close(client.first);
+    close(upstream.first);
+  }
+
+  //an upstream that resets takes the client down with it
+  {
+    auto client = sockets.pair(), upstream = sockets.pair();
+    std::promise<tunnel::totals> finished;
+    tunnels.add(client.second, upstream.second, [&](const tunnel::totals& t) { finished.set_value(t); });
+    write_all(client.first, "hello");
+    char buffer[5];
+    assert(read(upstream.first, buffer, 5) == 5);
+    linger hard{1, 0};
+    setsockopt(upstream.first, SOL_SOCKET, SO_LINGER, &hard, sizeof(hard));
+    close(upstream.first);
+    auto totals = finished.get_future().get();
+    assert(totals.to_upstream == 5 && !totals.timed_out);
+    assert(read_all(client.first).empty());
+    close(client.first);
+  }
+
+  //a quiet tunnel times out
+  {
+    auto client = sockets.pair(), upstream = sockets.pair();
+    std::promise<tunnel::totals> finished;
+    auto started = event::clock::now();
+    tunnels.add(client.second, upstream.second, [&](const tunnel::totals& t) { finished.set_value(t); });
+    assert(finished.get_future().get().timed_out && event::clock::now() - started >= std::chrono::seconds(1));
+    close(client.first);
+    close(upstream.first);
+  }
+
+  //CONNECT opens a plain socket to the authority, a closed port is an upstream_error
+  {
+    int opened = tunnel::connect("127.0.0.1:" + std::to_string(sockets.port), std::chrono::milliseconds(1000));
+    int accepted = accept(sockets.fd, nullptr, nullptr);
+    write_all(opened, "ping");
+    char buffer[4];
+    assert(read(accepted, buffer, 4) == 4 && std::string(buffer, 4) == "ping");
+    close(opened);
+    close(accepted);
+    int unused = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in a{};
+    a.sin_family = AF_INET;
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(a);
+    bind(unused, reinterpret_cast<sockaddr*>(&a), sizeof(a));
+    getsockname(unused, reinterpret_cast<sockaddr*>(&a), &length);
+    bool refused = false;
+    try {
+      tunnel::connect("127.0.0.1:" + std::to_string(ntohs(a.sin_port)), std::chrono::milliseconds(1000));
+    }
+    catch(const upstream::upstream_error&) {
+      refused = true;
+    }
+    close(unused);
+    assert(refused);
+  }
+
+  //an upgrade hands back the socket and whatever came behind the 101, any other answer does not
+  {
+    http::request request;
+    request.method = "GET";
+    request.target = "/chat";
+    http::set_header(request.headers, "Host", "backend");
+    http::set_header(request.headers, "Connection", "keep-alive, Upgrade");
+    http::set_header(request.headers, "Upgrade", "websocket");
+    assert(tunnel::is_upgrade(request));
+    for(const std::string& answer : {std::string("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n\r\nfirst frame"),
+                                     std::string("HTTP/1.1 403 Forbidden\r\nContent-Length: 0\r\n\r\n")}) {
+      std::thread backend([&]() {
+        int c = accept(sockets.fd, nullptr, nullptr);
+        std::string in;
+        char buffer[4096];
+        ssize_t n;
+        while(in.find("\r\n\r\n") == std::string::npos && (n = read(c, buffer, sizeof(buffer))) > 0)
+          in.append(buffer, static_cast<size_t>(n));
+        write_all(c, answer);
+        shutdown(c, SHUT_WR);
+        read_all(c);
+        close(c);
+      });
+      auto result = tunnel::upgrade(upstream::backend{"127.0.0.1", sockets.port}, request, std::chrono::milliseconds(1000));
+      if(result.response.status == 101) {
+        assert(result.upstream >= 0 && result.early == "first frame");
+        close(result.upstream);
+      }
+      else {
+        assert(result.response.status == 403 && result.upstream < 0);
+      }
+      backend.join();
+    }
+    http::remove_header(request.headers, "Upgrade");
+    assert(!tunnel::is_upgrade(request));
+  }
+
+  //tunnels going away closes what is still open without reporting back, its pipe cache and
+  //callbacks are gone once it is, so no idle timer may fire into them later
+  {
+    auto client = sockets.pair(), upstream = sockets.pair();
+    std::unique_ptr<tunnel::tunnels> brief(new tunnel::tunnels(loop, tunnel::tunnel_config_t{{"tunnel_idle_timeout", "1"}}));
+    bool reported = false;
+    brief->add(client.second, upstream.second, [&reported](const tunnel::totals&) { reported = true; });
+    write_all(client.first, "open");
+    char buffer[4];
+    assert(read(upstream.first, buffer, 4) == 4);
+    std::promise<size_t> was_open;
+    loop.post([&]() {
+      was_open.set_value(brief->size());
+      brief.reset();
+    });
+    assert(was_open.get_future().get() == 1);
+    assert(read_all(client.first).empty() && read_all(upstream.first).empty());
+    std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+    std::promise<void> settled;
+    loop.post([&]() { settled.set_value(); });
+    settled.get_future().get();
+    assert(!reported);
+    close(client.first);
+    close(upstream.first);
+  }
+
+  //configuration
+  auto rejects = [&](const tunnel::tunnel_config_t& config) {
+    try {
+      tunnel::tunnels t(loop, config);
+    }
+    catch(const std::runtime_error&) {
+      return true;
+    }
+    return false;
+  };
+  assert(rejects(tunnel::tunnel_config_t{{"tunnel_idle_timeout", "0"}}));
+  assert(rejects(tunnel::tunnel_config_t{{"tunnel_pipe_size", "100"}}));
+  assert(rejects(tunnel::tunnel_config_t{{"tunnel_cached_pipes", "many"}}));
+
+  //every tunnel is done, so nothing is left on the loop when it stops
+  loop.stop();
+  runner.join();
+  std::cout << "tunnel ok" << std::endl;
+  return 0;
+}
+#endif
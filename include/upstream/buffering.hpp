@@ -0,0 +1,453 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __BUFFERING_HPP__
+#define __BUFFERING_HPP__
+
+#include "upstream/upstream.hpp"
+
+#include <memory>
+#include <vector>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+namespace upstream {
+    //fixed size buffers recycled across responses so buffering does not churn the allocator
+    class chunk_pool {
+    public:
+        chunk_pool(size_t chunk_size, size_t max_pooled) : chunk_size(chunk_size), max_pooled(max_pooled) {}
+        std::unique_ptr<char[]> get() {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if(!free.empty()) {
+                    auto chunk = std::move(free.back());
+                    free.pop_back();
+                    return chunk;
+                }
+            }
+            return std::unique_ptr<char[]>(new char[chunk_size]);
+        }
+        void put(std::unique_ptr<char[]> chunk) {
+            std::lock_guard<std::mutex> guard(lock);
+            if(free.size() < max_pooled)
+                free.push_back(std::move(chunk));
+        }
+        size_t size() const {
+            return chunk_size;
+        }
+    protected:
+        size_t chunk_size;
+        size_t max_pooled;
+        std::mutex lock;
+        std::vector<std::unique_ptr<char[]> > free;
+    };
+
+    //holds one upstream response so the upstream connection can go back to the pool while a slow
+    //client is still reading. the first max_memory bytes live in pooled chunks, anything beyond
+    //goes to an anonymous temporary file that is sent with sendfile and vanishes on close
+    class response_buffer {
+    public:
+        response_buffer(chunk_pool& chunks, size_t max_memory, const std::string& temp_dir, uint64_t max_file) :
+            chunks(chunks), max_memory(max_memory), temp_dir(temp_dir), max_file(max_file),
+            memory_bytes(0), file_fd(-1), file_bytes(0), head_sent(0), memory_sent(0), file_sent(0) {}
+        ~response_buffer() {
+            for(auto& c : memory)
+                chunks.put(std::move(c));
+            if(file_fd >= 0)
+                close(file_fd);
+        }
+        response_buffer(const response_buffer&) = delete;
+        response_buffer& operator=(const response_buffer&) = delete;
+
+        //the bytes sent ahead of the body, usually the serialized response head
+        void set_head(std::string bytes) {
+            head = std::move(bytes);
+        }
+
+        //a body_sink compatible append
+        void append(const char* data, size_t size) {
+            while(size && memory_bytes < max_memory) {
+                size_t used = memory_bytes % chunks.size();
+                if(used == 0)
+                    memory.push_back(chunks.get());
+                size_t take = std::min({size, chunks.size() - used, max_memory - memory_bytes});
+                memcpy(memory.back().get() + used, data, take);
+                memory_bytes += take;
+                data += take;
+                size -= take;
+            }
+            if(size)
+                spill(data, size);
+        }
+
+        body_sink sink() {
+            return [this](const char* data, size_t size) { append(data, size); };
+        }
+
+        uint64_t size() const {
+            return memory_bytes + file_bytes;
+        }
+        bool spilled() const {
+            return file_fd >= 0;
+        }
+
+        //sends as much as the client socket takes, returns true once everything went out. on a
+        //non blocking socket a false return means wait for writability and call again
+        bool send(int client) {
+            while(head_sent < head.size()) {
+                ssize_t n = ::send(client, head.data() + head_sent, head.size() - head_sent, MSG_NOSIGNAL | (memory_bytes ? MSG_MORE : 0));
+                if(!progress(n))
+                    return false;
+                head_sent += static_cast<size_t>(n);
+            }
+            while(memory_sent < memory_bytes) {
+                //gather every remaining chunk into one writev
+                iovec vectors[64];
+                int count = 0;
+                size_t position = memory_sent;
+                while(position < memory_bytes && count < 64) {
+                    size_t index = position / chunks.size(), offset = position % chunks.size();
+                    size_t length = std::min(chunks.size() - offset, memory_bytes - position);
+                    vectors[count].iov_base = memory[index].get() + offset;
+                    vectors[count].iov_len = length;
+                    position += length;
+                    ++count;
+                }
+                ssize_t n = writev(client, vectors, count);
+                if(!progress(n))
+                    return false;
+                memory_sent += static_cast<size_t>(n);
+            }
+            while(file_sent < file_bytes) {
+                off_t offset = static_cast<off_t>(file_sent);
+                ssize_t n = sendfile(client, file_fd, &offset, static_cast<size_t>(std::min<uint64_t>(file_bytes - file_sent, 1 << 30)));
+                if(!progress(n))
+                    return false;
+                file_sent += static_cast<uint64_t>(n);
+            }
+            return true;
+        }
+
+    protected:
+        //true if n bytes were written, false to wait, throws on a dead client
+        static bool progress(ssize_t n) {
+            if(n > 0)
+                return true;
+            if(n < 0 && (errno == EAGAIN || errno == EINTR))
+                return false;
+            throw std::runtime_error(std::string("Couldn't write buffered response: ") + (n == 0 ? "no progress" : strerror(errno)));
+        }
+
+        void spill(const char* data, size_t size) {
+            if(file_bytes + size > max_file)
+                throw upstream_error("Upstream response exceeds the temporary file limit");
+            if(file_fd < 0) {
+                //an unnamed file in temp_dir, nothing to clean up if we crash
+                file_fd = open(temp_dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+                if(file_fd < 0 && (errno == EOPNOTSUPP || errno == EISDIR || errno == EINVAL)) {
+                    std::string name = temp_dir + "/cheehttpd-XXXXXX";
+                    file_fd = mkostemp(&name.front(), O_CLOEXEC);
+                    if(file_fd >= 0)
+                        unlink(name.c_str());
+                }
+                if(file_fd < 0)
+                    throw upstream_error("Couldn't create a temporary file in " + temp_dir + ": " + strerror(errno));
+            }
+            while(size) {
+                ssize_t n = pwrite(file_fd, data, size, static_cast<off_t>(file_bytes));
+                if(n < 0 && errno == EINTR)
+                    continue;
+                if(n <= 0)
+                    throw upstream_error(std::string("Couldn't write to temporary file: ") + strerror(errno));
+                file_bytes += static_cast<uint64_t>(n);
+                data += n;
+                size -= static_cast<size_t>(n);
+            }
+        }
+
+        chunk_pool& chunks;
+        size_t max_memory;
+        std::string temp_dir;
+        uint64_t max_file;
+        std::string head;
+        std::vector<std::unique_ptr<char[]> > memory;
+        size_t memory_bytes;
+        int file_fd;
+        uint64_t file_bytes;
+        size_t head_sent;
+        size_t memory_sent;
+        uint64_t file_sent;
+    };
+
+    //reads whole upstream responses into response_buffers. the upstream connection is back in its
+    //pool the moment the last byte arrived, however long the client then takes to drain it
+    class buffering {
+    public:
+        buffering() = delete;
+        explicit buffering(const upstream_config_t& config) :
+            max_memory(1 << 20), temp_dir("/tmp"), max_file(uint64_t(1) << 30) {
+            auto parse = [&config](const char* key, size_t& value) {
+                auto found = config.find(key);
+                if(found == config.end())
+                    return;
+                try {
+                    value = std::stoul(found->second);
+                }
+                catch(...) {
+                    throw std::runtime_error(found->second + " is not a valid " + key);
+                }
+            };
+            size_t chunk_size = 64 * 1024, pooled = 1024, file_limit = static_cast<size_t>(max_file);
+            parse("buffer_chunk_size", chunk_size);
+            parse("buffer_pooled_chunks", pooled);
+            parse("buffer_max_memory", max_memory);
+            parse("buffer_max_temp_file", file_limit);
+            max_file = file_limit;
+            auto dir = config.find("buffer_temp_dir");
+            if(dir != config.end())
+                temp_dir = dir->second;
+            if(chunk_size == 0)
+                throw std::runtime_error("buffer_chunk_size must be positive");
+            struct stat st{};
+            if(stat(temp_dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+                throw std::runtime_error(temp_dir + " is not a usable buffer_temp_dir");
+            chunks.reset(new chunk_pool(chunk_size, pooled));
+        }
+
+        //fetches request through p into a new buffer, head included and ready to send
+        std::unique_ptr<response_buffer> fetch(pool& p, const http::request& request) {
+            std::unique_ptr<response_buffer> buffered(new response_buffer(*chunks, max_memory, temp_dir, max_file));
+            auto response = p.exchange(request, buffered->sink());
+            //the body is now framed by its known size, whatever the upstream used
+            http::remove_header(response.headers, "Transfer-Encoding");
+            http::remove_header(response.headers, "Connection");
+            http::remove_header(response.headers, "Keep-Alive");
+            if(http::has_body(request.method, response.status))
+                http::set_header(response.headers, "Content-Length", std::to_string(buffered->size()));
+            response.version = "HTTP/1.1";
+            buffered->set_head(http::serialize_head(response));
+            return buffered;
+        }
+
+    protected:
+        size_t max_memory;
+        std::string temp_dir;
+        uint64_t max_file;
+        std::unique_ptr<chunk_pool> chunks;
+    };
+}
+
+#endif //__BUFFERING_HPP__
+
+#ifdef TEST_BUFFERING
+//g++ -std=c++17 -O2 -DTEST_BUFFERING -Iinclude -x c++ include/upstream/buffering.hpp -o bufferingtest -pthread
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <cassert>
+#include <iostream>
+#include <thread>
+
+namespace {
+  //names in a directory, "." and ".." aside
+  size_t entries(const std::string& dir) {
+    size_t n = 0;
+    DIR* d = opendir(dir.c_str());
+    while(dirent* e = readdir(d))
+      n += strcmp(e->d_name, ".") && strcmp(e->d_name, "..");
+    closedir(d);
+    return n;
+  }
+  size_t open_fds() {
+    return entries("/proc/self/fd");
+  }
+  std::string pattern(size_t size) {
+    std::string s(size, '\0');
+    for(size_t i = 0; i < size; ++i)
+      s[i] = static_cast<char>('a' + (i * 7 + i / 251) % 26);
+    return s;
+  }
+  //sends b through a small non blocking socket buffer, waiting on every false return
+  std::string drain(upstream::response_buffer& b, size_t* waited = nullptr) {
+    int pair[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+    int small = 4096;
+    setsockopt(pair[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    fcntl(pair[0], F_SETFL, O_NONBLOCK);
+    std::string got;
+    std::thread reader([&]() {
+      char buffer[1000];
+      ssize_t n;
+      while((n = read(pair[1], buffer, sizeof(buffer))) > 0)
+        got.append(buffer, static_cast<size_t>(n));
+    });
+    size_t waits = 0;
+    while(!b.send(pair[0])) {
+      pollfd p{pair[0], POLLOUT, 0};
+      poll(&p, 1, 1000);
+      ++waits;
+    }
+    close(pair[0]);
+    reader.join();
+    close(pair[1]);
+    if(waited)
+      *waited = waits;
+    return got;
+  }
+}
+
+int main() {
+  char dir_template[] = "/tmp/bufferingtest-XXXXXX";
+  std::string dir = mkdtemp(dir_template);
+  upstream::chunk_pool chunks(1000, 4);
+  size_t fds = open_fds();
+
+  //small responses stay in memory, the head goes first
+  {
+    upstream::response_buffer b(chunks, 10000, dir, 100000);
+    std::string body = pattern(2500);
+    b.append(body.data(), 1);
+    b.append(body.data() + 1, body.size() - 1);
+    b.set_head("HEAD\r\n\r\n");
+    assert(b.size() == 2500 && !b.spilled() && open_fds() == fds);
+    assert(drain(b) == "HEAD\r\n\r\n" + body);
+  }
+
+  //past max_memory the rest goes to an unnamed temporary file that leaves nothing behind
+  {
+    upstream::response_buffer b(chunks, 3500, dir, 1 << 20);
+    std::string body = pattern(300000);
+    auto sink = b.sink();
+    for(size_t at = 0; at < body.size(); at += 777)
+      sink(body.data() + at, std::min<size_t>(777, body.size() - at));
+    assert(b.size() == body.size() && b.spilled());
+    assert(open_fds() == fds + 1 && entries(dir) == 0);
+    b.set_head("H\r\n");
+    size_t waits = 0;
+    assert(drain(b, &waits) == "H\r\n" + body && waits > 0);
+  }
+  assert(open_fds() == fds && entries(dir) == 0);
+
+  //max_file caps what spills on top of the memory part
+  {
+    upstream::response_buffer b(chunks, 2000, dir, 10);
+    std::string body = pattern(2010);
+    b.append(body.data(), body.size());
+    assert(b.spilled() && b.size() == 2010);
+    bool refused = false;
+    try {
+      b.append("x", 1);
+    }
+    catch(const upstream::upstream_error&) {
+      refused = true;
+    }
+    assert(refused && b.size() == 2010);
+  }
+  assert(open_fds() == fds);
+
+  //a memory only buffer never touches the disk, even a missing temp_dir
+  {
+    upstream::response_buffer b(chunks, 100, dir + "/missing", 100);
+    b.append("abc", 3);
+    bool refused = false;
+    try {
+      std::string more = pattern(200);
+      b.append(more.data(), more.size());
+    }
+    catch(const upstream::upstream_error& e) {
+      refused = std::string(e.what()).find("temporary file") != std::string::npos;
+    }
+    assert(refused);
+  }
+
+  //a client that went away is an error rather than a spin
+  {
+    upstream::response_buffer b(chunks, 100, dir, 100);
+    b.set_head("HTTP/1.1 200 OK\r\n\r\n");
+    b.append("abc", 3);
+    int pair[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+    close(pair[1]);
+    bool failed = false;
+    try {
+      b.send(pair[0]);
+    }
+    catch(const std::runtime_error&) {
+      failed = true;
+    }
+    close(pair[0]);
+    assert(failed);
+  }
+
+  //configuration
+  auto rejects = [](const upstream::upstream_config_t& config) {
+    try {
+      upstream::buffering b(config);
+    }
+    catch(const std::runtime_error&) {
+      return true;
+    }
+    return false;
+  };
+  assert(rejects(upstream::upstream_config_t{{"buffer_chunk_size", "0"}}));
+  assert(rejects(upstream::upstream_config_t{{"buffer_max_memory", "lots"}}));
+  assert(rejects(upstream::upstream_config_t{{"buffer_temp_dir", dir + "/missing"}}));
+
+  //a chunked upstream response comes out with a Content-Length and the connection back in the pool
+  int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_in a{};
+  a.sin_family = AF_INET;
+  a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(a);
+  assert(bind(listener, reinterpret_cast<sockaddr*>(&a), sizeof(a)) == 0 && listen(listener, 4) == 0);
+  getsockname(listener, reinterpret_cast<sockaddr*>(&a), &length);
+  std::string body = pattern(50000);
+  std::thread backend([&]() {
+    int c = accept(listener, nullptr, nullptr);
+    std::string in;
+    char buffer[4096];
+    ssize_t n;
+    while(in.find("\r\n\r\n") == std::string::npos && (n = read(c, buffer, sizeof(buffer))) > 0)
+      in.append(buffer, static_cast<size_t>(n));
+    std::string out = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nKeep-Alive: timeout=5\r\n\r\n";
+    for(size_t at = 0; at < body.size(); at += 9000) {
+      size_t take = std::min<size_t>(9000, body.size() - at);
+      char size[32];
+      snprintf(size, sizeof(size), "%zx\r\n", take);
+      out += size + body.substr(at, take) + "\r\n";
+    }
+    out += "0\r\n\r\n";
+    assert(write(c, out.data(), out.size()) == static_cast<ssize_t>(out.size()));
+    read(c, buffer, sizeof(buffer));
+    close(c);
+  });
+  {
+    upstream::buffering buffering(upstream::upstream_config_t{
+      {"buffer_chunk_size", "4096"}, {"buffer_max_memory", "10000"}, {"buffer_temp_dir", dir}});
+    upstream::pool p(upstream::backend{"127.0.0.1", ntohs(a.sin_port)}, upstream::upstream_config_t{});
+    http::request request;
+    request.method = "GET";
+    request.target = "/big";
+    http::set_header(request.headers, "Host", "backend");
+    auto buffered = buffering.fetch(p, request);
+    assert(buffered->spilled() && buffered->size() == body.size());
+    //the upstream connection went back to the pool before the client read a byte
+    auto reused = p.acquire();
+    assert(reused->responses() == 1);
+    std::string sent = drain(*buffered);
+    http::response head;
+    size_t end = http::parse_response_head(sent.data(), sent.size(), head);
+    assert(end && head.status == 200);
+    assert(*http::find_header(head.headers, "Content-Length") == std::to_string(body.size()));
+    assert(!http::find_header(head.headers, "Transfer-Encoding") && !http::find_header(head.headers, "Keep-Alive"));
+    assert(sent.substr(end) == body);
+  }
+  backend.join();
+  close(listener);
+  assert(open_fds() == fds && entries(dir) == 0);
+  rmdir(dir.c_str());
+  std::cout << "buffering ok" << std::endl;
+  return 0;
+}
+#endif
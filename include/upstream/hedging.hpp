@@ -0,0 +1,466 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __HEDGING_HPP__
+#define __HEDGING_HPP__
+
+#include "upstream/upstream.hpp"
+#include "upstream/histogram.hpp"
+
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <condition_variable>
+
+namespace upstream {
+    //limits extra upstream requests to a share of real traffic: every request deposits ratio
+    //tokens, every hedge or retry withdraws a whole one. the balance is capped so a quiet
+    //period cannot save up for a burst that would hit already struggling backends
+    class retry_budget {
+    public:
+        retry_budget(double ratio, double cap) : ratio_milli(static_cast<int64_t>(ratio * 1000)), cap_milli(static_cast<int64_t>(cap * 1000)), balance(0) {}
+        void deposit() {
+            if(balance.fetch_add(ratio_milli, std::memory_order_relaxed) + ratio_milli > cap_milli)
+                balance.fetch_sub(ratio_milli, std::memory_order_relaxed);
+        }
+        //gives back a withdrawal that was not spent after all
+        void refund() {
+            balance.fetch_add(1000, std::memory_order_relaxed);
+        }
+        bool withdraw() {
+            int64_t current = balance.load(std::memory_order_relaxed);
+            while(current >= 1000)
+                if(balance.compare_exchange_weak(current, current - 1000, std::memory_order_relaxed))
+                    return true;
+            return false;
+        }
+    protected:
+        int64_t ratio_milli;
+        int64_t cap_milli;
+        std::atomic<int64_t> balance;
+    };
+
+    //a fixed set of threads running upstream exchanges. work is only taken when a thread is
+    //free to start it right away: a hedge queued behind the slow exchanges it was meant to get
+    //around would be useless, so a busy executor counts as saturated and refuses
+    class executor {
+    public:
+        explicit executor(size_t threads) : idle(0), stopping(false) {
+            for(size_t i = 0; i < threads; ++i)
+                workers.emplace_back([this]() { run(); });
+            //until every thread waits for work there is nobody to hand it to
+            std::unique_lock<std::mutex> guard(lock);
+            ready.wait(guard, [this, threads]() { return idle == threads; });
+        }
+        ~executor() {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+            }
+            wake.notify_all();
+            for(auto& w : workers)
+                w.join();
+        }
+        //then runs once the thread counts as idle again, so whoever it wakes finds it free
+        bool submit(std::function<void()> task, std::function<void()> then = nullptr) {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if(stopping || queue.size() >= idle)
+                    return false;
+                queue.emplace_back(std::move(task), std::move(then));
+            }
+            wake.notify_one();
+            return true;
+        }
+    protected:
+        void run() {
+            std::unique_lock<std::mutex> guard(lock);
+            ++idle;
+            ready.notify_all();
+            while(true) {
+                wake.wait(guard, [this]() { return stopping || !queue.empty(); });
+                if(queue.empty())
+                    return;
+                --idle;
+                auto task = std::move(queue.front());
+                queue.pop_front();
+                guard.unlock();
+                task.first();
+                guard.lock();
+                //free again the moment the task is over, before anyone hears it is
+                ++idle;
+                if(task.second) {
+                    guard.unlock();
+                    task.second();
+                    guard.lock();
+                }
+            }
+        }
+        size_t idle;
+        bool stopping;
+        std::mutex lock;
+        std::condition_variable wake;
+        std::condition_variable ready;
+        std::deque<std::pair<std::function<void()>, std::function<void()> > > queue;
+        std::vector<std::thread> workers;
+    };
+
+    struct hedge_stats {
+        std::atomic<uint64_t> requests{0};
+        std::atomic<uint64_t> hedged{0};
+        std::atomic<uint64_t> hedge_wins{0};
+        std::atomic<uint64_t> retried{0};
+        std::atomic<uint64_t> budget_denied{0};
+        //requests sent without a hedge because every hedging thread was busy
+        std::atomic<uint64_t> saturated{0};
+    };
+
+    //sends idempotent requests to one backend and, if no answer arrived by the configured
+    //latency percentile, a second copy to another backend, taking whichever answers first.
+    //hedges and retries spend from a retry budget so at most hedge_budget percent extra load
+    //is generated
+    class hedged_upstream {
+    public:
+        hedged_upstream() = delete;
+        hedged_upstream(const std::vector<backend>& backends, const upstream_config_t& config) :
+            percentile(0.95), min_delay(std::chrono::milliseconds(5)), default_delay(std::chrono::milliseconds(50)),
+            next(0) {
+            if(backends.empty())
+                throw std::runtime_error("Hedging needs at least one backend");
+            auto number = [&config](const char* key, double& value) {
+                auto found = config.find(key);
+                if(found == config.end())
+                    return;
+                char* end = nullptr;
+                value = std::strtod(found->second.c_str(), &end);
+                if(end == found->second.c_str() || value < 0)
+                    throw std::runtime_error(found->second + " is not a valid " + key);
+            };
+            double pct = 95, budget_percent = 10, min_ms = 5, default_ms = 50, threads = 8;
+            number("hedge_percentile", pct);
+            number("hedge_budget", budget_percent);
+            number("hedge_min_ms", min_ms);
+            number("hedge_default_ms", default_ms);
+            number("hedge_threads", threads);
+            if(pct <= 0 || pct >= 100)
+                throw std::runtime_error("hedge_percentile must be between 0 and 100");
+            percentile = pct / 100;
+            min_delay = std::chrono::microseconds(static_cast<int64_t>(min_ms * 1000));
+            default_delay = std::chrono::microseconds(static_cast<int64_t>(default_ms * 1000));
+            budget.reset(new retry_budget(budget_percent / 100, 100));
+            workers.reset(new executor(static_cast<size_t>(std::max(1.0, threads))));
+            for(const auto& b : backends)
+                pools.emplace_back(new pool(b, config));
+        }
+
+        http::response exchange(const http::request& request) {
+            ++stats.requests;
+            budget->deposit();
+            size_t primary = next++ % pools.size();
+            if(pools.size() < 2 || !http::idempotent(request.method) || !request.body.empty())
+                return timed(primary, request);
+
+            //the race is shared with the worker threads, the loser may finish long after we returned
+            auto race = std::make_shared<state>();
+            if(!launch(race, primary, request, false)) {
+                ++stats.saturated;
+                return unhedged(primary, request);
+            }
+            std::unique_lock<std::mutex> guard(race->lock);
+            //a primary that is slow gets hedged, one that failed fast gets retried, both cost budget
+            bool answered = race->done.wait_for(guard, delay(), [&race]() { return race->finished > 0; });
+            if(!race->winner) {
+                if(budget->withdraw()) {
+                    guard.unlock();
+                    if(launch(race, (primary + 1) % pools.size(), request, true)) {
+                        ++(answered ? stats.retried : stats.hedged);
+                    }
+                    else if(answered) {
+                        //the primary already failed and nobody is free, so retry right here
+                        ++stats.retried;
+                        return timed((primary + 1) % pools.size(), request);
+                    }
+                    else {
+                        budget->refund();
+                        ++stats.saturated;
+                    }
+                    guard.lock();
+                }
+                else {
+                    ++stats.budget_denied;
+                }
+            }
+            race->done.wait(guard, [&race]() { return race->winner || race->finished == race->launched; });
+            if(race->winner) {
+                if(race->hedge_won)
+                    ++stats.hedge_wins;
+                return *race->winner;
+            }
+            std::rethrow_exception(race->failure);
+        }
+
+        //how long we wait before hedging, the configured percentile of recent latencies
+        std::chrono::microseconds delay() const {
+            uint64_t samples = 0;
+            auto p = std::chrono::microseconds(latencies.percentile(percentile, samples));
+            if(samples < 100)
+                return default_delay;
+            return std::max(p, min_delay);
+        }
+
+        const hedge_stats& statistics() const {
+            return stats;
+        }
+
+    protected:
+        struct state {
+            std::mutex lock;
+            std::condition_variable done;
+            size_t launched = 0;
+            size_t finished = 0;
+            std::unique_ptr<http::response> winner;
+            bool hedge_won = false;
+            std::exception_ptr failure;
+        };
+        struct outcome {
+            std::unique_ptr<http::response> response;
+            std::exception_ptr failure;
+        };
+
+        bool launch(const std::shared_ptr<state>& race, size_t index, const http::request& request, bool hedge) {
+            {
+                std::lock_guard<std::mutex> guard(race->lock);
+                ++race->launched;
+            }
+            //the answer is only told once the thread is free, a retry it triggers can have it
+            auto result = std::make_shared<outcome>();
+            bool queued = workers->submit([this, result, index, request]() {
+                try {
+                    result->response.reset(new http::response(timed(index, request)));
+                }
+                catch(...) {
+                    result->failure = std::current_exception();
+                }
+            }, [race, result, hedge]() {
+                std::lock_guard<std::mutex> guard(race->lock);
+                ++race->finished;
+                if(result->response && !race->winner) {
+                    race->winner = std::move(result->response);
+                    race->hedge_won = hedge;
+                }
+                else if(result->failure) {
+                    race->failure = result->failure;
+                }
+                race->done.notify_all();
+            });
+            if(!queued) {
+                std::lock_guard<std::mutex> guard(race->lock);
+                --race->launched;
+            }
+            return queued;
+        }
+
+        //the primary on the calling thread when nobody is free to race it, a failure still gets
+        //the budgeted retry on the next pool
+        http::response unhedged(size_t primary, const http::request& request) {
+            try {
+                return timed(primary, request);
+            }
+            catch(...) {
+                if(!budget->withdraw()) {
+                    ++stats.budget_denied;
+                    throw;
+                }
+            }
+            ++stats.retried;
+            return timed((primary + 1) % pools.size(), request);
+        }
+
+        http::response timed(size_t index, const http::request& request) {
+            auto start = clock::now();
+            auto response = pools[index]->exchange(request);
+            latencies.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count()));
+            return response;
+        }
+
+        double percentile;
+        std::chrono::microseconds min_delay;
+        std::chrono::microseconds default_delay;
+        std::atomic<size_t> next;
+        std::vector<std::unique_ptr<pool> > pools;
+        histogram latencies;
+        std::unique_ptr<retry_budget> budget;
+        std::unique_ptr<executor> workers;
+        hedge_stats stats;
+    };
+}
+
+#endif //__HEDGING_HPP__
+
+#ifdef TEST_HEDGING
+//g++ -std=c++17 -O2 -DTEST_HEDGING -Iinclude -x c++ include/upstream/hedging.hpp -o hedgingtest -pthread
+#include <arpa/inet.h>
+#include <cassert>
+#include <iostream>
+
+namespace {
+  //a backend on a loopback port, a thread per connection, that takes delay(target) to answer
+  struct slow_backend {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    uint16_t port = 0;
+    std::string name;
+    std::function<std::chrono::milliseconds(const std::string&)> delay;
+    std::atomic<size_t> served{0};
+    std::mutex lock;
+    std::vector<int> connections;
+    std::vector<std::thread> threads;
+    std::thread acceptor;
+    slow_backend(std::string name, std::function<std::chrono::milliseconds(const std::string&)> delay) :
+      name(std::move(name)), delay(std::move(delay)) {
+      sockaddr_in a{};
+      a.sin_family = AF_INET;
+      a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      socklen_t length = sizeof(a);
+      assert(bind(fd, reinterpret_cast<sockaddr*>(&a), sizeof(a)) == 0 && listen(fd, 64) == 0);
+      getsockname(fd, reinterpret_cast<sockaddr*>(&a), &length);
+      port = ntohs(a.sin_port);
+      acceptor = std::thread([this]() {
+        int c;
+        while((c = accept(fd, nullptr, nullptr)) >= 0) {
+          std::lock_guard<std::mutex> guard(lock);
+          connections.push_back(c);
+          threads.emplace_back([this, c]() { serve(c); });
+        }
+      });
+    }
+    void serve(int c) {
+      std::string in;
+      char buffer[4096];
+      ssize_t got;
+      while((got = read(c, buffer, sizeof(buffer))) > 0) {
+        in.append(buffer, static_cast<size_t>(got));
+        http::request request;
+        size_t head;
+        while((head = http::parse_request_head(in.data(), in.size(), request))) {
+          in.erase(0, head);
+          std::this_thread::sleep_for(delay(request.target));
+          ++served;
+          std::string out = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(name.size()) + "\r\n\r\n" + name;
+          if(write(c, out.data(), out.size()) != static_cast<ssize_t>(out.size()))
+            return;
+        }
+      }
+    }
+    ~slow_backend() {
+      shutdown(fd, SHUT_RDWR);
+      acceptor.join();
+      for(int c : connections)
+        shutdown(c, SHUT_RDWR);
+      for(auto& t : threads)
+        t.join();
+      for(int c : connections)
+        close(c);
+      close(fd);
+    }
+  };
+
+  http::request get(const std::string& target) {
+    http::request r;
+    r.method = "GET";
+    r.target = target;
+    r.headers = {{"Host", "localhost"}};
+    return r;
+  }
+
+  double millis_since(upstream::clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(upstream::clock::now() - start).count();
+  }
+}
+
+int main() {
+  using std::chrono::milliseconds;
+  //a answers /stall and everything else slowly, b only stalls on /stall
+  slow_backend a("a", [](const std::string&) { return milliseconds(300); });
+  slow_backend b("b", [](const std::string& target) { return milliseconds(target == "/stall" ? 300 : 0); });
+  std::vector<upstream::backend> backends{{"127.0.0.1", a.port}, {"127.0.0.1", b.port}};
+  upstream::upstream_config_t config{{"hedge_default_ms", "20"}, {"hedge_threads", "2"}, {"hedge_budget", "100"}};
+
+  //a slow primary is hedged and the hedge answers long before the primary would have
+  {
+    upstream::hedged_upstream hedged(backends, config);
+    auto start = upstream::clock::now();
+    auto response = hedged.exchange(get("/"));
+    assert(response.body == "b" && millis_since(start) < 200);
+    const auto& stats = hedged.statistics();
+    assert(stats.hedged == 1 && stats.hedge_wins == 1 && stats.saturated == 0);
+    //the primary goes to b next, which needs no hedge
+    assert(hedged.exchange(get("/")).body == "b" && stats.hedged == 1);
+  }
+
+  //both hedging threads stuck on stalled exchanges: a request arriving then does not queue
+  //behind them, its primary runs on the caller and answers as fast as its backend does
+  {
+    upstream::hedged_upstream hedged(backends, config);
+    std::vector<std::thread> stalled;
+    for(int i = 0; i < 2; ++i)
+      stalled.emplace_back([&hedged]() { assert(hedged.exchange(get("/stall")).status == 200); });
+    std::this_thread::sleep_for(milliseconds(50));
+    //two at once so one of them has b as its primary, whichever way the round robin went
+    std::atomic<double> fastest{1e9};
+    std::vector<std::thread> probes;
+    for(int i = 0; i < 2; ++i)
+      probes.emplace_back([&hedged, &fastest]() {
+        auto start = upstream::clock::now();
+        assert(hedged.exchange(get("/")).status == 200);
+        double took = millis_since(start), current = fastest;
+        while(took < current && !fastest.compare_exchange_weak(current, took));
+      });
+    for(auto& t : probes)
+      t.join();
+    assert(fastest < 100);
+    for(auto& t : stalled)
+      t.join();
+    assert(hedged.statistics().saturated >= 1);
+  }
+
+  //a primary that fails outright is retried on the other backend
+  {
+    int closed = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    bind(closed, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    getsockname(closed, reinterpret_cast<sockaddr*>(&address), &length);
+    //bound but never listening, connects are refused
+    upstream::hedged_upstream hedged({{"127.0.0.1", ntohs(address.sin_port)}, {"127.0.0.1", b.port}}, config);
+    for(int i = 0; i < 4; ++i)
+      assert(hedged.exchange(get("/")).body == "b");
+    assert(hedged.statistics().retried == 2);
+
+    //with the only hedging thread stuck on a stall of b, a refused primary running on the
+    //caller is still retried on b
+    upstream::upstream_config_t single = config;
+    single["hedge_threads"] = "1";
+    upstream::hedged_upstream busy({{"127.0.0.1", ntohs(address.sin_port)}, {"127.0.0.1", b.port}}, single);
+    assert(busy.exchange(get("/")).body == "b" && busy.statistics().retried == 1);
+    std::thread stall([&busy]() { assert(busy.exchange(get("/stall")).body == "b"); });
+    std::this_thread::sleep_for(milliseconds(100));
+    uint64_t saturated = busy.statistics().saturated;
+    assert(busy.exchange(get("/")).body == "b");
+    assert(busy.statistics().retried == 2 && busy.statistics().saturated == saturated + 1);
+    stall.join();
+    close(closed);
+  }
+
+  //without budget there are no hedges at all
+  {
+    upstream::hedged_upstream hedged(backends, {{"hedge_default_ms", "20"}, {"hedge_budget", "0"}});
+    assert(hedged.exchange(get("/")).body == "a");
+    assert(hedged.statistics().hedged == 0 && hedged.statistics().budget_denied == 1);
+  }
+  std::cout << "hedging ok" << std::endl;
+  return 0;
+}
+#endif
@@ -0,0 +1,236 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __HISTOGRAM_HPP__
+#define __HISTOGRAM_HPP__
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+
+namespace upstream {
+    //a histogram with log2 major buckets split into 8 linear sub buckets, good to about 12%
+    //relative error over the whole uint64 range. two generations are kept and rotated so
+    //percentiles follow recent traffic. next to them run counters by power of two that are
+    //never reset, which is what gets exported. recording is a few relaxed atomic adds
+    class histogram {
+    public:
+        //the exported bounds are 2^0 to 2^(BOUNDS - 1), larger values only count towards +Inf
+        static constexpr size_t BOUNDS = 33;
+
+        explicit histogram(std::chrono::seconds window = std::chrono::seconds(10)) :
+            window(window), current(0), rotated(std::chrono::steady_clock::now().time_since_epoch().count()), total_sum(0) {
+            for(auto& generation : counts)
+                for(auto& c : generation)
+                    c = 0;
+            for(auto& s : sums)
+                s = 0;
+            for(auto& t : totals)
+                t = 0;
+        }
+
+        void record(uint64_t value) {
+            maybe_rotate();
+            size_t generation = current.load(std::memory_order_relaxed);
+            counts[generation][bucket(value)].fetch_add(1, std::memory_order_relaxed);
+            sums[generation].fetch_add(value, std::memory_order_relaxed);
+            totals[value <= 1 ? 0 : 64 - __builtin_clzll(value - 1)].fetch_add(1, std::memory_order_relaxed);
+            total_sum.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        //the value below which quantile (0..1) of the samples in both generations fall
+        uint64_t percentile(double quantile, uint64_t& samples) const {
+            std::array<uint64_t, BUCKETS> merged{};
+            samples = 0;
+            for(const auto& generation : counts)
+                for(size_t b = 0; b < BUCKETS; ++b) {
+                    merged[b] += generation[b].load(std::memory_order_relaxed);
+                    samples += generation[b].load(std::memory_order_relaxed);
+                }
+            auto rank = static_cast<uint64_t>(quantile * static_cast<double>(samples));
+            uint64_t seen = 0;
+            for(size_t b = 0; b < BUCKETS; ++b) {
+                seen += merged[b];
+                if(seen > rank)
+                    return upper_bound(b);
+            }
+            return upper_bound(BUCKETS - 1);
+        }
+
+        //(upper bound, count) of every non empty bucket in both generations
+        std::vector<std::pair<uint64_t, uint64_t> > snapshot() const {
+            std::vector<std::pair<uint64_t, uint64_t> > out;
+            for(size_t b = 0; b < BUCKETS; ++b) {
+                uint64_t n = counts[0][b].load(std::memory_order_relaxed) + counts[1][b].load(std::memory_order_relaxed);
+                if(n)
+                    out.emplace_back(upper_bound(b), n);
+            }
+            return out;
+        }
+
+        //the total of the samples in both generations
+        uint64_t sum() const {
+            return sums[0].load(std::memory_order_relaxed) + sums[1].load(std::memory_order_relaxed);
+        }
+
+        //since the histogram was made: samples up to 2^bound, up to BOUNDS and beyond for
+        //bound == BOUNDS, and their total. neither ever goes down
+        uint64_t cumulative(size_t bound) const {
+            uint64_t n = 0;
+            for(size_t b = 0; b < totals.size() && (b <= bound || bound >= BOUNDS); ++b)
+                n += totals[b].load(std::memory_order_relaxed);
+            return n;
+        }
+        uint64_t cumulative_sum() const {
+            return total_sum.load(std::memory_order_relaxed);
+        }
+
+    protected:
+        static constexpr size_t SUB = 8;
+        static constexpr size_t BUCKETS = 64 * SUB;
+        static size_t bucket(uint64_t v) {
+            if(v < SUB)
+                return static_cast<size_t>(v);
+            int major = 63 - __builtin_clzll(v);
+            size_t sub = static_cast<size_t>((v >> (major - 3)) & (SUB - 1));
+            return std::min(BUCKETS - 1, static_cast<size_t>(major - 2) * SUB + sub);
+        }
+        static uint64_t upper_bound(size_t b) {
+            if(b < SUB)
+                return b + 1;
+            size_t major = b / SUB + 2, sub = b % SUB;
+            if(major >= 63)
+                return UINT64_MAX;
+            return ((SUB + sub + 1) << (major - 3));
+        }
+        void maybe_rotate() {
+            auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+            auto last = rotated.load(std::memory_order_relaxed);
+            if(now - last < std::chrono::duration_cast<std::chrono::steady_clock::duration>(window).count())
+                return;
+            if(!rotated.compare_exchange_strong(last, now))
+                return;
+            //the older generation becomes the new current one
+            size_t next = current.load() ^ 1;
+            for(auto& c : counts[next])
+                c.store(0, std::memory_order_relaxed);
+            sums[next].store(0, std::memory_order_relaxed);
+            current.store(next);
+        }
+        std::chrono::seconds window;
+        std::atomic<size_t> current;
+        std::atomic<std::chrono::steady_clock::rep> rotated;
+        std::array<std::array<std::atomic<uint64_t>, BUCKETS>, 2> counts;
+        std::array<std::atomic<uint64_t>, 2> sums;
+        //by the smallest power of two at least the value, 2^0 to 2^64
+        std::array<std::atomic<uint64_t>, 65> totals;
+        std::atomic<uint64_t> total_sum;
+    };
+
+    //the '# TYPE' line announcing a metric family, once per name however many label sets follow
+    inline void describe(std::string& out, const std::string& name, const char* type) {
+        out.append("# TYPE " + name + " " + type + "\n");
+    }
+
+    //appends a histogram in the prometheus text format: every power of two bound, empty or not,
+    //plus sum and count, all counted since the histogram was made so rate() works on them. the
+    //windowed view is for percentile() only. typed writes the TYPE line first, leave it off for
+    //the second and later label sets of name
+    inline void expose(std::string& out, const std::string& name, const std::string& labels, const histogram& h, bool typed = true) {
+        if(typed)
+            describe(out, name, "histogram");
+        //the reads race with recording, take the sum first so it never runs ahead of the buckets
+        uint64_t sum = h.cumulative_sum();
+        std::string prefix = name + "_bucket{" + labels + (labels.empty() ? "" : ",") + "le=\"";
+        uint64_t below = 0;
+        for(size_t b = 0; b < histogram::BOUNDS; ++b) {
+            //each bucket read after the ones below it, so they never come out of order
+            below = std::max(below, h.cumulative(b));
+            out.append(prefix + std::to_string(uint64_t(1) << b) + "\"} " + std::to_string(below) + "\n");
+        }
+        uint64_t count = std::max(below, h.cumulative(histogram::BOUNDS));
+        out.append(prefix + "+Inf\"} " + std::to_string(count) + "\n");
+        out.append(name + "_sum{" + labels + "} " + std::to_string(sum) + "\n");
+        out.append(name + "_count{" + labels + "} " + std::to_string(count) + "\n");
+    }
+}
+
+#endif //__HISTOGRAM_HPP__
+
+#ifdef TEST_HISTOGRAM
+//g++ -std=c++17 -O2 -DTEST_HISTOGRAM -Iinclude -x c++ include/upstream/histogram.hpp -o histogramtest
+#include <cassert>
+#include <iostream>
+
+int main() {
+  upstream::histogram h;
+  uint64_t samples = 0;
+  h.percentile(0.5, samples);
+  assert(samples == 0 && h.sum() == 0);
+  for(uint64_t v = 1; v <= 1000; ++v)
+    h.record(v);
+  assert(h.sum() == 500500);
+  //within the bucket resolution of the exact answer
+  uint64_t p50 = h.percentile(0.5, samples), p99 = h.percentile(0.99, samples);
+  assert(samples == 1000);
+  assert(p50 >= 500 && p50 <= 500 * 1.13 && p99 >= 990 && p99 <= 990 * 1.13);
+  //small values have exact buckets
+  upstream::histogram small;
+  for(int i = 0; i < 10; ++i)
+    small.record(3);
+  assert(small.percentile(0.5, samples) == 4 && small.snapshot().size() == 1);
+  //the largest values land in the last bucket rather than out of range
+  small.record(UINT64_MAX);
+  assert(small.percentile(1.0, samples) == UINT64_MAX);
+
+  std::string out;
+  upstream::histogram latency;
+  latency.record(2);
+  latency.record(2);
+  latency.record(100);
+  upstream::expose(out, "wait_us", "backend=\"a\"", latency);
+  upstream::expose(out, "wait_us", "backend=\"b\"", latency, false);
+  assert(out.compare(0, 27, "# TYPE wait_us histogram\nwa") == 0);
+  assert(out.find("# TYPE", 1) == std::string::npos);
+  //every bound is written, empty ones included, counting everything at or below it
+  assert(out.find("wait_us_bucket{backend=\"a\",le=\"1\"} 0\n") != std::string::npos);
+  assert(out.find("wait_us_bucket{backend=\"a\",le=\"2\"} 2\n") != std::string::npos);
+  assert(out.find("wait_us_bucket{backend=\"a\",le=\"64\"} 2\n") != std::string::npos);
+  assert(out.find("wait_us_bucket{backend=\"a\",le=\"128\"} 3\n") != std::string::npos);
+  assert(out.find("wait_us_bucket{backend=\"a\",le=\"4294967296\"} 3\n") != std::string::npos);
+  assert(out.find("wait_us_bucket{backend=\"a\",le=\"+Inf\"} 3\n") != std::string::npos);
+  size_t buckets = 0;
+  for(size_t at = out.find("wait_us_bucket{backend=\"b\""); at != std::string::npos; at = out.find("wait_us_bucket{backend=\"b\"", at + 1))
+    ++buckets;
+  assert(buckets == upstream::histogram::BOUNDS + 1);
+  assert(out.find("wait_us_sum{backend=\"a\"} 104\n") != std::string::npos);
+  assert(out.find("wait_us_count{backend=\"b\"} 3\n") != std::string::npos);
+  //sum comes before count in each series
+  assert(out.find("wait_us_sum{backend=\"a\"}") < out.find("wait_us_count{backend=\"a\"}"));
+
+  //a rotation forgets the generation before last
+  upstream::histogram windowed(std::chrono::seconds(0));
+  windowed.record(5);
+  windowed.record(7);
+  windowed.record(9);
+  assert(windowed.sum() == 16);
+  //while the exported counters keep everything, values past the last bound only in +Inf
+  windowed.record(uint64_t(1) << 40);
+  out.clear();
+  upstream::expose(out, "wait_us", "", windowed);
+  assert(out.find("wait_us_bucket{le=\"8\"} 2\n") != std::string::npos);
+  assert(out.find("wait_us_bucket{le=\"16\"} 3\n") != std::string::npos);
+  assert(out.find("wait_us_bucket{le=\"4294967296\"} 3\n") != std::string::npos);
+  assert(out.find("wait_us_bucket{le=\"+Inf\"} 4\n") != std::string::npos);
+  assert(out.find("wait_us_sum{} " + std::to_string(21 + (uint64_t(1) << 40)) + "\n") != std::string::npos);
+  assert(out.find("wait_us_count{} 4\n") != std::string::npos);
+  std::cout << "histogram ok" << std::endl;
+  return 0;
+}
+#endif
@@ -0,0 +1,293 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __QUEUE_HPP__
+#define __QUEUE_HPP__
+
+#include "upstream/upstream.hpp"
+#include "upstream/histogram.hpp"
+
+#include <list>
+#include <atomic>
+#include <condition_variable>
+
+namespace upstream {
+    //thrown when a request could not get a connection slot, full queue or waited too long
+    class queue_error : public upstream_error {
+    public:
+        queue_error(const std::string& what, bool timed_out) : upstream_error(what), timed_out(timed_out) {}
+        //a timeout maps to 504, a full queue to 503
+        int status() const {
+            return timed_out ? 504 : 503;
+        }
+        bool timed_out;
+    };
+
+    //caps the connections in use towards one backend. requests over the cap wait in a bounded
+    //fifo instead of failing, a released slot is handed straight to the oldest waiter so nobody
+    //is overtaken by a newcomer, and waiters give up after queue_timeout
+    class admission {
+    public:
+        admission() = delete;
+        admission(size_t max_connections, size_t max_queue, std::chrono::milliseconds timeout) :
+            max_connections(max_connections), max_queue(max_queue), timeout(timeout), active(0) {
+            if(max_connections == 0)
+                throw std::runtime_error("max_connections must be positive");
+        }
+
+        //holds one connection slot for as long as it lives
+        class slot {
+        public:
+            slot() : owner(nullptr) {}
+            explicit slot(admission* owner) : owner(owner) {}
+            slot(slot&& other) noexcept : owner(other.owner) { other.owner = nullptr; }
+            slot& operator=(slot&& other) noexcept {
+                if(this != &other) {
+                    reset();
+                    owner = other.owner;
+                    other.owner = nullptr;
+                }
+                return *this;
+            }
+            ~slot() { reset(); }
+            void reset() {
+                if(owner)
+                    owner->release();
+                owner = nullptr;
+            }
+        protected:
+            admission* owner;
+        };
+
+        slot acquire() {
+            auto start = clock::now();
+            std::unique_lock<std::mutex> guard(lock);
+            if(active < max_connections && waiters.empty()) {
+                ++active;
+                waits.record(0);
+                return slot(this);
+            }
+            if(waiters.size() >= max_queue) {
+                ++rejected;
+                throw queue_error("Upstream queue is full", false);
+            }
+            depths.record(waiters.size() + 1);
+            waiters.emplace_back();
+            auto me = std::prev(waiters.end());
+            bool granted = me->wake.wait_for(guard, timeout, [&me]() { return me->granted; });
+            waiters.erase(me);
+            waits.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count()));
+            if(!granted) {
+                ++timeouts;
+                throw queue_error("Timed out waiting for an upstream connection", true);
+            }
+            return slot(this);
+        }
+
+        //current queue depth and connections in use
+        size_t queued() {
+            std::lock_guard<std::mutex> guard(lock);
+            return waiters.size();
+        }
+        size_t in_use() {
+            std::lock_guard<std::mutex> guard(lock);
+            return active;
+        }
+
+        //appends gauges, counters and the queue depth and wait time histograms in prometheus text
+        //format. typed writes the TYPE lines, leave it off for the second and later backend
+        void metrics(std::string& out, const std::string& labels, bool typed = true) {
+            size_t depth, busy;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                depth = waiters.size();
+                busy = active;
+            }
+            auto sample = [&](const char* name, const char* type, uint64_t value) {
+                if(typed)
+                    describe(out, name, type);
+                out.append(std::string(name) + "{" + labels + "} " + std::to_string(value) + "\n");
+            };
+            sample("cheehttpd_upstream_queue_depth", "gauge", depth);
+            sample("cheehttpd_upstream_active_connections", "gauge", busy);
+            sample("cheehttpd_upstream_queue_rejected_total", "counter", rejected.load());
+            sample("cheehttpd_upstream_queue_timeouts_total", "counter", timeouts.load());
+            expose(out, "cheehttpd_upstream_queue_depth_observed", labels, depths, typed);
+            expose(out, "cheehttpd_upstream_queue_wait_microseconds", labels, waits, typed);
+        }
+
+    protected:
+        struct waiter {
+            std::condition_variable wake;
+            bool granted = false;
+        };
+
+        void release() {
+            std::lock_guard<std::mutex> guard(lock);
+            //hand the slot to the oldest waiter still waiting, the active count stays the same
+            for(auto& w : waiters)
+                if(!w.granted) {
+                    w.granted = true;
+                    w.wake.notify_one();
+                    return;
+                }
+            --active;
+        }
+
+        size_t max_connections;
+        size_t max_queue;
+        std::chrono::milliseconds timeout;
+        std::mutex lock;
+        size_t active;
+        std::list<waiter> waiters;
+        std::atomic<uint64_t> rejected{0};
+        std::atomic<uint64_t> timeouts{0};
+        histogram depths;
+        histogram waits;
+    };
+
+    //a connection pool behind an admission queue, the upstream never sees more than
+    //max_connections concurrent requests from this process
+    class queued_pool {
+    public:
+        queued_pool() = delete;
+        queued_pool(const backend& target, const upstream_config_t& config) : connections(target, config) {
+            auto parse = [&config](const char* key, size_t& value) {
+                auto found = config.find(key);
+                if(found == config.end())
+                    return;
+                try {
+                    value = std::stoul(found->second);
+                }
+                catch(...) {
+                    throw std::runtime_error(found->second + " is not a valid " + key);
+                }
+            };
+            size_t max_connections = 64, max_queue = 1024, timeout_ms = 1000;
+            parse("max_connections", max_connections);
+            parse("max_queue", max_queue);
+            parse("queue_timeout_ms", timeout_ms);
+            gate.reset(new admission(max_connections, max_queue, std::chrono::milliseconds(timeout_ms)));
+        }
+
+        http::response exchange(const http::request& request, const body_sink& sink = nullptr) {
+            auto held = gate->acquire();
+            return connections.exchange(request, sink);
+        }
+
+        void metrics(std::string& out, bool typed = true) {
+            gate->metrics(out, "backend=\"" + connections.peer().name() + "\"", typed);
+        }
+
+        admission& queue() {
+            return *gate;
+        }
+
+    protected:
+        pool connections;
+        std::unique_ptr<admission> gate;
+    };
+}
+
+#endif //__QUEUE_HPP__
+
+#ifdef TEST_QUEUE
+//g++ -std=c++17 -O2 -DTEST_QUEUE -Iinclude -x c++ include/upstream/queue.hpp -o queuetest -pthread
+#include <cassert>
+#include <iostream>
+#include <thread>
+
+int main() {
+  using std::chrono::milliseconds;
+  auto wait_for = [](const std::function<bool()>& done) {
+    for(int i = 0; i < 1000 && !done(); ++i)
+      std::this_thread::sleep_for(milliseconds(1));
+    assert(done());
+  };
+
+  //one slot, two waiters: they get it in the order they came, each release waking the next,
+  //and a third waiter finds the queue full
+  {
+    upstream::admission gate(1, 2, milliseconds(5000));
+    auto held = gate.acquire();
+    assert(gate.in_use() == 1 && gate.queued() == 0);
+    std::mutex lock;
+    std::vector<int> order;
+    std::vector<std::thread> waiters;
+    for(int i = 1; i <= 2; ++i) {
+      waiters.emplace_back([&gate, &lock, &order, i]() {
+        auto slot = gate.acquire();
+        std::lock_guard<std::mutex> guard(lock);
+        order.push_back(i);
+      });
+      wait_for([&gate, i]() { return gate.queued() == static_cast<size_t>(i); });
+    }
+    try {
+      gate.acquire();
+      assert(false);
+    }
+    catch(const upstream::queue_error& e) {
+      assert(!e.timed_out && e.status() == 503);
+    }
+    //nobody got in while the slot was held
+    std::this_thread::sleep_for(milliseconds(20));
+    assert(order.empty() && gate.in_use() == 1);
+    held.reset();
+    for(auto& t : waiters)
+      t.join();
+    assert((order == std::vector<int>{1, 2}));
+    assert(gate.in_use() == 0 && gate.queued() == 0);
+  }
+
+  //a waiter gives up at its deadline
+  {
+    upstream::admission gate(1, 1, milliseconds(50));
+    auto held = gate.acquire();
+    auto start = upstream::clock::now();
+    try {
+      gate.acquire();
+      assert(false);
+    }
+    catch(const upstream::queue_error& e) {
+      assert(e.timed_out && e.status() == 504);
+    }
+    assert(upstream::clock::now() - start >= milliseconds(50));
+    assert(gate.queued() == 0 && gate.in_use() == 1);
+  }
+
+  //the pool reports its queue under the backend label, and a failed exchange gives back its slot
+  {
+    upstream::queued_pool pool({"127.0.0.1", 1}, {{"max_connections", "1"}, {"max_queue", "0"}, {"timeout_ms", "100"}});
+    try {
+      pool.exchange(http::request{});
+      assert(false);
+    }
+    catch(const upstream::upstream_error& e) {
+      assert(dynamic_cast<const upstream::queue_error*>(&e) == nullptr);
+    }
+    assert(pool.queue().in_use() == 0);
+    auto held = pool.queue().acquire();
+    try {
+      pool.exchange(http::request{});
+      assert(false);
+    }
+    catch(const upstream::queue_error& e) {
+      assert(e.status() == 503);
+    }
+    std::string out;
+    pool.metrics(out);
+    assert(out.find("# TYPE cheehttpd_upstream_queue_depth gauge\n") != std::string::npos);
+    assert(out.find("cheehttpd_upstream_active_connections{backend=\"127.0.0.1:1\"} 1\n") != std::string::npos);
+    assert(out.find("cheehttpd_upstream_queue_rejected_total{backend=\"127.0.0.1:1\"} 1\n") != std::string::npos);
+    assert(out.find("cheehttpd_upstream_queue_timeouts_total{backend=\"127.0.0.1:1\"} 0\n") != std::string::npos);
+    assert(out.find("cheehttpd_upstream_queue_wait_microseconds_count{backend=\"127.0.0.1:1\"} 2\n") != std::string::npos);
+    //typed only once, later backends append their series under the same TYPE lines
+    std::string more;
+    pool.metrics(more, false);
+    assert(more.find("# TYPE") == std::string::npos && more.find("cheehttpd_upstream_queue_depth{") != std::string::npos);
+  }
+  std::cout << "queue ok" << std::endl;
+  return 0;
+}
+#endif
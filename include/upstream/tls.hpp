@@ -0,0 +1,529 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __TLS_HPP__
+#define __TLS_HPP__
+
+#include "upstream/upstream.hpp"
+
+#include <deque>
+#include <atomic>
+#include <arpa/inet.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+namespace upstream {
+    //the most recent openssl error as text
+    inline std::string tls_error() {
+        char text[256] = "unknown tls error";
+        unsigned long code = ERR_get_error();
+        if(code)
+            ERR_error_string_n(code, text, sizeof(text));
+        ERR_clear_error();
+        return text;
+    }
+
+    struct tls_stats {
+        std::atomic<uint64_t> handshakes{0};
+        std::atomic<uint64_t> resumed{0};
+        std::atomic<uint64_t> tickets{0};
+    };
+
+    //the client side tls settings shared by every connection to our https backends, along with
+    //the resumption sessions (tickets) each backend gave us. a new connection to a backend we
+    //talked to before presents its latest ticket and skips the full handshake.
+    //tls backends are spoken to in http/1.1 only. the http/2 pool runs its own reader thread
+    //straight on the socket, which a tls session cannot be shared with, so it stays cleartext
+    //h2c and tls_alpn may not offer h2
+    class tls_client {
+    public:
+        tls_client() = delete;
+        explicit tls_client(const upstream_config_t& config) : verify(true), sessions_per_upstream(4) {
+            auto parse = [&config](const char* key, size_t& value) {
+                auto found = config.find(key);
+                if(found == config.end())
+                    return;
+                try {
+                    value = std::stoul(found->second);
+                }
+                catch(...) {
+                    throw std::runtime_error(found->second + " is not a valid " + key);
+                }
+            };
+            size_t verify_peer = 1;
+            parse("tls_verify", verify_peer);
+            parse("tls_sessions_per_upstream", sessions_per_upstream);
+            verify = verify_peer != 0;
+
+            //wire format alpn list from 'http/1.1' or a comma list in preference order
+            auto alpn = config.find("tls_alpn");
+            std::string names = alpn == config.end() ? "http/1.1" : alpn->second;
+            size_t start = 0;
+            while(start < names.size()) {
+                size_t comma = names.find(',', start);
+                std::string name = names.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+                if(name.empty() || name.size() > 255)
+                    throw std::runtime_error(names + " is not a valid tls_alpn");
+                if(name == "h2")
+                    throw std::runtime_error("tls_alpn cannot offer h2, http/2 backends are only reached over cleartext h2c");
+                protocols.push_back(static_cast<char>(name.size()));
+                protocols.append(name);
+                start = comma == std::string::npos ? names.size() : comma + 1;
+            }
+            auto sni = config.find("tls_sni");
+            if(sni != config.end())
+                server_name = sni->second;
+
+            context = SSL_CTX_new(TLS_client_method());
+            if(!context)
+                throw std::runtime_error("Couldn't create tls context: " + tls_error());
+            SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+            SSL_CTX_set_mode(context, SSL_MODE_AUTO_RETRY);
+            //a backend closing without close_notify is an ordinary end of connection
+            SSL_CTX_set_options(context, SSL_OP_IGNORE_UNEXPECTED_EOF);
+            //openssl keeps nothing itself, every session goes through remember below
+            SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+            SSL_CTX_sess_set_new_cb(context, &tls_client::remember);
+            SSL_CTX_set_ex_data(context, index(), this);
+            if(verify) {
+                SSL_CTX_set_verify(context, SSL_VERIFY_PEER, nullptr);
+                auto ca = config.find("tls_ca_file");
+                if(ca != config.end()) {
+                    if(SSL_CTX_load_verify_locations(context, ca->second.c_str(), nullptr) != 1) {
+                        std::string reason = tls_error();
+                        SSL_CTX_free(context);
+                        throw std::runtime_error("Couldn't load tls_ca_file " + ca->second + ": " + reason);
+                    }
+                }
+                else {
+                    SSL_CTX_set_default_verify_paths(context);
+                }
+            }
+        }
+        ~tls_client() {
+            for(auto& s : sessions)
+                for(auto* session : s.second)
+                    SSL_SESSION_free(session);
+            SSL_CTX_free(context);
+        }
+        tls_client(const tls_client&) = delete;
+        tls_client& operator=(const tls_client&) = delete;
+
+        //plugs into pool::set_connector
+        connector connect();
+
+        SSL_CTX* ctx() const {
+            return context;
+        }
+        const std::string& alpn() const {
+            return protocols;
+        }
+        bool verifies() const {
+            return verify;
+        }
+        //the name sent as sni and checked against the certificate, the host unless configured
+        std::string name_for(const backend& target) const {
+            return server_name.empty() ? target.host : server_name;
+        }
+
+        //a session to resume the next connection to key with, nullptr if we have none. tls 1.3
+        //tickets are handed out once as the rfc recommends, tls 1.2 ones stay until replaced
+        SSL_SESSION* take(const std::string& key) {
+            std::lock_guard<std::mutex> guard(lock);
+            auto found = sessions.find(key);
+            if(found == sessions.end() || found->second.empty())
+                return nullptr;
+            SSL_SESSION* session = found->second.back();
+            if(SSL_SESSION_get_protocol_version(session) >= TLS1_3_VERSION)
+                found->second.pop_back();
+            else
+                SSL_SESSION_up_ref(session);
+            return session;
+        }
+
+        const tls_stats& statistics() const {
+            return stats;
+        }
+
+        //the ssl ex_data slot holding the session key of a connection
+        static int index() {
+            static int slot = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+            return slot;
+        }
+
+    protected:
+        friend class tls_connection;
+
+        //openssl's new session callback, fires for every ticket including the ones tls 1.3 sends
+        //after the handshake. returning 1 means we kept the reference
+        static int remember(SSL* ssl, SSL_SESSION* session) {
+            auto* self = static_cast<tls_client*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), index()));
+            auto* key = static_cast<const std::string*>(SSL_get_ex_data(ssl, index()));
+            if(!self || !key || !SSL_SESSION_is_resumable(session))
+                return 0;
+            ++self->stats.tickets;
+            std::lock_guard<std::mutex> guard(self->lock);
+            auto& kept = self->sessions[*key];
+            kept.push_back(session);
+            while(kept.size() > self->sessions_per_upstream) {
+                SSL_SESSION_free(kept.front());
+                kept.pop_front();
+            }
+            return 1;
+        }
+
+        SSL_CTX* context;
+        bool verify;
+        size_t sessions_per_upstream;
+        std::string protocols;
+        std::string server_name;
+        std::mutex lock;
+        std::unordered_map<std::string, std::deque<SSL_SESSION*> > sessions;
+        tls_stats stats;
+    };
+
+    //an http/1.1 connection over tls, same framing as the plain one with ssl reads and writes
+    class tls_connection : public connection {
+    public:
+        tls_connection(tls_client& client, const backend& target, std::chrono::milliseconds timeout, const address_lookup& lookup = nullptr) :
+            connection(target, timeout, lookup), client(client), ssl(SSL_new(client.ctx())), key(client.name_for(target) + "@" + target.name()) {
+            if(!ssl)
+                throw upstream_error("Couldn't create tls session: " + tls_error());
+            std::string name = client.name_for(target);
+            SSL_set_fd(ssl, fd);
+            SSL_set_ex_data(ssl, tls_client::index(), &key);
+            //sni is only for names, never for address literals
+            in6_addr ignored;
+            if(inet_pton(AF_INET, name.c_str(), &ignored) != 1 && inet_pton(AF_INET6, name.c_str(), &ignored) != 1)
+                SSL_set_tlsext_host_name(ssl, name.c_str());
+            if(client.verifies())
+                SSL_set1_host(ssl, name.c_str());
+            const std::string& alpn = client.alpn();
+            SSL_set_alpn_protos(ssl, reinterpret_cast<const unsigned char*>(alpn.data()), static_cast<unsigned>(alpn.size()));
+            SSL_SESSION* session = client.take(key);
+            if(session) {
+                SSL_set_session(ssl, session);
+                SSL_SESSION_free(session);
+            }
+            try {
+                handshake();
+            }
+            catch(...) {
+                SSL_free(ssl);
+                throw;
+            }
+        }
+        ~tls_connection() override {
+            //best effort close_notify, we do not wait for the peer's
+            if(fd >= 0 && SSL_is_init_finished(ssl))
+                SSL_shutdown(ssl);
+            SSL_free(ssl);
+        }
+
+        //what the backend picked from our alpn list, empty if it ignored alpn
+        std::string protocol() const {
+            const unsigned char* data = nullptr;
+            unsigned length = 0;
+            SSL_get0_alpn_selected(ssl, &data, &length);
+            return std::string(reinterpret_cast<const char*>(data), length);
+        }
+        bool resumed() const {
+            return SSL_session_reused(ssl) == 1;
+        }
+
+        //the socket is useless without the tls state, nothing can take it over. this is what keeps
+        //tunnels and the http/2 pool on cleartext backends
+        int detach() override {
+            throw upstream_error("A tls connection to " + target.name() + " cannot be handed over");
+        }
+
+        //tls 1.3 tickets arrive after the handshake and make an idle socket readable, they are
+        //consumed here instead of costing us the connection
+        bool stale() override {
+            pollfd p{fd, POLLIN, 0};
+            if(poll(&p, 1, 0) == 0)
+                return false;
+            char peek;
+            ERR_clear_error();
+            int got = SSL_peek(ssl, &peek, 1);
+            if(got > 0)
+                return true;
+            int error = SSL_get_error(ssl, got);
+            return error != SSL_ERROR_WANT_READ;
+        }
+
+    protected:
+        void handshake() {
+            while(true) {
+                ERR_clear_error();
+                int done = SSL_connect(ssl);
+                if(done == 1)
+                    break;
+                if(!wait(SSL_get_error(ssl, done))) {
+                    long verified = SSL_get_verify_result(ssl);
+                    std::string reason = verified != X509_V_OK ? X509_verify_cert_error_string(verified) : tls_error();
+                    //whatever is left would show up as the reason of this thread's next tls error
+                    ERR_clear_error();
+                    throw upstream_error("TLS handshake with " + target.name() + " failed: " + reason);
+                }
+            }
+            ++client.stats.handshakes;
+            if(resumed())
+                ++client.stats.resumed;
+            //only reachable with a tls_alpn naming something other than h2 or http/1.1
+            std::string chosen = protocol();
+            if(!chosen.empty() && chosen != "http/1.1")
+                throw upstream_error(target.name() + " negotiated " + chosen + " where http/1.1 was needed");
+        }
+
+        //waits for what openssl asked for, false on a real error or timeout
+        bool wait(int error) {
+            if(error == SSL_ERROR_WANT_READ)
+                return wait_for(POLLIN);
+            if(error == SSL_ERROR_WANT_WRITE)
+                return wait_for(POLLOUT);
+            return false;
+        }
+
+        void write_all(const char* data, size_t size) override {
+            while(size) {
+                ERR_clear_error();
+                int sent = SSL_write(ssl, data, static_cast<int>(std::min<size_t>(size, 1 << 30)));
+                if(sent > 0) {
+                    data += sent;
+                    size -= static_cast<size_t>(sent);
+                    continue;
+                }
+                if(!wait(SSL_get_error(ssl, sent))) {
+                    reusable = false;
+                    throw upstream_error("Couldn't write to " + target.name() + ": " + tls_error());
+                }
+            }
+        }
+
+        bool fill() override {
+            char chunk[16384];
+            while(true) {
+                ERR_clear_error();
+                int got = SSL_read(ssl, chunk, sizeof(chunk));
+                if(got > 0) {
+                    buffer.append(chunk, static_cast<size_t>(got));
+                    return true;
+                }
+                int error = SSL_get_error(ssl, got);
+                if(error == SSL_ERROR_ZERO_RETURN) {
+                    reusable = false;
+                    return false;
+                }
+                if(!wait(error)) {
+                    reusable = false;
+                    throw upstream_error("Couldn't read from " + target.name() + ": " + tls_error());
+                }
+            }
+        }
+
+        tls_client& client;
+        SSL* ssl;
+        std::string key;
+    };
+
+    inline connector tls_client::connect() {
+        return [this](const backend& target, std::chrono::milliseconds timeout, const address_lookup& lookup) {
+            return std::unique_ptr<connection>(new tls_connection(*this, target, timeout, lookup));
+        };
+    }
+}
+
+#endif //__TLS_HPP__
+
+#ifdef TEST_TLS
+//g++ -std=c++17 -O2 -DTEST_TLS -Iinclude -x c++ include/upstream/tls.hpp -o tlstest -lssl -lcrypto -pthread
+#include <cassert>
+#include <iostream>
+#include <thread>
+#include <openssl/pem.h>
+
+namespace {
+  //an https upstream::backend on a loopback port with a throwaway self signed certificate for localhost
+  //and 127.0.0.1, a thread per connection answering keep-alive requests with their target
+  struct stand_in {
+    EVP_PKEY* key = EVP_EC_gen("P-256");
+    X509* certificate = X509_new();
+    SSL_CTX* context = SSL_CTX_new(TLS_server_method());
+    std::string ca_file;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    uint16_t port = 0;
+    std::atomic<size_t> handshakes{0};
+    std::mutex lock;
+    std::vector<int> connections;
+    std::vector<std::thread> threads;
+    std::thread acceptor;
+    stand_in() {
+      X509_set_version(certificate, 2);
+      ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+      X509_gmtime_adj(X509_getm_notBefore(certificate), -60);
+      X509_gmtime_adj(X509_getm_notAfter(certificate), 3600);
+      X509_set_pubkey(certificate, key);
+      X509_NAME* name = X509_get_subject_name(certificate);
+      X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+      X509_set_issuer_name(certificate, name);
+      X509V3_CTX v3;
+      X509V3_set_ctx_nodb(&v3);
+      X509V3_set_ctx(&v3, certificate, certificate, nullptr, nullptr, 0);
+      X509_EXTENSION* names = X509V3_EXT_conf_nid(nullptr, &v3, NID_subject_alt_name, "DNS:localhost,IP:127.0.0.1");
+      X509_add_ext(certificate, names, -1);
+      X509_EXTENSION_free(names);
+      assert(X509_sign(certificate, key, EVP_sha256()) > 0);
+      assert(SSL_CTX_use_certificate(context, certificate) == 1 && SSL_CTX_use_PrivateKey(context, key) == 1);
+      SSL_CTX_set_alpn_select_cb(context, [](SSL*, const unsigned char** out, unsigned char* length, const unsigned char* in,
+                                             unsigned size, void*) {
+        //picks the first protocol offered, whatever it is
+        if(size < 1 || in[0] + 1u > size)
+          return SSL_TLSEXT_ERR_NOACK;
+        *out = in + 1;
+        *length = in[0];
+        return SSL_TLSEXT_ERR_OK;
+      }, nullptr);
+      char path[] = "/tmp/tlstest-XXXXXX";
+      int file = mkstemp(path);
+      ca_file = path;
+      FILE* out = fdopen(file, "w");
+      PEM_write_X509(out, certificate);
+      fclose(out);
+
+      sockaddr_in a{};
+      a.sin_family = AF_INET;
+      a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      socklen_t length = sizeof(a);
+      assert(bind(fd, reinterpret_cast<sockaddr*>(&a), sizeof(a)) == 0 && listen(fd, 64) == 0);
+      getsockname(fd, reinterpret_cast<sockaddr*>(&a), &length);
+      port = ntohs(a.sin_port);
+      acceptor = std::thread([this]() {
+        int c;
+        while((c = accept(fd, nullptr, nullptr)) >= 0) {
+          std::lock_guard<std::mutex> guard(lock);
+          connections.push_back(c);
+          threads.emplace_back([this, c]() { serve(c); });
+        }
+      });
+    }
+    void serve(int c) {
+      SSL* ssl = SSL_new(context);
+      SSL_set_fd(ssl, c);
+      if(SSL_accept(ssl) == 1) {
+        ++handshakes;
+        std::string in;
+        char buffer[4096];
+        int got;
+        while((got = SSL_read(ssl, buffer, sizeof(buffer))) > 0) {
+          in.append(buffer, static_cast<size_t>(got));
+          http::request request;
+          size_t head;
+          while((head = http::parse_request_head(in.data(), in.size(), request))) {
+            in.erase(0, head);
+            std::string body = request.target + (SSL_session_reused(ssl) ? " resumed" : " full");
+            std::string out = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+            SSL_write(ssl, out.data(), static_cast<int>(out.size()));
+          }
+        }
+      }
+      SSL_free(ssl);
+    }
+    ~stand_in() {
+      shutdown(fd, SHUT_RDWR);
+      acceptor.join();
+      for(int c : connections)
+        shutdown(c, SHUT_RDWR);
+      for(auto& t : threads)
+        t.join();
+      for(int c : connections)
+        close(c);
+      close(fd);
+      SSL_CTX_free(context);
+      X509_free(certificate);
+      EVP_PKEY_free(key);
+      unlink(ca_file.c_str());
+    }
+  };
+
+  std::string get(upstream::pool& p, const std::string& target) {
+    http::request request;
+    request.method = "GET";
+    request.target = target;
+    http::set_header(request.headers, "Host", "localhost");
+    return p.exchange(request).body;
+  }
+  bool refused(const std::function<void()>& attempt) {
+    try {
+      attempt();
+    }
+    catch(const std::runtime_error&) {
+      return true;
+    }
+    return false;
+  }
+}
+
+int main() {
+  stand_in server;
+  upstream::backend named{"localhost", server.port}, literal{"127.0.0.1", server.port};
+
+  //keep-alive over one connection, then a new connection resumes with the ticket from the first
+  {
+    upstream::tls_client client(upstream::upstream_config_t{{"tls_ca_file", server.ca_file}});
+    upstream::pool p(named, upstream::upstream_config_t{});
+    p.set_connector(client.connect());
+    assert(get(p, "/one") == "/one full" && get(p, "/two") == "/two full");
+    assert(client.statistics().handshakes == 1 && client.statistics().tickets >= 1);
+    //a second connection while the first is checked out
+    auto first = p.acquire();
+    auto second = p.acquire();
+    auto* tls = dynamic_cast<upstream::tls_connection*>(second.get());
+    assert(tls && tls->resumed() && tls->protocol() == "http/1.1");
+    assert(client.statistics().handshakes == 2 && client.statistics().resumed == 1);
+    //tickets that arrived on an idle connection do not make it stale
+    assert(!first->stale());
+    //nothing can take the socket away from the tls session
+    assert(refused([&]() { second->detach(); }));
+  }
+
+  //certificates are checked against the name, ip literals against the address
+  {
+    upstream::tls_client client(upstream::upstream_config_t{{"tls_ca_file", server.ca_file}});
+    upstream::pool p(literal, upstream::upstream_config_t{});
+    p.set_connector(client.connect());
+    assert(get(p, "/ip") == "/ip full");
+  }
+  {
+    upstream::tls_client client(upstream::upstream_config_t{{"tls_ca_file", server.ca_file}, {"tls_sni", "other.example"}});
+    upstream::pool p(named, upstream::upstream_config_t{});
+    p.set_connector(client.connect());
+    assert(refused([&]() { get(p, "/"); }));
+  }
+  {
+    //not trusted by the system store, accepted once verification is off
+    upstream::tls_client trusting(upstream::upstream_config_t{});
+    upstream::pool p(named, upstream::upstream_config_t{});
+    p.set_connector(trusting.connect());
+    assert(refused([&]() { get(p, "/"); }));
+    upstream::tls_client blind(upstream::upstream_config_t{{"tls_verify", "0"}});
+    upstream::pool q(named, upstream::upstream_config_t{});
+    q.set_connector(blind.connect());
+    assert(get(q, "/blind") == "/blind full");
+  }
+
+  //only http/1.1 is spoken over tls, h2 is refused up front and any other choice at handshake
+  assert(refused([]() { upstream::tls_client c(upstream::upstream_config_t{{"tls_alpn", "h2,http/1.1"}}); }));
+  assert(refused([]() { upstream::tls_client c(upstream::upstream_config_t{{"tls_alpn", "http/1.1,,x"}}); }));
+  {
+    upstream::tls_client client(upstream::upstream_config_t{{"tls_ca_file", server.ca_file}, {"tls_alpn", "spdy/3,http/1.1"}});
+    upstream::pool p(named, upstream::upstream_config_t{});
+    p.set_connector(client.connect());
+    assert(refused([&]() { get(p, "/"); }));
+  }
+  std::cout << "tls ok" << std::endl;
+  return 0;
+}
+#endif
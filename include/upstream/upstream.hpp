@@ -0,0 +1,452 @@
+//
+// Created on 10/18/26.
+//
+
+#ifndef __UPSTREAM_HPP__
+#define __UPSTREAM_HPP__
+
+#include "http/http.hpp"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+namespace upstream {
+    using clock = std::chrono::steady_clock;
+    using upstream_config_t = std::unordered_map<std::string, std::string>;
+
+    //thrown for anything that went wrong talking to a backend, the caller may try another
+    class upstream_error : public std::runtime_error {
+    public:
+        explicit upstream_error(const std::string& what) : std::runtime_error(what) {}
+    };
+
+    //an address we proxy to
+    struct backend {
+        std::string host;
+        uint16_t port;
+        std::string name() const {
+            return host + ":" + std::to_string(port);
+        }
+    };
+
+    //parses 'host:port' or '[v6]:port'
+    inline backend parse_backend(const std::string& spec) {
+        backend b{};
+        auto colon = spec.rfind(':');
+        if(colon == std::string::npos || colon + 1 == spec.size())
+            throw std::runtime_error(spec + " is not a valid backend, expected host:port");
+        b.host = spec.substr(0, colon);
+        if(b.host.size() > 2 && b.host.front() == '[' && b.host.back() == ']')
+            b.host = b.host.substr(1, b.host.size() - 2);
+        try {
+            unsigned long port = std::stoul(spec.substr(colon + 1));
+            if(port == 0 || port > 65535)
+                throw std::out_of_range("port");
+            b.port = static_cast<uint16_t>(port);
+        }
+        catch(...) {
+            throw std::runtime_error(spec + " is not a valid backend port");
+        }
+        return b;
+    }
+
+    //resolves a backend host without blocking, an empty answer falls back to getaddrinfo
+    using address_lookup = std::function<std::vector<sockaddr_storage>(const std::string& host, uint16_t port)>;
+
+    //receives response body bytes as they arrive
+    using body_sink = std::function<void(const char* data, size_t size)>;
+
+    class connection;
+    //makes new connections for a pool, plain tcp unless something like tls is layered on
+    using connector = std::function<std::unique_ptr<connection>(const backend& target, std::chrono::milliseconds timeout, const address_lookup& lookup)>;
+
+    //a blocking keep-alive http/1.1 connection to one backend, every wait is bounded by poll
+    class connection {
+    public:
+        connection(const backend& target, std::chrono::milliseconds timeout, const address_lookup& lookup = nullptr) :
+            target(target), timeout(timeout), fd(-1), reusable(true), served(0) {
+            if(lookup) {
+                for(const auto& address : lookup(target.host, target.port))
+                    if(try_connect(reinterpret_cast<const sockaddr*>(&address), address.ss_family == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6)))
+                        return;
+            }
+            connect_to();
+        }
+        virtual ~connection() {
+            if(fd >= 0)
+                close(fd);
+        }
+        connection(const connection&) = delete;
+        connection& operator=(const connection&) = delete;
+
+        //sends a request and reads the whole response, body bytes go to sink or into response.body
+        http::response exchange(const http::request& request, const body_sink& sink = nullptr) {
+            send(request);
+            http::response response;
+            read_response(request.method, response, sink);
+            return response;
+        }
+
+        void send(const http::request& request) {
+            std::string head = http::serialize_head(request);
+            if(!request.body.empty() && !http::find_header(request.headers, "Content-Length"))
+                throw upstream_error("Request with a body needs a content-length");
+            write_all(head.data(), head.size());
+            write_all(request.body.data(), request.body.size());
+            last_used = clock::now();
+        }
+
+        //reads status, headers and body framed by content-length, chunked encoding or close
+        void read_response(const std::string& method, http::response& response, const body_sink& sink = nullptr) {
+            size_t head = 0;
+            while(!(head = parse_head(response)))
+                if(!fill())
+                    throw upstream_error("Backend " + target.name() + " closed before a response");
+            buffer.erase(0, head);
+            //interim responses are skipped, a 101 hands the socket over to whoever asked for it
+            if(response.status >= 100 && response.status < 200 && response.status != 101)
+                return read_response(method, response, sink);
+            auto deliver = sink ? sink : body_sink([&response](const char* d, size_t n) { response.body.append(d, n); });
+            reusable = http::keep_alive(response.version, response.headers);
+            ++served;
+            if(!http::has_body(method, response.status) || response.status == 101)
+                return;
+            const std::string* encoding = http::find_header(response.headers, "Transfer-Encoding");
+            const std::string* length = http::find_header(response.headers, "Content-Length");
+            if(encoding && strcasestr(encoding->c_str(), "chunked"))
+                read_chunked(deliver);
+            else if(length)
+                read_exactly(parse_number(*length, 10), deliver);
+            else
+                read_until_close(deliver);
+            last_used = clock::now();
+        }
+
+        //bytes read past the response, only ever non empty after a 101
+        std::string take_buffered() {
+            std::string rest;
+            rest.swap(buffer);
+            return rest;
+        }
+
+        bool is_reusable() const {
+            return reusable && fd >= 0;
+        }
+        void mark_broken() {
+            reusable = false;
+        }
+        int descriptor() const {
+            return fd;
+        }
+        //gives up the socket, the caller closes it
+        virtual int detach() {
+            int taken = fd;
+            fd = -1;
+            reusable = false;
+            return taken;
+        }
+        const backend& peer() const {
+            return target;
+        }
+        clock::time_point idle_since() const {
+            return last_used;
+        }
+        //responses received so far, zero for a connection that was just opened
+        size_t responses() const {
+            return served;
+        }
+        //true if the backend closed or sent something unsolicited while we were idle
+        virtual bool stale() {
+            pollfd p{fd, POLLIN, 0};
+            return poll(&p, 1, 0) != 0;
+        }
+
+    protected:
+        void connect_to() {
+            addrinfo hints{}, *results = nullptr;
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            int error = getaddrinfo(target.host.c_str(), std::to_string(target.port).c_str(), &hints, &results);
+            if(error != 0)
+                throw upstream_error("Couldn't resolve " + target.host + ": " + gai_strerror(error));
+            std::string failure;
+            for(auto* ai = results; ai; ai = ai->ai_next) {
+                if(try_connect(ai->ai_addr, ai->ai_addrlen))
+                    break;
+                failure = strerror(errno);
+            }
+            freeaddrinfo(results);
+            if(fd < 0)
+                throw upstream_error("Couldn't connect to " + target.name() + ": " + failure);
+        }
+
+        bool try_connect(const sockaddr* address, socklen_t length) {
+            fd = socket(address->sa_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+            if(fd < 0)
+                return false;
+            if(::connect(fd, address, length) == 0 || (errno == EINPROGRESS && wait_for(POLLOUT) && socket_error() == 0)) {
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                last_used = clock::now();
+                return true;
+            }
+            int saved = errno;
+            close(fd);
+            fd = -1;
+            errno = saved;
+            return false;
+        }
+
+        int socket_error() {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            errno = error;
+            return error;
+        }
+
+        bool wait_for(short events) {
+            pollfd p{fd, events, 0};
+            int ready;
+            while((ready = poll(&p, 1, static_cast<int>(timeout.count()))) < 0 && errno == EINTR);
+            if(ready == 0)
+                errno = ETIMEDOUT;
+            return ready > 0;
+        }
+
+        virtual void write_all(const char* data, size_t size) {
+            while(size) {
+                ssize_t sent = ::send(fd, data, size, MSG_NOSIGNAL);
+                if(sent < 0 && errno == EINTR)
+                    continue;
+                if(sent < 0 && errno == EAGAIN && wait_for(POLLOUT))
+                    continue;
+                if(sent <= 0) {
+                    reusable = false;
+                    throw upstream_error("Couldn't write to " + target.name() + ": " + strerror(errno));
+                }
+                data += sent;
+                size -= static_cast<size_t>(sent);
+            }
+        }
+
+        //appends whatever the socket has to the buffer, false on orderly close
+        virtual bool fill() {
+            char chunk[16384];
+            while(true) {
+                ssize_t got = ::recv(fd, chunk, sizeof(chunk), 0);
+                if(got > 0) {
+                    buffer.append(chunk, static_cast<size_t>(got));
+                    return true;
+                }
+                if(got == 0) {
+                    reusable = false;
+                    return false;
+                }
+                if(errno == EINTR || (errno == EAGAIN && wait_for(POLLIN)))
+                    continue;
+                reusable = false;
+                throw upstream_error("Couldn't read from " + target.name() + ": " + strerror(errno));
+            }
+        }
+
+        //whatever a backend sends that we cannot parse is its fault like any other protocol
+        //error, so it surfaces as an upstream_error callers already fall back on
+        size_t parse_head(http::response& response) {
+            try {
+                return http::parse_response_head(buffer.data(), buffer.size(), response);
+            }
+            catch(const std::runtime_error& e) {
+                reusable = false;
+                throw upstream_error("Backend " + target.name() + " sent a malformed head: " + e.what());
+            }
+        }
+
+        //a content-length in decimal or a chunk size in hex, which may carry extensions
+        uint64_t parse_number(const std::string& text, int base) {
+            size_t used = 0;
+            uint64_t value = 0;
+            try {
+                if(text.find('-') == std::string::npos)
+                    value = std::stoull(text, &used, base);
+            }
+            catch(const std::logic_error&) {
+                used = 0;
+            }
+            size_t rest = used;
+            while(rest < text.size() && (text[rest] == ' ' || text[rest] == '\t'))
+                ++rest;
+            if(!used || (rest < text.size() && !(base == 16 && text[rest] == ';'))) {
+                reusable = false;
+                throw upstream_error("Backend " + target.name() + " sent a malformed " +
+                                     (base == 16 ? "chunk size " : "content-length ") + text);
+            }
+            return value;
+        }
+
+        void read_exactly(uint64_t length, const body_sink& sink) {
+            while(length) {
+                if(buffer.empty() && !fill())
+                    throw upstream_error("Backend " + target.name() + " closed mid body");
+                size_t take = static_cast<size_t>(std::min<uint64_t>(length, buffer.size()));
+                sink(buffer.data(), take);
+                buffer.erase(0, take);
+                length -= take;
+            }
+        }
+
+        void read_until_close(const body_sink& sink) {
+            reusable = false;
+            do {
+                if(!buffer.empty())
+                    sink(buffer.data(), buffer.size());
+                buffer.clear();
+            } while(fill());
+        }
+
+        void read_chunked(const body_sink& sink) {
+            while(true) {
+                size_t eol;
+                while((eol = buffer.find("\r\n")) == std::string::npos)
+                    if(!fill())
+                        throw upstream_error("Backend " + target.name() + " closed mid chunk");
+                uint64_t size = parse_number(buffer.substr(0, eol), 16);
+                buffer.erase(0, eol + 2);
+                if(size == 0)
+                    break;
+                read_exactly(size, sink);
+                while(buffer.size() < 2)
+                    if(!fill())
+                        throw upstream_error("Backend " + target.name() + " closed mid chunk");
+                buffer.erase(0, 2);
+            }
+            //skip trailers up to the blank line
+            while(true) {
+                size_t eol;
+                while((eol = buffer.find("\r\n")) == std::string::npos)
+                    if(!fill())
+                        throw upstream_error("Backend " + target.name() + " closed in trailers");
+                buffer.erase(0, eol + 2);
+                if(eol == 0)
+                    break;
+            }
+        }
+
+        backend target;
+        std::chrono::milliseconds timeout;
+        int fd;
+        bool reusable;
+        size_t served;
+        std::string buffer;
+        clock::time_point last_used;
+    };
+
+    //idle keep-alive connections to one backend, handed out most recently used first so the
+    //warmest sockets get reused and the coldest ones time out
+    class pool {
+    public:
+        pool() = delete;
+        pool(const backend& target, const upstream_config_t& config) :
+            target(target), timeout(std::chrono::milliseconds(5000)), max_idle(32), idle_timeout(std::chrono::seconds(60)) {
+            auto parse = [&config](const char* key, size_t& value) {
+                auto found = config.find(key);
+                if(found == config.end())
+                    return;
+                try {
+                    value = std::stoul(found->second);
+                }
+                catch(...) {
+                    throw std::runtime_error(found->second + " is not a valid " + key);
+                }
+            };
+            size_t timeout_ms = 5000, idle_seconds = 60;
+            parse("timeout_ms", timeout_ms);
+            parse("max_idle", max_idle);
+            parse("idle_timeout", idle_seconds);
+            timeout = std::chrono::milliseconds(timeout_ms);
+            idle_timeout = std::chrono::seconds(idle_seconds);
+        }
+
+        std::unique_ptr<connection> acquire() {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                auto now = clock::now();
+                while(!idle.empty()) {
+                    std::unique_ptr<connection> c = std::move(idle.back());
+                    idle.pop_back();
+                    if(now - c->idle_since() < idle_timeout && !c->stale())
+                        return c;
+                }
+            }
+            if(connect)
+                return connect(target, timeout, lookup);
+            return std::unique_ptr<connection>(new connection(target, timeout, lookup));
+        }
+
+        //where new connections get their addresses, set before the pool is shared
+        void set_lookup(address_lookup resolve) {
+            lookup = std::move(resolve);
+        }
+        //how new connections are made, set before the pool is shared
+        void set_connector(connector make) {
+            connect = std::move(make);
+        }
+
+        void release(std::unique_ptr<connection> c) {
+            if(!c || !c->is_reusable())
+                return;
+            std::lock_guard<std::mutex> guard(lock);
+            if(idle.size() < max_idle)
+                idle.push_back(std::move(c));
+        }
+
+        //one request over a pooled connection, a stale keep-alive socket gets one retry on a fresh one
+        http::response exchange(const http::request& request, const body_sink& sink = nullptr) {
+            for(int attempt = 0;; ++attempt) {
+                auto c = acquire();
+                bool fresh = c->responses() == 0;
+                try {
+                    auto response = c->exchange(request, sink);
+                    release(std::move(c));
+                    return response;
+                }
+                catch(const upstream_error&) {
+                    //only replay when the request cannot have been processed, a reused socket the peer had closed
+                    if(fresh || attempt > 0 || !http::idempotent(request.method) || sink)
+                        throw;
+                }
+            }
+        }
+
+        const backend& peer() const {
+            return target;
+        }
+
+    protected:
+        backend target;
+        std::chrono::milliseconds timeout;
+        size_t max_idle;
+        std::chrono::seconds idle_timeout;
+        address_lookup lookup;
+        connector connect;
+        std::mutex lock;
+        std::vector<std::unique_ptr<connection> > idle;
+    };
+}
+
+#endif //__UPSTREAM_HPP__